@@ -0,0 +1,385 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+
+// The balloon grows and shrinks this much at a time.
+#define BALLOON_CHUNK_SIZE (64LL * 1024 * 1024)
+
+#define USAGE \
+"usage: balloon [options] <schedule>\n" \
+"\n" \
+"Squeezes the page cache with anonymous memory.  The schedule is a\n" \
+"comma-separated list of steps of the form size[@seconds]: at the given\n" \
+"number of seconds after starting (or right after the previous step), the\n" \
+"balloon grows or shrinks to size bytes, which may end in k, m or g.  For\n" \
+"example, 1g,2g@10,4g@20,0@30 ramps up the pressure every ten seconds and\n" \
+"then lets it go.  After each step, and every interval in between, it\n" \
+"prints the size of the balloon, the Cached, Mlocked and MemAvailable\n" \
+"lines of /proc/meminfo, and the fraction of each watched file that\n" \
+"mincore finds resident.  After the last step it holds the balloon until\n" \
+"it is interrupted.\n" \
+"\n" \
+"options:\n" \
+"  -u             leave the balloon unpinned, so that it can be swapped\n" \
+"                 out rather than only squeezing the page cache\n" \
+"  -w <file>      report how much of file is resident; may be repeated\n" \
+"  -i <seconds>   report interval (default 1; 0 to report only at steps)\n" \
+"  -d <path>      create path once the last step is reached, for scripts\n" \
+"                 to wait on\n"
+
+struct balloon_step {
+	long long bytes;
+
+	// Seconds after starting, or -1 for right after the previous step
+	double at;
+};
+
+struct watched {
+	const char *path;
+	char *map;
+	long long size;
+};
+
+struct balloon {
+	int pin;
+	double interval;
+	const char *done_path;
+
+	struct balloon_step *steps;
+	int num_steps;
+
+	struct watched *watched;
+	int num_watched;
+
+	// The chunks the balloon holds now
+	char **chunks;
+	long long num_chunks;
+	long long max_chunks;
+
+	double start;
+};
+
+static volatile sig_atomic_t g_stop;
+
+static void handle_stop(int sig)
+{
+	g_stop = 1;
+}
+
+/*
+ * Parse a byte count with an optional k, m or g suffix.  Returns the count,
+ * or -1 if it is invalid.
+ */
+static long long parse_bytes(const char *str, char **end)
+{
+	long long val;
+
+	val = strtoll(str, end, 10);
+	if ((*end == str) || (val < 0))
+		return -1;
+	switch (**end) {
+	case 'k': case 'K':
+		val <<= 10;
+		(*end)++;
+		break;
+	case 'm': case 'M':
+		val <<= 20;
+		(*end)++;
+		break;
+	case 'g': case 'G':
+		val <<= 30;
+		(*end)++;
+		break;
+	default:
+		break;
+	}
+	return val;
+}
+
+static int parse_schedule(struct balloon *bal, const char *schedule)
+{
+	const char *str = schedule;
+	struct balloon_step *step;
+	char *end;
+
+	bal->num_steps = 1;
+	for (end = (char *)schedule; *end; end++)
+		bal->num_steps += (*end == ',');
+	bal->steps = calloc(bal->num_steps, sizeof(bal->steps[0]));
+	if (!bal->steps)
+		return ENOMEM;
+	for (step = bal->steps; ; step++) {
+		step->bytes = parse_bytes(str, &end);
+		if (step->bytes < 0)
+			goto invalid;
+		step->at = -1;
+		if (*end == '@') {
+			str = end + 1;
+			step->at = strtod(str, &end);
+			if ((end == str) || (step->at < 0))
+				goto invalid;
+		}
+		if (*end == '\0')
+			return 0;
+		if (*end != ',')
+			goto invalid;
+		str = end + 1;
+	}
+invalid:
+	fprintf(stderr, "invalid schedule %s\n", schedule);
+	return EINVAL;
+}
+
+static int watch(struct balloon *bal, const char *path)
+{
+	struct watched *w;
+	struct stat st;
+	int fd, ret;
+
+	w = realloc(bal->watched, (bal->num_watched + 1) * sizeof(*w));
+	if (!w)
+		return ENOMEM;
+	bal->watched = w;
+	w = &bal->watched[bal->num_watched];
+	memset(w, 0, sizeof(*w));
+	w->path = path;
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		ret = errno;
+		fprintf(stderr, "failed to open %s: error %d (%s)\n", path,
+			ret, strerror(ret));
+		return ret;
+	}
+	if (fstat(fd, &st)) {
+		ret = errno;
+		close(fd);
+		fprintf(stderr, "failed to stat %s: error %d (%s)\n", path,
+			ret, strerror(ret));
+		return ret;
+	}
+	w->size = st.st_size;
+	if (w->size > 0) {
+		// Mapping the file doesn't read it, so this doesn't disturb
+		// what we measure.
+		w->map = mmap(NULL, w->size, PROT_READ, MAP_SHARED, fd, 0);
+		if (w->map == MAP_FAILED) {
+			ret = errno;
+			close(fd);
+			fprintf(stderr, "mmap(%s) failed: error %d (%s)\n",
+				path, ret, strerror(ret));
+			return ret;
+		}
+	}
+	close(fd);
+	bal->num_watched++;
+	return 0;
+}
+
+/*
+ * Look up a line of /proc/meminfo, in kB.  Returns -1 if it is missing.
+ */
+static long long meminfo_kb(const char *name)
+{
+	char line[256];
+	size_t len = strlen(name);
+	long long kb = -1;
+	FILE *fp;
+
+	fp = fopen("/proc/meminfo", "r");
+	if (!fp)
+		return -1;
+	while (fgets(line, sizeof(line), fp)) {
+		if (!strncmp(line, name, len) && (line[len] == ':')) {
+			kb = atoll(line + len + 1);
+			break;
+		}
+	}
+	fclose(fp);
+	return kb;
+}
+
+static void report(const struct balloon *bal)
+{
+	int i;
+
+	printf("balloon %.1f s: %lld bytes, cached %lld kB, mlocked %lld kB, "
+		"available %lld kB", monotonic_seconds() - bal->start,
+		bal->num_chunks * BALLOON_CHUNK_SIZE, meminfo_kb("Cached"),
+		meminfo_kb("Mlocked"), meminfo_kb("MemAvailable"));
+	for (i = 0; i < bal->num_watched; i++) {
+		printf(", %s %.1f%% resident", bal->watched[i].path,
+			100 * resident_fraction(bal->watched[i].map,
+				bal->watched[i].size));
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+/*
+ * Grow or shrink the balloon to the given size, rounded up to whole chunks.
+ *
+ * Returns 0 on success, or an errno value if the balloon couldn't grow that
+ * far; it keeps whatever it managed to get.
+ */
+static int balloon_resize(struct balloon *bal, long long bytes)
+{
+	long long want = (bytes + BALLOON_CHUNK_SIZE - 1) / BALLOON_CHUNK_SIZE;
+	char **chunks, *chunk;
+	int ret;
+
+	if (want > bal->max_chunks) {
+		chunks = realloc(bal->chunks, want * sizeof(chunks[0]));
+		if (!chunks)
+			return ENOMEM;
+		bal->chunks = chunks;
+		bal->max_chunks = want;
+	}
+	while (bal->num_chunks > want) {
+		bal->num_chunks--;
+		munmap(bal->chunks[bal->num_chunks], BALLOON_CHUNK_SIZE);
+	}
+	while ((bal->num_chunks < want) && !g_stop) {
+		chunk = mmap(NULL, BALLOON_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (chunk == MAP_FAILED) {
+			ret = errno;
+			goto error;
+		}
+		// mlock faults the chunk in; otherwise write it, since
+		// untouched anonymous memory takes nothing from the page
+		// cache.
+		if (bal->pin) {
+			if (mlock(chunk, BALLOON_CHUNK_SIZE)) {
+				ret = errno;
+				munmap(chunk, BALLOON_CHUNK_SIZE);
+				goto error;
+			}
+		} else {
+			memset(chunk, 0xa5, BALLOON_CHUNK_SIZE);
+		}
+		bal->chunks[bal->num_chunks++] = chunk;
+	}
+	return 0;
+error:
+	fprintf(stderr, "balloon stuck at %lld bytes: error %d (%s)%s\n",
+		bal->num_chunks * BALLOON_CHUNK_SIZE, ret, strerror(ret),
+		((ret == ENOMEM) || (ret == EPERM) || (ret == EAGAIN)) &&
+		bal->pin ? "; check ulimit -l" : "");
+	return ret;
+}
+
+/*
+ * Sleep until the given time, reporting every interval.  Returns early if
+ * we are interrupted.
+ */
+static void wait_until(const struct balloon *bal, double until)
+{
+	struct timespec ts;
+	double now, next;
+
+	while (!g_stop) {
+		now = monotonic_seconds();
+		if (now >= until)
+			break;
+		next = until;
+		if ((bal->interval > 0) && (now + bal->interval < until))
+			next = now + bal->interval;
+		ts.tv_sec = next - now;
+		ts.tv_nsec = (next - now - ts.tv_sec) * 1e9;
+		nanosleep(&ts, NULL);
+		if (!g_stop && (monotonic_seconds() < until))
+			report(bal);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct balloon bal;
+	struct sigaction sa;
+	int c, i, ret = 1;
+	FILE *fp;
+
+	memset(&bal, 0, sizeof(bal));
+	bal.pin = 1;
+	bal.interval = 1;
+	while ((c = getopt(argc, argv, "uw:i:d:")) != -1) {
+		switch (c) {
+		case 'u':
+			bal.pin = 0;
+			break;
+		case 'w':
+			if (watch(&bal, optarg))
+				goto done;
+			break;
+		case 'i':
+			bal.interval = atof(optarg);
+			break;
+		case 'd':
+			bal.done_path = optarg;
+			break;
+		default:
+			fprintf(stderr, USAGE);
+			goto done;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, USAGE);
+		goto done;
+	}
+	if (parse_schedule(&bal, argv[optind]))
+		goto done;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	bal.start = monotonic_seconds();
+	report(&bal);
+	for (i = 0; (i < bal.num_steps) && !g_stop; i++) {
+		if (bal.steps[i].at >= 0)
+			wait_until(&bal, bal.start + bal.steps[i].at);
+		if (g_stop)
+			break;
+		// A balloon that can't grow any further still squeezes, so
+		// carry on with the schedule.
+		balloon_resize(&bal, bal.steps[i].bytes);
+		report(&bal);
+	}
+	if (bal.done_path && !g_stop) {
+		fp = fopen(bal.done_path, "w");
+		if (!fp) {
+			fprintf(stderr, "failed to create %s: error %d\n",
+				bal.done_path, errno);
+			goto done;
+		}
+		fprintf(fp, "%lld\n", bal.num_chunks * BALLOON_CHUNK_SIZE);
+		fclose(fp);
+	}
+	while (!g_stop)
+		wait_until(&bal, monotonic_seconds() + 3600);
+	ret = 0;
+done:
+	balloon_resize(&bal, 0);
+	for (i = 0; i < bal.num_watched; i++) {
+		if (bal.watched[i].map)
+			munmap(bal.watched[i].map, bal.watched[i].size);
+	}
+	free(bal.watched);
+	free(bal.chunks);
+	free(bal.steps);
+	return ret;
+}
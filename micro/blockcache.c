@@ -0,0 +1,558 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include "blockcache.h"
+#include "blockcodec.h"
+#include "ssdtier.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define BLOCKCACHE_HUGE_PAGE_SIZE (2L * 1024 * 1024)
+
+// A compressed cache hands out its arena in runs of units of this size.
+#define BLOCKCACHE_UNIT_SIZE 4096
+
+struct blockcache {
+	char *arena;
+	size_t arena_len;
+	int block_size;
+	long long num_slots;
+	long long used;
+	long long capacity_blocks;
+
+	// Block id and length of each slot.
+	uint64_t *slot_id;
+	int *slot_len;
+
+	// Sum of slot_len over the slots in use
+	long long cached_bytes;
+
+	// Compressed caches only: the first unit and number of units of each
+	// slot's frame, a bitmap of the units in use, and room to compress a
+	// block into.  full is set when a frame didn't fit even after the
+	// policy gave up its victims, until something is removed.
+	int compress;
+	int64_t *slot_unit;
+	int *slot_units;
+	uint64_t *unit_map;
+	long long num_units;
+	long long used_units;
+	long long next_unit;
+	char *scratch;
+	int full;
+
+	// Stack of free slots; the top is free_slots[num_slots - used - 1].
+	int64_t *free_slots;
+
+	// Decides what to keep.
+	struct cache_policy *policy;
+
+	// Set by a miss that the policy admitted, until the block is inserted.
+	int pending;
+	uint64_t pending_id;
+
+	// Slot numbers by block id
+	struct idtable table;
+
+	// The SSD tier, if any, its flags, and an aligned buffer to read
+	// blocks from it into.
+	struct ssdtier *ssd;
+	int ssd_flags;
+	char *ssd_buf;
+
+	struct blockcache_stats stats;
+};
+
+/*
+ * Map and fault in the arena.
+ */
+static int blockcache_map(struct blockcache *bc, int hugepages)
+{
+	int ret;
+
+	if (hugepages) {
+		bc->arena_len = (bc->arena_len + BLOCKCACHE_HUGE_PAGE_SIZE - 1) &
+			~(BLOCKCACHE_HUGE_PAGE_SIZE - 1);
+		bc->arena = mmap(NULL, bc->arena_len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+			MAP_POPULATE, -1, 0);
+		if (bc->arena != MAP_FAILED)
+			return 0;
+		fprintf(stderr, "blockcache: no explicit huge pages for a "
+			"%zu-byte arena (error %d); falling back on "
+			"transparent huge pages.\n", bc->arena_len, errno);
+		bc->arena = mmap(NULL, bc->arena_len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (bc->arena == MAP_FAILED)
+			goto error;
+		if (madvise(bc->arena, bc->arena_len, MADV_HUGEPAGE)) {
+			fprintf(stderr, "blockcache: madvise(MADV_HUGEPAGE) "
+				"failed: error %d\n", errno);
+		}
+		memset(bc->arena, 0, bc->arena_len);
+		return 0;
+	}
+	bc->arena = mmap(NULL, bc->arena_len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (bc->arena != MAP_FAILED)
+		return 0;
+error:
+	ret = errno;
+	fprintf(stderr, "blockcache: failed to map a %zu-byte arena: "
+		"error %d (%s)\n", bc->arena_len, ret, strerror(ret));
+	bc->arena = NULL;
+	return ret;
+}
+
+int blockcache_create(long long capacity, int block_size, int flags,
+		enum cache_policy_type policy, struct blockcache **out)
+{
+	struct blockcache *bc;
+	long long i;
+	int ret;
+
+	if ((block_size <= 0) || (capacity < block_size)) {
+		fprintf(stderr, "blockcache: a capacity of %lld bytes can't "
+			"hold a single %d-byte block.\n", capacity,
+			block_size);
+		return EINVAL;
+	}
+	bc = calloc(1, sizeof(*bc));
+	if (!bc)
+		return ENOMEM;
+	bc->block_size = block_size;
+	bc->capacity_blocks = capacity / block_size;
+	bc->num_slots = bc->capacity_blocks;
+	bc->arena_len = bc->num_slots * block_size;
+	if (flags & BLOCKCACHE_COMPRESS) {
+		// There can be no more frames than there would be if every
+		// block compressed as well as it could.
+		bc->compress = 1;
+		bc->num_units = capacity / BLOCKCACHE_UNIT_SIZE;
+		bc->num_slots = capacity / (block_size / BLOCKCODEC_MAX_RATIO);
+		bc->arena_len = (bc->num_units + 1) * BLOCKCACHE_UNIT_SIZE;
+		bc->slot_unit = calloc(bc->num_slots, sizeof(int64_t));
+		bc->slot_units = calloc(bc->num_slots, sizeof(int));
+		bc->unit_map = calloc((bc->num_units + 63) / 64,
+			sizeof(uint64_t));
+		bc->scratch = malloc(blockcodec_bound(block_size) +
+			BLOCKCODEC_PAD);
+		if (!bc->slot_unit || !bc->slot_units || !bc->unit_map ||
+				!bc->scratch) {
+			ret = ENOMEM;
+			goto error;
+		}
+	}
+	bc->slot_id = calloc(bc->num_slots, sizeof(uint64_t));
+	bc->slot_len = calloc(bc->num_slots, sizeof(int));
+	bc->free_slots = malloc(bc->num_slots * sizeof(int64_t));
+	if (!bc->slot_id || !bc->slot_len || !bc->free_slots) {
+		ret = ENOMEM;
+		goto error;
+	}
+	ret = idtable_init(&bc->table, bc->num_slots, bc->slot_id,
+		sizeof(uint64_t));
+	if (ret)
+		goto error;
+	// Hand out slots in arena order.
+	for (i = 0; i < bc->num_slots; i++)
+		bc->free_slots[i] = bc->num_slots - i - 1;
+	ret = cache_policy_create(policy, bc->num_slots, &bc->policy);
+	if (ret)
+		goto error;
+	ret = blockcache_map(bc, flags & BLOCKCACHE_HUGEPAGES);
+	if (ret)
+		goto error;
+	*out = bc;
+	return 0;
+
+error:
+	blockcache_free(bc);
+	return ret;
+}
+
+void blockcache_free(struct blockcache *bc)
+{
+	if (!bc)
+		return;
+	if (bc->arena)
+		munmap(bc->arena, bc->arena_len);
+	free(bc->slot_id);
+	free(bc->slot_len);
+	free(bc->slot_unit);
+	free(bc->slot_units);
+	free(bc->unit_map);
+	free(bc->scratch);
+	free(bc->free_slots);
+	idtable_free(&bc->table);
+	cache_policy_free(bc->policy);
+	ssdtier_free(bc->ssd);
+	free(bc->ssd_buf);
+	free(bc);
+}
+
+/*
+ * The most bytes a block can take in the arena, and so in the SSD tier.
+ */
+static int blockcache_max_stored(const struct blockcache *bc)
+{
+	if (bc->compress)
+		return blockcodec_bound(bc->block_size);
+	return bc->block_size;
+}
+
+int blockcache_add_ssd_tier(struct blockcache *bc, const char *dir,
+		long long capacity, int flags)
+{
+	int ret;
+
+	if (bc->compress && !bc->scratch) {
+		bc->scratch = malloc(blockcodec_bound(bc->block_size) +
+			BLOCKCODEC_PAD);
+		if (!bc->scratch)
+			return ENOMEM;
+	}
+	// Leave room for the padding the decoder reads past a frame.
+	if (posix_memalign((void **)&bc->ssd_buf, 4096,
+			blockcache_max_stored(bc) + 4096))
+		return ENOMEM;
+	ret = ssdtier_create(dir, capacity, blockcache_max_stored(bc),
+		&bc->ssd);
+	if (ret) {
+		free(bc->ssd_buf);
+		bc->ssd_buf = NULL;
+		return ret;
+	}
+	bc->ssd_flags = flags;
+	return 0;
+}
+
+/*
+ * Set or clear the bits of n units starting at unit u.
+ */
+static void blockcache_mark_units(struct blockcache *bc, long long u,
+		long long n, int used)
+{
+	for (; n > 0; u++, n--) {
+		if (used)
+			bc->unit_map[u / 64] |= 1ULL << (u % 64);
+		else
+			bc->unit_map[u / 64] &= ~(1ULL << (u % 64));
+	}
+}
+
+/*
+ * Find a run of n free units, first fit from where the last run ended, so
+ * that a cache that never evicts fills its arena in order.  Returns the
+ * first unit of the run, or -1 if there is none.
+ */
+static long long blockcache_alloc_units(struct blockcache *bc, long long n)
+{
+	long long u, start, run = 0, scanned;
+
+	if (bc->num_units - bc->used_units < n)
+		return -1;
+	u = start = bc->next_unit;
+	for (scanned = 0; scanned < bc->num_units + n; scanned++, u++) {
+		if (u == bc->num_units) {
+			// Runs don't wrap around the end of the arena.
+			u = 0;
+			run = 0;
+		}
+		if (bc->unit_map[u / 64] == ~0ULL) {
+			// Skip the rest of a full word.
+			scanned += 63 - (u % 64);
+			u += 63 - (u % 64);
+			run = 0;
+			continue;
+		}
+		if (bc->unit_map[u / 64] & (1ULL << (u % 64))) {
+			run = 0;
+			continue;
+		}
+		if (++run == n) {
+			start = u - n + 1;
+			blockcache_mark_units(bc, start, n, 1);
+			bc->used_units += n;
+			bc->next_unit = (u + 1) % bc->num_units;
+			return start;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Drop the block in bucket i, and free its slot.
+ */
+static void blockcache_remove(struct blockcache *bc, uint64_t i)
+{
+	int64_t slot = bc->table.buckets[i];
+
+	bc->free_slots[bc->num_slots - bc->used] = slot;
+	bc->used--;
+	bc->cached_bytes -= bc->slot_len[slot];
+	if (bc->compress) {
+		blockcache_mark_units(bc, bc->slot_unit[slot],
+			bc->slot_units[slot], 0);
+		bc->used_units -= bc->slot_units[slot];
+		bc->full = 0;
+	}
+	idtable_remove(&bc->table, i);
+}
+
+static void blockcache_demote(struct blockcache *bc, int64_t slot);
+
+/*
+ * Make the policy evict one more block, because the arena of a compressed
+ * cache ran out of units before the policy ran out of slots.  id is the
+ * block being placed.  Returns nonzero if that freed a block other than
+ * id.
+ */
+static int blockcache_make_room(struct blockcache *bc, uint64_t id)
+{
+	uint64_t i, victim;
+
+	if (!cache_policy_evict(bc->policy, &victim) || (victim == id))
+		return 0;
+	i = idtable_find(&bc->table, victim);
+	if (bc->table.buckets[i] != IDTABLE_EMPTY) {
+		bc->stats.evictions++;
+		blockcache_demote(bc, bc->table.buckets[i]);
+		blockcache_remove(bc, i);
+	}
+	return 1;
+}
+
+/*
+ * Put a block into a free slot, if the policy admitted it and there is room.
+ * stored holds stored_len bytes of the block in the form the arena keeps it
+ * in.  Returns the slot, or -1 if the block wasn't placed.
+ */
+static int64_t blockcache_place(struct blockcache *bc, uint64_t id,
+		const void *stored, int stored_len, int len)
+{
+	long long unit, units;
+	int64_t slot;
+
+	if ((!bc->pending) || (bc->pending_id != id) ||
+			(len > bc->block_size) || (bc->used == bc->num_slots))
+		return -1;
+	bc->pending = 0;
+	if (bc->compress) {
+		if (bc->full) {
+			// The block may not have been compressed, so just hand
+			// its admission back.  A policy other than none may
+			// free a cached block instead, which clears full; this
+			// block then gets another chance at its next hit.
+			while (bc->full && blockcache_make_room(bc, id))
+				;
+			return -1;
+		}
+		units = (stored_len + BLOCKCODEC_PAD + BLOCKCACHE_UNIT_SIZE -
+			1) / BLOCKCACHE_UNIT_SIZE;
+		while ((unit = blockcache_alloc_units(bc, units)) < 0) {
+			if (!blockcache_make_room(bc, id)) {
+				bc->full = 1;
+				return -1;
+			}
+		}
+		// Take the slot only now, since evictions push slots back.
+		slot = bc->free_slots[bc->num_slots - bc->used - 1];
+		memcpy(bc->arena + (unit * BLOCKCACHE_UNIT_SIZE), stored,
+			stored_len);
+		bc->slot_unit[slot] = unit;
+		bc->slot_units[slot] = units;
+	} else {
+		slot = bc->free_slots[bc->num_slots - bc->used - 1];
+		memcpy(bc->arena + (slot * bc->block_size), stored, len);
+	}
+	bc->used++;
+	bc->slot_id[slot] = id;
+	bc->slot_len[slot] = len;
+	bc->cached_bytes += len;
+	bc->table.buckets[idtable_find(&bc->table, id)] = slot;
+	return slot;
+}
+
+/*
+ * Queue a block that is about to be evicted to be written to the SSD tier.
+ */
+static void blockcache_demote(struct blockcache *bc, int64_t slot)
+{
+	const char *stored;
+	int stored_len;
+
+	if (!bc->ssd)
+		return;
+	if (bc->compress) {
+		stored = bc->arena + (bc->slot_unit[slot] * BLOCKCACHE_UNIT_SIZE);
+		stored_len = blockcodec_frame_len(stored);
+	} else {
+		stored = bc->arena + (slot * bc->block_size);
+		stored_len = bc->slot_len[slot];
+	}
+	if (!ssdtier_write(bc->ssd, bc->slot_id[slot], stored, stored_len,
+			bc->slot_len[slot]))
+		bc->stats.demotions++;
+}
+
+/*
+ * Look for a block that missed in memory in the SSD tier, and promote it if
+ * the policy admitted it.
+ */
+static const void *blockcache_lookup_ssd(struct blockcache *bc, uint64_t id,
+		int *len)
+{
+	int64_t slot;
+	int stored;
+
+	stored = ssdtier_read(bc->ssd, id, bc->ssd_buf, len);
+	if (stored <= 0) {
+		bc->stats.ssd_misses++;
+		return NULL;
+	}
+	bc->stats.ssd_hits++;
+	bc->stats.bytes_ssd += *len;
+	if (bc->ssd_flags & BLOCKCACHE_SSD_NO_PROMOTE) {
+		bc->pending = 0;
+		return bc->ssd_buf;
+	}
+	slot = blockcache_place(bc, id, bc->ssd_buf, stored, *len);
+	bc->pending = 0;
+	if (slot < 0)
+		return bc->ssd_buf;
+	bc->stats.promotions++;
+	if (!(bc->ssd_flags & BLOCKCACHE_SSD_INCLUSIVE))
+		ssdtier_remove(bc->ssd, id);
+	if (bc->compress)
+		return bc->arena + (bc->slot_unit[slot] * BLOCKCACHE_UNIT_SIZE);
+	return bc->arena + (slot * bc->block_size);
+}
+
+const void *blockcache_lookup(struct blockcache *bc, uint64_t id, int *len)
+{
+	int64_t slot = bc->table.buckets[idtable_find(&bc->table, id)];
+	uint64_t i, victim;
+
+	bc->pending = 0;
+	switch (cache_policy_access(bc->policy, id, &victim)) {
+	case CACHE_POLICY_HIT:
+		// The policy may count a block as resident that the caller
+		// never inserted; take this as another chance to insert it.
+		if (slot != IDTABLE_EMPTY)
+			break;
+		bc->pending = 1;
+		bc->pending_id = id;
+		bc->stats.misses++;
+		if (bc->ssd)
+			return blockcache_lookup_ssd(bc, id, len);
+		return NULL;
+	case CACHE_POLICY_MISS_EVICT:
+		bc->stats.evictions++;
+		i = idtable_find(&bc->table, victim);
+		if (bc->table.buckets[i] != IDTABLE_EMPTY) {
+			blockcache_demote(bc, bc->table.buckets[i]);
+			blockcache_remove(bc, i);
+		}
+		// fall through
+	case CACHE_POLICY_MISS:
+		bc->pending = 1;
+		bc->pending_id = id;
+		// fall through
+	default:
+		bc->stats.misses++;
+		if (bc->ssd)
+			return blockcache_lookup_ssd(bc, id, len);
+		return NULL;
+	}
+	*len = bc->slot_len[slot];
+	bc->stats.hits++;
+	bc->stats.bytes_hit += *len;
+	if (bc->compress)
+		return bc->arena + (bc->slot_unit[slot] * BLOCKCACHE_UNIT_SIZE);
+	return bc->arena + (slot * bc->block_size);
+}
+
+void blockcache_insert(struct blockcache *bc, uint64_t id, const void *buf,
+		int len)
+{
+	const void *stored = buf;
+	int stored_len = len;
+	int64_t slot;
+
+	bc->stats.bytes_missed += len;
+	// Only compress blocks that have somewhere to go.  Any other block
+	// is turned away by blockcache_place before it looks at the bytes.
+	if (bc->compress && (len <= bc->block_size) &&
+			(bc->ssd || (bc->pending && !bc->full))) {
+		stored_len = blockcodec_compress(buf, len, bc->scratch);
+		stored = bc->scratch;
+	}
+	slot = blockcache_place(bc, id, stored, stored_len, len);
+	bc->pending = 0;
+	if (slot < 0)
+		bc->stats.rejected++;
+	if (bc->ssd && (len <= bc->block_size) && ((slot < 0) ||
+			(bc->ssd_flags & BLOCKCACHE_SSD_INCLUSIVE))) {
+		if (!ssdtier_write(bc->ssd, id, stored, stored_len, len))
+			bc->stats.demotions++;
+	}
+}
+
+void blockcache_get_stats(struct blockcache *bc, struct blockcache_stats *stats,
+		int reset)
+{
+	struct ssdtier_stats ss;
+
+	*stats = bc->stats;
+	if (bc->ssd) {
+		ssdtier_get_stats(bc->ssd, &ss, reset);
+		stats->ssd_dropped = ss.dropped;
+	}
+	if (reset)
+		memset(&bc->stats, 0, sizeof(bc->stats));
+}
+
+long long blockcache_capacity_blocks(const struct blockcache *bc)
+{
+	return bc->capacity_blocks;
+}
+
+long long blockcache_used_blocks(const struct blockcache *bc)
+{
+	return bc->used;
+}
+
+int blockcache_compressed(const struct blockcache *bc)
+{
+	return bc->compress;
+}
+
+long long blockcache_stored_bytes(const struct blockcache *bc)
+{
+	if (bc->compress)
+		return bc->used_units * BLOCKCACHE_UNIT_SIZE;
+	return bc->used * bc->block_size;
+}
+
+long long blockcache_cached_bytes(const struct blockcache *bc)
+{
+	return bc->cached_bytes;
+}
+
+long long blockcache_ssd_capacity_blocks(const struct blockcache *bc)
+{
+	return bc->ssd ? ssdtier_capacity_blocks(bc->ssd) : 0;
+}
+
+long long blockcache_ssd_used_blocks(const struct blockcache *bc)
+{
+	return bc->ssd ? ssdtier_used_blocks(bc->ssd) : 0;
+}
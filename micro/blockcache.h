@@ -0,0 +1,154 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#ifndef VECSUM_BLOCKCACHE_H
+#define VECSUM_BLOCKCACHE_H
+
+/*
+ * An in-process block cache.
+ *
+ * The cache holds up to capacity / block_size blocks in a single arena that
+ * is mapped and faulted in up front, optionally out of 2 MiB huge pages, so
+ * that filling the cache measures copies and not page faults.  Blocks are
+ * found through an open-addressed hash table keyed by a caller-chosen 64-bit
+ * block id.
+ *
+ * Which blocks stay cached is up to a replacement policy (see
+ * cachepolicy.h).  With the default policy, none, the cache behaves like
+ * the HDFS cache: it never evicts, and once it is full, further blocks are
+ * read through without being cached, so a scan over a file that is larger
+ * than the cache finds the same leading blocks cached on every pass.  That
+ * is what lets vecsum2 measure partially cached files.
+ *
+ * A compressed cache holds each block as a blockcodec frame (see
+ * blockcodec.h) in a run of 4 KiB units of the arena, so it holds more
+ * blocks the better they compress.  Lookups return the frame, which the
+ * caller decodes.  The policy is sized for blocks that compress as well as
+ * the codec allows, so it is usually the arena that fills first; a frame
+ * that doesn't fit makes the policy evict its own victims until it does.
+ * Under the none policy, which never evicts, the cache stops admitting
+ * once the arena is full, and reads further blocks through without
+ * compressing them.
+ *
+ * A cache can have a second tier on a local SSD (see ssdtier.h) under it,
+ * holding blocks in the same form as the arena does.  By default the tiers
+ * are exclusive: blocks that the cache evicts, or has no room for, are
+ * demoted to the SSD, and a block found there is promoted back into the
+ * arena and dropped from the SSD.  An inclusive SSD tier is written through
+ * instead, and keeps its copy when a block is promoted.  Lookups return
+ * blocks from either tier.
+ */
+
+#include <stdint.h>
+
+#include "cachepolicy.h"
+
+// Flags for blockcache_create.
+#define BLOCKCACHE_HUGEPAGES 0x1
+#define BLOCKCACHE_COMPRESS 0x2
+
+// Flags for blockcache_add_ssd_tier.
+#define BLOCKCACHE_SSD_INCLUSIVE 0x1
+#define BLOCKCACHE_SSD_NO_PROMOTE 0x2
+
+struct blockcache;
+
+struct blockcache_stats {
+	long long hits;
+	long long misses;
+	long long bytes_hit;
+	long long bytes_missed;
+
+	// Misses that the policy chose not to cache
+	long long rejected;
+
+	// Blocks evicted to make room for others
+	long long evictions;
+
+	// Misses in memory that hit and missed in the SSD tier, and the bytes
+	// of data in the blocks that hit
+	long long ssd_hits;
+	long long ssd_misses;
+	long long bytes_ssd;
+
+	// Blocks moved from the SSD tier into memory, and blocks queued to be
+	// written to it
+	long long promotions;
+	long long demotions;
+
+	// Writes to the SSD tier that were dropped because its queue was full
+	long long ssd_dropped;
+};
+
+/*
+ * Create a cache of capacity bytes, in blocks of block_size bytes, managed
+ * by the given replacement policy.  With BLOCKCACHE_HUGEPAGES, the arena is
+ * backed by explicit huge pages if the system has any reserved, and by
+ * transparent huge pages otherwise.  With BLOCKCACHE_COMPRESS, blocks are
+ * stored compressed.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int blockcache_create(long long capacity, int block_size, int flags,
+		enum cache_policy_type policy, struct blockcache **out);
+
+void blockcache_free(struct blockcache *bc);
+
+/*
+ * Add an SSD tier of capacity bytes, in a file under dir.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int blockcache_add_ssd_tier(struct blockcache *bc, const char *dir,
+		long long capacity, int flags);
+
+/*
+ * Look up a block.  On a hit in either tier, returns the cached bytes, or in
+ * a compressed cache the block's frame, and sets *len to the block's length.
+ * The bytes stay valid until the next call.  On a miss, returns NULL, and
+ * the caller must read the block and pass it to blockcache_insert before the
+ * next lookup.  Either way, the access is counted in the stats and reported
+ * to the policy.
+ */
+const void *blockcache_lookup(struct blockcache *bc, uint64_t id, int *len);
+
+/*
+ * Copy the block that just missed into the cache, if the policy admitted
+ * it, and into the SSD tier if there is one and the block belongs there.
+ */
+void blockcache_insert(struct blockcache *bc, uint64_t id, const void *buf,
+		int len);
+
+/*
+ * Get the stats, and reset them if reset is nonzero.
+ */
+void blockcache_get_stats(struct blockcache *bc, struct blockcache_stats *stats,
+		int reset);
+
+/*
+ * Number of blocks the cache can hold, uncompressed, and number it holds
+ * now.
+ */
+long long blockcache_capacity_blocks(const struct blockcache *bc);
+long long blockcache_used_blocks(const struct blockcache *bc);
+
+/*
+ * Nonzero if the cache holds blocks compressed.
+ */
+int blockcache_compressed(const struct blockcache *bc);
+
+/*
+ * Bytes of the arena taken by the blocks the cache holds, and the bytes of
+ * data in those blocks.  They differ only in a compressed cache.
+ */
+long long blockcache_stored_bytes(const struct blockcache *bc);
+long long blockcache_cached_bytes(const struct blockcache *bc);
+
+/*
+ * Number of blocks the SSD tier can hold, and number it holds now, or 0 if
+ * there is no SSD tier.
+ */
+long long blockcache_ssd_capacity_blocks(const struct blockcache *bc);
+long long blockcache_ssd_used_blocks(const struct blockcache *bc);
+
+#endif
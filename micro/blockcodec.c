@@ -0,0 +1,129 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+
+#include "blockcodec.h"
+
+#include <string.h>
+
+// Masks for 0 to 8 significant bytes.
+static const uint64_t BLOCKCODEC_MASKS[9] = {
+	0x0000000000000000ULL, 0x00000000000000ffULL, 0x000000000000ffffULL,
+	0x0000000000ffffffULL, 0x00000000ffffffffULL, 0x000000ffffffffffULL,
+	0x0000ffffffffffffULL, 0x00ffffffffffffffULL, 0xffffffffffffffffULL,
+};
+
+size_t blockcodec_bound(size_t len)
+{
+	// Raw is the worst case, since anything bigger is stored raw.
+	return sizeof(struct blockcodec_header) + len;
+}
+
+static size_t blockcodec_store_raw(const void *src, size_t len, void *dst)
+{
+	struct blockcodec_header hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	// data_len keeps any bytes past the last whole double, which count
+	// can't.
+	hdr.count = len / sizeof(double);
+	hdr.flags = BLOCKCODEC_FLAG_RAW;
+	hdr.data_len = len;
+	memcpy(dst, &hdr, sizeof(hdr));
+	memcpy((char *)dst + sizeof(hdr), src, len);
+	return sizeof(hdr) + len;
+}
+
+size_t blockcodec_compress(const void *src, size_t len, void *dst)
+{
+	const uint8_t *in = src;
+	struct blockcodec_header hdr;
+	uint8_t *ctl = (uint8_t *)dst + sizeof(hdr), *data, *limit;
+	uint64_t prev = 0, cur, x;
+	size_t i, count = len / sizeof(double);
+	int tz, nb;
+
+	if (len % sizeof(double))
+		return blockcodec_store_raw(src, len, dst);
+	data = ctl + count;
+	// Give up as soon as the frame would save less than a sixteenth of
+	// the block, which isn't worth decoding for.
+	limit = (uint8_t *)dst + sizeof(hdr) + len - (len / 16);
+	for (i = 0; i < count; i++) {
+		memcpy(&cur, in + (i * sizeof(double)), sizeof(cur));
+		x = cur ^ prev;
+		prev = cur;
+		if (x == 0) {
+			ctl[i] = 0;
+			continue;
+		}
+		tz = __builtin_ctzll(x) / 8;
+		nb = 8 - tz - (__builtin_clzll(x) / 8);
+		x >>= 8 * tz;
+		// Always store 8 bytes; the next value overwrites the rest.
+		// The slack past the limit is within the padding.
+		memcpy(data, &x, sizeof(x));
+		data += nb;
+		if (data >= limit)
+			return blockcodec_store_raw(src, len, dst);
+		ctl[i] = (tz << 4) | nb;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.count = count;
+	hdr.data_len = data - (ctl + count);
+	memcpy(dst, &hdr, sizeof(hdr));
+	return data - (uint8_t *)dst;
+}
+
+size_t blockcodec_frame_len(const void *frame)
+{
+	const struct blockcodec_header *hdr = frame;
+
+	if (hdr->flags & BLOCKCODEC_FLAG_RAW)
+		return sizeof(*hdr) + hdr->data_len;
+	return sizeof(*hdr) + hdr->count + hdr->data_len;
+}
+
+void blockcodec_reader_init(struct blockcodec_reader *rd, const void *frame)
+{
+	const struct blockcodec_header *hdr = frame;
+
+	memset(rd, 0, sizeof(*rd));
+	rd->left = hdr->count;
+	if (hdr->flags & BLOCKCODEC_FLAG_RAW) {
+		rd->raw = (const double *)(hdr + 1);
+	} else {
+		rd->ctl = (const uint8_t *)(hdr + 1);
+		rd->data = rd->ctl + hdr->count;
+	}
+}
+
+int blockcodec_next(struct blockcodec_reader *rd, double *tile, int max,
+		const double **vals)
+{
+	const uint8_t *ctl = rd->ctl, *data = rd->data;
+	uint64_t prev = rd->prev, x;
+	int i, n;
+
+	if (rd->raw) {
+		n = rd->left;
+		*vals = rd->raw;
+		rd->raw += n;
+		rd->left = 0;
+		return n;
+	}
+	n = (rd->left < (uint32_t)max) ? (int)rd->left : max;
+	for (i = 0; i < n; i++) {
+		memcpy(&x, data, sizeof(x));
+		x &= BLOCKCODEC_MASKS[ctl[i] & 0xf];
+		data += ctl[i] & 0xf;
+		prev ^= x << (8 * (ctl[i] >> 4));
+		memcpy(&tile[i], &prev, sizeof(prev));
+	}
+	rd->ctl = ctl + n;
+	rd->data = data;
+	rd->prev = prev;
+	rd->left -= n;
+	*vals = tile;
+	return n;
+}
@@ -0,0 +1,88 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#ifndef VECSUM_BLOCKCODEC_H
+#define VECSUM_BLOCKCODEC_H
+
+/*
+ * A fast codec for blocks of doubles, for the compressed block cache.
+ *
+ * Each value is XORed with the one before it, as in Gorilla (Pelkonen et
+ * al., VLDB '15), but the result is stored at byte rather than bit
+ * granularity so that decoding needs no bit twiddling: one control byte
+ * per value gives the number of trailing zero bytes and the number of
+ * significant bytes, which follow in a separate data stream.  Repeated and
+ * slowly changing values, and values with short mantissas (integers,
+ * sawtooths, decimals with few digits), shrink well; random mantissas
+ * hardly shrink at all, and blocks that would shrink by less than a
+ * sixteenth are stored raw, so that they cost nothing to decode.
+ *
+ * A frame is a struct blockcodec_header, followed by count control bytes
+ * and then data_len data bytes, or by the data_len raw bytes of the block,
+ * of which the decoder reads the first count doubles.  The decoder reads
+ * up to BLOCKCODEC_PAD bytes past the end of a frame, so frames must be
+ * stored with that much readable space after them.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLOCKCODEC_PAD 8
+
+// The best ratio the codec can reach: one control byte per double.
+#define BLOCKCODEC_MAX_RATIO 8
+
+// The frame holds the block's data_len bytes raw.
+#define BLOCKCODEC_FLAG_RAW 0x1
+
+struct blockcodec_header {
+	uint32_t count;
+	uint32_t flags;
+	uint32_t data_len;
+	uint32_t reserved;
+};
+
+/*
+ * Decodes a frame a tile at a time.
+ */
+struct blockcodec_reader {
+	const uint8_t *ctl;
+	const uint8_t *data;
+	const double *raw;
+	uint64_t prev;
+	uint32_t left;
+};
+
+/*
+ * The most bytes a frame for a block of len bytes can take, not counting
+ * the padding.
+ */
+size_t blockcodec_bound(size_t len);
+
+/*
+ * Compress a block of len bytes into dst, which must have room for
+ * blockcodec_bound(len) + BLOCKCODEC_PAD bytes.  Blocks that are not a
+ * whole number of doubles, or that hardly shrink, are stored raw.
+ *
+ * Returns the length of the frame.
+ */
+size_t blockcodec_compress(const void *src, size_t len, void *dst);
+
+/*
+ * The length of a frame, not counting the padding.
+ */
+size_t blockcodec_frame_len(const void *frame);
+
+void blockcodec_reader_init(struct blockcodec_reader *rd, const void *frame);
+
+/*
+ * Decode up to max values into tile, and point *vals at them.  Raw frames
+ * aren't copied: *vals points into the frame, at up to all of the values
+ * that are left.  Every call but the last returns a multiple of max.
+ *
+ * Returns the number of values, or 0 at the end of the frame.
+ */
+int blockcodec_next(struct blockcodec_reader *rd, double *tile, int max,
+		const double **vals);
+
+#endif
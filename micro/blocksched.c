@@ -0,0 +1,221 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include "blocksched.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct blocksched {
+	long long block_size;
+
+	// A group for every HDFS block with a chunk starting in it, in file
+	// order
+	struct blocksched_block *blocks;
+	long long num_blocks;
+
+	// The chunks: offset and length in the file, and nonzero if every
+	// block they touch has a replica on this host
+	long long *chunk_off;
+	int *chunk_len;
+	char *chunk_local;
+	long long num_chunks;
+
+	// The blocks in the order they are handed out this pass, and the
+	// next one to hand out
+	struct blocksched_block **order;
+	long long next;
+
+	// Protects the stats.
+	pthread_mutex_t lock;
+	struct blocksched_stats stats;
+};
+
+static const char * const BLOCKSCHED_CLASS_NAMES[BLOCKSCHED_CLASSES] = {
+	"cached",
+	"local",
+	"remote",
+};
+
+const char *blocksched_class_name(enum blocksched_class cls)
+{
+	return BLOCKSCHED_CLASS_NAMES[cls];
+}
+
+/*
+ * Nonzero if block has a replica on this host.  hosts has an entry for
+ * each of the file's num_hosts blocks.
+ */
+static int blocksched_is_local(char ***hosts, long long num_hosts,
+		long long block, const char *hostname)
+{
+	char **host;
+
+	if (block >= num_hosts)
+		return 0;
+	for (host = hosts[block]; *host; host++) {
+		if (!strcmp(*host, hostname) || !strcmp(*host, "localhost") ||
+				!strcmp(*host, "127.0.0.1"))
+			return 1;
+	}
+	return 0;
+}
+
+int blocksched_create(long long start, long long end, int chunk_size,
+		long long block_size, char ***hosts, const char *hostname,
+		struct blocksched **out)
+{
+	struct blocksched *bs;
+	struct blocksched_block *blk = NULL;
+	long long off, next, b, num_hosts = 0;
+	int ret;
+
+	if ((chunk_size <= 0) || (block_size <= 0) || (end < start))
+		return EINVAL;
+	bs = calloc(1, sizeof(*bs));
+	if (!bs)
+		return ENOMEM;
+	pthread_mutex_init(&bs->lock, NULL);
+	bs->block_size = block_size;
+	while (hosts && hosts[num_hosts])
+		num_hosts++;
+	// Every chunk starts a block at worst.
+	bs->num_chunks = (end - start + chunk_size - 1) / chunk_size + 1;
+	bs->chunk_off = calloc(bs->num_chunks, sizeof(long long));
+	bs->chunk_len = calloc(bs->num_chunks, sizeof(int));
+	bs->chunk_local = calloc(bs->num_chunks, sizeof(char));
+	bs->blocks = calloc(bs->num_chunks, sizeof(struct blocksched_block));
+	bs->order = calloc(bs->num_chunks, sizeof(struct blocksched_block *));
+	if (!bs->chunk_off || !bs->chunk_len || !bs->chunk_local ||
+			!bs->blocks || !bs->order) {
+		ret = ENOMEM;
+		goto error;
+	}
+	bs->num_chunks = 0;
+	for (off = start; off < end; off = next) {
+		next = (off / chunk_size + 1) * chunk_size;
+		if (next > end)
+			next = end;
+		b = off / block_size;
+		if (!blk || (blk->off != b * block_size)) {
+			blk = &bs->blocks[bs->num_blocks++];
+			blk->off = b * block_size;
+			blk->first_chunk = bs->num_chunks;
+			blk->local = 1;
+		}
+		blk->num_chunks++;
+		bs->chunk_off[bs->num_chunks] = off;
+		bs->chunk_len[bs->num_chunks] = next - off;
+		// The chunk may run on into the blocks after its own.
+		bs->chunk_local[bs->num_chunks] = 1;
+		for (; b <= (next - 1) / block_size; b++) {
+			if (!blocksched_is_local(hosts, num_hosts, b, hostname))
+				bs->chunk_local[bs->num_chunks] = 0;
+		}
+		// A group is only local if every one of its chunks is.
+		if (!bs->chunk_local[bs->num_chunks])
+			blk->local = 0;
+		blk->cls = blk->local ? BLOCKSCHED_LOCAL : BLOCKSCHED_REMOTE;
+		bs->num_chunks++;
+	}
+	*out = bs;
+	return 0;
+
+error:
+	blocksched_free(bs);
+	return ret;
+}
+
+void blocksched_free(struct blocksched *bs)
+{
+	if (!bs)
+		return;
+	free(bs->chunk_off);
+	free(bs->chunk_len);
+	free(bs->chunk_local);
+	free(bs->blocks);
+	free(bs->order);
+	pthread_mutex_destroy(&bs->lock);
+	free(bs);
+}
+
+long long blocksched_num_chunks(const struct blocksched *bs)
+{
+	return bs->num_chunks;
+}
+
+void blocksched_chunk(const struct blocksched *bs, long long chunk,
+		long long *off, int *len)
+{
+	*off = bs->chunk_off[chunk];
+	*len = bs->chunk_len[chunk];
+}
+
+void blocksched_start_pass(struct blocksched *bs)
+{
+	long long i, n = 0;
+	int cls;
+
+	// Best class first, and each class in file order
+	for (cls = 0; cls < BLOCKSCHED_CLASSES; cls++) {
+		for (i = 0; i < bs->num_blocks; i++) {
+			if (bs->blocks[i].cls == (enum blocksched_class)cls)
+				bs->order[n++] = &bs->blocks[i];
+		}
+	}
+	bs->next = 0;
+	memset(&bs->stats, 0, sizeof(bs->stats));
+}
+
+struct blocksched_block *blocksched_next(struct blocksched *bs)
+{
+	long long i = __atomic_fetch_add(&bs->next, 1, __ATOMIC_RELAXED);
+
+	if (i >= bs->num_blocks)
+		return NULL;
+	return bs->order[i];
+}
+
+void blocksched_account(struct blocksched *bs, long long chunk, int hit,
+		long long len, double seconds)
+{
+	enum blocksched_class cls;
+
+	if (hit)
+		cls = BLOCKSCHED_CACHED;
+	else if (bs->chunk_local[chunk])
+		cls = BLOCKSCHED_LOCAL;
+	else
+		cls = BLOCKSCHED_REMOTE;
+	pthread_mutex_lock(&bs->lock);
+	bs->stats.chunks[cls]++;
+	bs->stats.bytes[cls] += len;
+	bs->stats.seconds[cls] += seconds;
+	pthread_mutex_unlock(&bs->lock);
+}
+
+void blocksched_block_done(struct blocksched *bs,
+		struct blocksched_block *blk, long long chunks_read,
+		long long chunks_hit)
+{
+	if (chunks_read && (chunks_hit == chunks_read))
+		blk->cls = BLOCKSCHED_CACHED;
+	else
+		blk->cls = blk->local ? BLOCKSCHED_LOCAL : BLOCKSCHED_REMOTE;
+	pthread_mutex_lock(&bs->lock);
+	bs->stats.groups[blk->cls]++;
+	pthread_mutex_unlock(&bs->lock);
+}
+
+void blocksched_get_stats(struct blocksched *bs,
+		struct blocksched_stats *stats)
+{
+	pthread_mutex_lock(&bs->lock);
+	*stats = bs->stats;
+	pthread_mutex_unlock(&bs->lock);
+}
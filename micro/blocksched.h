@@ -0,0 +1,128 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#ifndef VECSUM_BLOCKSCHED_H
+#define VECSUM_BLOCKSCHED_H
+
+/*
+ * Block-aware scheduling of a multi-threaded scan.
+ *
+ * A scan reads the file in chunks, each of which one thread has to add up
+ * whole.  Chunks and HDFS blocks don't line up, so a thread that took a
+ * range of chunks could straddle two HDFS blocks and pay for both of their
+ * DataNodes.  Instead, the scheduler groups the chunks by the HDFS block
+ * they start in, and hands out whole groups: the thread that takes a group
+ * reads all of its chunks, splitting reads at HDFS block boundaries.
+ *
+ * A group is usually an HDFS block's worth of chunks.  When HDFS blocks are
+ * smaller than a chunk, though, no chunk starts in most of them, and each
+ * group is a single chunk that spans several HDFS blocks; the stats count
+ * groups rather than HDFS blocks for that reason.
+ *
+ * Every group is classed as cached, local or remote, from its replica
+ * locations and from what the last pass saw.  It is local if this host has
+ * a replica of every HDFS block that any of its chunks touches, and a group
+ * whose chunks all came out of the block cache is cached on the next pass.
+ * Groups are handed out in that order, so that threads take the ones they
+ * can read fastest first.  The scheduler also keeps the bytes read and the
+ * time spent on chunks of each class, for the per-class throughput.
+ */
+
+enum blocksched_class {
+	BLOCKSCHED_CACHED = 0,
+	BLOCKSCHED_LOCAL,
+	BLOCKSCHED_REMOTE,
+	BLOCKSCHED_CLASSES,
+};
+
+// A group of chunks, the ones that start in one HDFS block.
+struct blocksched_block {
+	// The HDFS block's offset in the file
+	long long off;
+
+	// The chunks that start in the HDFS block
+	long long first_chunk;
+	long long num_chunks;
+
+	// Nonzero if this host has a replica of everything the chunks touch
+	int local;
+
+	// The group's class, as of the last pass, or from its locations
+	// before the first
+	enum blocksched_class cls;
+};
+
+struct blocksched_stats {
+	// Groups that turned out to be of each class this pass
+	long long groups[BLOCKSCHED_CLASSES];
+
+	// Chunks read from each class, the bytes in them, and the time the
+	// threads spent on them
+	long long chunks[BLOCKSCHED_CLASSES];
+	long long bytes[BLOCKSCHED_CLASSES];
+	double seconds[BLOCKSCHED_CLASSES];
+};
+
+struct blocksched;
+
+/*
+ * Create a scheduler for the chunks of [start, end) in a file of HDFS
+ * blocks of block_size bytes.  Chunks are cut at file offsets that are
+ * multiples of chunk_size.  hosts is what hdfsGetHosts returned for the
+ * whole file: for each block, a NULL-terminated list of the hosts with a
+ * replica.  A block is local if hostname, or localhost, is among them.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int blocksched_create(long long start, long long end, int chunk_size,
+		long long block_size, char ***hosts, const char *hostname,
+		struct blocksched **out);
+
+void blocksched_free(struct blocksched *bs);
+
+/*
+ * The number of chunks, and where chunk lies in the file.
+ */
+long long blocksched_num_chunks(const struct blocksched *bs);
+void blocksched_chunk(const struct blocksched *bs, long long chunk,
+		long long *off, int *len);
+
+/*
+ * Order the groups for a new pass, best class first, and reset the stats.
+ */
+void blocksched_start_pass(struct blocksched *bs);
+
+/*
+ * Take the next group, or NULL if every group has been handed out.
+ */
+struct blocksched_block *blocksched_next(struct blocksched *bs);
+
+/*
+ * Charge a chunk of len bytes that took seconds to read and add up to the
+ * class it was read from: cached if it hit the block cache, and otherwise
+ * local or remote.
+ */
+void blocksched_account(struct blocksched *bs, long long chunk, int hit,
+		long long len, double seconds);
+
+/*
+ * Record what a group's thread saw: chunks_read of its chunks were read
+ * (the rest skipped), chunks_hit of them from the block cache.  This sets
+ * the group's class for the next pass.
+ */
+void blocksched_block_done(struct blocksched *bs,
+		struct blocksched_block *blk, long long chunks_read,
+		long long chunks_hit);
+
+/*
+ * Get this pass's stats.  Call once every thread is done.
+ */
+void blocksched_get_stats(struct blocksched *bs,
+		struct blocksched_stats *stats);
+
+/*
+ * The name of a class.
+ */
+const char *blocksched_class_name(enum blocksched_class cls);
+
+#endif
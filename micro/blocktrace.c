@@ -0,0 +1,417 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include "blocktrace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Records each thread buffers before writing them out: 128 KiB.
+#define BLOCKTRACE_BUF_RECORDS 4096
+
+struct blocktrace_buf {
+	struct blocktrace_buf *next;
+	int used;
+	uint16_t thread;
+	struct blocktrace_record recs[BLOCKTRACE_BUF_RECORDS];
+};
+
+struct blocktrace {
+	int fd;
+	char *path;
+	uint64_t start;
+
+	// Tells this trace's thread buffers apart from a closed trace's.
+	uint64_t generation;
+
+	// Protects everything below, and writes to fd.
+	pthread_mutex_t lock;
+	struct blocktrace_buf *bufs;
+	uint32_t num_files;
+	int num_threads;
+	long long records;
+
+	// The first write error, or 0
+	int err;
+};
+
+static uint64_t g_blocktrace_generation;
+
+static __thread struct blocktrace_buf *t_blocktrace_buf;
+static __thread uint64_t t_blocktrace_generation;
+
+static uint64_t blocktrace_clock(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Write all of buf to the trace.  Called with the lock held.
+ */
+static void blocktrace_write(struct blocktrace *bt, const void *buf,
+		size_t len)
+{
+	const char *cbuf = buf;
+	ssize_t res;
+
+	while ((len > 0) && (!bt->err)) {
+		res = write(bt->fd, cbuf, len);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			bt->err = errno;
+			fprintf(stderr, "blocktrace: failed to write %s: "
+				"error %d (%s)\n", bt->path, bt->err,
+				strerror(bt->err));
+			return;
+		}
+		cbuf += res;
+		len -= res;
+	}
+}
+
+/*
+ * Write out a thread buffer.  Called with the lock held.
+ */
+static void blocktrace_flush(struct blocktrace *bt, struct blocktrace_buf *buf)
+{
+	blocktrace_write(bt, buf->recs, buf->used * sizeof(buf->recs[0]));
+	bt->records += buf->used;
+	buf->used = 0;
+}
+
+int blocktrace_open(const char *path, struct blocktrace **out)
+{
+	struct blocktrace *bt;
+	struct blocktrace_header hdr;
+	int ret;
+
+	bt = calloc(1, sizeof(*bt));
+	if (!bt)
+		return ENOMEM;
+	bt->fd = -1;
+	bt->path = strdup(path);
+	if (!bt->path) {
+		ret = ENOMEM;
+		goto error;
+	}
+	pthread_mutex_init(&bt->lock, NULL);
+	bt->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (bt->fd < 0) {
+		ret = errno;
+		fprintf(stderr, "blocktrace: failed to open %s: error %d "
+			"(%s)\n", path, ret, strerror(ret));
+		goto error;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, BLOCKTRACE_MAGIC, BLOCKTRACE_MAGIC_LEN);
+	hdr.version = BLOCKTRACE_VERSION;
+	hdr.endian_tag = BLOCKTRACE_ENDIAN_TAG;
+	hdr.record_size = sizeof(struct blocktrace_record);
+	hdr.start_ns = blocktrace_clock(CLOCK_REALTIME);
+	blocktrace_write(bt, &hdr, sizeof(hdr));
+	if (bt->err) {
+		ret = bt->err;
+		goto error;
+	}
+	bt->start = blocktrace_clock(CLOCK_MONOTONIC);
+	bt->generation = __atomic_add_fetch(&g_blocktrace_generation, 1,
+		__ATOMIC_RELAXED);
+	*out = bt;
+	return 0;
+
+error:
+	if (bt->fd >= 0)
+		close(bt->fd);
+	free(bt->path);
+	free(bt);
+	return ret;
+}
+
+uint32_t blocktrace_file(struct blocktrace *bt, const char *path)
+{
+	struct blocktrace_record rec;
+	char pad[sizeof(rec)] = { 0 };
+	size_t len = strlen(path);
+	uint32_t id;
+
+	memset(&rec, 0, sizeof(rec));
+	pthread_mutex_lock(&bt->lock);
+	id = bt->num_files++;
+	rec.ts = blocktrace_clock(CLOCK_MONOTONIC) - bt->start;
+	rec.length = len;
+	rec.file = id;
+	rec.op = BLOCKTRACE_OP_FILE;
+	blocktrace_write(bt, &rec, sizeof(rec));
+	blocktrace_write(bt, path, len);
+	blocktrace_write(bt, pad, (sizeof(rec) - (len % sizeof(rec))) %
+		sizeof(rec));
+	pthread_mutex_unlock(&bt->lock);
+	return id;
+}
+
+/*
+ * Give the calling thread a buffer in this trace.
+ */
+static struct blocktrace_buf *blocktrace_buf_create(struct blocktrace *bt)
+{
+	struct blocktrace_buf *buf;
+
+	buf = malloc(sizeof(*buf));
+	if (!buf)
+		return NULL;
+	buf->used = 0;
+	pthread_mutex_lock(&bt->lock);
+	buf->thread = bt->num_threads++;
+	buf->next = bt->bufs;
+	bt->bufs = buf;
+	pthread_mutex_unlock(&bt->lock);
+	t_blocktrace_buf = buf;
+	t_blocktrace_generation = bt->generation;
+	return buf;
+}
+
+void blocktrace_record(struct blocktrace *bt, uint32_t file, uint64_t offset,
+		uint32_t length, int op, int flags)
+{
+	struct blocktrace_buf *buf = t_blocktrace_buf;
+	struct blocktrace_record *rec;
+
+	if ((!buf) || (t_blocktrace_generation != bt->generation)) {
+		buf = blocktrace_buf_create(bt);
+		if (!buf)
+			return;
+	}
+	rec = &buf->recs[buf->used++];
+	rec->ts = blocktrace_clock(CLOCK_MONOTONIC) - bt->start;
+	rec->offset = offset;
+	rec->length = length;
+	rec->file = file;
+	rec->thread = buf->thread;
+	rec->op = op;
+	rec->flags = flags;
+	rec->reserved = 0;
+	if (buf->used == BLOCKTRACE_BUF_RECORDS) {
+		pthread_mutex_lock(&bt->lock);
+		blocktrace_flush(bt, buf);
+		pthread_mutex_unlock(&bt->lock);
+	}
+}
+
+int blocktrace_close(struct blocktrace *bt)
+{
+	struct blocktrace_buf *buf, *next;
+	int ret;
+
+	if (!bt)
+		return 0;
+	for (buf = bt->bufs; buf; buf = next) {
+		next = buf->next;
+		blocktrace_flush(bt, buf);
+		free(buf);
+	}
+	if (close(bt->fd) && (!bt->err)) {
+		bt->err = errno;
+		fprintf(stderr, "blocktrace: failed to close %s: error %d "
+			"(%s)\n", bt->path, bt->err, strerror(bt->err));
+	}
+	if (!bt->err) {
+		printf("blocktrace: wrote %lld records from %d threads to "
+			"%s\n", bt->records, bt->num_threads, bt->path);
+	}
+	ret = bt->err;
+	pthread_mutex_destroy(&bt->lock);
+	free(bt->path);
+	free(bt);
+	return ret;
+}
+
+static int blocktrace_record_compare(const void *a, const void *b)
+{
+	const struct blocktrace_record *ra = a, *rb = b;
+
+	if (ra->ts != rb->ts)
+		return (ra->ts < rb->ts) ? -1 : 1;
+	return (int)ra->thread - (int)rb->thread;
+}
+
+static int blocktrace_header_check(const struct blocktrace_header *hdr)
+{
+	if (memcmp(hdr->magic, BLOCKTRACE_MAGIC, BLOCKTRACE_MAGIC_LEN)) {
+		fprintf(stderr, "blocktrace: bad magic\n");
+		return EINVAL;
+	}
+	if (hdr->endian_tag != BLOCKTRACE_ENDIAN_TAG) {
+		fprintf(stderr, "blocktrace: the trace was written on a "
+			"machine with a different byte order\n");
+		return EINVAL;
+	}
+	if (hdr->version != BLOCKTRACE_VERSION) {
+		fprintf(stderr, "blocktrace: unsupported version %u\n",
+			hdr->version);
+		return EINVAL;
+	}
+	if (hdr->record_size < sizeof(struct blocktrace_record)) {
+		fprintf(stderr, "blocktrace: invalid record size %u\n",
+			hdr->record_size);
+		return EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Read the records that follow the header.
+ */
+static int blocktrace_parse(struct blocktrace_log *log, FILE *fp,
+		blocktrace_filter_fn filter, void *arg)
+{
+	uint32_t step = log->hdr.record_size;
+	struct blocktrace_record *recs;
+	long long cap = 0, off = sizeof(log->hdr);
+	char *raw, **files;
+	size_t res;
+	int ret = 0;
+
+	raw = malloc(step);
+	if (!raw)
+		return ENOMEM;
+	for (; (res = fread(raw, 1, step, fp)) == step; off += step) {
+		struct blocktrace_record *rec = (void *)raw;
+
+		if (rec->op >= BLOCKTRACE_OP_MAX) {
+			fprintf(stderr, "blocktrace: unknown op %d at offset "
+				"%lld\n", rec->op, off);
+			ret = EINVAL;
+			goto done;
+		}
+		if (rec->op != BLOCKTRACE_OP_FILE) {
+			if (rec->file >= log->num_files) {
+				fprintf(stderr, "blocktrace: record at offset "
+					"%lld refers to unnamed file %u\n",
+					off, rec->file);
+				ret = EINVAL;
+				goto done;
+			}
+			if (filter && !filter(rec, arg))
+				continue;
+			if (log->num_recs == cap) {
+				cap = cap ? (cap * 2) : 4096;
+				recs = realloc(log->recs, cap * sizeof(*recs));
+				if (!recs) {
+					ret = ENOMEM;
+					goto done;
+				}
+				log->recs = recs;
+			}
+			memcpy(&log->recs[log->num_recs++], rec,
+				sizeof(*rec));
+			continue;
+		}
+		if (rec->file != log->num_files) {
+			fprintf(stderr, "blocktrace: bad file record at "
+				"offset %lld\n", off);
+			ret = EINVAL;
+			goto done;
+		}
+		files = realloc(log->files,
+			(log->num_files + 1) * sizeof(char *));
+		if (!files) {
+			ret = ENOMEM;
+			goto done;
+		}
+		log->files = files;
+		// The name is padded to whole records of the writer's size.
+		res = (rec->length + step - 1) / step * step;
+		log->files[log->num_files] = calloc(1, res + 1);
+		if (!log->files[log->num_files]) {
+			ret = ENOMEM;
+			goto done;
+		}
+		if (fread(log->files[log->num_files], 1, res, fp) != res) {
+			fprintf(stderr, "blocktrace: truncated file name at "
+				"offset %lld\n", off);
+			ret = EINVAL;
+			goto done;
+		}
+		log->files[log->num_files++][rec->length] = '\0';
+		off += res;
+	}
+	if (ferror(fp)) {
+		fprintf(stderr, "blocktrace: read error at offset %lld\n",
+			off);
+		ret = EIO;
+	} else if (res != 0) {
+		fprintf(stderr, "blocktrace: %zu trailing bytes\n", res);
+		ret = EINVAL;
+	}
+done:
+	free(raw);
+	return ret;
+}
+
+int blocktrace_load(const char *path, blocktrace_filter_fn filter, void *arg,
+		struct blocktrace_log **out)
+{
+	struct blocktrace_log *log = NULL;
+	FILE *fp;
+	int ret;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		ret = errno;
+		fprintf(stderr, "blocktrace: failed to open %s: error %d "
+			"(%s)\n", path, ret, strerror(ret));
+		return ret;
+	}
+	log = calloc(1, sizeof(*log));
+	if (!log) {
+		ret = ENOMEM;
+		goto done;
+	}
+	if (fread(&log->hdr, 1, sizeof(log->hdr), fp) != sizeof(log->hdr)) {
+		fprintf(stderr, "blocktrace: %s is too short to be a trace\n",
+			path);
+		ret = EINVAL;
+		goto done;
+	}
+	ret = blocktrace_header_check(&log->hdr);
+	if (ret)
+		goto done;
+	ret = blocktrace_parse(log, fp, filter, arg);
+	if (ret)
+		goto done;
+	if (log->num_recs) {
+		qsort(log->recs, log->num_recs, sizeof(log->recs[0]),
+			blocktrace_record_compare);
+	}
+	*out = log;
+	log = NULL;
+done:
+	blocktrace_log_free(log);
+	fclose(fp);
+	return ret;
+}
+
+void blocktrace_log_free(struct blocktrace_log *log)
+{
+	uint32_t i;
+
+	if (!log)
+		return;
+	for (i = 0; i < log->num_files; i++)
+		free(log->files[i]);
+	free(log->files);
+	free(log->recs);
+	free(log);
+}
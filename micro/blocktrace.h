@@ -0,0 +1,147 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#ifndef VECSUM_BLOCKTRACE_H
+#define VECSUM_BLOCKTRACE_H
+
+/*
+ * Block-level read traces.
+ *
+ * A trace records every chunk that a read path touches: which file, where,
+ * how much, when, on which thread, through which kind of read, and whether
+ * the block cache had it.  It is meant for sizing and comparing caches
+ * offline, and for replaying a run's reads without the rest of the stack.
+ *
+ * The trace file is a struct blocktrace_header followed by a stream of
+ * 32-byte struct blocktrace_record.  A record with op BLOCKTRACE_OP_FILE
+ * names a file: its length field is the length of the name, which follows
+ * it, NUL padded to a whole number of records.  A file is always named
+ * before any record refers to it.  Like float files, integers are in the
+ * writer's byte order.
+ *
+ * Each thread appends to its own buffer, which is written out when it
+ * fills, so recording costs a clock read and a few stores, and takes no
+ * lock.  Records from different threads are therefore only ordered by
+ * their timestamps.  Only one trace can be recorded at a time, and every
+ * thread that records into it must be done before it is closed.
+ */
+
+#include <stdint.h>
+
+#define BLOCKTRACE_MAGIC "VSUMTRCE"
+#define BLOCKTRACE_MAGIC_LEN 8
+#define BLOCKTRACE_VERSION 1
+#define BLOCKTRACE_ENDIAN_TAG 0x01020304U
+
+// What a record describes.
+enum blocktrace_op {
+	// Names a file
+	BLOCKTRACE_OP_FILE = 0,
+
+	// A chunk read through hadoopReadZero
+	BLOCKTRACE_OP_READ_ZERO,
+
+	// A chunk read through hdfsRead
+	BLOCKTRACE_OP_HDFS_READ,
+
+	// A chunk of a local mmap that was summed in place
+	BLOCKTRACE_OP_MMAP,
+
+	// A chunk read through pread
+	BLOCKTRACE_OP_PREAD,
+
+	BLOCKTRACE_OP_MAX,
+};
+
+// The block cache had the chunk, so the read path did not read it.
+#define BLOCKTRACE_FLAG_HIT 0x1
+
+struct blocktrace_header {
+	char magic[BLOCKTRACE_MAGIC_LEN];
+	uint32_t version;
+	uint32_t endian_tag;
+
+	// Size of each record.  Readers must step through the records by
+	// this much, so that newer writers can append fields.
+	uint32_t record_size;
+	uint32_t reserved;
+
+	// CLOCK_REALTIME when the trace started, in nanoseconds
+	uint64_t start_ns;
+};
+
+struct blocktrace_record {
+	// Nanoseconds since the trace started, when the read was issued
+	uint64_t ts;
+	uint64_t offset;
+	uint32_t length;
+	uint32_t file;
+
+	// Small per-trace thread number, in the order threads first record
+	uint16_t thread;
+	uint8_t op;
+	uint8_t flags;
+	uint32_t reserved;
+};
+
+struct blocktrace;
+
+/*
+ * Start a trace in a new file at path.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int blocktrace_open(const char *path, struct blocktrace **out);
+
+/*
+ * Name a file in the trace.  Returns its id, for blocktrace_record.
+ */
+uint32_t blocktrace_file(struct blocktrace *bt, const char *path);
+
+/*
+ * Record a read of length bytes at offset in the given file.  op is a
+ * blocktrace_op, and flags a combination of BLOCKTRACE_FLAG_*.
+ */
+void blocktrace_record(struct blocktrace *bt, uint32_t file, uint64_t offset,
+		uint32_t length, int op, int flags);
+
+/*
+ * Write out every thread's buffer, close the trace, and free it.
+ *
+ * Returns 0 on success, or the first error any write hit.
+ */
+int blocktrace_close(struct blocktrace *bt);
+
+// A trace read back into memory.
+struct blocktrace_log {
+	struct blocktrace_header hdr;
+
+	// The reads, sorted by timestamp
+	struct blocktrace_record *recs;
+	long long num_recs;
+
+	// File names, indexed by file id
+	char **files;
+	uint32_t num_files;
+};
+
+/*
+ * Decides whether blocktrace_load keeps a record.  Returns nonzero to keep
+ * it.
+ */
+typedef int (*blocktrace_filter_fn)(const struct blocktrace_record *rec,
+		void *arg);
+
+/*
+ * Load the trace at path, streaming through it so that only the records
+ * filter keeps are held in memory.  If filter is NULL, every record is
+ * kept.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int blocktrace_load(const char *path, blocktrace_filter_fn filter, void *arg,
+		struct blocktrace_log **out);
+
+void blocktrace_log_free(struct blocktrace_log *log);
+
+#endif
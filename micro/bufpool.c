@@ -0,0 +1,351 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include "bufpool.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BUFPOOL_HUGE_PAGE_SIZE (2L * 1024 * 1024)
+
+// Most classes a pool can have.
+#define BUFPOOL_MAX_CLASSES 32
+
+// Buffers of each class a thread keeps for itself.
+#define BUFPOOL_THREAD_SLOTS 2
+
+struct bufpool_class {
+	size_t size;
+
+	// The slots, mapped on first use, and a stack of the free ones
+	char *slab;
+	size_t slab_len;
+	void **free;
+	int num_free;
+
+	// Set if mapping the slab failed, so that gets stop trying
+	int failed;
+
+	// Hits, and what allocating and faulting in one buffer of this size
+	// cost when we measured it
+	long long hits;
+	double alloc_seconds;
+};
+
+struct bufpool_thread {
+	struct bufpool *bp;
+	void *bufs[BUFPOOL_MAX_CLASSES][BUFPOOL_THREAD_SLOTS];
+	int count[BUFPOOL_MAX_CLASSES];
+};
+
+struct bufpool {
+	struct bufpool_class classes[BUFPOOL_MAX_CLASSES];
+	int num_classes;
+	int min_shift;
+	int slots_per_class;
+	int hugepages;
+
+	// Protects the classes' slabs and free lists.
+	pthread_mutex_t lock;
+
+	// Each thread's cache
+	pthread_key_t key;
+
+	long long gets;
+	long long thread_hits;
+};
+
+/*
+ * Return a thread's cached buffers to the shared free lists.
+ */
+static void bufpool_thread_flush(void *arg)
+{
+	struct bufpool_thread *bt = arg;
+	struct bufpool *bp = bt->bp;
+	struct bufpool_class *cls;
+	int c;
+
+	pthread_mutex_lock(&bp->lock);
+	for (c = 0; c < bp->num_classes; c++) {
+		cls = &bp->classes[c];
+		while (bt->count[c] > 0) {
+			bt->count[c]--;
+			cls->free[cls->num_free++] = bt->bufs[c][bt->count[c]];
+		}
+	}
+	pthread_mutex_unlock(&bp->lock);
+	free(bt);
+}
+
+int bufpool_create(size_t min_size, size_t max_size, int slots_per_class,
+		int flags, struct bufpool **out)
+{
+	struct bufpool *bp;
+	size_t size;
+	int c, ret;
+
+	if ((min_size < (size_t)sysconf(_SC_PAGESIZE)) ||
+			(min_size & (min_size - 1)) ||
+			(max_size & (max_size - 1)) || (max_size < min_size) ||
+			(slots_per_class < 1)) {
+		fprintf(stderr, "bufpool: invalid classes %zu to %zu bytes "
+			"with %d slots each.\n", min_size, max_size,
+			slots_per_class);
+		return EINVAL;
+	}
+	bp = calloc(1, sizeof(*bp));
+	if (!bp)
+		return ENOMEM;
+	bp->min_shift = __builtin_ctzll(min_size);
+	bp->slots_per_class = slots_per_class;
+	bp->hugepages = !!(flags & BUFPOOL_HUGEPAGES);
+	for (size = min_size; size <= max_size; size <<= 1) {
+		if (bp->num_classes == BUFPOOL_MAX_CLASSES) {
+			free(bp);
+			return EINVAL;
+		}
+		bp->classes[bp->num_classes++].size = size;
+	}
+	for (c = 0; c < bp->num_classes; c++) {
+		bp->classes[c].free = calloc(slots_per_class, sizeof(void *));
+		if (!bp->classes[c].free) {
+			ret = ENOMEM;
+			goto error;
+		}
+	}
+	ret = pthread_key_create(&bp->key, bufpool_thread_flush);
+	if (ret)
+		goto error;
+	pthread_mutex_init(&bp->lock, NULL);
+	*out = bp;
+	return 0;
+
+error:
+	for (c = 0; c < bp->num_classes; c++)
+		free(bp->classes[c].free);
+	free(bp);
+	return ret;
+}
+
+void bufpool_free(struct bufpool *bp)
+{
+	struct bufpool_thread *bt;
+	int c;
+
+	if (!bp)
+		return;
+	bt = pthread_getspecific(bp->key);
+	if (bt) {
+		pthread_setspecific(bp->key, NULL);
+		bufpool_thread_flush(bt);
+	}
+	pthread_key_delete(bp->key);
+	for (c = 0; c < bp->num_classes; c++) {
+		if (bp->classes[c].slab)
+			munmap(bp->classes[c].slab, bp->classes[c].slab_len);
+		free(bp->classes[c].free);
+	}
+	pthread_mutex_destroy(&bp->lock);
+	free(bp);
+}
+
+/*
+ * Time allocating, faulting in, and freeing one buffer of a class, which is
+ * what each hit saves.
+ */
+static void bufpool_measure(struct bufpool_class *cls)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	double start = monotonic_seconds();
+	volatile char *vbuf;
+	void *buf;
+	size_t off;
+
+	if (posix_memalign(&buf, page_size, cls->size))
+		return;
+	// Volatile, so that the compiler can't drop the stores.
+	vbuf = buf;
+	for (off = 0; off < cls->size; off += page_size)
+		vbuf[off] = 0;
+	free(buf);
+	cls->alloc_seconds = monotonic_seconds() - start;
+}
+
+/*
+ * Map and fault in a class's slab, and put its slots on the free list.
+ * Called with the lock held.
+ */
+static int bufpool_map(struct bufpool *bp, struct bufpool_class *cls)
+{
+	size_t len = cls->size * bp->slots_per_class;
+	char *slab;
+	int i;
+
+	bufpool_measure(cls);
+	if (bp->hugepages) {
+		len = (len + BUFPOOL_HUGE_PAGE_SIZE - 1) &
+			~(BUFPOOL_HUGE_PAGE_SIZE - 1);
+		slab = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+			MAP_POPULATE, -1, 0);
+		if (slab == MAP_FAILED) {
+			slab = mmap(NULL, len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (slab != MAP_FAILED) {
+				madvise(slab, len, MADV_HUGEPAGE);
+				memset(slab, 0, len);
+			}
+		}
+	} else {
+		slab = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	}
+	if (slab == MAP_FAILED) {
+		fprintf(stderr, "bufpool: failed to map a %zu-byte slab: "
+			"error %d (%s)\n", len, errno, strerror(errno));
+		return ENOMEM;
+	}
+	for (i = bp->slots_per_class - 1; i >= 0; i--)
+		cls->free[cls->num_free++] = slab + (i * cls->size);
+	// bufpool_put looks at the slab without the lock.
+	cls->slab_len = len;
+	__atomic_store_n(&cls->slab, slab, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/*
+ * The class for len bytes, or -1 if it is too big for any.
+ */
+static int bufpool_class_of(const struct bufpool *bp, size_t len)
+{
+	int shift;
+
+	if (len <= ((size_t)1 << bp->min_shift))
+		return 0;
+	shift = 64 - __builtin_clzll(len - 1);
+	if (shift - bp->min_shift >= bp->num_classes)
+		return -1;
+	return shift - bp->min_shift;
+}
+
+static struct bufpool_thread *bufpool_thread_get(struct bufpool *bp)
+{
+	struct bufpool_thread *bt = pthread_getspecific(bp->key);
+
+	if (bt)
+		return bt;
+	bt = calloc(1, sizeof(*bt));
+	if (!bt)
+		return NULL;
+	bt->bp = bp;
+	if (pthread_setspecific(bp->key, bt)) {
+		free(bt);
+		return NULL;
+	}
+	return bt;
+}
+
+void *bufpool_get(struct bufpool *bp, size_t len)
+{
+	struct bufpool_thread *bt;
+	struct bufpool_class *cls;
+	void *buf = NULL;
+	int c = bufpool_class_of(bp, len);
+
+	__atomic_fetch_add(&bp->gets, 1, __ATOMIC_RELAXED);
+	if (c < 0)
+		goto miss;
+	cls = &bp->classes[c];
+	bt = bufpool_thread_get(bp);
+	if (bt && bt->count[c]) {
+		__atomic_fetch_add(&bp->thread_hits, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&cls->hits, 1, __ATOMIC_RELAXED);
+		return bt->bufs[c][--bt->count[c]];
+	}
+	if (__atomic_load_n(&cls->failed, __ATOMIC_RELAXED)) {
+		len = cls->size;
+		goto miss;
+	}
+	pthread_mutex_lock(&bp->lock);
+	if (!cls->slab && !cls->failed && bufpool_map(bp, cls))
+		__atomic_store_n(&cls->failed, 1, __ATOMIC_RELAXED);
+	if (cls->num_free)
+		buf = cls->free[--cls->num_free];
+	pthread_mutex_unlock(&bp->lock);
+	if (buf) {
+		__atomic_fetch_add(&cls->hits, 1, __ATOMIC_RELAXED);
+		return buf;
+	}
+	len = cls->size;
+miss:
+	if (posix_memalign(&buf, sysconf(_SC_PAGESIZE), len))
+		return NULL;
+	return buf;
+}
+
+void bufpool_put(struct bufpool *bp, void *buf)
+{
+	struct bufpool_thread *bt;
+	struct bufpool_class *cls;
+	char *slab;
+	int c;
+
+	if (!buf)
+		return;
+	for (c = 0; c < bp->num_classes; c++) {
+		slab = __atomic_load_n(&bp->classes[c].slab, __ATOMIC_ACQUIRE);
+		if (slab && ((char *)buf >= slab) &&
+				((char *)buf < slab + bp->classes[c].slab_len))
+			break;
+	}
+	if (c == bp->num_classes) {
+		// It was a miss.
+		free(buf);
+		return;
+	}
+	cls = &bp->classes[c];
+	bt = bufpool_thread_get(bp);
+	if (bt && (bt->count[c] < BUFPOOL_THREAD_SLOTS)) {
+		bt->bufs[c][bt->count[c]++] = buf;
+		return;
+	}
+	pthread_mutex_lock(&bp->lock);
+	cls->free[cls->num_free++] = buf;
+	pthread_mutex_unlock(&bp->lock);
+}
+
+/*
+ * Read a counter, and zero it if reset is nonzero.
+ */
+static long long bufpool_counter(long long *counter, int reset)
+{
+	if (reset)
+		return __atomic_exchange_n(counter, 0, __ATOMIC_RELAXED);
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+void bufpool_get_stats(struct bufpool *bp, struct bufpool_stats *stats,
+		int reset)
+{
+	long long hits;
+	int c;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->gets = bufpool_counter(&bp->gets, reset);
+	stats->thread_hits = bufpool_counter(&bp->thread_hits, reset);
+	for (c = 0; c < bp->num_classes; c++) {
+		hits = bufpool_counter(&bp->classes[c].hits, reset);
+		stats->hits += hits;
+		stats->seconds_saved += hits * bp->classes[c].alloc_seconds;
+	}
+}
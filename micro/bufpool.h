@@ -0,0 +1,72 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#ifndef VECSUM_BUFPOOL_H
+#define VECSUM_BUFPOOL_H
+
+/*
+ * A pool of aligned read buffers.
+ *
+ * Buffers come in power-of-two size classes.  The first time a class is
+ * used, the pool maps a slab of slots for it, optionally out of 2 MiB huge
+ * pages, and faults the whole slab in, so that reads into pooled buffers
+ * never take page faults.  Freed buffers go back to a small cache in the
+ * thread that freed them, and from there, when it is full or the thread
+ * exits, to the class's shared free list.
+ *
+ * When a class has no free slot, or the size is bigger than the biggest
+ * class, the buffer is allocated with posix_memalign instead; the stats
+ * count these as misses.
+ */
+
+#include <stddef.h>
+
+// Flags for bufpool_create.
+#define BUFPOOL_HUGEPAGES 0x1
+
+struct bufpool;
+
+struct bufpool_stats {
+	// Buffers handed out, and how many of those came from the pool, and
+	// from the thread's own cache
+	long long gets;
+	long long hits;
+	long long thread_hits;
+
+	// Estimated time that allocating and faulting in the pooled buffers
+	// would have taken
+	double seconds_saved;
+};
+
+/*
+ * Create a pool with classes from min_size to max_size bytes, both powers
+ * of two of at least the page size, and slots_per_class slots in each.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int bufpool_create(size_t min_size, size_t max_size, int slots_per_class,
+		int flags, struct bufpool **out);
+
+/*
+ * Free the pool.  Every buffer must have been put back.
+ */
+void bufpool_free(struct bufpool *bp);
+
+/*
+ * Get a page-aligned buffer of at least len bytes, or NULL if there is no
+ * memory.
+ */
+void *bufpool_get(struct bufpool *bp, size_t len);
+
+/*
+ * Put back a buffer from bufpool_get.
+ */
+void bufpool_put(struct bufpool *bp, void *buf);
+
+/*
+ * Get the stats, and reset them if reset is nonzero.
+ */
+void bufpool_get_stats(struct bufpool *bp, struct bufpool_stats *stats,
+		int reset);
+
+#endif
@@ -0,0 +1,527 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blocktrace.h"
+
+// Solve exactly up to this many partitions by default.
+#define DEFAULT_EXACT_LIMIT 64
+
+// Give up proving optimality after this many branch and bound nodes.
+#define EXACT_NODE_LIMIT 50000000LL
+
+// Capacity units for the approximate dynamic program.
+#define DEFAULT_RESOLUTION 100000
+
+#define USAGE \
+"usage: cache-planner [options] <manifest> <budget bytes>\n" \
+"\n" \
+"Chooses the partitions to cache in a memory budget so as to maximize the\n" \
+"bytes that are read from cache, and prints the hdfs cacheadmin directives\n" \
+"that cache them.  The manifest has one partition per line, as\n" \
+"\"<name> <bytes> [<path>]\", like the partitions.txt that\n" \
+"create-partitions.sh writes; the path defaults to the name.\n" \
+"\n" \
+"How often each partition is read comes from block traces (-t), whose\n" \
+"file names are matched against the paths, and from access logs (-a),\n" \
+"with one \"<name or path> <scans>\" line per query that scanned a\n" \
+"partition that many times.  With neither, every partition is assumed to\n" \
+"be read once, which just fills the budget.\n" \
+"\n" \
+"This is a 0/1 knapsack: up to -e partitions it is solved exactly by\n" \
+"branch and bound; beyond that, by dynamic programming over sizes rounded\n" \
+"up to 1/-r of the budget, so the plan always fits.\n" \
+"\n" \
+"options:\n" \
+"  -t <trace>   count the bytes read per file in a block trace; may be\n" \
+"               repeated\n" \
+"  -a <log>     add scan counts from an access log; may be repeated\n" \
+"  -e <count>   largest problem to solve exactly (default 64)\n" \
+"  -r <units>   capacity units for the approximation (default 100000)\n" \
+"  -P <pool>    cache pool for the directives (default pool1)\n" \
+"  -R <count>   cache replication; each partition costs its size times\n" \
+"               this much of the budget (default 1)\n"
+
+struct partition {
+	char *name;
+	char *path;
+	long long bytes;
+
+	// Bytes of budget it takes to cache
+	long long cost;
+
+	// Expected bytes read from the partition, all of which would be
+	// cache hits if it were cached
+	double value;
+
+	int chosen;
+};
+
+struct planner {
+	struct partition *parts;
+	int num_parts;
+	long long budget;
+	int replication;
+
+	// Partition indexes by decreasing value per byte
+	int *order;
+
+	// Branch and bound state
+	char *take;
+	char *best_take;
+	double best_value;
+	long long nodes;
+};
+
+static int planner_add(struct planner *pl, const char *name, long long bytes,
+		const char *path)
+{
+	struct partition *parts, *part;
+
+	parts = realloc(pl->parts, (pl->num_parts + 1) * sizeof(*parts));
+	if (!parts)
+		return ENOMEM;
+	pl->parts = parts;
+	part = &pl->parts[pl->num_parts];
+	memset(part, 0, sizeof(*part));
+	part->name = strdup(name);
+	part->path = strdup(path);
+	if (!part->name || !part->path) {
+		free(part->name);
+		free(part->path);
+		return ENOMEM;
+	}
+	part->bytes = bytes;
+	pl->num_parts++;
+	return 0;
+}
+
+static int load_manifest(struct planner *pl, const char *file)
+{
+	char line[4096], name[2048], path[2048];
+	long long bytes;
+	int n, lineno = 0, ret = 0;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		ret = errno;
+		fprintf(stderr, "failed to open %s: error %d (%s)\n", file,
+			ret, strerror(ret));
+		return ret;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		n = sscanf(line, "%2047s %lld %2047s", name, &bytes, path);
+		if ((n <= 0) || (name[0] == '#'))
+			continue;
+		if ((n < 2) || (bytes < 0)) {
+			fprintf(stderr, "%s:%d: expected \"<name> <bytes> "
+				"[<path>]\"\n", file, lineno);
+			ret = EINVAL;
+			break;
+		}
+		ret = planner_add(pl, name, bytes, (n == 3) ? path : name);
+		if (ret)
+			break;
+	}
+	fclose(fp);
+	if (!ret && (pl->num_parts == 0)) {
+		fprintf(stderr, "%s lists no partitions\n", file);
+		ret = EINVAL;
+	}
+	return ret;
+}
+
+static struct partition *find_partition(struct planner *pl, const char *key)
+{
+	int i;
+
+	for (i = 0; i < pl->num_parts; i++) {
+		if (!strcmp(pl->parts[i].path, key) ||
+				!strcmp(pl->parts[i].name, key))
+			return &pl->parts[i];
+	}
+	return NULL;
+}
+
+static int load_access_log(struct planner *pl, const char *file)
+{
+	char line[4096], key[2048];
+	struct partition *part;
+	double scans;
+	int lineno = 0, unmatched = 0, ret = 0;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		ret = errno;
+		fprintf(stderr, "failed to open %s: error %d (%s)\n", file,
+			ret, strerror(ret));
+		return ret;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if (sscanf(line, "%2047s %lf", key, &scans) != 2) {
+			if ((sscanf(line, "%2047s", key) == 1) &&
+					(key[0] != '#')) {
+				fprintf(stderr, "%s:%d: expected \"<name or "
+					"path> <scans>\"\n", file, lineno);
+				ret = EINVAL;
+				break;
+			}
+			continue;
+		}
+		part = find_partition(pl, key);
+		if (!part) {
+			unmatched++;
+			continue;
+		}
+		part->value += scans * part->bytes;
+	}
+	fclose(fp);
+	if (unmatched) {
+		fprintf(stderr, "%s: %d lines named no partition in the "
+			"manifest\n", file, unmatched);
+	}
+	return ret;
+}
+
+static int load_trace(struct planner *pl, const char *file)
+{
+	struct blocktrace_log *log;
+	struct partition **parts;
+	uint32_t f, unmatched = 0;
+	long long i;
+	int ret;
+
+	ret = blocktrace_load(file, NULL, NULL, &log);
+	if (ret)
+		return ret;
+	parts = calloc(log->num_files ? log->num_files : 1, sizeof(*parts));
+	if (!parts) {
+		blocktrace_log_free(log);
+		return ENOMEM;
+	}
+	for (f = 0; f < log->num_files; f++) {
+		parts[f] = find_partition(pl, log->files[f]);
+		if (!parts[f])
+			unmatched++;
+	}
+	for (i = 0; i < log->num_recs; i++) {
+		if (parts[log->recs[i].file])
+			parts[log->recs[i].file]->value += log->recs[i].length;
+	}
+	if (unmatched) {
+		fprintf(stderr, "%s: %u of %u traced files are not in the "
+			"manifest\n", file, unmatched, log->num_files);
+	}
+	free(parts);
+	blocktrace_log_free(log);
+	return 0;
+}
+
+static struct planner *g_sort_planner;
+
+static int compare_density(const void *a, const void *b)
+{
+	const struct partition *pa = &g_sort_planner->parts[*(const int *)a];
+	const struct partition *pb = &g_sort_planner->parts[*(const int *)b];
+	double da, db;
+
+	// Free partitions go first, then by value per byte of budget.
+	da = pa->cost ? pa->value / pa->cost : INFINITY;
+	db = pb->cost ? pb->value / pb->cost : INFINITY;
+	if (da != db)
+		return (da > db) ? -1 : 1;
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * Upper bound on the value reachable from position k of the density order,
+ * with room bytes of budget left: the fractional knapsack.
+ */
+static double bound(const struct planner *pl, int k, long long room)
+{
+	const struct partition *part;
+	double value = 0;
+
+	for (; k < pl->num_parts; k++) {
+		part = &pl->parts[pl->order[k]];
+		if (part->cost <= room) {
+			room -= part->cost;
+			value += part->value;
+		} else {
+			value += part->value * ((double)room / part->cost);
+			break;
+		}
+	}
+	return value;
+}
+
+static void branch(struct planner *pl, int k, long long room, double value)
+{
+	const struct partition *part;
+
+	if (++pl->nodes > EXACT_NODE_LIMIT)
+		return;
+	if (value > pl->best_value) {
+		pl->best_value = value;
+		memcpy(pl->best_take, pl->take, pl->num_parts);
+	}
+	if ((k == pl->num_parts) ||
+			(value + bound(pl, k, room) <= pl->best_value))
+		return;
+	part = &pl->parts[pl->order[k]];
+	if (part->cost <= room) {
+		pl->take[k] = 1;
+		branch(pl, k + 1, room - part->cost, value + part->value);
+		pl->take[k] = 0;
+	}
+	branch(pl, k + 1, room, value);
+}
+
+/*
+ * Solve exactly by depth-first branch and bound, taking partitions in
+ * density order.  Returns 0 if optimality was proven, or ETIMEDOUT if the
+ * node limit cut the search short.
+ */
+static int solve_exact(struct planner *pl)
+{
+	int k;
+
+	pl->take = calloc(pl->num_parts, 1);
+	pl->best_take = calloc(pl->num_parts, 1);
+	if (!pl->take || !pl->best_take)
+		return ENOMEM;
+	pl->best_value = -1;
+	branch(pl, 0, pl->budget, 0);
+	for (k = 0; k < pl->num_parts; k++)
+		pl->parts[pl->order[k]].chosen = pl->best_take[k];
+	return (pl->nodes > EXACT_NODE_LIMIT) ? ETIMEDOUT : 0;
+}
+
+/*
+ * Solve approximately by dynamic programming over costs rounded up to
+ * units of budget / resolution.  Rounding up keeps every plan within the
+ * budget; the price is at most one unit of unused budget per partition.
+ */
+static int solve_approx(struct planner *pl, long long resolution)
+{
+	long long unit, cap, w, c, n = pl->num_parts;
+	uint8_t *take;
+	double *best;
+	int i;
+
+	unit = (pl->budget + resolution - 1) / resolution;
+	if (unit < 1)
+		unit = 1;
+	cap = pl->budget / unit;
+	best = calloc(cap + 1, sizeof(double));
+	take = calloc(n * ((cap + 8) / 8), 1);
+	if (!best || !take) {
+		free(best);
+		free(take);
+		return ENOMEM;
+	}
+	for (i = 0; i < n; i++) {
+		c = (pl->parts[i].cost + unit - 1) / unit;
+		for (w = cap; w >= c; w--) {
+			if (best[w - c] + pl->parts[i].value > best[w]) {
+				best[w] = best[w - c] + pl->parts[i].value;
+				take[i * ((cap + 8) / 8) + w / 8] |=
+					1 << (w % 8);
+			}
+		}
+	}
+	for (w = cap, i = n - 1; i >= 0; i--) {
+		if (take[i * ((cap + 8) / 8) + w / 8] & (1 << (w % 8))) {
+			pl->parts[i].chosen = 1;
+			w -= (pl->parts[i].cost + unit - 1) / unit;
+		}
+	}
+	free(best);
+	free(take);
+	return 0;
+}
+
+/*
+ * Value of CacheTool.cache(): walk the partitions newest first, which is
+ * last first in the manifest, and stop at the first that doesn't fit.
+ */
+static double cachetool_value(const struct planner *pl, long long *bytes)
+{
+	double value = 0;
+	long long cost = 0;
+	int i;
+
+	*bytes = 0;
+	for (i = pl->num_parts - 1; i >= 0; i--) {
+		if (cost + pl->parts[i].cost > pl->budget)
+			break;
+		cost += pl->parts[i].cost;
+		*bytes += pl->parts[i].bytes;
+		value += pl->parts[i].value;
+	}
+	return value;
+}
+
+static void planner_free(struct planner *pl)
+{
+	int i;
+
+	for (i = 0; i < pl->num_parts; i++) {
+		free(pl->parts[i].name);
+		free(pl->parts[i].path);
+	}
+	free(pl->parts);
+	free(pl->order);
+	free(pl->take);
+	free(pl->best_take);
+}
+
+/*
+ * Parse a positive count no bigger than max.  Returns 0 on success, or 1
+ * after printing why str is invalid.
+ */
+static int parse_count(const char *str, const char *what, long long max,
+		long long *out)
+{
+	char *end;
+
+	errno = 0;
+	*out = strtoll(str, &end, 10);
+	if ((end == str) || *end || errno || (*out < 1) || (*out > max)) {
+		fprintf(stderr, "invalid %s %s: it must be a positive "
+			"integer no bigger than %lld.\n" USAGE, what, str, max);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct planner pl;
+	const char *pool = "pool1", *method;
+	long long resolution = DEFAULT_RESOLUTION, bytes = 0, ct_bytes;
+	long long exact_limit = DEFAULT_EXACT_LIMIT, replication;
+	double value = 0, total = 0, ct_value;
+	int c, i, have_counts = 0;
+	int count = 0, ret = 1;
+
+	memset(&pl, 0, sizeof(pl));
+	pl.replication = 1;
+	// The manifest has to be loaded before the counts can be matched to
+	// it, so find it first.
+	while ((c = getopt(argc, argv, "t:a:e:r:P:R:")) != -1) {
+		switch (c) {
+		case 't':
+		case 'a':
+			have_counts = 1;
+			break;
+		case 'e':
+			if (parse_count(optarg, "exact limit", INT_MAX,
+					&exact_limit))
+				return 1;
+			break;
+		case 'r':
+			if (parse_count(optarg, "resolution", LLONG_MAX,
+					&resolution))
+				return 1;
+			break;
+		case 'P':
+			pool = optarg;
+			break;
+		case 'R':
+			if (parse_count(optarg, "replication", INT_MAX,
+					&replication))
+				return 1;
+			pl.replication = replication;
+			break;
+		default:
+			fprintf(stderr, USAGE);
+			return 1;
+		}
+	}
+	if (argc - optind != 2) {
+		fprintf(stderr, USAGE);
+		return 1;
+	}
+	pl.budget = atoll(argv[optind + 1]);
+	if (pl.budget <= 0) {
+		fprintf(stderr, "invalid budget %s\n" USAGE, argv[optind + 1]);
+		return 1;
+	}
+	if (load_manifest(&pl, argv[optind]))
+		goto done;
+	optind = 1;
+	while ((c = getopt(argc, argv, "t:a:e:r:P:R:")) != -1) {
+		if ((c == 't') && load_trace(&pl, optarg))
+			goto done;
+		if ((c == 'a') && load_access_log(&pl, optarg))
+			goto done;
+	}
+	pl.order = malloc(pl.num_parts * sizeof(int));
+	if (!pl.order)
+		goto done;
+	for (i = 0; i < pl.num_parts; i++) {
+		pl.parts[i].cost = pl.parts[i].bytes * pl.replication;
+		if (!have_counts)
+			pl.parts[i].value = pl.parts[i].bytes;
+		total += pl.parts[i].value;
+		pl.order[i] = i;
+	}
+	g_sort_planner = &pl;
+	qsort(pl.order, pl.num_parts, sizeof(int), compare_density);
+	if (pl.num_parts <= exact_limit) {
+		ret = solve_exact(&pl);
+		if (ret == ENOMEM)
+			goto done;
+		method = ret ? "best found before the node limit" :
+			"solved exactly";
+	} else {
+		if (solve_approx(&pl, resolution))
+			goto done;
+		method = "approximated";
+	}
+	for (i = 0; i < pl.num_parts; i++) {
+		if (!pl.parts[i].chosen)
+			continue;
+		count++;
+		bytes += pl.parts[i].bytes;
+		value += pl.parts[i].value;
+	}
+	ct_value = cachetool_value(&pl, &ct_bytes);
+	printf("# %d partitions, %s: caching %d partitions, %lld bytes, of "
+		"a %lld-byte budget\n", pl.num_parts, method, count, bytes,
+		pl.budget);
+	printf("# expected cached-byte hits: %.6g of %.6g (%.2f%%); at most "
+		"%.6g\n", value, total, total ? 100 * value / total : 0.0,
+		bound(&pl, 0, pl.budget));
+	printf("# CacheTool's newest-first walk: %lld bytes, %.6g hits "
+		"(%.2f%%)\n", ct_bytes, ct_value,
+		total ? 100 * ct_value / total : 0.0);
+	for (i = 0; i < pl.num_parts; i++) {
+		if (!pl.parts[i].chosen)
+			continue;
+		printf("hdfs cacheadmin -addDirective -pool %s -path %s", pool,
+			pl.parts[i].path);
+		if (pl.replication > 1)
+			printf(" -replication %d", pl.replication);
+		printf("\n");
+	}
+	ret = 0;
+done:
+	planner_free(&pl);
+	return ret;
+}
@@ -0,0 +1,335 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blockcache.h"
+#include "shardcache.h"
+#include "util.h"
+
+#define USAGE \
+"usage: cachebench [options]\n" \
+"\n" \
+"Measures how block cache lookups scale with threads.  Each thread looks\n" \
+"up blocks of a table, most of them from a hot set, reads part of every\n" \
+"block it finds, and inserts every block it doesn't, for a fixed time.\n" \
+"This runs at 1, 2, 4, ... threads up to the maximum, against two caches:\n" \
+"\n" \
+"  global   the block cache, with CLOCK replacement, behind one mutex that\n" \
+"           is held through each lookup, read and insert\n" \
+"  sharded  the sharded cache, with lock-free lookups and pinned reads\n" \
+"\n" \
+"options:\n" \
+"  -t <threads>  most threads to run (default 64)\n" \
+"  -S <shards>   shards in the sharded cache, a power of two (default 64)\n" \
+"  -n <blocks>   number of blocks in the table (default 16384)\n" \
+"  -c <blocks>   cache capacity in blocks (default 4096)\n" \
+"  -b <bytes>    block size (default 65536)\n" \
+"  -r <bytes>    bytes of each hit to read (default 4096)\n" \
+"  -H <frac>     fraction of the table in the hot set (default 0.1)\n" \
+"  -q <frac>     fraction of lookups from the hot set (default 0.9)\n" \
+"  -d <seconds>  how long each run lasts (default 1)\n"
+
+#define MAX_THREADS 1024
+
+enum bench_cache {
+	BENCH_GLOBAL = 0,
+	BENCH_SHARDED,
+	BENCH_MAX,
+};
+
+static const char * const BENCH_CACHE_NAMES[] = {
+	[BENCH_GLOBAL] = "global",
+	[BENCH_SHARDED] = "sharded",
+};
+
+struct bench_opts {
+	int max_threads;
+	int num_shards;
+	long long num_blocks;
+	long long cache_blocks;
+	int block_size;
+	int read_bytes;
+	double hot_fraction;
+	double hot_share;
+	double seconds;
+};
+
+struct bench {
+	const struct bench_opts *opts;
+	enum bench_cache type;
+	struct blockcache *bc;
+	pthread_mutex_t bc_lock;
+	struct shardcache *sc;
+
+	// Set by the main thread to start and stop the workers
+	int go;
+	int stop;
+};
+
+struct bench_worker {
+	struct bench *bench;
+	pthread_t thread;
+	uint64_t rng;
+
+	// The block a miss "reads", which is then inserted
+	char *buf;
+
+	long long lookups;
+	long long hits;
+
+	// Keeps the reads from being optimized away
+	uint64_t sum;
+} __attribute__((aligned(64)));
+
+/*
+ * Pick the next block: the hot set is the last hot blocks of the table, as
+ * in cachesim.
+ */
+static uint64_t next_block(const struct bench_opts *opts, uint64_t *rng,
+		uint64_t threshold, long long hot)
+{
+	long long cold = opts->num_blocks - hot;
+
+	if ((cold == 0) || (splitmix64_next(rng) < threshold))
+		return cold + (splitmix64_next(rng) % hot);
+	return splitmix64_next(rng) % cold;
+}
+
+static uint64_t read_block(const char *block, int len)
+{
+	uint64_t sum = 0, v;
+	int i;
+
+	for (i = 0; i + (int)sizeof(v) <= len; i += sizeof(v)) {
+		memcpy(&v, block + i, sizeof(v));
+		sum += v;
+	}
+	return sum;
+}
+
+static void *bench_worker_run(void *arg)
+{
+	struct bench_worker *w = arg;
+	struct bench *b = w->bench;
+	const struct bench_opts *opts = b->opts;
+	uint64_t threshold = opts->hot_share * 18446744073709551615.0, id;
+	long long hot = opts->num_blocks * opts->hot_fraction;
+	int read_len = opts->read_bytes, len;
+	const char *block;
+
+	if (hot < 1)
+		hot = 1;
+	if (read_len > opts->block_size)
+		read_len = opts->block_size;
+	while (!__atomic_load_n(&b->go, __ATOMIC_ACQUIRE))
+		;
+	while (!__atomic_load_n(&b->stop, __ATOMIC_RELAXED)) {
+		id = next_block(opts, &w->rng, threshold, hot);
+		w->lookups++;
+		if (b->type == BENCH_GLOBAL) {
+			pthread_mutex_lock(&b->bc_lock);
+			block = blockcache_lookup(b->bc, id, &len);
+			if (block) {
+				w->hits++;
+				w->sum += read_block(block, read_len);
+			} else {
+				blockcache_insert(b->bc, id, w->buf,
+					opts->block_size);
+			}
+			pthread_mutex_unlock(&b->bc_lock);
+			continue;
+		}
+		block = shardcache_pin(b->sc, id, &len);
+		if (block) {
+			w->hits++;
+			w->sum += read_block(block, read_len);
+			shardcache_unpin(b->sc, block);
+		} else {
+			shardcache_insert(b->sc, id, w->buf, opts->block_size);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Run one cache at one thread count, and print a line for it.  Returns 0 on
+ * success, or an errno value on failure.
+ */
+static int run(const struct bench_opts *opts, enum bench_cache type,
+		int num_threads)
+{
+	struct bench b;
+	struct bench_worker *workers;
+	struct shardcache_stats ss;
+	long long lookups = 0, hits = 0, retries = 0, busy = 0;
+	double start, secs;
+	struct timespec ts;
+	int i, started = 0, ret;
+
+	memset(&b, 0, sizeof(b));
+	b.opts = opts;
+	b.type = type;
+	pthread_mutex_init(&b.bc_lock, NULL);
+	workers = calloc(num_threads, sizeof(*workers));
+	if (!workers)
+		return ENOMEM;
+	if (type == BENCH_GLOBAL) {
+		ret = blockcache_create(opts->cache_blocks * opts->block_size,
+			opts->block_size, 0, CACHE_POLICY_CLOCK, &b.bc);
+	} else {
+		ret = shardcache_create(opts->cache_blocks * opts->block_size,
+			opts->block_size, opts->num_shards, &b.sc);
+	}
+	if (ret)
+		goto done;
+	for (i = 0; i < num_threads; i++) {
+		workers[i].bench = &b;
+		workers[i].rng = i + 1;
+		workers[i].buf = malloc(opts->block_size);
+		if (!workers[i].buf) {
+			ret = ENOMEM;
+			goto done;
+		}
+		memset(workers[i].buf, i, opts->block_size);
+	}
+	for (; started < num_threads; started++) {
+		ret = pthread_create(&workers[started].thread, NULL,
+			bench_worker_run, &workers[started]);
+		if (ret) {
+			fprintf(stderr, "failed to create thread %d: error %d "
+				"(%s)\n", started, ret, strerror(ret));
+			break;
+		}
+	}
+	start = monotonic_seconds();
+	__atomic_store_n(&b.go, 1, __ATOMIC_RELEASE);
+	if (!ret) {
+		ts.tv_sec = opts->seconds;
+		ts.tv_nsec = (opts->seconds - ts.tv_sec) * 1e9;
+		while (nanosleep(&ts, &ts) && (errno == EINTR))
+			;
+	}
+	__atomic_store_n(&b.stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < started; i++)
+		pthread_join(workers[i].thread, NULL);
+	secs = monotonic_seconds() - start;
+	if (ret)
+		goto done;
+	for (i = 0; i < num_threads; i++) {
+		lookups += workers[i].lookups;
+		hits += workers[i].hits;
+	}
+	if (type == BENCH_SHARDED) {
+		shardcache_get_stats(b.sc, &ss);
+		retries = ss.retries;
+		busy = ss.busy;
+	}
+	printf("%7d  %-8s  %12.4g  %12.1f  %9.4f  %10lld  %8lld\n",
+		num_threads, BENCH_CACHE_NAMES[type], lookups / secs / 1e6,
+		secs * num_threads * 1e9 / (lookups ? lookups : 1),
+		lookups ? (double)hits / lookups : 0.0, retries, busy);
+done:
+	for (i = 0; i < num_threads; i++)
+		free(workers[i].buf);
+	free(workers);
+	blockcache_free(b.bc);
+	shardcache_free(b.sc);
+	pthread_mutex_destroy(&b.bc_lock);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts opts;
+	int c, t, type;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.max_threads = 64;
+	opts.num_shards = 64;
+	opts.num_blocks = 16384;
+	opts.cache_blocks = 4096;
+	opts.block_size = 65536;
+	opts.read_bytes = 4096;
+	opts.hot_fraction = 0.1;
+	opts.hot_share = 0.9;
+	opts.seconds = 1;
+	while ((c = getopt(argc, argv, "t:S:n:c:b:r:H:q:d:")) != -1) {
+		switch (c) {
+		case 't':
+			opts.max_threads = atoi(optarg);
+			break;
+		case 'S':
+			opts.num_shards = atoi(optarg);
+			break;
+		case 'n':
+			opts.num_blocks = atoll(optarg);
+			break;
+		case 'c':
+			opts.cache_blocks = atoll(optarg);
+			break;
+		case 'b':
+			opts.block_size = atoi(optarg);
+			break;
+		case 'r':
+			opts.read_bytes = atoi(optarg);
+			break;
+		case 'H':
+			opts.hot_fraction = atof(optarg);
+			break;
+		case 'q':
+			opts.hot_share = atof(optarg);
+			break;
+		case 'd':
+			opts.seconds = atof(optarg);
+			break;
+		default:
+			fprintf(stderr, USAGE);
+			return 1;
+		}
+	}
+	if (optind != argc) {
+		fprintf(stderr, USAGE);
+		return 1;
+	}
+	if ((opts.max_threads < 1) || (opts.max_threads > MAX_THREADS) ||
+			(opts.num_blocks < 1) || (opts.cache_blocks < 1) ||
+			(opts.block_size < 1) || (opts.read_bytes < 0) ||
+			(opts.seconds <= 0)) {
+		fprintf(stderr, "invalid options.\n" USAGE);
+		return 1;
+	}
+	if ((opts.hot_fraction <= 0) || (opts.hot_fraction > 1) ||
+			(opts.hot_share < 0) || (opts.hot_share > 1)) {
+		fprintf(stderr, "-H and -q take fractions between 0 and 1.\n"
+			USAGE);
+		return 1;
+	}
+	printf("%lld blocks of %d bytes, %lld cached, %lld hot, %d shards, "
+		"%d bytes read per hit\n", opts.num_blocks, opts.block_size,
+		opts.cache_blocks,
+		(long long)(opts.num_blocks * opts.hot_fraction),
+		opts.num_shards, opts.read_bytes);
+	printf("%7s  %-8s  %12s  %12s  %9s  %10s  %8s\n", "threads", "cache",
+		"M lookups/s", "ns/lookup", "hit ratio", "retries", "busy");
+	for (t = 1; ; t *= 2) {
+		if (t > opts.max_threads)
+			t = opts.max_threads;
+		for (type = 0; type < BENCH_MAX; type++) {
+			if (run(&opts, type, t))
+				return 1;
+		}
+		if (t == opts.max_threads)
+			break;
+	}
+	return 0;
+}
@@ -0,0 +1,1035 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#include "cachepolicy.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define CP_NIL (-1)
+
+// Which of a node's two sets of links a list threads through.  Only LIRS
+// keeps nodes on two lists at once.
+#define CP_LINK_MAIN 0
+#define CP_LINK_AUX 1
+
+#define CP_MAX_LISTS 4
+
+// LIRS node states.
+#define LIRS_LIR 0
+#define LIRS_HIR_RESIDENT 1
+#define LIRS_HIR_NONRESIDENT 2
+
+// Node flags.
+#define CP_IN_STACK 0x1
+#define CP_IN_QUEUE 0x2
+#define CP_REFERENCED 0x4
+
+#define S3FIFO_MAX_FREQ 3
+#define WTINYLFU_MAX_COUNT 15
+#define WTINYLFU_ROWS 4
+
+static const char * const CACHE_POLICY_NAMES[CACHE_POLICY_MAX] = {
+	[CACHE_POLICY_NONE] = "none",
+	[CACHE_POLICY_LRU] = "lru",
+	[CACHE_POLICY_CLOCK] = "clock",
+	[CACHE_POLICY_ARC] = "arc",
+	[CACHE_POLICY_2Q] = "2q",
+	[CACHE_POLICY_LIRS] = "lirs",
+	[CACHE_POLICY_S3FIFO] = "s3fifo",
+	[CACHE_POLICY_WTINYLFU] = "wtinylfu",
+};
+
+struct cp_node {
+	uint64_t id;
+	int32_t prev[2];
+	int32_t next[2];
+
+	// Which list the node's main links are on
+	uint8_t list;
+
+	// LIRS state, or S3-FIFO frequency
+	uint8_t state;
+	uint8_t flags;
+};
+
+struct cp_list {
+	int32_t head;
+	int32_t tail;
+	long long len;
+	int link;
+};
+
+struct cache_policy {
+	enum cache_policy_type type;
+	long long capacity;
+
+	// Number of resident blocks
+	long long resident;
+
+	struct cp_node *nodes;
+	int32_t max_nodes;
+	int32_t *free_nodes;
+	int32_t num_free;
+
+	// Nodes by block id
+	struct idtable table;
+
+	struct cp_list lists[CP_MAX_LISTS];
+
+	// Policy-specific sizes: ARC's target for T1; 2Q's Kin and Kout;
+	// LIRS's LIR capacity; S3-FIFO's small queue size; W-TinyLFU's
+	// window and protected segment sizes.
+	long long target;
+	long long target2;
+
+	// CLOCK hand
+	int32_t hand;
+
+	// LIRS LIR count
+	long long num_lir;
+
+	// W-TinyLFU count-min sketch
+	uint8_t *sketch;
+	uint64_t sketch_mask;
+	long long sketch_adds;
+	long long sketch_period;
+};
+
+static int32_t cp_lookup(const struct cache_policy *cp, uint64_t id)
+{
+	int64_t n = cp->table.buckets[idtable_find(&cp->table, id)];
+
+	return (n == IDTABLE_EMPTY) ? CP_NIL : n;
+}
+
+static int32_t cp_node_alloc(struct cache_policy *cp, uint64_t id)
+{
+	int32_t n = cp->free_nodes[--cp->num_free];
+
+	memset(&cp->nodes[n], 0, sizeof(cp->nodes[n]));
+	cp->nodes[n].id = id;
+	cp->table.buckets[idtable_find(&cp->table, id)] = n;
+	return n;
+}
+
+static void cp_node_free(struct cache_policy *cp, int32_t n)
+{
+	idtable_remove(&cp->table, idtable_find(&cp->table, cp->nodes[n].id));
+	cp->free_nodes[cp->num_free++] = n;
+}
+
+static void cp_list_init(struct cache_policy *cp, int l, int link)
+{
+	cp->lists[l].head = cp->lists[l].tail = CP_NIL;
+	cp->lists[l].len = 0;
+	cp->lists[l].link = link;
+}
+
+static void cp_push_head(struct cache_policy *cp, int l, int32_t n)
+{
+	struct cp_list *list = &cp->lists[l];
+	struct cp_node *node = &cp->nodes[n];
+	int k = list->link;
+
+	node->prev[k] = CP_NIL;
+	node->next[k] = list->head;
+	if (list->head != CP_NIL)
+		cp->nodes[list->head].prev[k] = n;
+	else
+		list->tail = n;
+	list->head = n;
+	list->len++;
+	if (k == CP_LINK_MAIN)
+		node->list = l;
+}
+
+static void cp_remove(struct cache_policy *cp, int l, int32_t n)
+{
+	struct cp_list *list = &cp->lists[l];
+	struct cp_node *node = &cp->nodes[n];
+	int k = list->link;
+
+	if (node->prev[k] != CP_NIL)
+		cp->nodes[node->prev[k]].next[k] = node->next[k];
+	else
+		list->head = node->next[k];
+	if (node->next[k] != CP_NIL)
+		cp->nodes[node->next[k]].prev[k] = node->prev[k];
+	else
+		list->tail = node->prev[k];
+	list->len--;
+}
+
+static void cp_move_head(struct cache_policy *cp, int from, int to, int32_t n)
+{
+	cp_remove(cp, from, n);
+	cp_push_head(cp, to, n);
+}
+
+/*
+ * Pop the tail of a list, and free its node.  Returns the id.
+ */
+static uint64_t cp_drop_tail(struct cache_policy *cp, int l)
+{
+	int32_t n = cp->lists[l].tail;
+	uint64_t id = cp->nodes[n].id;
+
+	cp_remove(cp, l, n);
+	cp_node_free(cp, n);
+	return id;
+}
+
+/****************************** none ******************************/
+
+/*
+ * The list is only there so that a forced eviction can hand back the
+ * newest block: none never gives up a block it has kept.
+ */
+#define NONE_LIST 0
+
+static int none_access(struct cache_policy *cp, uint64_t id, uint64_t *victim)
+{
+	if (cp_lookup(cp, id) != CP_NIL)
+		return CACHE_POLICY_HIT;
+	if (cp->resident == cp->capacity)
+		return CACHE_POLICY_MISS_BYPASS;
+	cp_push_head(cp, NONE_LIST, cp_node_alloc(cp, id));
+	cp->resident++;
+	return CACHE_POLICY_MISS;
+}
+
+static int none_evict(struct cache_policy *cp, uint64_t *victim)
+{
+	int32_t n = cp->lists[NONE_LIST].head;
+
+	if (n == CP_NIL)
+		return 0;
+	*victim = cp->nodes[n].id;
+	cp_remove(cp, NONE_LIST, n);
+	cp_node_free(cp, n);
+	cp->resident--;
+	return 1;
+}
+
+/****************************** LRU ******************************/
+
+#define LRU_LIST 0
+
+static int lru_access(struct cache_policy *cp, uint64_t id, uint64_t *victim)
+{
+	int32_t n = cp_lookup(cp, id);
+	int ret = CACHE_POLICY_MISS;
+
+	if (n != CP_NIL) {
+		cp_move_head(cp, LRU_LIST, LRU_LIST, n);
+		return CACHE_POLICY_HIT;
+	}
+	if (cp->lists[LRU_LIST].len == cp->capacity) {
+		*victim = cp_drop_tail(cp, LRU_LIST);
+		ret = CACHE_POLICY_MISS_EVICT;
+	}
+	cp_push_head(cp, LRU_LIST, cp_node_alloc(cp, id));
+	return ret;
+}
+
+static int lru_evict(struct cache_policy *cp, uint64_t *victim)
+{
+	if (cp->lists[LRU_LIST].len == 0)
+		return 0;
+	*victim = cp_drop_tail(cp, LRU_LIST);
+	return 1;
+}
+
+/****************************** CLOCK ******************************/
+
+/*
+ * The nodes are the clock's slots, in order, so the hand just walks the
+ * node array.
+ */
+static int clock_access(struct cache_policy *cp, uint64_t id,
+		uint64_t *victim)
+{
+	int32_t n = cp_lookup(cp, id);
+	struct cp_node *node;
+
+	if (n != CP_NIL) {
+		cp->nodes[n].flags |= CP_REFERENCED;
+		return CACHE_POLICY_HIT;
+	}
+	if (cp->resident < cp->capacity) {
+		n = cp->resident++;
+		node = &cp->nodes[n];
+		node->id = id;
+		node->flags = 0;
+		cp->table.buckets[idtable_find(&cp->table, id)] = n;
+		return CACHE_POLICY_MISS;
+	}
+	while (cp->nodes[cp->hand].flags & CP_REFERENCED) {
+		cp->nodes[cp->hand].flags &= ~CP_REFERENCED;
+		if (++cp->hand == cp->capacity)
+			cp->hand = 0;
+	}
+	n = cp->hand;
+	node = &cp->nodes[n];
+	*victim = node->id;
+	idtable_remove(&cp->table, idtable_find(&cp->table, node->id));
+	node->id = id;
+	node->flags = 0;
+	cp->table.buckets[idtable_find(&cp->table, id)] = n;
+	if (++cp->hand == cp->capacity)
+		cp->hand = 0;
+	return CACHE_POLICY_MISS_EVICT;
+}
+
+/*
+ * Evict without a replacement: the last slot moves into the hole, so that
+ * the resident blocks stay in slots 0 to resident - 1.
+ */
+static int clock_evict(struct cache_policy *cp, uint64_t *victim)
+{
+	int32_t n, last;
+
+	if (cp->resident == 0)
+		return 0;
+	if (cp->hand >= cp->resident)
+		cp->hand = 0;
+	while (cp->nodes[cp->hand].flags & CP_REFERENCED) {
+		cp->nodes[cp->hand].flags &= ~CP_REFERENCED;
+		if (++cp->hand == cp->resident)
+			cp->hand = 0;
+	}
+	n = cp->hand;
+	*victim = cp->nodes[n].id;
+	idtable_remove(&cp->table, idtable_find(&cp->table, cp->nodes[n].id));
+	last = --cp->resident;
+	if (n != last) {
+		cp->nodes[n] = cp->nodes[last];
+		cp->table.buckets[idtable_find(&cp->table,
+			cp->nodes[n].id)] = n;
+	}
+	return 1;
+}
+
+/****************************** ARC ******************************/
+
+#define ARC_T1 0
+#define ARC_T2 1
+#define ARC_B1 2
+#define ARC_B2 3
+
+/*
+ * Evict the LRU block of T1 or T2 into the matching ghost list.  Returns
+ * nonzero if something was evicted.
+ */
+static int arc_evict_one(struct cache_policy *cp, int in_b2, uint64_t *victim)
+{
+	long long t1 = cp->lists[ARC_T1].len;
+	int32_t n;
+
+	if (t1 + cp->lists[ARC_T2].len == 0)
+		return 0;
+	if ((t1 >= 1) && ((t1 > cp->target) ||
+			(in_b2 && (t1 == cp->target)) ||
+			(cp->lists[ARC_T2].len == 0))) {
+		n = cp->lists[ARC_T1].tail;
+		cp_move_head(cp, ARC_T1, ARC_B1, n);
+	} else {
+		n = cp->lists[ARC_T2].tail;
+		cp_move_head(cp, ARC_T2, ARC_B2, n);
+	}
+	*victim = cp->nodes[n].id;
+	return 1;
+}
+
+/*
+ * Make room for one block, if the cache is full.
+ */
+static int arc_replace(struct cache_policy *cp, int in_b2, uint64_t *victim)
+{
+	if (cp->lists[ARC_T1].len + cp->lists[ARC_T2].len < cp->capacity)
+		return 0;
+	return arc_evict_one(cp, in_b2, victim);
+}
+
+static int arc_access(struct cache_policy *cp, uint64_t id, uint64_t *victim)
+{
+	int32_t n = cp_lookup(cp, id);
+	long long c = cp->capacity, b1, b2, total;
+	int evicted = 0;
+
+	b1 = cp->lists[ARC_B1].len;
+	b2 = cp->lists[ARC_B2].len;
+	if (n != CP_NIL) {
+		switch (cp->nodes[n].list) {
+		case ARC_T1:
+		case ARC_T2:
+			cp_move_head(cp, cp->nodes[n].list, ARC_T2, n);
+			return CACHE_POLICY_HIT;
+		case ARC_B1:
+			cp->target += (b2 > b1) ? (b2 / b1) : 1;
+			if (cp->target > c)
+				cp->target = c;
+			evicted = arc_replace(cp, 0, victim);
+			cp_move_head(cp, ARC_B1, ARC_T2, n);
+			break;
+		case ARC_B2:
+			cp->target -= (b1 > b2) ? (b1 / b2) : 1;
+			if (cp->target < 0)
+				cp->target = 0;
+			evicted = arc_replace(cp, 1, victim);
+			cp_move_head(cp, ARC_B2, ARC_T2, n);
+			break;
+		}
+		return evicted ? CACHE_POLICY_MISS_EVICT : CACHE_POLICY_MISS;
+	}
+	total = cp->lists[ARC_T1].len + cp->lists[ARC_T2].len + b1 + b2;
+	if (cp->lists[ARC_T1].len + b1 == c) {
+		if (cp->lists[ARC_T1].len < c) {
+			cp_drop_tail(cp, ARC_B1);
+			evicted = arc_replace(cp, 0, victim);
+		} else {
+			*victim = cp_drop_tail(cp, ARC_T1);
+			evicted = 1;
+		}
+	} else if (total >= c) {
+		if (total == 2 * c)
+			cp_drop_tail(cp, ARC_B2);
+		evicted = arc_replace(cp, 0, victim);
+	}
+	cp_push_head(cp, ARC_T1, cp_node_alloc(cp, id));
+	return evicted ? CACHE_POLICY_MISS_EVICT : CACHE_POLICY_MISS;
+}
+
+/****************************** 2Q ******************************/
+
+#define TWOQ_AM 0
+#define TWOQ_A1IN 1
+#define TWOQ_A1OUT 2
+
+/*
+ * Evict one resident block.  Returns nonzero if something was evicted.
+ * target is Kin and target2 is Kout.
+ */
+static int twoq_evict_one(struct cache_policy *cp, uint64_t *victim)
+{
+	int32_t n;
+
+	if (cp->lists[TWOQ_AM].len + cp->lists[TWOQ_A1IN].len == 0)
+		return 0;
+	if ((cp->lists[TWOQ_A1IN].len > cp->target) ||
+			(cp->lists[TWOQ_AM].len == 0)) {
+		n = cp->lists[TWOQ_A1IN].tail;
+		*victim = cp->nodes[n].id;
+		cp_move_head(cp, TWOQ_A1IN, TWOQ_A1OUT, n);
+		if (cp->lists[TWOQ_A1OUT].len > cp->target2)
+			cp_drop_tail(cp, TWOQ_A1OUT);
+	} else {
+		*victim = cp_drop_tail(cp, TWOQ_AM);
+	}
+	return 1;
+}
+
+/*
+ * Make room for one block, if the cache is full.
+ */
+static int twoq_reclaim(struct cache_policy *cp, uint64_t *victim)
+{
+	if (cp->lists[TWOQ_AM].len + cp->lists[TWOQ_A1IN].len < cp->capacity)
+		return 0;
+	return twoq_evict_one(cp, victim);
+}
+
+static int twoq_access(struct cache_policy *cp, uint64_t id, uint64_t *victim)
+{
+	int32_t n = cp_lookup(cp, id);
+	int evicted;
+
+	if (n != CP_NIL) {
+		switch (cp->nodes[n].list) {
+		case TWOQ_AM:
+			cp_move_head(cp, TWOQ_AM, TWOQ_AM, n);
+			return CACHE_POLICY_HIT;
+		case TWOQ_A1IN:
+			// A1in is a FIFO: a second access within it says
+			// nothing about long-term popularity.
+			return CACHE_POLICY_HIT;
+		}
+		// Take the block off A1out first, so that reclaiming can't
+		// push it out of the end.
+		cp_remove(cp, TWOQ_A1OUT, n);
+		evicted = twoq_reclaim(cp, victim);
+		cp_push_head(cp, TWOQ_AM, n);
+	} else {
+		evicted = twoq_reclaim(cp, victim);
+		cp_push_head(cp, TWOQ_A1IN, cp_node_alloc(cp, id));
+	}
+	return evicted ? CACHE_POLICY_MISS_EVICT : CACHE_POLICY_MISS;
+}
+
+/****************************** LIRS ******************************/
+
+/*
+ * The stack S holds LIR blocks and recently seen HIR blocks, resident or
+ * not, on the main links.  The queue Q holds the resident HIR blocks on
+ * the auxiliary links, and the list N holds the non-resident ones there, in
+ * the order they were evicted.  target is the LIR capacity.
+ */
+#define LIRS_S 0
+#define LIRS_Q 1
+#define LIRS_N 2
+
+static void lirs_stack_remove(struct cache_policy *cp, int32_t n)
+{
+	cp_remove(cp, LIRS_S, n);
+	cp->nodes[n].flags &= ~CP_IN_STACK;
+	if (cp->nodes[n].state == LIRS_HIR_NONRESIDENT) {
+		cp_remove(cp, LIRS_N, n);
+		cp_node_free(cp, n);
+	}
+}
+
+static void lirs_stack_push(struct cache_policy *cp, int32_t n)
+{
+	if (cp->nodes[n].flags & CP_IN_STACK)
+		cp_remove(cp, LIRS_S, n);
+	cp_push_head(cp, LIRS_S, n);
+	cp->nodes[n].flags |= CP_IN_STACK;
+}
+
+static void lirs_queue_remove(struct cache_policy *cp, int32_t n)
+{
+	cp_remove(cp, LIRS_Q, n);
+	cp->nodes[n].flags &= ~CP_IN_QUEUE;
+}
+
+static void lirs_queue_push(struct cache_policy *cp, int32_t n)
+{
+	if (cp->nodes[n].flags & CP_IN_QUEUE)
+		cp_remove(cp, LIRS_Q, n);
+	cp_push_head(cp, LIRS_Q, n);
+	cp->nodes[n].flags |= CP_IN_QUEUE;
+}
+
+/*
+ * Pop HIR blocks off the bottom of the stack until an LIR block is there.
+ */
+static void lirs_prune(struct cache_policy *cp)
+{
+	int32_t n;
+
+	while ((n = cp->lists[LIRS_S].tail) != CP_NIL &&
+			(cp->nodes[n].state != LIRS_LIR))
+		lirs_stack_remove(cp, n);
+}
+
+/*
+ * Turn the bottom LIR block into a resident HIR block.
+ */
+static void lirs_demote_bottom(struct cache_policy *cp)
+{
+	int32_t n = cp->lists[LIRS_S].tail;
+
+	cp->nodes[n].state = LIRS_HIR_RESIDENT;
+	cp->num_lir--;
+	lirs_stack_remove(cp, n);
+	lirs_queue_push(cp, n);
+	lirs_prune(cp);
+}
+
+/*
+ * Demote the bottom LIR block, if there are too many LIR blocks.
+ */
+static void lirs_demote(struct cache_policy *cp)
+{
+	if (cp->num_lir > cp->target)
+		lirs_demote_bottom(cp);
+}
+
+/*
+ * Evict the oldest resident HIR block.  Returns its id.
+ */
+static uint64_t lirs_evict_hir(struct cache_policy *cp)
+{
+	int32_t v = cp->lists[LIRS_Q].tail;
+	uint64_t id = cp->nodes[v].id;
+
+	lirs_queue_remove(cp, v);
+	cp->nodes[v].state = LIRS_HIR_NONRESIDENT;
+	if (cp->nodes[v].flags & CP_IN_STACK)
+		cp_push_head(cp, LIRS_N, v);
+	else
+		cp_node_free(cp, v);
+	cp->resident--;
+	return id;
+}
+
+/*
+ * Free the oldest non-resident HIR block, so that the stack can't grow
+ * without bound during a long scan.
+ */
+static void lirs_trim(struct cache_policy *cp)
+{
+	int32_t n = cp->lists[LIRS_N].tail;
+
+	if (n != CP_NIL)
+		lirs_stack_remove(cp, n);
+}
+
+static int lirs_access(struct cache_policy *cp, uint64_t id, uint64_t *victim)
+{
+	int32_t n = cp_lookup(cp, id);
+	struct cp_node *node;
+	int evicted = 0;
+
+	if (n != CP_NIL) {
+		node = &cp->nodes[n];
+		if (node->state == LIRS_LIR) {
+			lirs_stack_push(cp, n);
+			lirs_prune(cp);
+			return CACHE_POLICY_HIT;
+		}
+		if (node->state == LIRS_HIR_RESIDENT) {
+			if (node->flags & CP_IN_STACK) {
+				node->state = LIRS_LIR;
+				cp->num_lir++;
+				lirs_queue_remove(cp, n);
+				lirs_stack_push(cp, n);
+				lirs_demote(cp);
+			} else {
+				lirs_queue_push(cp, n);
+				lirs_stack_push(cp, n);
+			}
+			return CACHE_POLICY_HIT;
+		}
+	}
+	if (cp->resident == cp->capacity) {
+		*victim = lirs_evict_hir(cp);
+		evicted = 1;
+	}
+	cp->resident++;
+	if (n != CP_NIL) {
+		// A non-resident HIR block that is still in the stack has a
+		// shorter reuse distance than the bottom LIR block.
+		cp_remove(cp, LIRS_N, n);
+		cp->nodes[n].state = LIRS_LIR;
+		cp->num_lir++;
+		lirs_stack_push(cp, n);
+		lirs_demote(cp);
+	} else {
+		if (cp->num_free == 0)
+			lirs_trim(cp);
+		n = cp_node_alloc(cp, id);
+		lirs_stack_push(cp, n);
+		if (cp->num_lir < cp->target) {
+			cp->nodes[n].state = LIRS_LIR;
+			cp->num_lir++;
+		} else {
+			cp->nodes[n].state = LIRS_HIR_RESIDENT;
+			lirs_queue_push(cp, n);
+		}
+	}
+	return evicted ? CACHE_POLICY_MISS_EVICT : CACHE_POLICY_MISS;
+}
+
+static int lirs_evict(struct cache_policy *cp, uint64_t *victim)
+{
+	if (cp->resident == 0)
+		return 0;
+	// Every resident block may be LIR, below the LIR capacity.
+	if (cp->lists[LIRS_Q].len == 0)
+		lirs_demote_bottom(cp);
+	*victim = lirs_evict_hir(cp);
+	return 1;
+}
+
+/****************************** S3-FIFO ******************************/
+
+/*
+ * target is the size of the small queue.  Ghost entries remember blocks
+ * evicted from the small queue, up to the capacity.
+ */
+#define S3FIFO_SMALL 0
+#define S3FIFO_MAIN 1
+#define S3FIFO_GHOST 2
+
+static uint64_t s3fifo_evict_main(struct cache_policy *cp)
+{
+	int32_t n;
+
+	while (1) {
+		n = cp->lists[S3FIFO_MAIN].tail;
+		if (cp->nodes[n].state == 0)
+			return cp_drop_tail(cp, S3FIFO_MAIN);
+		cp->nodes[n].state--;
+		cp_move_head(cp, S3FIFO_MAIN, S3FIFO_MAIN, n);
+	}
+}
+
+static uint64_t s3fifo_evict(struct cache_policy *cp)
+{
+	int32_t n;
+	uint64_t id;
+
+	if ((cp->lists[S3FIFO_SMALL].len < cp->target) &&
+			(cp->lists[S3FIFO_MAIN].len > 0))
+		return s3fifo_evict_main(cp);
+	while ((n = cp->lists[S3FIFO_SMALL].tail) != CP_NIL) {
+		if (cp->nodes[n].state > 1) {
+			// Accessed again while on probation: promote.
+			cp->nodes[n].state = 0;
+			cp_move_head(cp, S3FIFO_SMALL, S3FIFO_MAIN, n);
+			if (cp->lists[S3FIFO_MAIN].len > cp->capacity -
+					cp->target)
+				return s3fifo_evict_main(cp);
+			continue;
+		}
+		id = cp->nodes[n].id;
+		cp_move_head(cp, S3FIFO_SMALL, S3FIFO_GHOST, n);
+		if (cp->lists[S3FIFO_GHOST].len > cp->capacity)
+			cp_drop_tail(cp, S3FIFO_GHOST);
+		return id;
+	}
+	return s3fifo_evict_main(cp);
+}
+
+static int s3fifo_access(struct cache_policy *cp, uint64_t id,
+		uint64_t *victim)
+{
+	int32_t n = cp_lookup(cp, id);
+	int evicted = 0;
+
+	if ((n != CP_NIL) && (cp->nodes[n].list != S3FIFO_GHOST)) {
+		if (cp->nodes[n].state < S3FIFO_MAX_FREQ)
+			cp->nodes[n].state++;
+		return CACHE_POLICY_HIT;
+	}
+	if (cp->lists[S3FIFO_SMALL].len + cp->lists[S3FIFO_MAIN].len ==
+			cp->capacity) {
+		*victim = s3fifo_evict(cp);
+		evicted = 1;
+	}
+	if (n != CP_NIL) {
+		// The evictions above may have dropped this ghost entry.
+		n = cp_lookup(cp, id);
+	}
+	if (n != CP_NIL) {
+		cp->nodes[n].state = 0;
+		cp_move_head(cp, S3FIFO_GHOST, S3FIFO_MAIN, n);
+	} else {
+		cp_push_head(cp, S3FIFO_SMALL, cp_node_alloc(cp, id));
+	}
+	return evicted ? CACHE_POLICY_MISS_EVICT : CACHE_POLICY_MISS;
+}
+
+static int s3fifo_evict_any(struct cache_policy *cp, uint64_t *victim)
+{
+	if (cp->lists[S3FIFO_SMALL].len + cp->lists[S3FIFO_MAIN].len == 0)
+		return 0;
+	*victim = s3fifo_evict(cp);
+	return 1;
+}
+
+/****************************** W-TinyLFU ******************************/
+
+/*
+ * target is the window size and target2 the protected segment size.
+ */
+#define WTINYLFU_WINDOW 0
+#define WTINYLFU_PROBATION 1
+#define WTINYLFU_PROTECTED 2
+
+static uint64_t wtinylfu_index(const struct cache_policy *cp, uint64_t h,
+		int row)
+{
+	// Derive one index per row from the two halves of the hash, as in
+	// Kirsch and Mitzenmacher's double hashing.
+	return ((uint32_t)h + row * ((h >> 32) | 1)) & cp->sketch_mask;
+}
+
+static int wtinylfu_frequency(const struct cache_policy *cp, uint64_t id)
+{
+	uint64_t h = mix64(id ^ 0x5bd1e995ULL);
+	int row, count, min = WTINYLFU_MAX_COUNT;
+
+	for (row = 0; row < WTINYLFU_ROWS; row++) {
+		count = cp->sketch[(row * (cp->sketch_mask + 1)) +
+			wtinylfu_index(cp, h, row)];
+		if (count < min)
+			min = count;
+	}
+	return min;
+}
+
+static void wtinylfu_increment(struct cache_policy *cp, uint64_t id)
+{
+	uint64_t h = mix64(id ^ 0x5bd1e995ULL), i;
+	int row;
+
+	for (row = 0; row < WTINYLFU_ROWS; row++) {
+		i = (row * (cp->sketch_mask + 1)) + wtinylfu_index(cp, h, row);
+		if (cp->sketch[i] < WTINYLFU_MAX_COUNT)
+			cp->sketch[i]++;
+	}
+	if (++cp->sketch_adds == cp->sketch_period) {
+		// Age the sketch, so that it follows changes in popularity.
+		for (i = 0; i < WTINYLFU_ROWS * (cp->sketch_mask + 1); i++)
+			cp->sketch[i] >>= 1;
+		cp->sketch_adds /= 2;
+	}
+}
+
+static int wtinylfu_access(struct cache_policy *cp, uint64_t id,
+		uint64_t *victim)
+{
+	int32_t n = cp_lookup(cp, id), cand, v;
+	long long main_len;
+
+	wtinylfu_increment(cp, id);
+	if (n != CP_NIL) {
+		switch (cp->nodes[n].list) {
+		case WTINYLFU_WINDOW:
+			cp_move_head(cp, WTINYLFU_WINDOW, WTINYLFU_WINDOW, n);
+			break;
+		case WTINYLFU_PROBATION:
+			cp_move_head(cp, WTINYLFU_PROBATION,
+				WTINYLFU_PROTECTED, n);
+			if (cp->lists[WTINYLFU_PROTECTED].len > cp->target2) {
+				cp_move_head(cp, WTINYLFU_PROTECTED,
+					WTINYLFU_PROBATION,
+					cp->lists[WTINYLFU_PROTECTED].tail);
+			}
+			break;
+		case WTINYLFU_PROTECTED:
+			cp_move_head(cp, WTINYLFU_PROTECTED,
+				WTINYLFU_PROTECTED, n);
+			break;
+		}
+		return CACHE_POLICY_HIT;
+	}
+	cp_push_head(cp, WTINYLFU_WINDOW, cp_node_alloc(cp, id));
+	if (cp->lists[WTINYLFU_WINDOW].len <= cp->target)
+		return CACHE_POLICY_MISS;
+	// The window overflowed: its oldest block has to earn a place in
+	// the main cache.
+	cand = cp->lists[WTINYLFU_WINDOW].tail;
+	main_len = cp->lists[WTINYLFU_PROBATION].len +
+		cp->lists[WTINYLFU_PROTECTED].len;
+	if (main_len < cp->capacity - cp->target) {
+		cp_move_head(cp, WTINYLFU_WINDOW, WTINYLFU_PROBATION, cand);
+		return CACHE_POLICY_MISS;
+	}
+	v = cp->lists[WTINYLFU_PROBATION].tail;
+	if (v == CP_NIL)
+		v = cp->lists[WTINYLFU_PROTECTED].tail;
+	if (wtinylfu_frequency(cp, cp->nodes[cand].id) >
+			wtinylfu_frequency(cp, cp->nodes[v].id)) {
+		*victim = cp->nodes[v].id;
+		cp_remove(cp, cp->nodes[v].list, v);
+		cp_node_free(cp, v);
+		cp_move_head(cp, WTINYLFU_WINDOW, WTINYLFU_PROBATION, cand);
+	} else {
+		*victim = cp->nodes[cand].id;
+		cp_remove(cp, WTINYLFU_WINDOW, cand);
+		cp_node_free(cp, cand);
+	}
+	return CACHE_POLICY_MISS_EVICT;
+}
+
+/*
+ * Evict from the main cache before the window, and from probation before
+ * the protected segment.
+ */
+static int wtinylfu_evict(struct cache_policy *cp, uint64_t *victim)
+{
+	static const int order[] = { WTINYLFU_PROBATION, WTINYLFU_PROTECTED,
+		WTINYLFU_WINDOW };
+	unsigned int i;
+
+	for (i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+		if (cp->lists[order[i]].len > 0) {
+			*victim = cp_drop_tail(cp, order[i]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/****************************** interface ******************************/
+
+int cache_policy_parse(const char *name)
+{
+	int type;
+
+	for (type = 0; type < CACHE_POLICY_MAX; type++) {
+		if (!strcasecmp(name, CACHE_POLICY_NAMES[type]))
+			return type;
+	}
+	return -1;
+}
+
+const char *cache_policy_name(enum cache_policy_type type)
+{
+	return CACHE_POLICY_NAMES[type];
+}
+
+static long long cp_fraction(long long capacity, int percent)
+{
+	long long n = capacity * percent / 100;
+
+	return (n > 0) ? n : 1;
+}
+
+int cache_policy_create(enum cache_policy_type type, long long capacity,
+		struct cache_policy **out)
+{
+	struct cache_policy *cp;
+	long long max_nodes;
+	uint64_t width;
+	int32_t i;
+	int l;
+
+	if ((capacity < 2) && (type != CACHE_POLICY_NONE)) {
+		fprintf(stderr, "cache_policy: the %s policy needs room for "
+			"at least 2 blocks.\n", CACHE_POLICY_NAMES[type]);
+		return EINVAL;
+	}
+	// Room for the ghost entries each policy keeps, beyond the
+	// resident blocks.
+	switch (type) {
+	case CACHE_POLICY_ARC:
+	case CACHE_POLICY_S3FIFO:
+		max_nodes = 2 * capacity + 1;
+		break;
+	case CACHE_POLICY_2Q:
+		max_nodes = capacity + (capacity / 2) + 2;
+		break;
+	case CACHE_POLICY_LIRS:
+		max_nodes = 3 * capacity;
+		break;
+	case CACHE_POLICY_WTINYLFU:
+		max_nodes = capacity + 1;
+		break;
+	default:
+		max_nodes = capacity;
+		break;
+	}
+	if (max_nodes > INT32_MAX / 2) {
+		fprintf(stderr, "cache_policy: a capacity of %lld blocks is "
+			"too large.\n", capacity);
+		return EINVAL;
+	}
+	cp = calloc(1, sizeof(*cp));
+	if (!cp)
+		return ENOMEM;
+	cp->type = type;
+	cp->capacity = capacity;
+	cp->max_nodes = max_nodes;
+	cp->nodes = calloc(max_nodes, sizeof(struct cp_node));
+	cp->free_nodes = malloc(max_nodes * sizeof(int32_t));
+	if (!cp->nodes || !cp->free_nodes)
+		goto oom;
+	if (idtable_init(&cp->table, max_nodes, &cp->nodes[0].id,
+			sizeof(struct cp_node)))
+		goto oom;
+	// Hand out low-numbered nodes first, for locality.
+	for (i = 0; i < max_nodes; i++)
+		cp->free_nodes[i] = max_nodes - 1 - i;
+	cp->num_free = max_nodes;
+	for (l = 0; l < CP_MAX_LISTS; l++)
+		cp_list_init(cp, l, CP_LINK_MAIN);
+
+	switch (type) {
+	case CACHE_POLICY_2Q:
+		cp->target = cp_fraction(capacity, 25);
+		cp->target2 = cp_fraction(capacity, 50);
+		break;
+	case CACHE_POLICY_LIRS:
+		cp_list_init(cp, LIRS_Q, CP_LINK_AUX);
+		cp_list_init(cp, LIRS_N, CP_LINK_AUX);
+		cp->target = capacity - cp_fraction(capacity, 1);
+		break;
+	case CACHE_POLICY_S3FIFO:
+		cp->target = cp_fraction(capacity, 10);
+		break;
+	case CACHE_POLICY_WTINYLFU:
+		cp->target = cp_fraction(capacity, 1);
+		cp->target2 = (capacity - cp->target) * 80 / 100;
+		for (width = 16; width < (uint64_t)capacity; )
+			width <<= 1;
+		cp->sketch_mask = width - 1;
+		cp->sketch_period = 10 * capacity;
+		cp->sketch = calloc(WTINYLFU_ROWS * width, 1);
+		if (!cp->sketch)
+			goto oom;
+		break;
+	default:
+		break;
+	}
+	*out = cp;
+	return 0;
+
+oom:
+	cache_policy_free(cp);
+	return ENOMEM;
+}
+
+void cache_policy_free(struct cache_policy *cp)
+{
+	if (!cp)
+		return;
+	free(cp->nodes);
+	free(cp->free_nodes);
+	idtable_free(&cp->table);
+	free(cp->sketch);
+	free(cp);
+}
+
+int cache_policy_access(struct cache_policy *cp, uint64_t id,
+		uint64_t *victim)
+{
+	switch (cp->type) {
+	case CACHE_POLICY_LRU:
+		return lru_access(cp, id, victim);
+	case CACHE_POLICY_CLOCK:
+		return clock_access(cp, id, victim);
+	case CACHE_POLICY_ARC:
+		return arc_access(cp, id, victim);
+	case CACHE_POLICY_2Q:
+		return twoq_access(cp, id, victim);
+	case CACHE_POLICY_LIRS:
+		return lirs_access(cp, id, victim);
+	case CACHE_POLICY_S3FIFO:
+		return s3fifo_access(cp, id, victim);
+	case CACHE_POLICY_WTINYLFU:
+		return wtinylfu_access(cp, id, victim);
+	default:
+		return none_access(cp, id, victim);
+	}
+}
+
+int cache_policy_evict(struct cache_policy *cp, uint64_t *victim)
+{
+	switch (cp->type) {
+	case CACHE_POLICY_LRU:
+		return lru_evict(cp, victim);
+	case CACHE_POLICY_CLOCK:
+		return clock_evict(cp, victim);
+	case CACHE_POLICY_ARC:
+		return arc_evict_one(cp, 0, victim);
+	case CACHE_POLICY_2Q:
+		return twoq_evict_one(cp, victim);
+	case CACHE_POLICY_LIRS:
+		return lirs_evict(cp, victim);
+	case CACHE_POLICY_S3FIFO:
+		return s3fifo_evict_any(cp, victim);
+	case CACHE_POLICY_WTINYLFU:
+		return wtinylfu_evict(cp, victim);
+	default:
+		return none_evict(cp, victim);
+	}
+}
@@ -0,0 +1,103 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#ifndef VECSUM_CACHEPOLICY_H
+#define VECSUM_CACHEPOLICY_H
+
+/*
+ * Cache replacement policies.
+ *
+ * A policy only tracks block ids; the block cache holds the data.  Every
+ * access goes through cache_policy_access, which says whether the block is
+ * resident and, on a miss, whether to admit it and which resident block
+ * to evict to make room.  Policies that remember recently evicted blocks
+ * (ARC, 2Q, LIRS and S3-FIFO) keep those "ghost" entries to themselves.
+ *
+ * Each policy keeps its entries in a fixed pool of nodes linked into
+ * intrusive lists by index, with one open-addressed hash table from id to
+ * node, so an access costs a hash probe and a few pointer updates and
+ * never allocates.
+ *
+ *   none      Admit until full, then never evict, like the HDFS cache.
+ *   lru       Least recently used.
+ *   clock     Second chance, with one reference bit per block.
+ *   arc       Adaptive Replacement Cache (Megiddo and Modha, FAST '03).
+ *   2q        The full 2Q, with Kin = 25% and Kout = 50% of the capacity
+ *             (Johnson and Shasha, VLDB '94).
+ *   lirs      Low Inter-reference Recency Set, with 1% of the capacity for
+ *             resident HIR blocks (Jiang and Zhang, SIGMETRICS '02).
+ *   s3fifo    A 10% probationary FIFO, a main FIFO with up to 3 reinsertions
+ *             and a ghost FIFO (Yang et al., SOSP '23).
+ *   wtinylfu  A 1% LRU window in front of a segmented LRU, with admission
+ *             by a count-min sketch of 4-bit counters that is halved every
+ *             10 x capacity accesses (Einziger et al., TOS '17).
+ */
+
+#include <stdint.h>
+
+enum cache_policy_type {
+	CACHE_POLICY_NONE = 0,
+	CACHE_POLICY_LRU,
+	CACHE_POLICY_CLOCK,
+	CACHE_POLICY_ARC,
+	CACHE_POLICY_2Q,
+	CACHE_POLICY_LIRS,
+	CACHE_POLICY_S3FIFO,
+	CACHE_POLICY_WTINYLFU,
+	CACHE_POLICY_MAX,
+};
+
+#define CACHE_POLICY_VALID_VALUES \
+	"none, lru, clock, arc, 2q, lirs, s3fifo, or wtinylfu"
+
+// Results of cache_policy_access.
+enum cache_policy_result {
+	// The block is resident.
+	CACHE_POLICY_HIT = 0,
+
+	// The block was admitted, and there was room for it.
+	CACHE_POLICY_MISS,
+
+	// The block was admitted in place of the block in *victim.
+	CACHE_POLICY_MISS_EVICT,
+
+	// The block was not admitted.
+	CACHE_POLICY_MISS_BYPASS,
+};
+
+struct cache_policy;
+
+/*
+ * Returns the policy with the given name, or -1 if there is none.
+ */
+int cache_policy_parse(const char *name);
+
+const char *cache_policy_name(enum cache_policy_type type);
+
+/*
+ * Create a policy for a cache of capacity blocks.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int cache_policy_create(enum cache_policy_type type, long long capacity,
+		struct cache_policy **out);
+
+void cache_policy_free(struct cache_policy *cp);
+
+/*
+ * Record an access to block id.  Returns a cache_policy_result.  After a
+ * miss that admits the block, the policy counts it as resident.
+ */
+int cache_policy_access(struct cache_policy *cp, uint64_t id,
+		uint64_t *victim);
+
+/*
+ * Evict one resident block, for a cache that ran out of room before the
+ * policy did.  Each policy picks the block it would evict to make room,
+ * except none, which gives back the block it admitted last.  Returns
+ * nonzero and sets *victim if a block was evicted, or 0 if nothing is
+ * resident.
+ */
+int cache_policy_evict(struct cache_policy *cp, uint64_t *victim);
+
+#endif
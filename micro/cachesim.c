@@ -0,0 +1,374 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blockcache.h"
+#include "cachepolicy.h"
+#include "util.h"
+
+// The block size vecsum2 caches at.
+#define BLOCK_SIZE (8 * 1024 * 1024)
+
+// Share of store_sales bytes in the partitions that
+// count_store_sales_2002-11-22.sql scans, per CacheTool's Constants.java.
+#define DEFAULT_HOT_FRACTION 0.046
+
+#define USAGE \
+"usage: cachesim [options]\n" \
+"\n" \
+"Replays a block access pattern through each cache replacement policy and\n" \
+"prints its hit ratio and throughput.  The patterns model the Impala runs\n" \
+"in scripts/impala over a table of num-blocks blocks, oldest partition\n" \
+"first:\n" \
+"\n" \
+"  small       run_count_small: scan the newest partitions (the hot set)\n" \
+"              over and over\n" \
+"  big         run_count_big: scan the whole table over and over\n" \
+"  concurrent  run_count_concurrent: hot set scans, interleaved block by\n" \
+"              block with a looping scan of the remainder\n" \
+"\n" \
+"Without -f, only the policies run, which measures what each costs per\n" \
+"access.  With -f, every access reads an 8 MiB block of the file through\n" \
+"the block cache, with pread on a miss, and adds up its doubles.\n" \
+"\n" \
+"options:\n" \
+"  -p <policy>  " CACHE_POLICY_VALID_VALUES ", or all\n" \
+"               (the default)\n" \
+"  -w <load>    small, big, concurrent, or all (the default)\n" \
+"  -n <blocks>  number of blocks in the table (default 1000)\n" \
+"  -c <blocks>  cache capacity in blocks (default a tenth of the table)\n" \
+"  -a <count>   number of accesses (default 10000000, or 1000 with -f)\n" \
+"  -H <frac>    fraction of the table in the hot set (default 0.046)\n" \
+"  -q <frac>    fraction of concurrent accesses from the hot set scan\n" \
+"               (default 0.5)\n" \
+"  -s <seed>    seed for interleaving the concurrent scans (default 1)\n" \
+"  -f <file>    read real blocks from file; the table is as many blocks\n" \
+"               as the file holds\n"
+
+enum workload {
+	WORKLOAD_SMALL = 0,
+	WORKLOAD_BIG,
+	WORKLOAD_CONCURRENT,
+	WORKLOAD_MAX,
+};
+
+static const char * const WORKLOAD_NAMES[] = {
+	[WORKLOAD_SMALL] = "small",
+	[WORKLOAD_BIG] = "big",
+	[WORKLOAD_CONCURRENT] = "concurrent",
+};
+
+struct sim_opts {
+	long long num_blocks;
+	long long cache_blocks;
+	long long accesses;
+	double hot_fraction;
+	double hot_share;
+	uint64_t seed;
+	const char *path;
+	int fd;
+	char *buf;
+};
+
+/*
+ * Fill trace with the block ids that a workload touches, in order.  The hot
+ * set is the last hot blocks of the table, like the newest partitions.
+ */
+static void make_trace(const struct sim_opts *opts, enum workload load,
+		uint64_t *trace)
+{
+	long long i, hot, cold, hot_pos = 0, cold_pos = 0;
+	uint64_t rng = opts->seed, threshold;
+
+	hot = opts->num_blocks * opts->hot_fraction;
+	if (hot < 1)
+		hot = 1;
+	cold = opts->num_blocks - hot;
+	threshold = opts->hot_share * 18446744073709551615.0;
+	for (i = 0; i < opts->accesses; i++) {
+		switch (load) {
+		case WORKLOAD_SMALL:
+			trace[i] = cold + (i % hot);
+			break;
+		case WORKLOAD_BIG:
+			trace[i] = i % opts->num_blocks;
+			break;
+		default:
+			if ((cold == 0) || (splitmix64_next(&rng) < threshold)) {
+				trace[i] = cold + hot_pos;
+				hot_pos = (hot_pos + 1) % hot;
+			} else {
+				trace[i] = cold_pos;
+				cold_pos = (cold_pos + 1) % cold;
+			}
+			break;
+		}
+	}
+}
+
+/*
+ * Replay a trace through the policy alone.  Returns 0 on success, or an
+ * errno value on failure.
+ */
+static int run_policy(const struct sim_opts *opts, enum cache_policy_type type,
+		const uint64_t *trace, long long *hits, double *secs)
+{
+	struct cache_policy *cp;
+	long long i, h = 0;
+	uint64_t victim;
+	double start;
+	int ret;
+
+	ret = cache_policy_create(type, opts->cache_blocks, &cp);
+	if (ret)
+		return ret;
+	start = monotonic_seconds();
+	for (i = 0; i < opts->accesses; i++) {
+		if (cache_policy_access(cp, trace[i], &victim) ==
+				CACHE_POLICY_HIT)
+			h++;
+	}
+	*secs = monotonic_seconds() - start;
+	*hits = h;
+	cache_policy_free(cp);
+	return 0;
+}
+
+/*
+ * Replay a trace through a block cache in front of the file.  Returns 0 on
+ * success, or an errno value on failure.
+ */
+static int run_cache(const struct sim_opts *opts, enum cache_policy_type type,
+		const uint64_t *trace, long long *hits, double *secs,
+		long long *bytes, double *sum)
+{
+	struct blockcache *bc;
+	struct blockcache_stats stats;
+	const double *vals;
+	long long i, j;
+	ssize_t res;
+	double start, s = 0;
+	int len, ret;
+
+	ret = blockcache_create(opts->cache_blocks * BLOCK_SIZE, BLOCK_SIZE,
+		0, type, &bc);
+	if (ret)
+		return ret;
+	start = monotonic_seconds();
+	for (i = 0; i < opts->accesses; i++) {
+		vals = blockcache_lookup(bc, trace[i], &len);
+		if (!vals) {
+			res = pread(opts->fd, opts->buf, BLOCK_SIZE,
+				(off_t)trace[i] * BLOCK_SIZE);
+			if (res < 0) {
+				ret = errno;
+				fprintf(stderr, "pread(%s) failed: error %d "
+					"(%s)\n", opts->path, ret,
+					strerror(ret));
+				goto done;
+			}
+			len = res;
+			blockcache_insert(bc, trace[i], opts->buf, len);
+			vals = (const double *)opts->buf;
+		}
+		for (j = 0; j < len / (long long)sizeof(double); j++)
+			s += vals[j];
+		*bytes += len;
+	}
+	*secs = monotonic_seconds() - start;
+	blockcache_get_stats(bc, &stats, 0);
+	*hits = stats.hits;
+	*sum = s;
+done:
+	blockcache_free(bc);
+	return ret;
+}
+
+static int run(const struct sim_opts *opts, enum workload load,
+		enum cache_policy_type type, const uint64_t *trace)
+{
+	long long hits = 0, bytes = 0;
+	double secs = 0, sum = 0;
+	int ret;
+
+	if (opts->path) {
+		ret = run_cache(opts, type, trace, &hits, &secs, &bytes, &sum);
+	} else {
+		ret = run_policy(opts, type, trace, &hits, &secs);
+	}
+	if (ret) {
+		fprintf(stderr, "failed to run the %s policy: error %d "
+			"(%s)\n", cache_policy_name(type), ret, strerror(ret));
+		return ret;
+	}
+	printf("%-10s  %-8s  %9.4f  %14.1f  %14.4g", WORKLOAD_NAMES[load],
+		cache_policy_name(type), (double)hits / opts->accesses,
+		secs * 1e9 / opts->accesses, opts->accesses / secs / 1e6);
+	if (opts->path)
+		printf("  %8.3f  %g", bytes / secs / 1e9, sum);
+	printf("\n");
+	return 0;
+}
+
+static int open_file(struct sim_opts *opts)
+{
+	struct stat st;
+	int ret;
+
+	opts->fd = open(opts->path, O_RDONLY);
+	if (opts->fd < 0) {
+		ret = errno;
+		fprintf(stderr, "failed to open %s: error %d (%s)\n",
+			opts->path, ret, strerror(ret));
+		return ret;
+	}
+	if (fstat(opts->fd, &st)) {
+		ret = errno;
+		fprintf(stderr, "failed to stat %s: error %d (%s)\n",
+			opts->path, ret, strerror(ret));
+		return ret;
+	}
+	opts->num_blocks = (st.st_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	if (opts->num_blocks < 2) {
+		fprintf(stderr, "%s is too small to hold two %d-byte "
+			"blocks.\n", opts->path, BLOCK_SIZE);
+		return EINVAL;
+	}
+	if (posix_memalign((void **)&opts->buf, 4096, BLOCK_SIZE))
+		return ENOMEM;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct sim_opts opts;
+	uint64_t *trace = NULL;
+	int c, policy = -1, load = -1, ret = 1;
+	int p, w;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.num_blocks = 1000;
+	opts.hot_fraction = DEFAULT_HOT_FRACTION;
+	opts.hot_share = 0.5;
+	opts.seed = 1;
+	opts.fd = -1;
+	while ((c = getopt(argc, argv, "p:w:n:c:a:H:q:s:f:")) != -1) {
+		switch (c) {
+		case 'p':
+			if (strcmp(optarg, "all")) {
+				policy = cache_policy_parse(optarg);
+				if (policy < 0) {
+					fprintf(stderr, "unknown policy %s\n"
+						USAGE, optarg);
+					return 1;
+				}
+			}
+			break;
+		case 'w':
+			if (strcmp(optarg, "all")) {
+				for (load = 0; load < WORKLOAD_MAX; load++) {
+					if (!strcmp(optarg,
+						    WORKLOAD_NAMES[load]))
+						break;
+				}
+				if (load == WORKLOAD_MAX) {
+					fprintf(stderr, "unknown workload "
+						"%s\n" USAGE, optarg);
+					return 1;
+				}
+			}
+			break;
+		case 'n':
+			opts.num_blocks = atoll(optarg);
+			break;
+		case 'c':
+			opts.cache_blocks = atoll(optarg);
+			break;
+		case 'a':
+			opts.accesses = atoll(optarg);
+			break;
+		case 'H':
+			opts.hot_fraction = atof(optarg);
+			break;
+		case 'q':
+			opts.hot_share = atof(optarg);
+			break;
+		case 's':
+			opts.seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'f':
+			opts.path = optarg;
+			break;
+		default:
+			fprintf(stderr, USAGE);
+			return 1;
+		}
+	}
+	if (optind != argc) {
+		fprintf(stderr, USAGE);
+		return 1;
+	}
+	if (opts.path && open_file(&opts))
+		goto done;
+	if (opts.accesses == 0)
+		opts.accesses = opts.path ? 1000 : 10000000;
+	if (opts.cache_blocks == 0)
+		opts.cache_blocks = opts.num_blocks / 10;
+	if ((opts.num_blocks < 2) || (opts.cache_blocks < 2) ||
+			(opts.accesses < 1)) {
+		fprintf(stderr, "the table and the cache must hold at least "
+			"two blocks, and there must be at least one "
+			"access.\n" USAGE);
+		goto done;
+	}
+	if ((opts.hot_fraction <= 0) || (opts.hot_fraction > 1) ||
+			(opts.hot_share < 0) || (opts.hot_share > 1)) {
+		fprintf(stderr, "-H and -q take fractions between 0 and 1.\n"
+			USAGE);
+		goto done;
+	}
+	trace = malloc(opts.accesses * sizeof(uint64_t));
+	if (!trace) {
+		fprintf(stderr, "failed to allocate a trace of %lld "
+			"accesses.\n", opts.accesses);
+		goto done;
+	}
+	printf("%lld blocks, %lld cached, %lld hot, %lld accesses\n",
+		opts.num_blocks, opts.cache_blocks,
+		(long long)(opts.num_blocks * opts.hot_fraction),
+		opts.accesses);
+	printf("%-10s  %-8s  %9s  %14s  %14s", "workload", "policy",
+		"hit ratio", "ns per access", "M accesses/s");
+	if (opts.path)
+		printf("  %8s  %s", "GB/s", "sum");
+	printf("\n");
+	for (w = 0; w < WORKLOAD_MAX; w++) {
+		if ((load >= 0) && (w != load))
+			continue;
+		make_trace(&opts, w, trace);
+		for (p = 0; p < CACHE_POLICY_MAX; p++) {
+			if ((policy >= 0) && (p != policy))
+				continue;
+			if (run(&opts, w, p, trace))
+				goto done;
+		}
+	}
+	ret = 0;
+done:
+	free(trace);
+	free(opts.buf);
+	if (opts.fd >= 0)
+		close(opts.fd);
+	return ret;
+}
@@ -0,0 +1,47 @@
+#!/bin/bash
+set -e
+
+# Compares the compressed block cache with the uncompressed one.  For each
+# distribution, vecsum2 runs with a cache big enough for the whole file, once
+# with VECSUM_CACHE_COMPRESS and once without, and the last pass, which is
+# all hits, gives the hit path throughput and CPU cost per byte.  The ratio
+# is how many more blocks the same memory holds compressed.
+
+if [ "$#" -lt 2 ]; then echo "$0 <local/pread/zcr/libhdfs> <number of floats> [passes] [work dir]"; exit -1; fi
+
+TYPE=$1
+NUM_FLOATS=$2
+PASSES=${3:-3}
+WORKDIR=${4:-/tmp/compress-sweep}
+
+DISTS="sawtooth zipf sorted clustered normal uniform"
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+mkdir -p $WORKDIR
+
+# Prints "<ratio> <hit GB/s> <hit ns per byte>" for the last pass of one run.
+run() {
+	VECSUM_TYPE=$TYPE VECSUM_PATH=$1 VECSUM_PASSES=$PASSES \
+		VECSUM_CACHE_BYTES=$2 VECSUM_CACHE_COMPRESS=$3 \
+		$HERE/vecsum2 | awk '
+		/^cache pass .* cached in/ {
+			ratio = $10; gsub(/[(x),]/, "", ratio)
+			gbps = $13; ns = $15; gsub(/\(/, "", ns)
+		}
+		END { print ratio, gbps, ns }'
+}
+
+printf "%-10s %7s %11s %11s %10s %10s\n" dist ratio "GB/s(comp)" \
+	"GB/s(raw)" "ns/B(comp)" "ns/B(raw)"
+for DIST in $DISTS; do
+	FILE=$WORKDIR/$DIST-$NUM_FLOATS.dat
+	if [ ! -f $FILE ]; then
+		$HERE/create-float-file -H -d $DIST $NUM_FLOATS > $FILE
+	fi
+	# Room for every block, rounded up to whole 8 MiB blocks.
+	CACHE=$(( ($(stat -c %s $FILE) / 8388608 + 2) * 8388608 ))
+	read RATIO COMP_GBPS COMP_NS < <(run $FILE $CACHE 1)
+	read _ RAW_GBPS RAW_NS < <(run $FILE $CACHE 0)
+	printf "%-10s %6.3gx %11.4g %11.4g %10.4g %10.4g\n" $DIST $RATIO \
+		$COMP_GBPS $RAW_GBPS $COMP_NS $RAW_NS
+done
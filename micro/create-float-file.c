@@ -2,34 +2,479 @@
  * vim: ts=8:sw=8:tw=79:noet
  */
 
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "expected.h"
+#include "floatfile.h"
+#include "util.h"
 
 #define DOUBLE_SIZE sizeof(double)
 
+// The scale of the values, which is about where the original sawtooth tops
+// out.  Uniform values are drawn from [0, VALUE_RANGE), Zipf values are the
+// ranks 1 .. VALUE_RANGE, and normal and clustered values are centered
+// inside the range but can fall outside it.
+#define VALUE_RANGE 100000.0
+
+// Number of doubles we buffer up before each fwrite.
+#define WRITE_BATCH 4096
+
+#define USAGE \
+"usage: create-float-file [options] [num-floats] [expected-file]\n" \
+"\n" \
+"Writes num-floats doubles to stdout.  If expected-file is given, the\n" \
+"aggregates that vecsum2 checks against are written there.\n" \
+"\n" \
+"options:\n" \
+"  -d <dist>   value distribution: sawtooth (the default), uniform,\n" \
+"              normal, zipf, sorted or clustered\n" \
+"  -s <seed>   seed for the random distributions (default 1)\n" \
+"  -z <s>      Zipf exponent (default 1.0)\n" \
+"  -H          write a self-describing header and footer (see\n" \
+"              floatfile.h) around the values, with per-block\n" \
+"              checksums and min/max zone maps\n" \
+"  -D <rate>   fraction of values to replace with denormals\n" \
+"  -N <rate>   fraction of values to replace with NaNs\n" \
+"  -I <rate>   fraction of values to replace with +/-infinity\n"
+
+enum distribution {
+	DIST_SAWTOOTH = 0,
+	DIST_UNIFORM,
+	DIST_NORMAL,
+	DIST_ZIPF,
+	DIST_SORTED,
+	DIST_CLUSTERED,
+};
+
+static const char * const DIST_NAMES[] = {
+	[DIST_SAWTOOTH] = "sawtooth",
+	[DIST_UNIFORM] = "uniform",
+	[DIST_NORMAL] = "normal",
+	[DIST_ZIPF] = "zipf",
+	[DIST_SORTED] = "sorted",
+	[DIST_CLUSTERED] = "clustered",
+};
+
+#define NUM_DISTS (sizeof(DIST_NAMES) / sizeof(DIST_NAMES[0]))
+
+// Number of cluster centers for DIST_CLUSTERED, and the mean length of a
+// run of values drawn from the same cluster.
+#define NUM_CLUSTERS 16
+#define CLUSTER_MEAN_RUN 4096
+
+struct generator {
+	enum distribution dist;
+	uint64_t rng;
+
+	// Rates at which special values are injected.
+	double denormal_rate;
+	double nan_rate;
+	double inf_rate;
+
+	// DIST_SAWTOOTH: the next value.
+	double sawtooth;
+
+	// DIST_NORMAL: the second value from the last Box-Muller draw.
+	int have_spare;
+	double spare;
+
+	// DIST_ZIPF: rejection-inversion sampler state.
+	double zipf_s;
+	double zipf_h_x1;
+	double zipf_h_n;
+	double zipf_c;
+
+	// DIST_SORTED: the last order statistic, counting down from the top.
+	long long sorted_left;
+	double sorted_w;
+
+	// DIST_CLUSTERED: cluster centers and the current run.
+	double centers[NUM_CLUSTERS];
+	int cluster;
+	long long run_left;
+};
+
+// Uniform in [0, 1).
+static double rng_uniform(struct generator *gen)
+{
+	return (splitmix64_next(&gen->rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double rng_normal(struct generator *gen)
+{
+	double u, v, r;
+
+	if (gen->have_spare) {
+		gen->have_spare = 0;
+		return gen->spare;
+	}
+	do {
+		u = 2 * rng_uniform(gen) - 1;
+		v = 2 * rng_uniform(gen) - 1;
+		r = u * u + v * v;
+	} while (r >= 1 || r == 0);
+	r = sqrt(-2 * log(r) / r);
+	gen->spare = v * r;
+	gen->have_spare = 1;
+	return u * r;
+}
+
+/*
+ * Zipf over the ranks 1 .. VALUE_RANGE, by Hormann and Derflinger's
+ * rejection-inversion method, which needs no tables.
+ */
+static double zipf_h(const struct generator *gen, double x)
+{
+	double e = 1 - gen->zipf_s;
+
+	if (fabs(e) < 1e-12)
+		return log(x);
+	return (pow(x, e) - 1) / e;
+}
+
+static double zipf_h_inv(const struct generator *gen, double x)
+{
+	double e = 1 - gen->zipf_s;
+
+	if (fabs(e) < 1e-12)
+		return exp(x);
+	return pow(1 + x * e, 1 / e);
+}
+
+static void zipf_init(struct generator *gen)
+{
+	gen->zipf_h_x1 = zipf_h(gen, 1.5) - 1;
+	gen->zipf_h_n = zipf_h(gen, VALUE_RANGE + 0.5);
+	gen->zipf_c = 2 - zipf_h_inv(gen, zipf_h(gen, 2.5) - pow(2,
+				-gen->zipf_s));
+}
+
+static double zipf_next(struct generator *gen)
+{
+	double u, x, k;
+
+	while (1) {
+		u = gen->zipf_h_n + rng_uniform(gen) *
+			(gen->zipf_h_x1 - gen->zipf_h_n);
+		x = zipf_h_inv(gen, u);
+		k = floor(x + 0.5);
+		if (k < 1)
+			k = 1;
+		else if (k > VALUE_RANGE)
+			k = VALUE_RANGE;
+		if ((k - x <= gen->zipf_c) ||
+				(u >= zipf_h(gen, k + 0.5) -
+				 pow(k, -gen->zipf_s)))
+			return k;
+	}
+}
+
+static double distribution_next(struct generator *gen)
+{
+	double val;
+
+	switch (gen->dist) {
+	case DIST_SAWTOOTH:
+		if (gen->sawtooth > 100000) gen->sawtooth = 0.0;
+		val = gen->sawtooth;
+		gen->sawtooth += 0.5;
+		return val;
+	case DIST_UNIFORM:
+		return rng_uniform(gen) * VALUE_RANGE;
+	case DIST_NORMAL:
+		return VALUE_RANGE / 2 + rng_normal(gen) * VALUE_RANGE / 10;
+	case DIST_ZIPF:
+		return zipf_next(gen);
+	case DIST_SORTED:
+		// Ascending order statistics of n uniforms, generated one at
+		// a time: the largest of k uniforms is distributed as
+		// U^(1/k), so we walk the order statistics of 1 - U down
+		// from the top.
+		gen->sorted_w *= pow(rng_uniform(gen),
+				1.0 / gen->sorted_left--);
+		return (1 - gen->sorted_w) * VALUE_RANGE;
+	case DIST_CLUSTERED:
+		if (gen->run_left-- <= 0) {
+			gen->cluster = splitmix64_next(&gen->rng) % NUM_CLUSTERS;
+			gen->run_left = -CLUSTER_MEAN_RUN *
+				log(1 - rng_uniform(gen));
+		}
+		return gen->centers[gen->cluster] +
+			rng_normal(gen) * VALUE_RANGE / 1000;
+	}
+	abort();
+}
+
+static double generator_next(struct generator *gen)
+{
+	double val = distribution_next(gen), u;
+	uint64_t bits;
+
+	if (gen->denormal_rate + gen->nan_rate + gen->inf_rate == 0)
+		return val;
+	u = rng_uniform(gen);
+	if (u < gen->denormal_rate) {
+		// Exponent zero, random non-zero mantissa.
+		bits = splitmix64_next(&gen->rng) & 0x000fffffffffffffULL;
+		if (!bits)
+			bits = 1;
+		memcpy(&val, &bits, sizeof(val));
+	} else if ((u -= gen->denormal_rate) < gen->nan_rate) {
+		val = NAN;
+	} else if ((u -= gen->nan_rate) < gen->inf_rate) {
+		val = (splitmix64_next(&gen->rng) & 1) ? INFINITY : -INFINITY;
+	}
+	return val;
+}
+
+/*
+ * Tracks the per-block checksums, sums and zone maps that go in the footer.
+ * Values are checksummed a batch at a time, from the first value not yet
+ * covered up to the end of the batch or of the block, whichever comes
+ * first.
+ */
+struct block_table {
+	struct floatfile_block *blocks;
+	uint64_t num_blocks;
+	uint64_t cur;
+	uint32_t crc;
+	uint32_t count;
+	double min;
+	double max;
+};
+
+static void block_table_reset(struct block_table *tbl)
+{
+	tbl->crc = 0;
+	tbl->count = 0;
+	tbl->min = INFINITY;
+	tbl->max = -INFINITY;
+}
+
+static void block_table_update(struct block_table *tbl, const double *batch,
+		int start, int end)
+{
+	int i;
+
+	if (!tbl->blocks)
+		return;
+	tbl->crc = floatfile_crc32c(tbl->crc, batch + start,
+			(end - start) * sizeof(double));
+	tbl->count += end - start;
+	for (i = start; i < end; i++) {
+		if (batch[i] < tbl->min)
+			tbl->min = batch[i];
+		if (batch[i] > tbl->max)
+			tbl->max = batch[i];
+	}
+}
+
+static void block_table_finish_block(struct block_table *tbl, double sum)
+{
+	if (!tbl->blocks)
+		return;
+	tbl->blocks[tbl->cur].crc = tbl->crc;
+	tbl->blocks[tbl->cur].count = tbl->count;
+	tbl->blocks[tbl->cur].sum = sum;
+	tbl->blocks[tbl->cur].min = tbl->min;
+	tbl->blocks[tbl->cur].max = tbl->max;
+	tbl->cur++;
+	block_table_reset(tbl);
+}
+
+static int write_header(const struct floatfile_header *hdr)
+{
+	char page[FLOATFILE_HEADER_SIZE];
+
+	memset(page, 0, sizeof(page));
+	memcpy(page, hdr, sizeof(*hdr));
+	return fwrite(page, 1, sizeof(page), stdout) != sizeof(page);
+}
+
+static int write_footer(const struct expected *exp,
+		const struct block_table *tbl)
+{
+	struct floatfile_footer ftr;
+
+	memset(&ftr, 0, sizeof(ftr));
+	memcpy(ftr.magic, FLOATFILE_FOOTER_MAGIC, FLOATFILE_MAGIC_LEN);
+	ftr.version = FLOATFILE_VERSION;
+	ftr.block_entry_size = sizeof(struct floatfile_block);
+	ftr.num_blocks = tbl->num_blocks;
+	ftr.count = exp->count;
+	ftr.sum = exp->sum;
+	ftr.min = exp->min;
+	ftr.max = exp->max;
+	if (fwrite(&ftr, sizeof(ftr), 1, stdout) != 1)
+		return 1;
+	if (fwrite(tbl->blocks, sizeof(struct floatfile_block),
+			tbl->num_blocks, stdout) != tbl->num_blocks)
+		return 1;
+	return 0;
+}
+
+static int parse_rate(const char *str, double *rate)
+{
+	char *end;
+
+	*rate = strtod(str, &end);
+	if (end == str || *end || *rate < 0 || *rate > 1) {
+		fprintf(stderr, "invalid rate %s: rates must be between 0 "
+			"and 1.\n" USAGE, str);
+		return 1;
+	}
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
-	int i, num_floats;
-	union {
-		double d;
-		char c[DOUBLE_SIZE];
-	} u;
+	long long i, num_floats;
+	double batch[WRITE_BATCH];
+	char *end;
+	int c, n = 0, start = 0, with_header = 0;
+	unsigned int d;
+	struct generator gen;
+	struct expected_acc acc;
+	struct expected exp;
+	struct floatfile_header hdr;
+	struct block_table tbl;
 
-	if (argc != 2) {
-		fprintf(stderr, "usage: create-float-file [num-floats]\n");
+	memset(&gen, 0, sizeof(gen));
+	gen.rng = 1;
+	gen.zipf_s = 1.0;
+	while ((c = getopt(argc, argv, "d:s:z:HD:N:I:")) != -1) {
+		switch (c) {
+		case 'd':
+			for (d = 0; d < NUM_DISTS; d++) {
+				if (!strcmp(optarg, DIST_NAMES[d]))
+					break;
+			}
+			if (d == NUM_DISTS) {
+				fprintf(stderr, "unknown distribution %s\n"
+					USAGE, optarg);
+				return 1;
+			}
+			gen.dist = d;
+			break;
+		case 's':
+			errno = 0;
+			gen.rng = strtoull(optarg, &end, 0);
+			if (end == optarg || *end || errno) {
+				fprintf(stderr, "invalid seed %s\n" USAGE,
+					optarg);
+				return 1;
+			}
+			break;
+		case 'z':
+			errno = 0;
+			gen.zipf_s = strtod(optarg, &end);
+			if (end == optarg || *end || errno ||
+					!isfinite(gen.zipf_s) ||
+					(gen.zipf_s <= 0)) {
+				fprintf(stderr, "invalid Zipf exponent %s: it "
+					"must be a positive number.\n" USAGE,
+					optarg);
+				return 1;
+			}
+			break;
+		case 'H':
+			with_header = 1;
+			break;
+		case 'D':
+			if (parse_rate(optarg, &gen.denormal_rate))
+				return 1;
+			break;
+		case 'N':
+			if (parse_rate(optarg, &gen.nan_rate))
+				return 1;
+			break;
+		case 'I':
+			if (parse_rate(optarg, &gen.inf_rate))
+				return 1;
+			break;
+		default:
+			fprintf(stderr, USAGE);
+			return 1;
+		}
+	}
+	if (gen.denormal_rate + gen.nan_rate + gen.inf_rate > 1) {
+		fprintf(stderr, "the special value rates add up to more "
+			"than 1.\n" USAGE);
+		return 1;
+	}
+	if (argc - optind != 1 && argc - optind != 2) {
+		fprintf(stderr, USAGE);
 		return 1;
 	}
-	num_floats = atoi(argv[1]);
+	num_floats = atoll(argv[optind]);
 	if (num_floats <= 0) {
-		fprintf(stderr, "failed to parse num_floats.\n"
-			"usage: create-float-file [num-floats]\n");
+		fprintf(stderr, "failed to parse num_floats.\n" USAGE);
 		return 1;
 	}
-	u.d = 0.0;
+
+	zipf_init(&gen);
+	gen.sorted_left = num_floats;
+	gen.sorted_w = 1.0;
+	for (d = 0; d < NUM_CLUSTERS; d++)
+		gen.centers[d] = rng_uniform(&gen) * VALUE_RANGE;
+
+	memset(&tbl, 0, sizeof(tbl));
+	block_table_reset(&tbl);
+	if (with_header) {
+		floatfile_header_init(&hdr, num_floats);
+		tbl.num_blocks = floatfile_num_blocks(&hdr);
+		tbl.blocks = calloc(tbl.num_blocks,
+				sizeof(struct floatfile_block));
+		if (!tbl.blocks) {
+			fprintf(stderr, "failed to allocate the block "
+				"table.\n");
+			return 1;
+		}
+		if (write_header(&hdr))
+			goto write_error;
+		expected_acc_init(&acc, hdr.payload_offset);
+	} else {
+		expected_acc_init(&acc, 0);
+	}
 	for (i = 0; i < num_floats; i++) {
-		if (u.d > 100000) u.d = 0.0;
-		fwrite(u.c, 1, DOUBLE_SIZE, stdout);
-		u.d += 0.5;
+		batch[n] = generator_next(&gen);
+		if (expected_acc_add(&acc, batch[n])) {
+			block_table_update(&tbl, batch, start, n + 1);
+			block_table_finish_block(&tbl, acc.block_sum);
+			start = n + 1;
+		}
+		if (++n == WRITE_BATCH) {
+			block_table_update(&tbl, batch, start, n);
+			if (fwrite(batch, DOUBLE_SIZE, n, stdout) !=
+					(size_t)n)
+				goto write_error;
+			n = start = 0;
+		}
+	}
+	block_table_update(&tbl, batch, start, n);
+	if (fwrite(batch, DOUBLE_SIZE, n, stdout) != (size_t)n)
+		goto write_error;
+	if (expected_acc_finish(&acc, &exp))
+		block_table_finish_block(&tbl, acc.block_sum);
+	if (with_header && write_footer(&exp, &tbl))
+		goto write_error;
+	if (fflush(stdout))
+		goto write_error;
+	free(tbl.blocks);
+	if (argc - optind == 2) {
+		if (expected_write(argv[optind + 1], &exp))
+			return 1;
 	}
 	return 0;
+
+write_error:
+	perror("create-float-file: failed to write output");
+	free(tbl.blocks);
+	return 1;
 }
@@ -0,0 +1,79 @@
+#!/bin/bash
+set -e
+# Fail if the partition list can't be parsed, not just if the loop fails.
+set -o pipefail
+
+# Writes a local copy of the store_sales partition layout that CacheTool
+# walks: one directory per ss_date partition, each holding a float file
+# whose size is that partition's share of the target total, in the same
+# proportions as the real table.  The partition list and sizes are read from
+# CacheTool's Constants.java, so the two can't drift apart.
+#
+# A manifest listing each partition's date, payload bytes and path, oldest
+# first like Constants.DIRS, is written to <output dir>/partitions.txt.
+# Caching the last N lines reproduces CacheTool cache, and a range of dates
+# reproduces the count_store_sales_<date>.sql partition scans.
+
+if [ "$#" -lt 2 ]; then echo "$0 <output dir> <total bytes> [create-float-file options]"; exit -1; fi
+
+OUTDIR=$1
+shift
+TOTAL=$1
+shift
+# Anything left is passed on to create-float-file, e.g. -d uniform.
+GEN_OPTS=("$@")
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+CONSTANTS=$HERE/../scripts/CacheTool/src/main/java/com/cloudera/Constants.java
+DOUBLE_SIZE=8
+
+if [ ! -f $CONSTANTS ]; then echo "can't find $CONSTANTS"; exit 1; fi
+if ! [ "$TOTAL" -gt 0 ] 2>/dev/null; then echo "invalid total bytes $TOTAL"; exit 1; fi
+
+# Emit "<date> <number of doubles>" for every partition.  Each partition
+# gets at least one double, so that no date is missing.
+partitions() {
+	awk -v total=$TOTAL -v dsize=$DOUBLE_SIZE '
+		/String\[\] DIRS/ { in_dirs = 1; next }
+		/long\[\] SIZES/ { in_sizes = 1; next }
+		/};/ { in_dirs = in_sizes = 0 }
+		in_dirs && match($0, /ss_date=[0-9-]+/) {
+			dates[ndirs++] = substr($0, RSTART + 8, RLENGTH - 8)
+		}
+		in_sizes && match($0, /[0-9]+/) {
+			size = substr($0, RSTART, RLENGTH) + 0
+			sizes[nsizes++] = size
+			sum += size
+		}
+		END {
+			if (ndirs == 0 || ndirs != nsizes) {
+				printf "found %d partitions but %d sizes\n", \
+					ndirs, nsizes > "/dev/stderr"
+				exit 1
+			}
+			for (i = 0; i < ndirs; i++) {
+				n = int(sizes[i] / sum * total / dsize)
+				printf "%s %d\n", dates[i], (n > 0) ? n : 1
+			}
+		}' $CONSTANTS
+}
+
+mkdir -p $OUTDIR/store_sales
+MANIFEST=$OUTDIR/partitions.txt
+: > $MANIFEST
+SEED=1
+BYTES=0
+partitions | while read DATE NUM_FLOATS; do
+	DIR=$OUTDIR/store_sales/ss_date=$DATE
+	mkdir -p $DIR
+	# A different seed per partition, so that they don't all hold the
+	# same values.
+	$HERE/create-float-file -H -s $SEED "${GEN_OPTS[@]}" \
+		$NUM_FLOATS > $DIR/data.dat
+	echo "$DATE $((NUM_FLOATS * DOUBLE_SIZE)) $DIR/data.dat" >> $MANIFEST
+	BYTES=$((BYTES + NUM_FLOATS * DOUBLE_SIZE))
+	echo -ne "\rwrote $SEED partitions, $BYTES bytes"
+	SEED=$((SEED + 1))
+done
+echo
+echo "Done!  Manifest in $MANIFEST"
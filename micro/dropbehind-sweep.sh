@@ -0,0 +1,109 @@
+#!/bin/bash
+set -e
+
+# Measures how well dropping pages behind a big scan protects the hot data
+# that foreground readers depend on, the way run_count_remainder.sh competes
+# with the foreground queries in scripts/impala/run_count_concurrent.sh.  The
+# balloon squeezes the page cache so that the hot file fits but the hot file
+# and the scan file together don't.  For each drop-behind mode, the hot file
+# is warmed, vecsum2 scans the scan file over and over in the background, and
+# the foreground scans the hot file RUNS times.  Latency is the seconds each
+# foreground scan took, and the slowdown is against the idle run, which has
+# no background scan.  The resident column is what mincore found of the hot
+# file at the end.
+
+if [ "$#" -lt 2 ]; then echo "$0 <hot float file> <scan float file> [balloon size] [runs] [local/pread]"; exit -1; fi
+
+HOT=$1
+SCAN=$2
+SIZE=${3:-0}
+RUNS=${4:-20}
+TYPE=${5:-local}
+
+if [ $TYPE = local ]; then
+	MODES="off dontneed cold pageout"
+else
+	MODES="off dontneed"
+fi
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+MARKERS=$(mktemp -d)
+trap 'kill $(jobs -p) 2>/dev/null || true; rm -rf $MARKERS' EXIT
+
+# Runs a command in the background, waiting until it creates its marker.
+# Returns 1 if the command exits first.
+start() {
+	local MARKER=$MARKERS/$1
+	shift
+	rm -f $MARKER
+	"$1" -d $MARKER "${@:2}" > $MARKER.out &
+	while [ ! -f $MARKER ]; do
+		if ! kill -0 $! 2>/dev/null; then
+			cat $MARKER.out >&2
+			echo "$1 failed" >&2
+			return 1
+		fi
+		sleep 0.1
+	done
+	PID=$!
+}
+
+# Prints "<median> <p95> <resident%> <scan GB/s>" for one mode, or for no
+# background scan at all if the mode is idle.
+run() {
+	local MODE=$1 SCANNER= START
+	start balloon $HERE/balloon -i 1 -w $HOT $SIZE || return 1
+	BALLOON=$PID
+	$HERE/warmup -i 0 $HOT > /dev/null
+	START=$(date +%s.%N)
+	if [ $MODE != idle ]; then
+		env VECSUM_TYPE=$TYPE VECSUM_PATH=$SCAN VECSUM_PASSES=1000000 \
+			VECSUM_DROP_BEHIND=$MODE stdbuf -oL $HERE/vecsum2 \
+			> $MARKERS/scan.out &
+		SCANNER=$!
+	fi
+	rm -f $MARKERS/latency
+	for RUN in $(seq $RUNS); do
+		VECSUM_TYPE=$TYPE VECSUM_PATH=$HOT VECSUM_PASSES=1 \
+			$HERE/vecsum2 | awk '/^stopwatch: took/ { print $3 }' \
+			>> $MARKERS/latency
+	done
+	# Let the balloon report the hot file once more before stopping.
+	sleep 1.1
+	if [ -n "$SCANNER" ]; then
+		kill $SCANNER
+		wait $SCANNER || true
+	fi
+	kill -INT $BALLOON
+	wait $BALLOON || true
+	sort -n $MARKERS/latency | awk '{ t[NR] = $1 }
+		END { printf "%s %s ", t[int((NR + 1) / 2)],
+			t[int((NR * 95 + 99) / 100)] }'
+	tail -n 1 $MARKERS/balloon.out | awk '
+		{ resident = $(NF - 1); gsub(/%/, "", resident) }
+		END { printf "%s ", resident }'
+	if [ -n "$SCANNER" ]; then
+		grep -c '^finished' $MARKERS/scan.out | awk \
+			-v bytes=$(stat -c %s $SCAN) -v start=$START \
+			-v stop=$(date +%s.%N) '
+			{ gb = $1 * bytes / 1e9
+			  printf "%.4g\n", gb / (stop - start) }'
+	else
+		echo -
+	fi
+}
+
+printf "%-9s %11s %11s %9s %10s %10s\n" mode "median s" "p95 s" slowdown \
+	resident% "scan GB/s"
+for MODE in idle $MODES; do
+	# run prints nothing if it failed, having said why.
+	if ! read MEDIAN P95 RESIDENT GBPS < <(run $MODE); then
+		echo "$0: the $MODE run failed" >&2
+		exit 1
+	fi
+	if [ $MODE = idle ]; then IDLE=$MEDIAN; fi
+	SLOWDOWN=$(awk -v m=$MEDIAN -v i=$IDLE \
+		'BEGIN { printf "%.2fx", (i > 0) ? m / i : 0 }')
+	printf "%-9s %11.4g %11.4g %9s %10s %10s\n" $MODE $MEDIAN $P95 \
+		$SLOWDOWN $RESIDENT $GBPS
+done
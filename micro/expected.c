@@ -0,0 +1,140 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#include "expected.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void expected_acc_init(struct expected_acc *acc, uint64_t offset)
+{
+	memset(acc, 0, sizeof(*acc));
+	acc->offset = offset;
+	acc->exp.min = INFINITY;
+	acc->exp.max = -INFINITY;
+}
+
+/*
+ * Fold the lanes the way vecsum() folds its eight __m128d accumulators:
+ * accumulator k holds lanes 2k and 2k + 1.
+ */
+static double expected_fold(const double *lanes)
+{
+	double x0[2], x1[2], x2[2], x3[2], x4[2], x5[2], x6[2];
+	int l;
+
+	for (l = 0; l < 2; l++) {
+		x0[l] = lanes[0 + l] + lanes[2 + l];
+		x1[l] = lanes[4 + l] + lanes[6 + l];
+		x2[l] = lanes[8 + l] + lanes[10 + l];
+		x3[l] = lanes[12 + l] + lanes[14 + l];
+		x4[l] = x0[l] + x1[l];
+		x5[l] = x2[l] + x3[l];
+		x6[l] = x4[l] + x5[l];
+	}
+	return x6[1] + x6[0];
+}
+
+static int expected_acc_flush(struct expected_acc *acc)
+{
+	if (acc->in_block == 0)
+		return 0;
+	acc->block_sum = expected_fold(acc->lanes);
+	acc->exp.sum += acc->block_sum;
+	memset(acc->lanes, 0, sizeof(acc->lanes));
+	acc->in_block = 0;
+	return 1;
+}
+
+int expected_acc_add(struct expected_acc *acc, double val)
+{
+	acc->lanes[acc->in_block++ % EXPECTED_LANES] += val;
+	acc->exp.count++;
+	if (val < acc->exp.min)
+		acc->exp.min = val;
+	if (val > acc->exp.max)
+		acc->exp.max = val;
+	acc->offset += sizeof(double);
+	if (acc->offset % EXPECTED_BLOCK_SIZE == 0)
+		return expected_acc_flush(acc);
+	return 0;
+}
+
+int expected_acc_finish(struct expected_acc *acc, struct expected *exp)
+{
+	int flushed = expected_acc_flush(acc);
+
+	*exp = acc->exp;
+	return flushed;
+}
+
+int expected_write(const char *path, const struct expected *exp)
+{
+	FILE *fp;
+	int ret;
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		ret = errno;
+		fprintf(stderr, "expected_write: failed to open %s: "
+			"error %d (%s)\n", path, ret, strerror(ret));
+		return ret;
+	}
+	fprintf(fp, "count=%lld\n", exp->count);
+	fprintf(fp, "sum=%a\n", exp->sum);
+	fprintf(fp, "min=%a\n", exp->min);
+	fprintf(fp, "max=%a\n", exp->max);
+	if (fclose(fp)) {
+		ret = errno;
+		fprintf(stderr, "expected_write: failed to write %s: "
+			"error %d (%s)\n", path, ret, strerror(ret));
+		return ret;
+	}
+	return 0;
+}
+
+int expected_read(const char *path, struct expected *exp)
+{
+	FILE *fp;
+	char line[256];
+	int found = 0;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		int ret = errno;
+		fprintf(stderr, "expected_read: failed to open %s: "
+			"error %d (%s)\n", path, ret, strerror(ret));
+		return ret;
+	}
+	memset(exp, 0, sizeof(*exp));
+	while (fgets(line, sizeof(line), fp)) {
+		if (!strncmp(line, "count=", 6)) {
+			exp->count = strtoll(line + 6, NULL, 10);
+			found |= 1;
+		} else if (!strncmp(line, "sum=", 4)) {
+			exp->sum = strtod(line + 4, NULL);
+			found |= 2;
+		} else if (!strncmp(line, "min=", 4)) {
+			exp->min = strtod(line + 4, NULL);
+		} else if (!strncmp(line, "max=", 4)) {
+			exp->max = strtod(line + 4, NULL);
+		}
+	}
+	fclose(fp);
+	if (found != 3) {
+		fprintf(stderr, "expected_read: %s is missing the count or "
+			"the sum.\n", path);
+		return EINVAL;
+	}
+	return 0;
+}
+
+int expected_sum_matches(double a, double b)
+{
+	if (isnan(a) && isnan(b))
+		return 1;
+	return memcmp(&a, &b, sizeof(double)) == 0;
+}
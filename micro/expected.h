@@ -0,0 +1,97 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#ifndef VECSUM_EXPECTED_H
+#define VECSUM_EXPECTED_H
+
+/*
+ * Expected aggregates of a float file.
+ *
+ * create-float-file computes these as it writes the data, and vecsum2 checks
+ * its results against them after every pass, so that a read path which
+ * drops or mangles data can't get away with a fast time.
+ *
+ * Floating-point addition is not associative, so for the sum to be
+ * checkable bit for bit, everyone has to add things up in the same order.
+ * The canonical order is the one vecsum() uses: the file is cut into blocks
+ * at multiples of EXPECTED_BLOCK_SIZE bytes (file offsets, so a header in
+ * front of the data shortens the first block); within a block, element i is
+ * added into lane (i % 16) of sixteen running sums; the lanes are folded
+ * pairwise in a fixed tree; and the block sums are added up in file order.
+ * Every read path must hand vecsum() whole blocks for its sums to come out
+ * right.
+ */
+
+#include <stdint.h>
+
+#define EXPECTED_BLOCK_SIZE (8 * 1024 * 1024)
+#define EXPECTED_LANES 16
+
+struct expected {
+	// Number of doubles in the file.
+	long long count;
+
+	// Sum, in the canonical reduction order.
+	double sum;
+
+	// Smallest and largest values, ignoring NaNs.
+	double min;
+	double max;
+};
+
+/*
+ * Incremental computation of the expected aggregates, one value at a time.
+ */
+struct expected_acc {
+	struct expected exp;
+	double lanes[EXPECTED_LANES];
+	long long in_block;
+
+	// File offset of the next value.
+	uint64_t offset;
+
+	// Sum of the last block to be completed.
+	double block_sum;
+};
+
+/*
+ * Start accumulating values that begin at the given file offset.
+ */
+void expected_acc_init(struct expected_acc *acc, uint64_t offset);
+
+/*
+ * Add the next value.  Returns nonzero if the value completed a block, in
+ * which case the block's sum is in acc->block_sum.
+ */
+int expected_acc_add(struct expected_acc *acc, double val);
+
+/*
+ * Flush the final partial block and return the aggregates.  Returns nonzero
+ * if there was a partial block, in which case its sum is in
+ * acc->block_sum.
+ */
+int expected_acc_finish(struct expected_acc *acc, struct expected *exp);
+
+/*
+ * Write the aggregates to path as key=value lines.  Doubles are written in
+ * hexadecimal floating point, so that they round-trip exactly.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int expected_write(const char *path, const struct expected *exp);
+
+/*
+ * Read aggregates written by expected_write.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int expected_read(const char *path, struct expected *exp);
+
+/*
+ * Returns nonzero if two sums are the same.  NaN matches NaN, since the NaN
+ * payload that comes out of a sum depends on operand order in ways that the
+ * canonical reduction doesn't pin down.
+ */
+int expected_sum_matches(double a, double b);
+
+#endif
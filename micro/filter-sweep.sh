@@ -0,0 +1,54 @@
+#!/bin/bash
+set -e
+
+# Measures how much block zone maps speed up filtered scans, against the
+# selectivity of the filter and the sortedness of the data.  For each
+# distribution and filter width, vecsum2 is run once with zone maps and once
+# without, and the speedup is the ratio of their throughputs.
+
+if [ "$#" -lt 2 ]; then echo "$0 <local/pread/zcr/libhdfs> <number of floats> [passes] [work dir]"; exit -1; fi
+
+TYPE=$1
+NUM_FLOATS=$2
+PASSES=${3:-5}
+WORKDIR=${4:-/tmp/filter-sweep}
+
+# Must match VALUE_RANGE in create-float-file.c
+VALUE_RANGE=100000
+
+DISTS="sorted clustered uniform"
+WIDTHS="0.0001 0.001 0.01 0.1 0.5"
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+mkdir -p $WORKDIR
+
+# Prints "<GB/s> <matched %> <skipped bytes %>" for one run.
+run() {
+	VECSUM_TYPE=$TYPE VECSUM_PATH=$1 VECSUM_PASSES=$PASSES \
+		VECSUM_FILTER=$2 VECSUM_ZONE_MAPS=$3 $HERE/vecsum2 | awk '
+		/^stopwatch: took/ { gbps = $(NF - 1) }
+		/^filter pass/ {
+			matched = $7; gsub(/[(%]/, "", matched)
+			skipped = $(NF); gsub(/[()%]/, "", skipped)
+		}
+		END { print gbps, matched, skipped }'
+}
+
+printf "%-10s %8s %10s %9s %10s %10s %8s\n" dist width "matched%" "skipped%" \
+	"GB/s(zm)" "GB/s(scan)" speedup
+for DIST in $DISTS; do
+	FILE=$WORKDIR/$DIST-$NUM_FLOATS.dat
+	if [ ! -f $FILE ]; then
+		$HERE/create-float-file -H -d $DIST $NUM_FLOATS > $FILE
+	fi
+	for WIDTH in $WIDTHS; do
+		# Center the range, so that it always has values to match.
+		FILTER=$(awk -v r=$VALUE_RANGE -v w=$WIDTH \
+			'BEGIN { printf "%.17g:%.17g", r * (0.5 - w / 2), r * (0.5 + w / 2) }')
+		read ZM_GBPS MATCHED SKIPPED < <(run $FILE $FILTER 1)
+		read SCAN_GBPS _ _ < <(run $FILE $FILTER 0)
+		printf "%-10s %8s %10s %9s %10.4g %10.4g %7.2fx\n" $DIST $WIDTH \
+			$MATCHED $SKIPPED $ZM_GBPS $SCAN_GBPS \
+			$(awk -v a=$ZM_GBPS -v b=$SCAN_GBPS 'BEGIN { print a / b }')
+	done
+done
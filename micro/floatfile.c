@@ -0,0 +1,232 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#include "floatfile.h"
+
+#include "expected.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nmmintrin.h"
+
+void floatfile_header_init(struct floatfile_header *hdr, uint64_t count)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, FLOATFILE_MAGIC, FLOATFILE_MAGIC_LEN);
+	hdr->version = FLOATFILE_VERSION;
+	hdr->endian_tag = FLOATFILE_ENDIAN_TAG;
+	hdr->dtype = FLOATFILE_DTYPE_F64;
+	hdr->encoding = FLOATFILE_ENCODING_PLAIN;
+	hdr->block_size = EXPECTED_BLOCK_SIZE;
+	hdr->count = count;
+	hdr->payload_offset = FLOATFILE_HEADER_SIZE;
+	hdr->payload_length = count * sizeof(double);
+	hdr->footer_offset = hdr->payload_offset + hdr->payload_length;
+	hdr->footer_length = sizeof(struct floatfile_footer) +
+		floatfile_num_blocks(hdr) * sizeof(struct floatfile_block);
+	hdr->header_crc = floatfile_crc32c(0, hdr,
+		offsetof(struct floatfile_header, header_crc));
+}
+
+int floatfile_has_header(const void *buf, long long len)
+{
+	return (len >= (long long)sizeof(struct floatfile_header)) &&
+		!memcmp(buf, FLOATFILE_MAGIC, FLOATFILE_MAGIC_LEN);
+}
+
+int floatfile_header_check(const struct floatfile_header *hdr,
+		long long file_length)
+{
+	uint32_t crc;
+
+	crc = floatfile_crc32c(0, hdr,
+		offsetof(struct floatfile_header, header_crc));
+	if (crc != hdr->header_crc) {
+		fprintf(stderr, "floatfile: header checksum mismatch: got "
+			"0x%08x, expected 0x%08x\n", crc, hdr->header_crc);
+		return EINVAL;
+	}
+	if (hdr->endian_tag != FLOATFILE_ENDIAN_TAG) {
+		fprintf(stderr, "floatfile: the file was written on a machine "
+			"with a different byte order.\n");
+		return EINVAL;
+	}
+	if (hdr->version != FLOATFILE_VERSION) {
+		fprintf(stderr, "floatfile: unsupported version %u\n",
+			hdr->version);
+		return EINVAL;
+	}
+	if (hdr->dtype != FLOATFILE_DTYPE_F64) {
+		fprintf(stderr, "floatfile: unsupported dtype %u\n",
+			hdr->dtype);
+		return EINVAL;
+	}
+	if (hdr->encoding != FLOATFILE_ENCODING_PLAIN) {
+		fprintf(stderr, "floatfile: unsupported encoding %u\n",
+			hdr->encoding);
+		return EINVAL;
+	}
+	if ((hdr->block_size == 0) || (hdr->block_size % sizeof(double))) {
+		fprintf(stderr, "floatfile: invalid block size %u\n",
+			hdr->block_size);
+		return EINVAL;
+	}
+	if ((hdr->payload_offset < sizeof(struct floatfile_header)) ||
+			(hdr->payload_offset % sizeof(double)) ||
+			(hdr->payload_length != hdr->count * sizeof(double)) ||
+			(hdr->footer_offset !=
+			 hdr->payload_offset + hdr->payload_length) ||
+			(hdr->footer_offset + hdr->footer_length !=
+			 (uint64_t)file_length)) {
+		fprintf(stderr, "floatfile: the header describes a layout "
+			"that does not fit a file of %lld bytes.\n",
+			file_length);
+		return EINVAL;
+	}
+	return 0;
+}
+
+int floatfile_footer_check(const struct floatfile_header *hdr,
+		const struct floatfile_footer *ftr)
+{
+	if (memcmp(ftr->magic, FLOATFILE_FOOTER_MAGIC, FLOATFILE_MAGIC_LEN)) {
+		fprintf(stderr, "floatfile: bad footer magic\n");
+		return EINVAL;
+	}
+	if (ftr->version != hdr->version) {
+		fprintf(stderr, "floatfile: footer version %u does not match "
+			"header version %u\n", ftr->version, hdr->version);
+		return EINVAL;
+	}
+	if ((ftr->num_blocks != floatfile_num_blocks(hdr)) ||
+			(ftr->block_entry_size < sizeof(struct floatfile_block)) ||
+			(sizeof(struct floatfile_footer) +
+			 ftr->num_blocks * ftr->block_entry_size !=
+			 hdr->footer_length)) {
+		fprintf(stderr, "floatfile: the footer's block table does not "
+			"match the header.\n");
+		return EINVAL;
+	}
+	if (ftr->count != hdr->count) {
+		fprintf(stderr, "floatfile: footer count %llu does not match "
+			"header count %llu\n", (unsigned long long)ftr->count,
+			(unsigned long long)hdr->count);
+		return EINVAL;
+	}
+	return 0;
+}
+
+uint64_t floatfile_num_blocks(const struct floatfile_header *hdr)
+{
+	uint64_t first, last;
+
+	if (hdr->payload_length == 0)
+		return 0;
+	first = hdr->payload_offset / hdr->block_size;
+	last = (hdr->payload_offset + hdr->payload_length - 1) /
+		hdr->block_size;
+	return last - first + 1;
+}
+
+uint64_t floatfile_block_left(uint64_t block_size, uint64_t offset)
+{
+	return block_size - (offset % block_size);
+}
+
+const struct floatfile_block *floatfile_block_get(
+		const struct floatfile_footer *ftr, uint64_t i)
+{
+	return (const struct floatfile_block *)((const char *)(ftr + 1) +
+			i * ftr->block_entry_size);
+}
+
+int floatfile_block_may_match(const struct floatfile_block *blk,
+		double lo, double hi)
+{
+	return (blk->max >= lo) && (blk->min <= hi);
+}
+
+#define CRC32C_POLY 0x82f63b78U
+
+static uint32_t g_crc32c_table[8][256];
+
+// Scan threads may checksum their first blocks at the same time.
+static pthread_once_t g_crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init_table(void)
+{
+	uint32_t crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+		g_crc32c_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++) {
+		crc = g_crc32c_table[0][i];
+		for (j = 1; j < 8; j++) {
+			crc = (crc >> 8) ^ g_crc32c_table[0][crc & 0xff];
+			g_crc32c_table[j][i] = crc;
+		}
+	}
+}
+
+/*
+ * Slicing-by-8, for CPUs without SSE4.2.
+ */
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, uint64_t len)
+{
+	uint64_t word;
+
+	pthread_once(&g_crc32c_once, crc32c_init_table);
+	while (len >= 8) {
+		memcpy(&word, p, sizeof(word));
+		word ^= crc;
+		crc = g_crc32c_table[7][word & 0xff] ^
+			g_crc32c_table[6][(word >> 8) & 0xff] ^
+			g_crc32c_table[5][(word >> 16) & 0xff] ^
+			g_crc32c_table[4][(word >> 24) & 0xff] ^
+			g_crc32c_table[3][(word >> 32) & 0xff] ^
+			g_crc32c_table[2][(word >> 40) & 0xff] ^
+			g_crc32c_table[1][(word >> 48) & 0xff] ^
+			g_crc32c_table[0][word >> 56];
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc = (crc >> 8) ^ g_crc32c_table[0][(crc ^ *p++) & 0xff];
+	return crc;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, uint64_t len)
+{
+	uint64_t c = crc, word;
+
+	while (len >= 8) {
+		memcpy(&word, p, sizeof(word));
+		c = _mm_crc32_u64(c, word);
+		p += 8;
+		len -= 8;
+	}
+	crc = c;
+	while (len--)
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+
+uint32_t floatfile_crc32c(uint32_t crc, const void *buf, uint64_t len)
+{
+	crc = ~crc;
+	if (__builtin_cpu_supports("sse4.2"))
+		crc = crc32c_hw(crc, buf, len);
+	else
+		crc = crc32c_sw(crc, buf, len);
+	return ~crc;
+}
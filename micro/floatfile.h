@@ -0,0 +1,158 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#ifndef VECSUM_FLOATFILE_H
+#define VECSUM_FLOATFILE_H
+
+/*
+ * The self-describing float file format.
+ *
+ * A float file is a header page, followed by the payload, followed by a
+ * footer:
+ *
+ *   [0, header_size)                 struct floatfile_header, zero padded
+ *   [payload_offset, footer_offset)  count values of type dtype
+ *   [footer_offset, end of file)     struct floatfile_footer, then
+ *                                    num_blocks block entries
+ *
+ * The header is padded out to a whole page, so the payload stays page
+ * aligned for mmap and zero-copy reads.  The generator streams its output,
+ * so anything that is only known after all the values have been written
+ * (checksums and aggregates) goes in the footer; the header records where
+ * the footer will be.
+ *
+ * Blocks are block_size bytes long and start at multiples of block_size in
+ * the file, not in the payload, so that they line up with HDFS blocks.  The
+ * first block is therefore shortened by the header, and the last one by
+ * the end of the payload.
+ *
+ * Every integer is stored in the writer's byte order; readers check the
+ * endian tag and refuse files they would misread.
+ */
+
+#include <stdint.h>
+
+#define FLOATFILE_MAGIC "VSUMFILE"
+#define FLOATFILE_FOOTER_MAGIC "VSUMFOOT"
+#define FLOATFILE_MAGIC_LEN 8
+#define FLOATFILE_VERSION 1
+#define FLOATFILE_HEADER_SIZE 4096
+#define FLOATFILE_ENDIAN_TAG 0x01020304U
+
+enum floatfile_dtype {
+	FLOATFILE_DTYPE_F64 = 1,
+};
+
+enum floatfile_encoding {
+	FLOATFILE_ENCODING_PLAIN = 0,
+};
+
+struct floatfile_header {
+	char magic[FLOATFILE_MAGIC_LEN];
+	uint32_t version;
+	uint32_t endian_tag;
+	uint32_t dtype;
+	uint32_t encoding;
+	uint32_t block_size;
+	uint32_t reserved;
+	uint64_t count;
+	uint64_t payload_offset;
+	uint64_t payload_length;
+	uint64_t footer_offset;
+	uint64_t footer_length;
+
+	// CRC32C of everything above.
+	uint32_t header_crc;
+};
+
+struct floatfile_footer {
+	char magic[FLOATFILE_MAGIC_LEN];
+	uint32_t version;
+
+	// Size of each block entry.  Readers must step through the entries
+	// by this much, so that newer writers can append fields.
+	uint32_t block_entry_size;
+	uint64_t num_blocks;
+
+	// Aggregates over the whole payload, as in struct expected.
+	uint64_t count;
+	double sum;
+	double min;
+	double max;
+};
+
+struct floatfile_block {
+	// CRC32C of the block's bytes.
+	uint32_t crc;
+
+	// Number of values in the block.
+	uint32_t count;
+
+	// Sum of the block, in the canonical reduction order.
+	double sum;
+
+	// Zone map: the smallest and largest values in the block, ignoring
+	// NaNs.  A block of nothing but NaNs has min = +inf and max = -inf,
+	// so no range predicate can match it.
+	double min;
+	double max;
+};
+
+/*
+ * Fill in a header for a file of count doubles.
+ */
+void floatfile_header_init(struct floatfile_header *hdr, uint64_t count);
+
+/*
+ * Returns nonzero if buf starts with a float file header.
+ */
+int floatfile_has_header(const void *buf, long long len);
+
+/*
+ * Check that a header is intact, describes a file of file_length bytes,
+ * and uses only features this reader understands.
+ *
+ * Returns 0 on success, or EINVAL after printing what is wrong.
+ */
+int floatfile_header_check(const struct floatfile_header *hdr,
+		long long file_length);
+
+/*
+ * Check the footer that the header points to.  The footer is followed by
+ * its block entries.
+ *
+ * Returns 0 on success, or EINVAL after printing what is wrong.
+ */
+int floatfile_footer_check(const struct floatfile_header *hdr,
+		const struct floatfile_footer *ftr);
+
+/*
+ * Number of blocks in a payload.
+ */
+uint64_t floatfile_num_blocks(const struct floatfile_header *hdr);
+
+/*
+ * Bytes between offset and the end of the block containing it.
+ */
+uint64_t floatfile_block_left(uint64_t block_size, uint64_t offset);
+
+/*
+ * Get the i'th block entry following a footer.
+ */
+const struct floatfile_block *floatfile_block_get(
+		const struct floatfile_footer *ftr, uint64_t i);
+
+/*
+ * Returns nonzero if a block might hold values in [lo, hi], going by its
+ * zone map.
+ */
+int floatfile_block_may_match(const struct floatfile_block *blk,
+		double lo, double hi);
+
+/*
+ * CRC32C (Castagnoli).  Pass 0 as crc to start a new checksum.  Uses the
+ * SSE4.2 crc32 instruction when the CPU has it.
+ */
+uint32_t floatfile_crc32c(uint32_t crc, const void *buf, uint64_t len);
+
+#endif
@@ -0,0 +1,383 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blocktrace.h"
+#include "cachepolicy.h"
+#include "util.h"
+
+// The block size vecsum2 caches at.
+#define DEFAULT_BLOCK_SIZE (8 * 1024 * 1024)
+
+// SHARDS samples a block if the low bits of its hash are below
+// rate * MRC_SAMPLE_MODULUS.
+#define MRC_SAMPLE_MODULUS (1ULL << 24)
+
+#define USAGE \
+"usage: mrc [options] <trace>\n" \
+"\n" \
+"Computes the miss ratio curve of a block trace written by vecsum2\n" \
+"(VECSUM_TRACE): the fraction of accesses that would miss a cache of each\n" \
+"size.  The LRU curve comes from Mattson stack distances over a SHARDS\n" \
+"spatial sample of the blocks (Waldspurger et al., FAST '15).  The other\n" \
+"policies are approximated by simulating them on the same sample with the\n" \
+"cache scaled down by the sampling rate (Waldspurger et al., ATC '17);\n" \
+"a - means the scaled cache is too small to simulate.\n" \
+"\n" \
+"options:\n" \
+"  -r <rate>    fraction of blocks to sample (default 0.01; 1 is exact)\n" \
+"  -b <bytes>   cache block size (default 8 MiB)\n" \
+"  -n <points>  number of cache sizes on the curve (default 20)\n" \
+"  -c <bytes>   largest cache size (default the working set)\n" \
+"  -p <policy>  " CACHE_POLICY_VALID_VALUES ",\n" \
+"               or all (the default)\n" \
+"  -m           only include the reads that missed vecsum2's cache\n"
+
+struct mrc {
+	double rate;
+	uint64_t threshold;
+	long long block_size;
+	int misses_only;
+
+	// Every block access in the trace, and the sampled ones in order
+	long long accesses;
+	uint64_t *keys;
+	long long num_keys;
+	long long keys_cap;
+
+	// Last access time of each sampled block, in an open-addressed
+	// table with linear probing
+	uint64_t *table_keys;
+	long long *table_times;
+	uint64_t table_mask;
+	long long distinct;
+
+	// Fenwick tree over access times, with a 1 at each block's most
+	// recent access
+	int *fenwick;
+
+	// hist[d] counts reuses at a stack distance of d sampled blocks
+	double *hist;
+	double cold;
+};
+
+static int mrc_sampled(const struct mrc *m, uint64_t key)
+{
+	return (mix64(key) & (MRC_SAMPLE_MODULUS - 1)) < m->threshold;
+}
+
+static uint64_t mrc_key(uint32_t file, uint64_t block)
+{
+	return ((uint64_t)file << 40) | block;
+}
+
+/*
+ * Keep a record if it touches a sampled block.  Counts every block access,
+ * sampled or not.
+ */
+static int mrc_filter(const struct blocktrace_record *rec, void *arg)
+{
+	struct mrc *m = arg;
+	uint64_t b, first, last;
+	int keep = 0;
+
+	if (rec->length == 0)
+		return 0;
+	if (m->misses_only && (rec->flags & BLOCKTRACE_FLAG_HIT))
+		return 0;
+	first = rec->offset / m->block_size;
+	last = (rec->offset + rec->length - 1) / m->block_size;
+	m->accesses += last - first + 1;
+	for (b = first; (b <= last) && !keep; b++)
+		keep = mrc_sampled(m, mrc_key(rec->file, b));
+	return keep;
+}
+
+/*
+ * Expand the kept records into the sampled block accesses, in time order.
+ */
+static int mrc_collect(struct mrc *m, const struct blocktrace_log *log)
+{
+	const struct blocktrace_record *rec;
+	uint64_t b, key, *keys;
+	long long i;
+
+	for (i = 0; i < log->num_recs; i++) {
+		rec = &log->recs[i];
+		for (b = rec->offset / m->block_size;
+				b <= (rec->offset + rec->length - 1) /
+					m->block_size; b++) {
+			key = mrc_key(rec->file, b);
+			if (!mrc_sampled(m, key))
+				continue;
+			if (m->num_keys == m->keys_cap) {
+				m->keys_cap = m->keys_cap ?
+					(m->keys_cap * 2) : 4096;
+				keys = realloc(m->keys,
+					m->keys_cap * sizeof(uint64_t));
+				if (!keys)
+					return ENOMEM;
+				m->keys = keys;
+			}
+			m->keys[m->num_keys++] = key;
+		}
+	}
+	return 0;
+}
+
+static void fenwick_add(int *fenwick, long long n, long long i, int delta)
+{
+	for (i++; i <= n; i += i & -i)
+		fenwick[i - 1] += delta;
+}
+
+// Sum of [0, i).
+static long long fenwick_sum(const int *fenwick, long long i)
+{
+	long long sum = 0;
+
+	for (; i > 0; i -= i & -i)
+		sum += fenwick[i - 1];
+	return sum;
+}
+
+/*
+ * Find the table slot for key, or the empty one where it would go.
+ */
+static uint64_t mrc_find(const struct mrc *m, uint64_t key)
+{
+	uint64_t i = mix64(key ^ 0x5851f42d4c957f2dULL) & m->table_mask;
+
+	while ((m->table_times[i] >= 0) && (m->table_keys[i] != key))
+		i = (i + 1) & m->table_mask;
+	return i;
+}
+
+/*
+ * Run Mattson's stack algorithm over the sampled accesses.  The stack
+ * distance of a reuse is the number of distinct blocks touched since the
+ * last access to the same block, which the Fenwick tree counts in log
+ * time.
+ */
+static int mrc_stack_distances(struct mrc *m)
+{
+	uint64_t size, slot;
+	long long t, last;
+
+	for (size = 1; size < 2 * (uint64_t)m->num_keys; )
+		size <<= 1;
+	m->table_mask = size - 1;
+	m->table_keys = malloc(size * sizeof(uint64_t));
+	m->table_times = malloc(size * sizeof(long long));
+	m->fenwick = calloc(m->num_keys, sizeof(int));
+	m->hist = calloc(m->num_keys + 1, sizeof(double));
+	if (!m->table_keys || !m->table_times || !m->fenwick || !m->hist)
+		return ENOMEM;
+	memset(m->table_times, 0xff, size * sizeof(long long));
+	for (t = 0; t < m->num_keys; t++) {
+		slot = mrc_find(m, m->keys[t]);
+		last = m->table_times[slot];
+		if (last < 0) {
+			m->table_keys[slot] = m->keys[t];
+			m->distinct++;
+			m->cold++;
+		} else {
+			m->hist[fenwick_sum(m->fenwick, t) -
+				fenwick_sum(m->fenwick, last + 1)]++;
+			fenwick_add(m->fenwick, m->num_keys, last, -1);
+		}
+		m->table_times[slot] = t;
+		fenwick_add(m->fenwick, m->num_keys, t, 1);
+	}
+	// SHARDS_adj: the sample holds more or fewer accesses than the
+	// rate predicts.  Credit the difference to the smallest distance,
+	// which is where the error matters least, but not below zero.
+	m->hist[0] += m->accesses * m->rate - m->num_keys;
+	if (m->hist[0] < 0)
+		m->hist[0] = 0;
+	return 0;
+}
+
+/*
+ * LRU miss ratio for a cache of the given number of blocks.
+ */
+static double mrc_lru(const struct mrc *m, long long blocks)
+{
+	double total = m->accesses * m->rate, hits = 0;
+	long long d;
+
+	// A reuse at sampled distance d hits if d / rate < blocks.
+	for (d = 0; (d < m->num_keys) && (d < blocks * m->rate); d++)
+		hits += m->hist[d];
+	// The adjustment is an estimate, so keep the ratio in [0, 1].
+	if (hits > total)
+		hits = total;
+	else if (hits < 0)
+		hits = 0;
+	return (total - hits) / total;
+}
+
+/*
+ * Miss ratio of a policy, simulated on the sample with the cache scaled by
+ * the rate.  Returns -1 if the scaled cache is too small to simulate.
+ */
+static double mrc_simulate(const struct mrc *m, enum cache_policy_type type,
+		long long blocks)
+{
+	struct cache_policy *cp;
+	long long i, cap = llround(blocks * m->rate), misses = 0;
+	uint64_t victim;
+
+	if ((cap < 2) || cache_policy_create(type, cap, &cp))
+		return -1;
+	for (i = 0; i < m->num_keys; i++) {
+		if (cache_policy_access(cp, m->keys[i], &victim) !=
+				CACHE_POLICY_HIT)
+			misses++;
+	}
+	cache_policy_free(cp);
+	return (double)misses / m->num_keys;
+}
+
+static void mrc_free(struct mrc *m)
+{
+	free(m->keys);
+	free(m->table_keys);
+	free(m->table_times);
+	free(m->fenwick);
+	free(m->hist);
+}
+
+int main(int argc, char **argv)
+{
+	struct mrc m;
+	struct blocktrace_log *log = NULL;
+	long long max_bytes = 0, working_set, blocks, last_blocks = 0;
+	double start, miss;
+	int c, i, p, policy = -1, points = 20, ret = 1;
+
+	memset(&m, 0, sizeof(m));
+	m.rate = 0.01;
+	m.block_size = DEFAULT_BLOCK_SIZE;
+	while ((c = getopt(argc, argv, "r:b:n:c:p:m")) != -1) {
+		switch (c) {
+		case 'r':
+			m.rate = atof(optarg);
+			if ((m.rate <= 0) || (m.rate > 1)) {
+				fprintf(stderr, "the sampling rate must be "
+					"in (0, 1].\n" USAGE);
+				return 1;
+			}
+			break;
+		case 'b':
+			m.block_size = atoll(optarg);
+			if (m.block_size <= 0) {
+				fprintf(stderr, "invalid block size %s\n"
+					USAGE, optarg);
+				return 1;
+			}
+			break;
+		case 'n':
+			points = atoi(optarg);
+			if (points < 1) {
+				fprintf(stderr, "there must be at least one "
+					"point.\n" USAGE);
+				return 1;
+			}
+			break;
+		case 'c':
+			max_bytes = atoll(optarg);
+			break;
+		case 'p':
+			if (!strcmp(optarg, "all"))
+				break;
+			policy = cache_policy_parse(optarg);
+			if (policy < 0) {
+				fprintf(stderr, "unknown policy %s\n" USAGE,
+					optarg);
+				return 1;
+			}
+			break;
+		case 'm':
+			m.misses_only = 1;
+			break;
+		default:
+			fprintf(stderr, USAGE);
+			return 1;
+		}
+	}
+	if (argc - optind != 1) {
+		fprintf(stderr, USAGE);
+		return 1;
+	}
+	m.threshold = llround(m.rate * MRC_SAMPLE_MODULUS);
+	if (m.threshold == 0) {
+		fprintf(stderr, "the sampling rate is below the hash's "
+			"resolution of 1/%llu.\n", MRC_SAMPLE_MODULUS);
+		return 1;
+	}
+	start = monotonic_seconds();
+	if (blocktrace_load(argv[optind], mrc_filter, &m, &log))
+		goto done;
+	if (mrc_collect(&m, log))
+		goto done;
+	blocktrace_log_free(log);
+	log = NULL;
+	if (m.num_keys == 0) {
+		fprintf(stderr, "no block accesses were sampled; try a "
+			"higher rate.\n");
+		goto done;
+	}
+	if (mrc_stack_distances(&m)) {
+		fprintf(stderr, "out of memory\n");
+		goto done;
+	}
+	working_set = llround(m.distinct / m.rate);
+	if (max_bytes <= 0)
+		max_bytes = working_set * m.block_size;
+	printf("%lld block accesses, %lld sampled (rate %g), working set "
+		"about %lld blocks (%lld bytes); analyzed in %.3g seconds\n",
+		m.accesses, m.num_keys, m.rate, working_set,
+		working_set * m.block_size, monotonic_seconds() - start);
+	printf("%16s  %10s  %8s", "cache bytes", "blocks", "lru");
+	for (p = 0; p < CACHE_POLICY_MAX; p++) {
+		if ((p != CACHE_POLICY_LRU) && ((policy < 0) || (p == policy)))
+			printf("  %8s", cache_policy_name(p));
+	}
+	printf("\n");
+	for (i = 1; i <= points; i++) {
+		blocks = (max_bytes / m.block_size * i + points - 1) / points;
+		// Small working sets round several points to the same size.
+		if ((blocks < 1) || (blocks == last_blocks))
+			continue;
+		last_blocks = blocks;
+		printf("%16lld  %10lld  %8.4f", blocks * m.block_size, blocks,
+			mrc_lru(&m, blocks));
+		for (p = 0; p < CACHE_POLICY_MAX; p++) {
+			if ((p == CACHE_POLICY_LRU) ||
+					((policy >= 0) && (p != policy)))
+				continue;
+			miss = mrc_simulate(&m, p, blocks);
+			if (miss < 0)
+				printf("  %8s", "-");
+			else
+				printf("  %8.4f", miss);
+		}
+		printf("\n");
+	}
+	ret = 0;
+done:
+	blocktrace_log_free(log);
+	mrc_free(&m);
+	return ret;
+}
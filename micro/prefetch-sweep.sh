@@ -0,0 +1,60 @@
+#!/bin/bash
+set -e
+
+# Measures how much of the gap between a scan that hits the block cache and
+# one that misses it the prefetcher closes.  The cached run has a block
+# cache big enough for the whole file; the uncached runs have none, and read
+# every chunk with pread, with each prefetch depth in turn (0 is no
+# prefetching).  Throughput is from the last pass of each run, once the
+# cache is warm.
+
+if [ "$#" -lt 1 ]; then echo "$0 <float file> [passes] [depths] [threads]"; exit -1; fi
+
+FILE=$1
+PASSES=${2:-3}
+DEPTHS=${3:-"0 1 2 4 8 16"}
+THREADS=${4:-1}
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+RESULTS=$(mktemp)
+trap "rm -f $RESULTS" EXIT
+
+# Prints "<accuracy> <coverage> <timeliness> <GB/s>" for the last pass of
+# one run, given its environment.
+run() {
+	rm -f $RESULTS
+	env VECSUM_TYPE=pread VECSUM_PATH=$FILE VECSUM_PASSES=$PASSES \
+		VECSUM_RESULTS=$RESULTS VECSUM_PREFETCH_THREADS=$THREADS "$@" \
+		$HERE/vecsum2 | awk '
+		/^prefetch pass/ {
+			acc = $16; cov = $18; tim = $20
+			gsub(/,/, "", acc); gsub(/,/, "", cov)
+			gsub(/,/, "", tim)
+		}
+		END { printf "%s %s %s", (acc == "" ? "-" : acc),
+			(cov == "" ? "-" : cov), (tim == "" ? "-" : tim) }'
+	echo -n " "
+	sed -n 's/.*gbps=\([0-9.,]*\).*/\1/p' $RESULTS | awk -F, '{ print $NF }'
+}
+
+# Room for every block, rounded up to whole 8 MiB blocks.
+CACHE=$(( ($(stat -c %s $FILE) / 8388608 + 2) * 8388608 ))
+read _ _ _ CACHED < <(run VECSUM_CACHE_BYTES=$CACHE)
+read BASE_ACC BASE_COV BASE_TIM UNCACHED < <(run VECSUM_PREFETCH_DEPTH=0)
+
+printf "%-8s %6s %9s %9s %9s %11s %11s\n" run depth "GB/s" accuracy \
+	coverage timeliness "gap closed"
+printf "%-8s %6s %9.4g %9s %9s %11s %11s\n" cached - $CACHED - - - -
+for DEPTH in $DEPTHS; do
+	# Depth 0 is the baseline itself; a second run of it would only
+	# measure noise.
+	if [ "$DEPTH" -eq 0 ]; then
+		ACC=$BASE_ACC COV=$BASE_COV TIM=$BASE_TIM GBPS=$UNCACHED
+	else
+		read ACC COV TIM GBPS < <(run VECSUM_PREFETCH_DEPTH=$DEPTH)
+	fi
+	CLOSED=$(awk -v c=$CACHED -v u=$UNCACHED -v g=$GBPS \
+		'BEGIN { printf "%.1f%%", (c > u) ? 100 * (g - u) / (c - u) : 0 }')
+	printf "%-8s %6s %9.4g %9s %9s %11s %11s\n" uncached $DEPTH $GBPS \
+		$ACC $COV $TIM $CLOSED
+done
@@ -0,0 +1,370 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include "prefetch.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+enum prefetch_state {
+	PREFETCH_FREE = 0,
+	PREFETCH_QUEUED,
+	PREFETCH_READING,
+	PREFETCH_READY,
+
+	// Returned to the reader, until its next read
+	PREFETCH_HELD,
+};
+
+struct prefetch_slot {
+	enum prefetch_state state;
+	char *buf;
+	long long off;
+	int len;
+
+	// Bytes read, or a negative errno value
+	int res;
+
+	// Order of issue, so that the I/O threads read in stream order
+	uint64_t seq;
+
+	// Set when a chunk is thrown away while it is being read
+	int discard;
+};
+
+struct prefetcher {
+	int fd;
+	long long start;
+	long long end;
+	int chunk_size;
+
+	// max_depth slots for chunks read ahead, and one for the reader
+	struct prefetch_slot *slots;
+	int num_slots;
+	struct prefetch_slot *held;
+	uint64_t next_seq;
+
+	// Where demand reads go
+	char *demand_buf;
+
+	// The stream: the last offset read, the stride before it, and how
+	// many strides in a row have matched
+	long long last_off;
+	long long stride;
+	int run;
+
+	int depth;
+	int max_depth;
+
+	pthread_t *threads;
+	int num_threads;
+	int stopping;
+	pthread_mutex_t lock;
+
+	// Signaled when a chunk is queued, and when one is read
+	pthread_cond_t queued;
+	pthread_cond_t done;
+
+	struct prefetch_stats stats;
+};
+
+/*
+ * Read len bytes at off, retrying short reads until the end of the file.
+ * Returns the number of bytes read, or a negative errno value.
+ */
+static int prefetch_pread(int fd, char *buf, long long off, int len)
+{
+	ssize_t res;
+	int nread = 0;
+
+	while (nread < len) {
+		res = pread(fd, buf + nread, len - nread, off + nread);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (res == 0)
+			break;
+		nread += res;
+	}
+	return nread;
+}
+
+static void *prefetch_thread_run(void *arg)
+{
+	struct prefetcher *pf = arg;
+	struct prefetch_slot *slot;
+	int i, res;
+
+	pthread_mutex_lock(&pf->lock);
+	while (!pf->stopping) {
+		// Take the oldest queued chunk.
+		slot = NULL;
+		for (i = 0; i < pf->num_slots; i++) {
+			if ((pf->slots[i].state == PREFETCH_QUEUED) &&
+					(!slot || (pf->slots[i].seq < slot->seq)))
+				slot = &pf->slots[i];
+		}
+		if (!slot) {
+			pthread_cond_wait(&pf->queued, &pf->lock);
+			continue;
+		}
+		slot->state = PREFETCH_READING;
+		pthread_mutex_unlock(&pf->lock);
+		res = prefetch_pread(pf->fd, slot->buf, slot->off, slot->len);
+		pthread_mutex_lock(&pf->lock);
+		slot->res = res;
+		if (slot->discard) {
+			slot->discard = 0;
+			slot->state = PREFETCH_FREE;
+		} else {
+			slot->state = PREFETCH_READY;
+		}
+		pthread_cond_broadcast(&pf->done);
+	}
+	pthread_mutex_unlock(&pf->lock);
+	return NULL;
+}
+
+int prefetch_create(int fd, long long start, long long end, int chunk_size,
+		int max_depth, int num_threads, struct prefetcher **out)
+{
+	struct prefetcher *pf;
+	int i, ret;
+
+	if ((chunk_size <= 0) || (max_depth < 1) || (num_threads < 1))
+		return EINVAL;
+	pf = calloc(1, sizeof(*pf));
+	if (!pf)
+		return ENOMEM;
+	pf->fd = fd;
+	pf->start = start;
+	pf->end = end;
+	pf->chunk_size = chunk_size;
+	pf->max_depth = max_depth;
+	pf->depth = 1;
+	pf->last_off = -1;
+	pthread_mutex_init(&pf->lock, NULL);
+	pthread_cond_init(&pf->queued, NULL);
+	pthread_cond_init(&pf->done, NULL);
+	pf->num_slots = max_depth + 1;
+	pf->slots = calloc(pf->num_slots, sizeof(struct prefetch_slot));
+	pf->threads = calloc(num_threads, sizeof(pthread_t));
+	if (!pf->slots || !pf->threads) {
+		ret = ENOMEM;
+		goto error;
+	}
+	for (i = 0; i < pf->num_slots; i++) {
+		if (posix_memalign((void **)&pf->slots[i].buf,
+				sysconf(_SC_PAGESIZE), chunk_size)) {
+			ret = ENOMEM;
+			goto error;
+		}
+	}
+	if (posix_memalign((void **)&pf->demand_buf, sysconf(_SC_PAGESIZE),
+			chunk_size)) {
+		ret = ENOMEM;
+		goto error;
+	}
+	for (; pf->num_threads < num_threads; pf->num_threads++) {
+		ret = pthread_create(&pf->threads[pf->num_threads], NULL,
+			prefetch_thread_run, pf);
+		if (ret)
+			goto error;
+	}
+	*out = pf;
+	return 0;
+
+error:
+	prefetch_free(pf);
+	return ret;
+}
+
+void prefetch_free(struct prefetcher *pf)
+{
+	int i;
+
+	if (!pf)
+		return;
+	pthread_mutex_lock(&pf->lock);
+	pf->stopping = 1;
+	pthread_cond_broadcast(&pf->queued);
+	pthread_mutex_unlock(&pf->lock);
+	for (i = 0; i < pf->num_threads; i++)
+		pthread_join(pf->threads[i], NULL);
+	if (pf->slots) {
+		for (i = 0; i < pf->num_slots; i++)
+			free(pf->slots[i].buf);
+	}
+	free(pf->slots);
+	free(pf->threads);
+	free(pf->demand_buf);
+	pthread_cond_destroy(&pf->done);
+	pthread_cond_destroy(&pf->queued);
+	pthread_mutex_destroy(&pf->lock);
+	free(pf);
+}
+
+/*
+ * Throw away a chunk that was read ahead.  Called with the lock held.
+ */
+static void prefetch_discard(struct prefetcher *pf, struct prefetch_slot *slot)
+{
+	if (slot->state == PREFETCH_READING)
+		slot->discard = 1;
+	else
+		slot->state = PREFETCH_FREE;
+	pf->stats.wasted++;
+	if (pf->depth > 1)
+		pf->depth /= 2;
+}
+
+/*
+ * Nonzero if a slot holds a chunk read ahead that nobody has taken yet.
+ */
+static int prefetch_pending(const struct prefetch_slot *slot)
+{
+	return ((slot->state == PREFETCH_QUEUED) ||
+		(slot->state == PREFETCH_READING) ||
+		(slot->state == PREFETCH_READY)) && !slot->discard;
+}
+
+static struct prefetch_slot *prefetch_find(struct prefetcher *pf,
+		long long off)
+{
+	int i;
+
+	for (i = 0; i < pf->num_slots; i++) {
+		if (prefetch_pending(&pf->slots[i]) &&
+				(pf->slots[i].off == off))
+			return &pf->slots[i];
+	}
+	return NULL;
+}
+
+/*
+ * Follow the stream to a read at off: throw away chunks that the stream has
+ * passed, or all of them if it broke, and read ahead of it if it is
+ * established.  Called with the lock held.
+ */
+static void prefetch_advance(struct prefetcher *pf, long long off)
+{
+	struct prefetch_slot *slot;
+	long long stride = off - pf->last_off, target, behind;
+	int i, k, outstanding = 0;
+
+	if ((pf->last_off >= 0) && (stride != 0) && (stride == pf->stride)) {
+		pf->run++;
+	} else {
+		pf->stride = (pf->last_off >= 0) ? stride : 0;
+		pf->run = 0;
+	}
+	pf->last_off = off;
+	for (i = 0; i < pf->num_slots; i++) {
+		slot = &pf->slots[i];
+		if (!prefetch_pending(slot))
+			continue;
+		// How many strides the chunk is behind this read
+		behind = (pf->run && pf->stride) ?
+			(off - slot->off) / pf->stride : 1;
+		if ((behind >= 0) || ((off - slot->off) % pf->stride))
+			prefetch_discard(pf, slot);
+		else
+			outstanding++;
+	}
+	if (!pf->run)
+		return;
+	for (k = 1; outstanding < pf->depth; k++) {
+		target = off + (k * pf->stride);
+		if ((target < pf->start) || (target >= pf->end))
+			break;
+		if (prefetch_find(pf, target))
+			continue;
+		for (i = 0; i < pf->num_slots; i++) {
+			if (pf->slots[i].state == PREFETCH_FREE)
+				break;
+		}
+		if (i == pf->num_slots)
+			break;
+		slot = &pf->slots[i];
+		slot->state = PREFETCH_QUEUED;
+		slot->off = target;
+		slot->len = (pf->end - target < pf->chunk_size) ?
+			(int)(pf->end - target) : pf->chunk_size;
+		slot->seq = pf->next_seq++;
+		pf->stats.issued++;
+		outstanding++;
+		pthread_cond_signal(&pf->queued);
+	}
+}
+
+int prefetch_read(struct prefetcher *pf, long long off, int len,
+		const void **out)
+{
+	struct prefetch_slot *slot;
+	double start;
+	int res;
+
+	pthread_mutex_lock(&pf->lock);
+	if (pf->held) {
+		pf->held->state = PREFETCH_FREE;
+		pf->held = NULL;
+	}
+	slot = prefetch_find(pf, off);
+	if (slot && (slot->len != len)) {
+		prefetch_discard(pf, slot);
+		slot = NULL;
+	}
+	if (slot) {
+		if (slot->state == PREFETCH_READY) {
+			pf->stats.timely++;
+		} else {
+			// Late: read further ahead from now on.
+			pf->stats.late++;
+			start = monotonic_seconds();
+			while (slot->state != PREFETCH_READY)
+				pthread_cond_wait(&pf->done, &pf->lock);
+			pf->stats.wait_seconds += monotonic_seconds() - start;
+			pf->depth *= 2;
+			if (pf->depth > pf->max_depth)
+				pf->depth = pf->max_depth;
+		}
+		slot->state = PREFETCH_HELD;
+		pf->held = slot;
+	} else {
+		pf->stats.demand++;
+	}
+	prefetch_advance(pf, off);
+	if (pf->depth > pf->stats.max_depth)
+		pf->stats.max_depth = pf->depth;
+	pthread_mutex_unlock(&pf->lock);
+	if (slot) {
+		*out = slot->buf;
+		return slot->res;
+	}
+	res = prefetch_pread(pf->fd, pf->demand_buf, off, len);
+	*out = pf->demand_buf;
+	return res;
+}
+
+void prefetch_get_stats(struct prefetcher *pf, struct prefetch_stats *stats,
+		int reset)
+{
+	pthread_mutex_lock(&pf->lock);
+	*stats = pf->stats;
+	stats->depth = pf->depth;
+	if (reset) {
+		memset(&pf->stats, 0, sizeof(pf->stats));
+		pf->stats.max_depth = pf->depth;
+	}
+	pthread_mutex_unlock(&pf->lock);
+}
@@ -0,0 +1,80 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#ifndef VECSUM_PREFETCH_H
+#define VECSUM_PREFETCH_H
+
+/*
+ * An asynchronous prefetcher for reads of one file descriptor.
+ *
+ * The reader asks for every chunk it misses through prefetch_read.  The
+ * prefetcher watches the offsets of those reads, and once two strides in a
+ * row match (sequential reads being the stride of one chunk), it starts
+ * reading the next chunks of the stream ahead of the reader on its own I/O
+ * threads.  A read that finds its chunk already read ahead is timely; one
+ * that finds it still in flight is late and waits for it.
+ *
+ * How far ahead to read adapts: every late read doubles the depth, up to
+ * the maximum, and every chunk that had to be thrown away unread, because
+ * the stream broke or the reader skipped it, halves it.
+ */
+
+#include <stdint.h>
+
+struct prefetcher;
+
+struct prefetch_stats {
+	// Chunks read ahead
+	long long issued;
+
+	// Reads that found their chunk read ahead, and found it still in
+	// flight
+	long long timely;
+	long long late;
+
+	// Chunks read ahead that were thrown away unread
+	long long wasted;
+
+	// Reads of chunks that weren't read ahead
+	long long demand;
+
+	// Time spent waiting on late chunks
+	double wait_seconds;
+
+	// Depth now, and the deepest it has been
+	int depth;
+	int max_depth;
+};
+
+/*
+ * Create a prefetcher for fd, which reads chunks of up to chunk_size bytes
+ * between file offsets start and end, at most max_depth chunks ahead, on
+ * num_threads threads.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int prefetch_create(int fd, long long start, long long end, int chunk_size,
+		int max_depth, int num_threads, struct prefetcher **out);
+
+/*
+ * Stop the I/O threads and free the prefetcher.
+ */
+void prefetch_free(struct prefetcher *pf);
+
+/*
+ * Read len bytes at file offset off, and point *out at them.  The bytes
+ * stay valid until the next call.
+ *
+ * Returns the number of bytes read, which is only short at the end of the
+ * file, or a negative errno value on failure.
+ */
+int prefetch_read(struct prefetcher *pf, long long off, int len,
+		const void **out);
+
+/*
+ * Get the stats, and reset the counts if reset is nonzero.
+ */
+void prefetch_get_stats(struct prefetcher *pf, struct prefetch_stats *stats,
+		int reset);
+
+#endif
@@ -0,0 +1,61 @@
+#!/bin/bash
+set -e
+
+# Measures how cached data degrades under memory pressure, for data that is
+# pinned with mlock the way the HDFS cache pins it and for data that is only
+# in the page cache.  For each balloon size, the file is warmed (and pinned,
+# in the pinned runs), the balloon squeezes the page cache, and then vecsum2
+# scans the file.  The resident column is what mincore found once the
+# balloon reached its size, before the scan.
+
+if [ "$#" -lt 2 ]; then echo "$0 <float file> <balloon sizes, e.g. \"0 4g 8g 16g\"> [local/pread] [passes]"; exit -1; fi
+
+FILE=$1
+SIZES=$2
+TYPE=${3:-local}
+PASSES=${4:-1}
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+MARKERS=$(mktemp -d)
+trap 'kill $(jobs -p) 2>/dev/null || true; rm -rf $MARKERS' EXIT
+
+# Runs a command in the background, waiting until it creates its marker.
+start() {
+	local MARKER=$MARKERS/$1
+	shift
+	rm -f $MARKER
+	"$1" -d $MARKER "${@:2}" > $MARKER.out &
+	while [ ! -f $MARKER ]; do
+		if ! kill -0 $! 2>/dev/null; then
+			cat $MARKER.out >&2
+			echo "$1 failed" >&2
+			exit 1
+		fi
+		sleep 0.1
+	done
+	PID=$!
+}
+
+printf "%-9s %12s %14s %10s %10s\n" mode balloon "balloon bytes" resident% GB/s
+for MODE in unpinned pinned; do
+	for SIZE in $SIZES; do
+		if [ $MODE = pinned ]; then
+			start warmup $HERE/warmup -l -i 0 $FILE
+			WARMUP=$PID
+		else
+			$HERE/warmup -i 0 $FILE > /dev/null
+			WARMUP=
+		fi
+		start balloon $HERE/balloon -i 0 -w $FILE $SIZE
+		BALLOON=$PID
+		read BYTES RESIDENT < <(tail -n 1 $MARKERS/balloon.out | awk '
+			{ bytes = $4; resident = $(NF - 1); gsub(/%/, "", resident) }
+			END { print bytes, resident }')
+		GBPS=$(VECSUM_TYPE=$TYPE VECSUM_PATH=$FILE VECSUM_PASSES=$PASSES \
+			$HERE/vecsum2 | awk '/^stopwatch: took/ { print $(NF - 1) }')
+		kill -INT $BALLOON $WARMUP
+		wait $BALLOON $WARMUP || true
+		printf "%-9s %12s %14s %10s %10.4g\n" $MODE $SIZE $BYTES \
+			$RESIDENT $GBPS
+	done
+done
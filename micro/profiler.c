@@ -0,0 +1,453 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include "profiler.h"
+
+#include <elf.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Maximum number of frames recorded per sample.
+#define PROF_MAX_DEPTH 48
+
+// Maximum number of samples we will hold before dropping new ones.  The
+// sample array is mmapped, so pages we never touch cost nothing.
+#define PROF_MAX_SAMPLES (64 * 1024)
+
+// backtrace() called from the handler sees the handler itself and the
+// kernel's signal trampoline before it gets to the interrupted frame.
+#define PROF_SKIP_FRAMES 2
+
+struct prof_sample {
+	int depth;
+	void *frames[PROF_MAX_DEPTH];
+};
+
+struct prof_sym {
+	uintptr_t addr;
+	uintptr_t size;
+	const char *name;
+};
+
+struct prof_state {
+	// Where to write the folded stacks.
+	char *path;
+
+	// The sample ring, and the index of the next sample to fill.
+	struct prof_sample *samples;
+	uint64_t next;
+
+	// The handler we replaced, restored by profiler_stop.
+	struct sigaction old_action;
+
+	// Function symbols from our own executable, sorted by address.
+	// backtrace_symbols only sees the dynamic symbol table, which leaves
+	// out every static function in vecsum2.
+	char *exe_image;
+	struct prof_sym *syms;
+	size_t num_syms;
+	uintptr_t exe_bias;
+};
+
+static struct prof_state g_prof;
+
+static void prof_handler(int sig, siginfo_t *info, void *uctx)
+{
+	int saved_errno = errno;
+	uint64_t idx;
+
+	idx = __atomic_fetch_add(&g_prof.next, 1, __ATOMIC_RELAXED);
+	if (idx < PROF_MAX_SAMPLES) {
+		struct prof_sample *sample = &g_prof.samples[idx];
+		sample->depth = backtrace(sample->frames, PROF_MAX_DEPTH);
+	}
+	errno = saved_errno;
+}
+
+static int prof_sym_compare(const void *a, const void *b)
+{
+	const struct prof_sym *sa = a, *sb = b;
+
+	if (sa->addr < sb->addr)
+		return -1;
+	return sa->addr > sb->addr;
+}
+
+/*
+ * Load the function symbols of /proc/self/exe.  Failing here is not fatal;
+ * we just fall back on backtrace_symbols for everything.
+ */
+static void prof_load_syms(void)
+{
+	const Elf64_Ehdr *ehdr;
+	const Elf64_Shdr *shdrs;
+	const Elf64_Phdr *phdrs;
+	struct stat st;
+	ssize_t res;
+	size_t off = 0;
+	int fd, i;
+
+	fd = open("/proc/self/exe", O_RDONLY);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(Elf64_Ehdr))
+		goto done;
+	g_prof.exe_image = malloc(st.st_size);
+	if (!g_prof.exe_image)
+		goto done;
+	while (off < (size_t)st.st_size) {
+		res = read(fd, g_prof.exe_image + off, st.st_size - off);
+		if (res <= 0)
+			goto done;
+		off += res;
+	}
+	ehdr = (const Elf64_Ehdr *)g_prof.exe_image;
+	if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+			ehdr->e_ident[EI_CLASS] != ELFCLASS64)
+		goto done;
+	if (ehdr->e_type == ET_DYN) {
+		// Position-independent executable: find out where the loader
+		// put our program headers.
+		phdrs = (const Elf64_Phdr *)(g_prof.exe_image + ehdr->e_phoff);
+		for (i = 0; i < ehdr->e_phnum; i++) {
+			if (phdrs[i].p_type == PT_PHDR) {
+				g_prof.exe_bias = getauxval(AT_PHDR) -
+					phdrs[i].p_vaddr;
+				break;
+			}
+		}
+		if (i == ehdr->e_phnum)
+			goto done;
+	}
+	shdrs = (const Elf64_Shdr *)(g_prof.exe_image + ehdr->e_shoff);
+	for (i = 0; i < ehdr->e_shnum; i++) {
+		const Elf64_Sym *syms;
+		const char *strtab;
+		size_t j, n;
+
+		if (shdrs[i].sh_type != SHT_SYMTAB)
+			continue;
+		syms = (const Elf64_Sym *)(g_prof.exe_image +
+				shdrs[i].sh_offset);
+		strtab = g_prof.exe_image + shdrs[shdrs[i].sh_link].sh_offset;
+		n = shdrs[i].sh_size / sizeof(Elf64_Sym);
+		g_prof.syms = calloc(n, sizeof(struct prof_sym));
+		if (!g_prof.syms)
+			goto done;
+		for (j = 0; j < n; j++) {
+			if (ELF64_ST_TYPE(syms[j].st_info) != STT_FUNC ||
+					syms[j].st_value == 0)
+				continue;
+			g_prof.syms[g_prof.num_syms].addr =
+				syms[j].st_value + g_prof.exe_bias;
+			g_prof.syms[g_prof.num_syms].size = syms[j].st_size;
+			g_prof.syms[g_prof.num_syms].name =
+				strtab + syms[j].st_name;
+			g_prof.num_syms++;
+		}
+		qsort(g_prof.syms, g_prof.num_syms, sizeof(struct prof_sym),
+			prof_sym_compare);
+		break;
+	}
+done:
+	close(fd);
+}
+
+static const char *prof_lookup_exe(uintptr_t addr)
+{
+	size_t lo = 0, hi = g_prof.num_syms;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (g_prof.syms[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return NULL;
+	lo--;
+	if (addr >= g_prof.syms[lo].addr + g_prof.syms[lo].size)
+		return NULL;
+	return g_prof.syms[lo].name;
+}
+
+/*
+ * Write the name of the function containing addr to out.  Symbols from
+ * shared libraries come from backtrace_symbols, which formats them as
+ * "path(func+0x10) [0xaddr]".
+ */
+static void prof_frame_name(void *addr, char *out, size_t out_len)
+{
+	const char *name;
+	char **strs;
+	char *open, *plus, *slash;
+
+	name = prof_lookup_exe((uintptr_t)addr);
+	if (name) {
+		snprintf(out, out_len, "%s", name);
+		return;
+	}
+	snprintf(out, out_len, "[unknown]");
+	strs = backtrace_symbols(&addr, 1);
+	if (!strs)
+		return;
+	open = strchr(strs[0], '(');
+	if (open) {
+		plus = strpbrk(open + 1, "+)");
+		if (plus && plus != open + 1) {
+			snprintf(out, out_len, "%.*s",
+				(int)(plus - open - 1), open + 1);
+		} else {
+			*open = '\0';
+			slash = strrchr(strs[0], '/');
+			snprintf(out, out_len, "[%s]",
+				slash ? slash + 1 : strs[0]);
+		}
+	}
+	free(strs);
+}
+
+static int prof_sample_compare(const void *a, const void *b)
+{
+	const struct prof_sample *sa = a, *sb = b;
+
+	if (sa->depth != sb->depth)
+		return sa->depth - sb->depth;
+	return memcmp(sa->frames, sb->frames, sa->depth * sizeof(void *));
+}
+
+struct prof_stack {
+	char *folded;
+	uint64_t count;
+};
+
+static int prof_stack_compare(const void *a, const void *b)
+{
+	const struct prof_stack *sa = a, *sb = b;
+
+	return strcmp(sa->folded, sb->folded);
+}
+
+/*
+ * Render one sample as a folded stack, root first.  Returns a malloc'ed
+ * string, or NULL if the sample has no frames below the handler.
+ */
+static char *prof_fold_sample(const struct prof_sample *sample)
+{
+	char name[256];
+	char *folded = NULL;
+	size_t len = 0, name_len;
+	int d;
+
+	for (d = sample->depth - 1; d >= PROF_SKIP_FRAMES; d--) {
+		void *addr = sample->frames[d];
+		char *next;
+
+		// Everything but the interrupted frame is a return address,
+		// which may point past the end of the calling function.
+		if (d != PROF_SKIP_FRAMES)
+			addr = (char *)addr - 1;
+		prof_frame_name(addr, name, sizeof(name));
+		name_len = strlen(name);
+		next = realloc(folded, len + name_len + 2);
+		if (!next) {
+			free(folded);
+			return NULL;
+		}
+		folded = next;
+		if (len)
+			folded[len++] = ';';
+		memcpy(folded + len, name, name_len + 1);
+		len += name_len;
+	}
+	return folded;
+}
+
+static int prof_write_folded(uint64_t num_samples)
+{
+	struct prof_stack *stacks = NULL;
+	uint64_t i, j, num_stacks = 0, unique = 0;
+	FILE *fp = NULL;
+	int ret = 0;
+
+	// Group identical raw stacks first, so that each is only symbolized
+	// once.  Different raw stacks can still fold to the same string,
+	// since any two PCs in one function get the same name.
+	qsort(g_prof.samples, num_samples, sizeof(struct prof_sample),
+		prof_sample_compare);
+	stacks = calloc(num_samples ? num_samples : 1,
+			sizeof(struct prof_stack));
+	if (!stacks) {
+		ret = ENOMEM;
+		goto done;
+	}
+	for (i = 0; i < num_samples; i = j) {
+		const struct prof_sample *sample = &g_prof.samples[i];
+
+		for (j = i + 1; j < num_samples; j++) {
+			if (prof_sample_compare(sample, &g_prof.samples[j]))
+				break;
+		}
+		if (sample->depth <= PROF_SKIP_FRAMES)
+			continue;
+		stacks[num_stacks].folded = prof_fold_sample(sample);
+		if (!stacks[num_stacks].folded) {
+			ret = ENOMEM;
+			goto done;
+		}
+		stacks[num_stacks].count = j - i;
+		num_stacks++;
+	}
+	qsort(stacks, num_stacks, sizeof(struct prof_stack),
+		prof_stack_compare);
+
+	fp = fopen(g_prof.path, "w");
+	if (!fp) {
+		ret = errno;
+		fprintf(stderr, "profiler: failed to open %s: error %d (%s)\n",
+			g_prof.path, ret, strerror(ret));
+		goto done;
+	}
+	for (i = 0; i < num_stacks; i = j) {
+		uint64_t count = stacks[i].count;
+
+		for (j = i + 1; j < num_stacks; j++) {
+			if (strcmp(stacks[i].folded, stacks[j].folded))
+				break;
+			count += stacks[j].count;
+		}
+		fprintf(fp, "%s %llu\n", stacks[i].folded,
+			(unsigned long long)count);
+		unique++;
+	}
+	if (fclose(fp)) {
+		fp = NULL;
+		ret = errno;
+		fprintf(stderr, "profiler: failed to write %s: error %d (%s)\n",
+			g_prof.path, ret, strerror(ret));
+		goto done;
+	}
+	fp = NULL;
+	printf("profiler: wrote %llu samples in %llu unique stacks to %s\n",
+		(unsigned long long)num_samples, (unsigned long long)unique,
+		g_prof.path);
+done:
+	if (fp)
+		fclose(fp);
+	if (stacks) {
+		for (i = 0; i < num_stacks; i++)
+			free(stacks[i].folded);
+		free(stacks);
+	}
+	return ret;
+}
+
+int profiler_start(const char *path, int hz)
+{
+	struct sigaction act;
+	struct itimerval timer;
+	void *warmup[PROF_MAX_DEPTH];
+	int ret;
+
+	if (hz <= 0 || hz > 1000000) {
+		fprintf(stderr, "profiler: invalid sampling frequency %d\n",
+			hz);
+		return EINVAL;
+	}
+	g_prof.path = strdup(path);
+	if (!g_prof.path)
+		return ENOMEM;
+	g_prof.samples = mmap(NULL,
+		PROF_MAX_SAMPLES * sizeof(struct prof_sample),
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (g_prof.samples == MAP_FAILED) {
+		ret = errno;
+		fprintf(stderr, "profiler: failed to map sample buffer: "
+			"error %d (%s)\n", ret, strerror(ret));
+		g_prof.samples = NULL;
+		goto error;
+	}
+	// The first call to backtrace loads libgcc_s, which is not something
+	// we want to happen inside a signal handler.
+	backtrace(warmup, PROF_MAX_DEPTH);
+	prof_load_syms();
+
+	memset(&act, 0, sizeof(act));
+	act.sa_sigaction = prof_handler;
+	act.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&act.sa_mask);
+	if (sigaction(SIGPROF, &act, &g_prof.old_action)) {
+		ret = errno;
+		fprintf(stderr, "profiler: sigaction failed: error %d (%s)\n",
+			ret, strerror(ret));
+		goto error;
+	}
+	memset(&timer, 0, sizeof(timer));
+	timer.it_interval.tv_sec = 0;
+	timer.it_interval.tv_usec = 1000000 / hz;
+	if (timer.it_interval.tv_usec == 0)
+		timer.it_interval.tv_usec = 1;
+	timer.it_value = timer.it_interval;
+	if (setitimer(ITIMER_PROF, &timer, NULL)) {
+		ret = errno;
+		fprintf(stderr, "profiler: setitimer failed: error %d (%s)\n",
+			ret, strerror(ret));
+		sigaction(SIGPROF, &g_prof.old_action, NULL);
+		goto error;
+	}
+	return 0;
+
+error:
+	if (g_prof.samples) {
+		munmap(g_prof.samples,
+			PROF_MAX_SAMPLES * sizeof(struct prof_sample));
+	}
+	free(g_prof.syms);
+	free(g_prof.exe_image);
+	free(g_prof.path);
+	memset(&g_prof, 0, sizeof(g_prof));
+	return ret;
+}
+
+int profiler_stop(void)
+{
+	struct itimerval timer;
+	uint64_t num_samples;
+	int ret;
+
+	if (!g_prof.samples)
+		return 0;
+	memset(&timer, 0, sizeof(timer));
+	setitimer(ITIMER_PROF, &timer, NULL);
+	sigaction(SIGPROF, &g_prof.old_action, NULL);
+
+	num_samples = __atomic_load_n(&g_prof.next, __ATOMIC_RELAXED);
+	if (num_samples > PROF_MAX_SAMPLES) {
+		fprintf(stderr, "profiler: dropped %llu samples because the "
+			"sample buffer was full.\n",
+			(unsigned long long)(num_samples - PROF_MAX_SAMPLES));
+		num_samples = PROF_MAX_SAMPLES;
+	}
+	ret = prof_write_folded(num_samples);
+
+	munmap(g_prof.samples, PROF_MAX_SAMPLES * sizeof(struct prof_sample));
+	free(g_prof.syms);
+	free(g_prof.exe_image);
+	free(g_prof.path);
+	memset(&g_prof, 0, sizeof(g_prof));
+	return ret;
+}
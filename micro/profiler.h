@@ -0,0 +1,33 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#ifndef VECSUM_PROFILER_H
+#define VECSUM_PROFILER_H
+
+/*
+ * A small in-process sampling profiler.
+ *
+ * While running, the profiler takes a SIGPROF every 1/hz seconds of CPU time
+ * and records the interrupted stack with backtrace(3).  When it is stopped,
+ * the stacks are symbolized and written out in the "folded" format consumed
+ * by flamegraph.pl: one line per unique stack, frames separated by
+ * semicolons from the root down, followed by a sample count.
+ */
+
+/*
+ * Start sampling at the given frequency.  The profile will be written to
+ * path by profiler_stop.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int profiler_start(const char *path, int hz);
+
+/*
+ * Stop sampling and write the folded stacks.  Does nothing if the profiler
+ * was never started.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int profiler_stop(void);
+
+#endif
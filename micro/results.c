@@ -0,0 +1,258 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include "results.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RESULTS_MAX_LINE (64 * 1024)
+
+int results_append(const char *path, const char *config,
+		long long bytes_per_pass, const double *gbps, int num_samples)
+{
+	FILE *fp;
+	int i, ret;
+
+	fp = fopen(path, "a");
+	if (!fp) {
+		ret = errno;
+		fprintf(stderr, "results_append: failed to open %s: "
+			"error %d (%s)\n", path, ret, strerror(ret));
+		return ret;
+	}
+	fprintf(fp, "result\ttime=%lld\tconfig=%s\tbytes=%lld\tgbps=",
+		(long long)time(NULL), config, bytes_per_pass);
+	for (i = 0; i < num_samples; i++)
+		fprintf(fp, "%s%.6g", i ? "," : "", gbps[i]);
+	fprintf(fp, "\n");
+	if (fclose(fp)) {
+		ret = errno;
+		fprintf(stderr, "results_append: failed to write %s: "
+			"error %d (%s)\n", path, ret, strerror(ret));
+		return ret;
+	}
+	return 0;
+}
+
+/*
+ * Append the gbps samples from one result line to *samples, if the line's
+ * config matches.  Returns 0 on success or ENOMEM.
+ */
+static int results_parse_line(char *line, const char *config,
+		double **samples, int *num_samples)
+{
+	char *field, *saveptr = NULL, *gbps = NULL;
+	int matched = 0;
+
+	field = strtok_r(line, "\t\n", &saveptr);
+	if (!field || strcmp(field, "result"))
+		return 0;
+	while ((field = strtok_r(NULL, "\t\n", &saveptr))) {
+		if (!strncmp(field, "config=", 7))
+			matched = !strcmp(field + 7, config);
+		else if (!strncmp(field, "gbps=", 5))
+			gbps = field + 5;
+	}
+	if (!matched || !gbps)
+		return 0;
+	while (*gbps) {
+		char *end;
+		double val = strtod(gbps, &end);
+		double *next;
+
+		if (end == gbps)
+			break;
+		next = realloc(*samples, (*num_samples + 1) * sizeof(double));
+		if (!next)
+			return ENOMEM;
+		*samples = next;
+		(*samples)[(*num_samples)++] = val;
+		gbps = (*end == ',') ? end + 1 : end;
+	}
+	return 0;
+}
+
+static void results_mean_var(const double *x, int n, double *mean,
+		double *var)
+{
+	double sum = 0, sq = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		sum += x[i];
+	*mean = sum / n;
+	for (i = 0; i < n; i++)
+		sq += (x[i] - *mean) * (x[i] - *mean);
+	*var = (n > 1) ? sq / (n - 1) : 0;
+}
+
+/*
+ * Continued fraction for the regularized incomplete beta function, by the
+ * modified Lentz method.
+ */
+static double results_betacf(double a, double b, double x)
+{
+	const double tiny = 1e-300;
+	double c = 1, d, h, del, aa;
+	int m, m2;
+
+	d = 1 - (a + b) * x / (a + 1);
+	if (fabs(d) < tiny)
+		d = tiny;
+	d = 1 / d;
+	h = d;
+	for (m = 1; m <= 300; m++) {
+		m2 = 2 * m;
+		aa = m * (b - m) * x / ((a + m2 - 1) * (a + m2));
+		d = 1 + aa * d;
+		if (fabs(d) < tiny)
+			d = tiny;
+		c = 1 + aa / c;
+		if (fabs(c) < tiny)
+			c = tiny;
+		d = 1 / d;
+		h *= d * c;
+		aa = -(a + m) * (a + b + m) * x / ((a + m2) * (a + m2 + 1));
+		d = 1 + aa * d;
+		if (fabs(d) < tiny)
+			d = tiny;
+		c = 1 + aa / c;
+		if (fabs(c) < tiny)
+			c = tiny;
+		d = 1 / d;
+		del = d * c;
+		h *= del;
+		if (fabs(del - 1) < 1e-12)
+			break;
+	}
+	return h;
+}
+
+static double results_betai(double a, double b, double x)
+{
+	double bt;
+
+	if (x <= 0)
+		return 0;
+	if (x >= 1)
+		return 1;
+	bt = exp(lgamma(a + b) - lgamma(a) - lgamma(b) +
+		a * log(x) + b * log(1 - x));
+	if (x < (a + 1) / (a + b + 2))
+		return bt * results_betacf(a, b, x) / a;
+	return 1 - bt * results_betacf(b, a, 1 - x) / b;
+}
+
+/*
+ * One-sided p-value for the hypothesis that the baseline mean is greater
+ * than the current mean, by Welch's t-test.  Scale the baseline to test for
+ * a drop of more than a given fraction.
+ */
+static double results_welch_p(double base_mean, double base_var, int base_n,
+		double cur_mean, double cur_var, int cur_n)
+{
+	double vb = base_var / base_n, vc = cur_var / cur_n;
+	double se, t, df;
+
+	se = sqrt(vb + vc);
+	if (se == 0)
+		return (base_mean > cur_mean) ? 0 : 1;
+	t = (base_mean - cur_mean) / se;
+	df = (vb + vc) * (vb + vc) /
+		((vb * vb) / (base_n - 1) + (vc * vc) / (cur_n - 1));
+	// For T with df degrees of freedom,
+	// P(T > t) = I_{df / (df + t^2)}(df / 2, 1 / 2) / 2 when t >= 0.
+	if (t >= 0)
+		return 0.5 * results_betai(df / 2, 0.5, df / (df + t * t));
+	return 1 - 0.5 * results_betai(df / 2, 0.5, df / (df + t * t));
+}
+
+int results_compare(const char *baseline_path, const char *config,
+		const double *gbps, int num_samples, double tolerance,
+		double alpha)
+{
+	FILE *fp;
+	char *line = NULL;
+	double *base = NULL;
+	int num_base = 0, tested, ret;
+	double base_mean, base_var, cur_mean, cur_var, change, p = 0;
+	double keep = 1 - tolerance;
+
+	fp = fopen(baseline_path, "r");
+	if (!fp) {
+		ret = errno;
+		fprintf(stderr, "results_compare: failed to open %s: "
+			"error %d (%s)\n", baseline_path, ret, strerror(ret));
+		return ret;
+	}
+	line = malloc(RESULTS_MAX_LINE);
+	if (!line) {
+		ret = ENOMEM;
+		goto done;
+	}
+	while (fgets(line, RESULTS_MAX_LINE, fp)) {
+		ret = results_parse_line(line, config, &base, &num_base);
+		if (ret)
+			goto done;
+	}
+	if (num_base == 0) {
+		fprintf(stderr, "results_compare: no runs with config %s in "
+			"baseline %s\n", config, baseline_path);
+		ret = ENOENT;
+		goto done;
+	}
+	if (num_samples == 0) {
+		fprintf(stderr, "results_compare: no samples to compare.\n");
+		ret = EINVAL;
+		goto done;
+	}
+	results_mean_var(base, num_base, &base_mean, &base_var);
+	results_mean_var(gbps, num_samples, &cur_mean, &cur_var);
+	change = (base_mean > 0) ? (cur_mean - base_mean) / base_mean : 0;
+	// With a single sample on either side we have no variance estimate,
+	// so there is no significance test, and the tolerance alone decides.
+	// Otherwise the null hypothesis is that the current mean is at least
+	// (1 - tolerance) times the baseline mean, so a small p-value means
+	// the drop is both larger than the tolerance and not noise.
+	tested = (num_base >= 2) && (num_samples >= 2);
+	if (tested) {
+		p = results_welch_p(keep * base_mean, keep * keep * base_var,
+				num_base, cur_mean, cur_var, num_samples);
+	}
+	printf("compare: config %s\n", config);
+	printf("compare: baseline %.5g GB/s (sd %.3g, n=%d), current %.5g "
+		"GB/s (sd %.3g, n=%d), change %+.2f%%, ",
+		base_mean, sqrt(base_var), num_base, cur_mean, sqrt(cur_var),
+		num_samples, 100 * change);
+	if (tested)
+		printf("p=%.3g for a drop past %.2f%%\n", p, 100 * tolerance);
+	else
+		printf("insufficient samples for a significance test\n");
+	if (tested ? (p < alpha) : (-change > tolerance)) {
+		if (tested) {
+			printf("compare: REGRESSION: throughput dropped by "
+				"more than %.2f%% (alpha %.3g)\n",
+				100 * tolerance, alpha);
+		} else {
+			printf("compare: REGRESSION: throughput dropped by "
+				"more than %.2f%% (tolerance alone)\n",
+				100 * tolerance);
+		}
+		ret = RESULTS_EXIT_REGRESSION;
+	} else {
+		printf("compare: OK\n");
+		ret = 0;
+	}
+done:
+	free(line);
+	free(base);
+	fclose(fp);
+	return ret;
+}
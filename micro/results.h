@@ -0,0 +1,51 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#ifndef VECSUM_RESULTS_H
+#define VECSUM_RESULTS_H
+
+/*
+ * Structured benchmark results.
+ *
+ * A results file holds one line per run.  Each line is a tab-separated list
+ * of key=value fields, starting with the literal "result":
+ *
+ *   result  time=1400000000  config=type=zcr,path=/f  bytes=1073741824
+ *           gbps=5.88,5.87,5.86
+ *
+ * gbps holds each pass's throughput in GB/s of 1e9 bytes, the unit every
+ * GB/s figure here is in.  The config field identifies the benchmark
+ * configuration.  Runs with the same config are comparable; when several runs in a baseline file share a
+ * config, their samples are pooled.
+ */
+
+// Exit code used by vecsum2 when a regression is detected.  This is kept
+// clear of the errno values vecsum2 exits with on other failures that it
+// can actually hit, and of 125, which git bisect run treats as "skip".
+#define RESULTS_EXIT_REGRESSION 3
+
+/*
+ * Append a run to the results file at path.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int results_append(const char *path, const char *config,
+		long long bytes_per_pass, const double *gbps, int num_samples);
+
+/*
+ * Compare a run against the runs with the same config in a baseline file.
+ *
+ * The run is a regression if a one-sided Welch's t-test rejects, at level
+ * alpha, the hypothesis that its mean throughput is at least (1 - tolerance)
+ * times the baseline mean; tolerance is a fraction.  With fewer than 2
+ * samples on either side there is no test, and the run is a regression if
+ * its mean is more than tolerance below the baseline mean.
+ *
+ * Returns 0 if there is no regression, RESULTS_EXIT_REGRESSION if there
+ * is, or an errno value if the comparison could not be made.
+ */
+int results_compare(const char *baseline_path, const char *config,
+		const double *gbps, int num_samples, double tolerance,
+		double alpha);
+
+#endif
@@ -0,0 +1,322 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include "roofline.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "immintrin.h"
+
+// Size of the buffer used to measure DRAM bandwidth.  This has to be well
+// past the last-level cache.
+#define ROOFLINE_DRAM_BYTES (512L * 1024 * 1024)
+
+// Each measurement is repeated until it has run for at least this long, and
+// the best of ROOFLINE_TRIALS trials is kept, as STREAM does.
+#define ROOFLINE_MIN_SECONDS 0.05
+#define ROOFLINE_TRIALS 3
+
+// Bytes to stream between clock reads.  A pass over an L1-sized buffer takes
+// well under a microsecond, so timing each pass would mostly time the clock.
+#define ROOFLINE_BATCH_BYTES (16L * 1024 * 1024)
+
+// Fallback cache sizes for when sysconf doesn't know.
+#define ROOFLINE_DEFAULT_L1 (32L * 1024)
+#define ROOFLINE_DEFAULT_L2 (256L * 1024)
+#define ROOFLINE_DEFAULT_L3 (8L * 1024 * 1024)
+
+static const char * const ROOFLINE_NAMES[ROOFLINE_MAX] = {
+	"L1 read",
+	"L2 read",
+	"L3 read",
+	"DRAM read",
+	"DRAM read (all cores)",
+	"memcpy",
+	"memcpy (all cores)",
+};
+
+const char *roofline_level_name(enum roofline_level level)
+{
+	return ROOFLINE_NAMES[level];
+}
+
+static double roofline_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1000000000.0);
+}
+
+/*
+ * The same eight-accumulator SSE2 loop that vecsum uses, so that the
+ * ceiling is measured with the instruction mix we actually run.
+ */
+static double roofline_sum(const double *buf, long num_doubles)
+{
+	__m128d sum0 = _mm_setzero_pd(), sum1 = _mm_setzero_pd();
+	__m128d sum2 = _mm_setzero_pd(), sum3 = _mm_setzero_pd();
+	__m128d sum4 = _mm_setzero_pd(), sum5 = _mm_setzero_pd();
+	__m128d sum6 = _mm_setzero_pd(), sum7 = _mm_setzero_pd();
+	double out[2];
+	long i;
+
+	for (i = 0; i < num_doubles; i += 16) {
+		sum0 = _mm_add_pd(sum0, _mm_load_pd(buf + i + 0));
+		sum1 = _mm_add_pd(sum1, _mm_load_pd(buf + i + 2));
+		sum2 = _mm_add_pd(sum2, _mm_load_pd(buf + i + 4));
+		sum3 = _mm_add_pd(sum3, _mm_load_pd(buf + i + 6));
+		sum4 = _mm_add_pd(sum4, _mm_load_pd(buf + i + 8));
+		sum5 = _mm_add_pd(sum5, _mm_load_pd(buf + i + 10));
+		sum6 = _mm_add_pd(sum6, _mm_load_pd(buf + i + 12));
+		sum7 = _mm_add_pd(sum7, _mm_load_pd(buf + i + 14));
+	}
+	sum0 = _mm_add_pd(_mm_add_pd(sum0, sum1), _mm_add_pd(sum2, sum3));
+	sum4 = _mm_add_pd(_mm_add_pd(sum4, sum5), _mm_add_pd(sum6, sum7));
+	_mm_storeu_pd(out, _mm_add_pd(sum0, sum4));
+	return out[0] + out[1];
+}
+
+// Keeps the compiler from discarding sums nobody looks at.
+static volatile double g_roofline_sink;
+
+/*
+ * Best-of-N read bandwidth over the first len bytes of buf, in GB/s.
+ */
+static double roofline_read_gbps(const double *buf, long len)
+{
+	double best = 0, start, elapsed, sum = 0;
+	long bytes, batch, i;
+	int trial;
+
+	batch = (len < ROOFLINE_BATCH_BYTES) ? ROOFLINE_BATCH_BYTES / len : 1;
+	for (trial = 0; trial < ROOFLINE_TRIALS; trial++) {
+		bytes = 0;
+		start = roofline_now();
+		do {
+			for (i = 0; i < batch; i++) {
+				sum += roofline_sum(buf, len / sizeof(double));
+				// Without the clock call in between, the
+				// compiler would sum the buffer only once.
+				__atomic_signal_fence(__ATOMIC_SEQ_CST);
+			}
+			bytes += batch * len;
+			elapsed = roofline_now() - start;
+		} while (elapsed < ROOFLINE_MIN_SECONDS);
+		if (bytes / elapsed > best)
+			best = bytes / elapsed;
+	}
+	g_roofline_sink = sum;
+	return best / 1e9;
+}
+
+static double roofline_memcpy_gbps(double *buf, long len)
+{
+	double best = 0, start, elapsed;
+	char *src = (char *)buf, *dst = (char *)buf + len / 2;
+	long bytes, half = len / 2;
+	int trial;
+
+	for (trial = 0; trial < ROOFLINE_TRIALS; trial++) {
+		bytes = 0;
+		start = roofline_now();
+		do {
+			memcpy(dst, src, half);
+			bytes += half;
+			elapsed = roofline_now() - start;
+		} while (elapsed < ROOFLINE_MIN_SECONDS);
+		if (bytes / elapsed > best)
+			best = bytes / elapsed;
+	}
+	g_roofline_sink = buf[len / sizeof(double) - 1];
+	return best / 1e9;
+}
+
+struct roofline_worker {
+	pthread_t thread;
+	const int *go;
+	double *buf;
+	long len;
+	// If nonzero, copy the first half of the slice into the second half
+	// instead of summing it.
+	int copy;
+	double sum;
+};
+
+// Passes each worker makes over its slice per trial.
+#define ROOFLINE_PARALLEL_PASSES 4
+
+static void *roofline_worker_run(void *arg)
+{
+	struct roofline_worker *worker = arg;
+	int pass, go;
+
+	// Spin rather than block, so that every worker starts streaming
+	// within a few cycles of the others.
+	while (!(go = __atomic_load_n(worker->go, __ATOMIC_ACQUIRE)))
+		_mm_pause();
+	if (go < 0)
+		return NULL;
+	for (pass = 0; pass < ROOFLINE_PARALLEL_PASSES; pass++) {
+		if (worker->copy) {
+			memcpy((char *)worker->buf + worker->len / 2,
+				worker->buf, worker->len / 2);
+		} else {
+			worker->sum += roofline_sum(worker->buf,
+					worker->len / sizeof(double));
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Read bandwidth with every thread streaming over its own slice of buf, or
+ * memcpy bandwidth if copy is nonzero.
+ */
+static int roofline_parallel_gbps(double *buf, long len, int threads,
+		int copy, double *gbps)
+{
+	struct roofline_worker *workers;
+	long slice, bytes;
+	double start, elapsed, best = 0;
+	int i, ret = 0, trial, started, go;
+
+	workers = calloc(threads, sizeof(struct roofline_worker));
+	if (!workers)
+		return ENOMEM;
+	slice = (len / threads) & ~((long)sysconf(_SC_PAGESIZE) - 1);
+	// As for roofline_memcpy_gbps, a copy counts the bytes copied.
+	bytes = ROOFLINE_PARALLEL_PASSES * (copy ? slice / 2 : slice);
+	for (trial = 0; trial < ROOFLINE_TRIALS; trial++) {
+		go = 0;
+		for (started = 0; started < threads; started++) {
+			workers[started].go = &go;
+			workers[started].buf = (double *)
+				((char *)buf + started * slice);
+			workers[started].len = slice;
+			workers[started].copy = copy;
+			ret = pthread_create(&workers[started].thread, NULL,
+					roofline_worker_run, &workers[started]);
+			if (ret) {
+				fprintf(stderr, "roofline: pthread_create "
+					"failed: error %d (%s)\n", ret,
+					strerror(ret));
+				break;
+			}
+		}
+		start = roofline_now();
+		__atomic_store_n(&go, ret ? -1 : 1, __ATOMIC_RELEASE);
+		for (i = 0; i < started; i++)
+			pthread_join(workers[i].thread, NULL);
+		elapsed = roofline_now() - start;
+		if (ret)
+			break;
+		if ((1.0 * bytes * threads) / elapsed > best)
+			best = (1.0 * bytes * threads) / elapsed;
+	}
+	for (i = 0; i < threads; i++)
+		g_roofline_sink = workers[i].sum;
+	*gbps = best / 1e9;
+	free(workers);
+	return ret;
+}
+
+static long roofline_cache_size(int name, long fallback)
+{
+	long size = sysconf(name);
+
+	return (size > 0) ? size : fallback;
+}
+
+int roofline_calibrate(struct roofline *rl)
+{
+	double *buf;
+	long i;
+	int level, ret;
+
+	memset(rl, 0, sizeof(*rl));
+	rl->cache_size[ROOFLINE_L1] = roofline_cache_size(
+		_SC_LEVEL1_DCACHE_SIZE, ROOFLINE_DEFAULT_L1);
+	rl->cache_size[ROOFLINE_L2] = roofline_cache_size(
+		_SC_LEVEL2_CACHE_SIZE, ROOFLINE_DEFAULT_L2);
+	rl->cache_size[ROOFLINE_L3] = roofline_cache_size(
+		_SC_LEVEL3_CACHE_SIZE, ROOFLINE_DEFAULT_L3);
+	rl->threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (rl->threads < 1)
+		rl->threads = 1;
+
+	buf = mmap(NULL, ROOFLINE_DRAM_BYTES, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED) {
+		ret = errno;
+		fprintf(stderr, "roofline: failed to map %ld bytes: "
+			"error %d (%s)\n", ROOFLINE_DRAM_BYTES, ret,
+			strerror(ret));
+		return ret;
+	}
+	// Fault everything in, so that we measure memory and not the page
+	// fault path.
+	for (i = 0; i < ROOFLINE_DRAM_BYTES / (long)sizeof(double); i++)
+		buf[i] = (double)(i & 0xffff);
+
+	// Use half of each cache level, so that the other half can hold
+	// whatever else is running.
+	for (level = ROOFLINE_L1; level <= ROOFLINE_L3; level++) {
+		long len = (rl->cache_size[level] / 2) & ~127L;
+		rl->gbps[level] = roofline_read_gbps(buf, len);
+	}
+	rl->gbps[ROOFLINE_DRAM] = roofline_read_gbps(buf,
+			ROOFLINE_DRAM_BYTES);
+	rl->gbps[ROOFLINE_MEMCPY] = roofline_memcpy_gbps(buf,
+			ROOFLINE_DRAM_BYTES);
+	ret = roofline_parallel_gbps(buf, ROOFLINE_DRAM_BYTES, rl->threads,
+			0, &rl->gbps[ROOFLINE_DRAM_ALL_CORES]);
+	if (!ret) {
+		ret = roofline_parallel_gbps(buf, ROOFLINE_DRAM_BYTES,
+			rl->threads, 1, &rl->gbps[ROOFLINE_MEMCPY_ALL_CORES]);
+	}
+	munmap(buf, ROOFLINE_DRAM_BYTES);
+	return ret;
+}
+
+void roofline_print(const struct roofline *rl)
+{
+	int level;
+
+	for (level = 0; level < ROOFLINE_MAX; level++) {
+		printf("roofline: %-22s %8.4g GB/s", ROOFLINE_NAMES[level],
+			rl->gbps[level]);
+		if (level <= ROOFLINE_L3)
+			printf("  (%ld KiB cache)", rl->cache_size[level] / 1024);
+		else if ((level == ROOFLINE_DRAM_ALL_CORES) ||
+				(level == ROOFLINE_MEMCPY_ALL_CORES))
+			printf("  (%d threads)", rl->threads);
+		printf("\n");
+	}
+}
+
+enum roofline_level roofline_applicable(const struct roofline *rl,
+		long long working_set, int threads, int copies)
+{
+	int level;
+
+	if (threads > 1)
+		return copies ? ROOFLINE_MEMCPY_ALL_CORES :
+			ROOFLINE_DRAM_ALL_CORES;
+	if (copies)
+		return ROOFLINE_MEMCPY;
+	for (level = ROOFLINE_L1; level <= ROOFLINE_L3; level++) {
+		if (working_set <= rl->cache_size[level] / 2)
+			return level;
+	}
+	return ROOFLINE_DRAM;
+}
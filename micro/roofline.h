@@ -0,0 +1,63 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#ifndef VECSUM_ROOFLINE_H
+#define VECSUM_ROOFLINE_H
+
+/*
+ * Memory bandwidth calibration.
+ *
+ * A throughput number only means something next to what the machine can
+ * do.  roofline_calibrate measures STREAM-style read bandwidth out of each
+ * level of the cache hierarchy and out of DRAM, both from one thread and
+ * from every online CPU, along with memcpy bandwidth measured the same two
+ * ways.  The benchmark can then report its own throughput as a fraction of
+ * the applicable ceiling.
+ *
+ * memcpy bandwidth counts bytes copied, not bytes read plus bytes written,
+ * so that it is comparable with the rate at which a copying read path can
+ * hand data to the kernel.
+ */
+
+enum roofline_level {
+	ROOFLINE_L1 = 0,
+	ROOFLINE_L2,
+	ROOFLINE_L3,
+	ROOFLINE_DRAM,
+	ROOFLINE_DRAM_ALL_CORES,
+	ROOFLINE_MEMCPY,
+	ROOFLINE_MEMCPY_ALL_CORES,
+	ROOFLINE_MAX,
+};
+
+struct roofline {
+	// Measured bandwidth of each level, in GB/s.
+	double gbps[ROOFLINE_MAX];
+
+	// Size of each cache level in bytes, or 0 if unknown.
+	long cache_size[ROOFLINE_L3 + 1];
+
+	// Number of threads used for the all-cores levels.
+	int threads;
+};
+
+/*
+ * Measure the bandwidth of each level.  This takes a second or two.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int roofline_calibrate(struct roofline *rl);
+
+void roofline_print(const struct roofline *rl);
+
+/*
+ * Pick the ceiling that applies to a scan of working_set bytes by the given
+ * number of threads.  copies should be nonzero if the read path copies the
+ * data into a buffer before it is summed.
+ */
+enum roofline_level roofline_applicable(const struct roofline *rl,
+		long long working_set, int threads, int copies);
+
+const char *roofline_level_name(enum roofline_level level);
+
+#endif
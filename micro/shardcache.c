@@ -0,0 +1,313 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include "shardcache.h"
+#include "util.h"
+
+#include <emmintrin.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define SHARDCACHE_CACHE_LINE 64
+
+/*
+ * A slot gets a cache line to itself, so that threads pinning different
+ * blocks don't bounce each other's reference counts around.
+ */
+struct shardcache_slot {
+	uint64_t id;
+	int refs;
+	int len;
+	uint8_t referenced;
+} __attribute__((aligned(SHARDCACHE_CACHE_LINE)));
+
+struct shardcache_shard {
+	// What lookups read: odd while an insert is changing the table, and
+	// bumped by every change.
+	uint64_t seq;
+	struct idtable table;
+
+	// The rest is only touched by inserts, under the lock, apart from
+	// retries.
+	pthread_mutex_t lock __attribute__((aligned(SHARDCACHE_CACHE_LINE)));
+	long long first_slot;
+	long long num_slots;
+	long long used;
+	long long hand;
+	long long inserts;
+	long long evictions;
+	long long busy;
+	long long retries;
+} __attribute__((aligned(SHARDCACHE_CACHE_LINE)));
+
+struct shardcache {
+	char *arena;
+	size_t arena_len;
+	int block_size;
+	long long num_slots;
+	struct shardcache_slot *slots;
+	struct shardcache_shard *shards;
+	int num_shards;
+	int shard_shift;
+};
+
+/*
+ * The shard a hash belongs to.  Shards take the top bits of the hash, and
+ * tables the bottom bits.
+ */
+static struct shardcache_shard *shardcache_shard_of(struct shardcache *sc,
+		uint64_t h)
+{
+	if (sc->num_shards == 1)
+		return &sc->shards[0];
+	return &sc->shards[h >> sc->shard_shift];
+}
+
+int shardcache_create(long long capacity, int block_size, int num_shards,
+		struct shardcache **out)
+{
+	struct shardcache *sc;
+	struct shardcache_shard *sh;
+	long long per_shard;
+	int i, ret;
+
+	if ((num_shards < 1) || (num_shards & (num_shards - 1))) {
+		fprintf(stderr, "shardcache: the number of shards must be a "
+			"power of two, not %d.\n", num_shards);
+		return EINVAL;
+	}
+	if ((block_size <= 0) || (capacity / block_size < num_shards)) {
+		fprintf(stderr, "shardcache: a capacity of %lld bytes can't "
+			"hold a %d-byte block in each of %d shards.\n",
+			capacity, block_size, num_shards);
+		return EINVAL;
+	}
+	sc = calloc(1, sizeof(*sc));
+	if (!sc)
+		return ENOMEM;
+	sc->block_size = block_size;
+	sc->num_shards = num_shards;
+	sc->shard_shift = 64 - __builtin_ctz(num_shards);
+	per_shard = capacity / block_size / num_shards;
+	sc->num_slots = per_shard * num_shards;
+	if (posix_memalign((void **)&sc->slots, SHARDCACHE_CACHE_LINE,
+			sc->num_slots * sizeof(struct shardcache_slot)) ||
+	    posix_memalign((void **)&sc->shards, SHARDCACHE_CACHE_LINE,
+			num_shards * sizeof(struct shardcache_shard))) {
+		ret = ENOMEM;
+		goto error;
+	}
+	memset(sc->slots, 0, sc->num_slots * sizeof(struct shardcache_slot));
+	memset(sc->shards, 0, num_shards * sizeof(struct shardcache_shard));
+	for (i = 0; i < num_shards; i++) {
+		sh = &sc->shards[i];
+		pthread_mutex_init(&sh->lock, NULL);
+		sh->first_slot = i * per_shard;
+		sh->num_slots = per_shard;
+		ret = idtable_init(&sh->table, per_shard, &sc->slots[0].id,
+			sizeof(struct shardcache_slot));
+		if (ret)
+			goto error;
+	}
+	sc->arena_len = sc->num_slots * block_size;
+	sc->arena = mmap(NULL, sc->arena_len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (sc->arena == MAP_FAILED) {
+		ret = errno;
+		fprintf(stderr, "shardcache: failed to map a %zu-byte arena: "
+			"error %d (%s)\n", sc->arena_len, ret, strerror(ret));
+		sc->arena = NULL;
+		goto error;
+	}
+	*out = sc;
+	return 0;
+
+error:
+	shardcache_free(sc);
+	return ret;
+}
+
+void shardcache_free(struct shardcache *sc)
+{
+	int i;
+
+	if (!sc)
+		return;
+	if (sc->arena)
+		munmap(sc->arena, sc->arena_len);
+	if (sc->shards) {
+		for (i = 0; i < sc->num_shards; i++) {
+			idtable_free(&sc->shards[i].table);
+			pthread_mutex_destroy(&sc->shards[i].lock);
+		}
+	}
+	free(sc->shards);
+	free(sc->slots);
+	free(sc);
+}
+
+const void *shardcache_pin(struct shardcache *sc, uint64_t id, int *len)
+{
+	uint64_t h = mix64(id), seq;
+	struct shardcache_shard *sh = shardcache_shard_of(sc, h);
+	struct shardcache_slot *s;
+	int64_t slot;
+
+	while (1) {
+		seq = __atomic_load_n(&sh->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			_mm_pause();
+			continue;
+		}
+		// The table may change under us; the counter tells us if it
+		// did.
+		slot = __atomic_load_n(&sh->table.buckets[idtable_find(
+				&sh->table, id)], __ATOMIC_RELAXED);
+		if ((slot == IDTABLE_EMPTY) ||
+				(__atomic_load_n(&sc->slots[slot].id,
+						 __ATOMIC_RELAXED) != id)) {
+			// A miss only counts if no insert moved the block
+			// while we were looking for it.
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&sh->seq, __ATOMIC_RELAXED) == seq)
+				return NULL;
+		} else {
+			s = &sc->slots[slot];
+			// Pin, then check that no eviction started in the
+			// meantime.  An eviction bumps the counter before it
+			// checks the count, so one of us sees the other.
+			__atomic_fetch_add(&s->refs, 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&sh->seq, __ATOMIC_SEQ_CST) ==
+					seq) {
+				if (!__atomic_load_n(&s->referenced,
+						__ATOMIC_RELAXED)) {
+					__atomic_store_n(&s->referenced, 1,
+						__ATOMIC_RELAXED);
+				}
+				*len = s->len;
+				return sc->arena + (slot * sc->block_size);
+			}
+			__atomic_fetch_sub(&s->refs, 1, __ATOMIC_RELEASE);
+		}
+		__atomic_fetch_add(&sh->retries, 1, __ATOMIC_RELAXED);
+	}
+}
+
+void shardcache_unpin(struct shardcache *sc, const void *buf)
+{
+	int64_t slot = ((const char *)buf - sc->arena) / sc->block_size;
+
+	__atomic_fetch_sub(&sc->slots[slot].refs, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Run the CLOCK hand to an unpinned, unreferenced block, and drop it from
+ * the table.  Called with the lock held.  Returns the freed slot, or -1 if
+ * every block was pinned.
+ */
+static int64_t shardcache_evict(struct shardcache *sc,
+		struct shardcache_shard *sh)
+{
+	struct shardcache_slot *s;
+	long long n;
+	int64_t slot;
+
+	// Two trips around clear every reference bit on the way.
+	for (n = 0; n < 2 * sh->num_slots; n++) {
+		slot = sh->first_slot + sh->hand;
+		sh->hand = (sh->hand + 1) % sh->num_slots;
+		s = &sc->slots[slot];
+		if (__atomic_load_n(&s->refs, __ATOMIC_RELAXED))
+			continue;
+		if (__atomic_load_n(&s->referenced, __ATOMIC_RELAXED)) {
+			__atomic_store_n(&s->referenced, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		__atomic_fetch_add(&sh->seq, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&s->refs, __ATOMIC_SEQ_CST)) {
+			// Pinned since we looked.
+			__atomic_fetch_add(&sh->seq, 1, __ATOMIC_RELEASE);
+			continue;
+		}
+		// The counter is odd, so lookups that see the entries
+		// move will retry.
+		idtable_remove(&sh->table, idtable_find(&sh->table, s->id));
+		__atomic_fetch_add(&sh->seq, 1, __ATOMIC_RELEASE);
+		sh->evictions++;
+		return slot;
+	}
+	return -1;
+}
+
+int shardcache_insert(struct shardcache *sc, uint64_t id, const void *buf,
+		int len)
+{
+	uint64_t h = mix64(id), i;
+	struct shardcache_shard *sh = shardcache_shard_of(sc, h);
+	struct shardcache_slot *s;
+	int64_t slot;
+
+	if (len > sc->block_size)
+		return EINVAL;
+	pthread_mutex_lock(&sh->lock);
+	i = idtable_find(&sh->table, id);
+	if (sh->table.buckets[i] != IDTABLE_EMPTY) {
+		pthread_mutex_unlock(&sh->lock);
+		return EEXIST;
+	}
+	if (sh->used < sh->num_slots) {
+		slot = sh->first_slot + sh->used++;
+	} else {
+		slot = shardcache_evict(sc, sh);
+		if (slot < 0) {
+			sh->busy++;
+			pthread_mutex_unlock(&sh->lock);
+			return EBUSY;
+		}
+		// The eviction may have shifted our bucket.
+		i = idtable_find(&sh->table, id);
+	}
+	// Nothing can find the slot yet, so fill it before taking the
+	// counter, and keep lookups of other blocks from waiting on the copy.
+	memcpy(sc->arena + (slot * sc->block_size), buf, len);
+	s = &sc->slots[slot];
+	__atomic_fetch_add(&sh->seq, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&s->id, id, __ATOMIC_RELAXED);
+	s->len = len;
+	__atomic_store_n(&s->referenced, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&sh->table.buckets[i], slot, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&sh->seq, 1, __ATOMIC_RELEASE);
+	sh->inserts++;
+	pthread_mutex_unlock(&sh->lock);
+	return 0;
+}
+
+void shardcache_get_stats(struct shardcache *sc,
+		struct shardcache_stats *stats)
+{
+	struct shardcache_shard *sh;
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < sc->num_shards; i++) {
+		sh = &sc->shards[i];
+		pthread_mutex_lock(&sh->lock);
+		stats->inserts += sh->inserts;
+		stats->evictions += sh->evictions;
+		stats->busy += sh->busy;
+		pthread_mutex_unlock(&sh->lock);
+		stats->retries += __atomic_load_n(&sh->retries,
+			__ATOMIC_RELAXED);
+	}
+}
+
+long long shardcache_capacity_blocks(const struct shardcache *sc)
+{
+	return sc->num_slots;
+}
@@ -0,0 +1,86 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#ifndef VECSUM_SHARDCACHE_H
+#define VECSUM_SHARDCACHE_H
+
+/*
+ * A block cache that many threads can share.
+ *
+ * Blocks are spread over a power-of-two number of shards by the hash of
+ * their id.  Each shard has its own slots, open-addressed hash table, CLOCK
+ * hand, and mutex, which only inserts take.  Lookups take no lock: they
+ * probe the table under the shard's sequence counter, as in a seqlock, and
+ * retry if an insert changed the table under them.
+ *
+ * A hit pins its block, and the block can't be evicted until it is
+ * unpinned, so a kernel can read it in place while other threads insert.
+ * Since hits can't move blocks around a list without a lock, each shard
+ * evicts by CLOCK: a hit sets the block's reference bit, and the hand
+ * passes over pinned blocks and clears reference bits until it finds a
+ * block to evict.
+ */
+
+#include <stdint.h>
+
+struct shardcache;
+
+struct shardcache_stats {
+	// Blocks inserted, and blocks evicted to make room for them
+	long long inserts;
+	long long evictions;
+
+	// Inserts turned away because every block in the shard was pinned
+	long long busy;
+
+	// Lookups that had to start over because an insert raced with them
+	long long retries;
+};
+
+/*
+ * Create a cache of capacity bytes, in blocks of block_size bytes, split
+ * into num_shards shards.  num_shards must be a power of two.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int shardcache_create(long long capacity, int block_size, int num_shards,
+		struct shardcache **out);
+
+/*
+ * Free the cache.  No block may be pinned.
+ */
+void shardcache_free(struct shardcache *sc);
+
+/*
+ * Look up a block.  On a hit, pins the block, sets *len to its length, and
+ * returns its bytes, which stay valid until shardcache_unpin.  On a miss,
+ * returns NULL.
+ */
+const void *shardcache_pin(struct shardcache *sc, uint64_t id, int *len);
+
+/*
+ * Unpin a block, given the bytes shardcache_pin returned.
+ */
+void shardcache_unpin(struct shardcache *sc, const void *buf);
+
+/*
+ * Copy a block into the cache, evicting another from its shard if need be.
+ *
+ * Returns 0 on success, EEXIST if the block is already cached, EBUSY if
+ * every block in the shard is pinned, or EINVAL if the block is too big.
+ */
+int shardcache_insert(struct shardcache *sc, uint64_t id, const void *buf,
+		int len);
+
+/*
+ * Add up the stats of every shard.
+ */
+void shardcache_get_stats(struct shardcache *sc,
+		struct shardcache_stats *stats);
+
+/*
+ * Number of blocks the cache can hold.
+ */
+long long shardcache_capacity_blocks(const struct shardcache *sc);
+
+#endif
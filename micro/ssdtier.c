@@ -0,0 +1,428 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include "ssdtier.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// O_DIRECT transfers must be aligned to this, in memory and on disk.
+#define SSDTIER_ALIGN 4096
+
+// Number of writes that can be queued at once.
+#define SSDTIER_QUEUE_DEPTH 4
+
+enum ssdtier_write_state {
+	SSDTIER_WRITE_FREE = 0,
+	SSDTIER_WRITE_FILLING,
+	SSDTIER_WRITE_READY,
+	SSDTIER_WRITE_WRITING,
+};
+
+struct ssdtier_write {
+	enum ssdtier_write_state state;
+	char *buf;
+	uint64_t id;
+	int stored_len;
+	int len;
+
+	// Set if the block was removed while it was queued, so that the
+	// writer doesn't publish it.
+	int cancelled;
+};
+
+struct ssdtier {
+	int fd;
+	int slot_size;
+	long long num_slots;
+	long long used;
+
+	// The slot the next write goes to
+	long long next_slot;
+
+	// Block id, length, and bytes stored of each slot; slot_stored is 0
+	// for an empty slot.
+	uint64_t *slot_id;
+	int *slot_len;
+	int *slot_stored;
+
+	// Reads in flight from each slot.  The writer waits for these to
+	// finish before it reuses the slot.
+	int *slot_pins;
+
+	// Slot numbers by block id
+	struct idtable table;
+
+	// A ring of writes; the writer takes them from the head.
+	struct ssdtier_write queue[SSDTIER_QUEUE_DEPTH];
+	int head;
+	int count;
+
+	// Protects everything but the file data and the contents of the
+	// queue buffers.  The writer waits on cond for queued writes and for
+	// pins to drain.
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t writer;
+	int have_writer;
+	int stopping;
+
+	struct ssdtier_stats stats;
+};
+
+static long long ssdtier_round(long long len)
+{
+	return (len + SSDTIER_ALIGN - 1) & ~(long long)(SSDTIER_ALIGN - 1);
+}
+
+/*
+ * Drop the block in bucket i from the index, and empty its slot.  Called
+ * with the lock held.
+ */
+static void ssdtier_unindex(struct ssdtier *st, uint64_t i)
+{
+	st->slot_stored[st->table.buckets[i]] = 0;
+	st->used--;
+	idtable_remove(&st->table, i);
+}
+
+static void *ssdtier_writer_run(void *arg)
+{
+	struct ssdtier *st = arg;
+	struct ssdtier_write *w;
+	long long slot, off, want;
+	ssize_t res;
+	uint64_t i;
+	int err;
+
+	pthread_mutex_lock(&st->lock);
+	while (1) {
+		while (((st->count == 0) ||
+				(st->queue[st->head].state !=
+				 SSDTIER_WRITE_READY)) && !st->stopping)
+			pthread_cond_wait(&st->cond, &st->lock);
+		if (st->count == 0)
+			break;
+		w = &st->queue[st->head];
+		w->state = SSDTIER_WRITE_WRITING;
+		// Take the next slot in the ring, and evict what was there
+		// before anyone can read it mid-write.
+		slot = st->next_slot;
+		st->next_slot = (st->next_slot + 1) % st->num_slots;
+		if (st->slot_stored[slot]) {
+			ssdtier_unindex(st, idtable_find(&st->table,
+				st->slot_id[slot]));
+		}
+		// Nothing can pin the slot once it is out of the index, but
+		// reads that already did may still be going.
+		while (st->slot_pins[slot])
+			pthread_cond_wait(&st->cond, &st->lock);
+		pthread_mutex_unlock(&st->lock);
+
+		err = 0;
+		want = ssdtier_round(w->stored_len);
+		for (off = 0; off < want; off += res) {
+			res = pwrite(st->fd, w->buf + off, want - off,
+				(slot * st->slot_size) + off);
+			if (res < 0) {
+				if (errno == EINTR) {
+					res = 0;
+					continue;
+				}
+				err = errno;
+				break;
+			}
+			if (res == 0) {
+				// Nothing written and no error: take it that
+				// the file system is out of room, rather than
+				// retry forever.
+				err = ENOSPC;
+				break;
+			}
+		}
+
+		pthread_mutex_lock(&st->lock);
+		if (err == ENOSPC) {
+			st->stats.dropped++;
+		} else if (err) {
+			if (st->stats.errors++ == 0) {
+				fprintf(stderr, "ssdtier: write failed: error "
+					"%d (%s)\n", err, strerror(err));
+			}
+		} else if (!w->cancelled) {
+			st->slot_id[slot] = w->id;
+			st->slot_len[slot] = w->len;
+			st->slot_stored[slot] = w->stored_len;
+			i = idtable_find(&st->table, w->id);
+			st->table.buckets[i] = slot;
+			st->used++;
+			st->stats.writes++;
+			st->stats.bytes_written += w->len;
+		}
+		w->state = SSDTIER_WRITE_FREE;
+		st->head = (st->head + 1) % SSDTIER_QUEUE_DEPTH;
+		st->count--;
+	}
+	pthread_mutex_unlock(&st->lock);
+	return NULL;
+}
+
+/*
+ * Create and open the tier's file, without O_DIRECT if we have to.
+ */
+static int ssdtier_open(struct ssdtier *st, const char *dir, long long len)
+{
+	char path[4096];
+	int flags, ret;
+
+	snprintf(path, sizeof(path), "%s/vecsum-ssdtier.XXXXXX", dir);
+	st->fd = mkstemp(path);
+	if (st->fd < 0) {
+		ret = errno;
+		fprintf(stderr, "ssdtier: failed to create a file in %s: "
+			"error %d (%s)\n", dir, ret, strerror(ret));
+		return ret;
+	}
+	// Nothing else should ever see it.
+	unlink(path);
+	flags = fcntl(st->fd, F_GETFL);
+	if (fcntl(st->fd, F_SETFL, flags | O_DIRECT)) {
+		fprintf(stderr, "ssdtier: %s doesn't support O_DIRECT (error "
+			"%d); reads may come from the page cache.\n", dir,
+			errno);
+	}
+	ret = posix_fallocate(st->fd, 0, len);
+	if (ret) {
+		fprintf(stderr, "ssdtier: failed to allocate %lld bytes in "
+			"%s: error %d (%s)\n", len, dir, ret, strerror(ret));
+		return ret;
+	}
+	return 0;
+}
+
+int ssdtier_create(const char *dir, long long capacity, int slot_size,
+		struct ssdtier **out)
+{
+	struct ssdtier *st;
+	int i, ret;
+
+	st = calloc(1, sizeof(*st));
+	if (!st)
+		return ENOMEM;
+	st->fd = -1;
+	pthread_mutex_init(&st->lock, NULL);
+	pthread_cond_init(&st->cond, NULL);
+	st->slot_size = ssdtier_round(slot_size);
+	st->num_slots = capacity / st->slot_size;
+	if (st->num_slots < 1) {
+		fprintf(stderr, "ssdtier: a capacity of %lld bytes can't hold "
+			"a single %d-byte slot.\n", capacity, st->slot_size);
+		ret = EINVAL;
+		goto error;
+	}
+	st->slot_id = calloc(st->num_slots, sizeof(uint64_t));
+	st->slot_len = calloc(st->num_slots, sizeof(int));
+	st->slot_stored = calloc(st->num_slots, sizeof(int));
+	st->slot_pins = calloc(st->num_slots, sizeof(int));
+	if (!st->slot_id || !st->slot_len || !st->slot_stored ||
+			!st->slot_pins) {
+		ret = ENOMEM;
+		goto error;
+	}
+	ret = idtable_init(&st->table, st->num_slots, st->slot_id,
+		sizeof(uint64_t));
+	if (ret)
+		goto error;
+	for (i = 0; i < SSDTIER_QUEUE_DEPTH; i++) {
+		if (posix_memalign((void **)&st->queue[i].buf, SSDTIER_ALIGN,
+				st->slot_size)) {
+			ret = ENOMEM;
+			goto error;
+		}
+	}
+	ret = ssdtier_open(st, dir, st->num_slots * st->slot_size);
+	if (ret)
+		goto error;
+	ret = pthread_create(&st->writer, NULL, ssdtier_writer_run, st);
+	if (ret)
+		goto error;
+	st->have_writer = 1;
+	*out = st;
+	return 0;
+
+error:
+	ssdtier_free(st);
+	return ret;
+}
+
+void ssdtier_free(struct ssdtier *st)
+{
+	int i;
+
+	if (!st)
+		return;
+	if (st->have_writer) {
+		pthread_mutex_lock(&st->lock);
+		st->stopping = 1;
+		pthread_cond_broadcast(&st->cond);
+		pthread_mutex_unlock(&st->lock);
+		pthread_join(st->writer, NULL);
+	}
+	if (st->fd >= 0)
+		close(st->fd);
+	for (i = 0; i < SSDTIER_QUEUE_DEPTH; i++)
+		free(st->queue[i].buf);
+	free(st->slot_id);
+	free(st->slot_len);
+	free(st->slot_stored);
+	free(st->slot_pins);
+	idtable_free(&st->table);
+	pthread_cond_destroy(&st->cond);
+	pthread_mutex_destroy(&st->lock);
+	free(st);
+}
+
+int ssdtier_read(struct ssdtier *st, uint64_t id, void *buf, int *len)
+{
+	long long off, want, slot;
+	int stored;
+	ssize_t res;
+
+	// Pin the slot, so that the writer can't reuse it under us, and read
+	// without the lock, so that other reads and the writer can go on.
+	pthread_mutex_lock(&st->lock);
+	slot = st->table.buckets[idtable_find(&st->table, id)];
+	if (slot == IDTABLE_EMPTY) {
+		pthread_mutex_unlock(&st->lock);
+		return 0;
+	}
+	st->slot_pins[slot]++;
+	stored = st->slot_stored[slot];
+	*len = st->slot_len[slot];
+	pthread_mutex_unlock(&st->lock);
+
+	want = ssdtier_round(stored);
+	for (off = 0; off < want; off += res) {
+		res = pread(st->fd, (char *)buf + off, want - off,
+			(slot * st->slot_size) + off);
+		if (res < 0) {
+			if (errno == EINTR) {
+				res = 0;
+				continue;
+			}
+			stored = -errno;
+			break;
+		}
+		if (res == 0) {
+			stored = -EIO;
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&st->lock);
+	if (--st->slot_pins[slot] == 0)
+		pthread_cond_signal(&st->cond);
+	pthread_mutex_unlock(&st->lock);
+	return stored;
+}
+
+/*
+ * Returns the queued write of id, or NULL if there is none.  Called with the
+ * lock held.
+ */
+static struct ssdtier_write *ssdtier_queued(struct ssdtier *st, uint64_t id)
+{
+	int i, q;
+
+	for (i = 0; i < st->count; i++) {
+		q = (st->head + i) % SSDTIER_QUEUE_DEPTH;
+		if ((st->queue[q].id == id) && !st->queue[q].cancelled)
+			return &st->queue[q];
+	}
+	return NULL;
+}
+
+int ssdtier_write(struct ssdtier *st, uint64_t id, const void *buf,
+		int stored_len, int len)
+{
+	struct ssdtier_write *w;
+
+	if (ssdtier_round(stored_len) > st->slot_size)
+		return EINVAL;
+	pthread_mutex_lock(&st->lock);
+	if ((st->table.buckets[idtable_find(&st->table, id)] !=
+			IDTABLE_EMPTY) || ssdtier_queued(st, id)) {
+		pthread_mutex_unlock(&st->lock);
+		return EEXIST;
+	}
+	if (st->count == SSDTIER_QUEUE_DEPTH) {
+		st->stats.dropped++;
+		pthread_mutex_unlock(&st->lock);
+		return EAGAIN;
+	}
+	w = &st->queue[(st->head + st->count) % SSDTIER_QUEUE_DEPTH];
+	w->state = SSDTIER_WRITE_FILLING;
+	w->id = id;
+	w->stored_len = stored_len;
+	w->len = len;
+	w->cancelled = 0;
+	st->count++;
+	pthread_mutex_unlock(&st->lock);
+
+	// The writer leaves a filling buffer alone, so copy without the lock.
+	memcpy(w->buf, buf, stored_len);
+
+	pthread_mutex_lock(&st->lock);
+	w->state = SSDTIER_WRITE_READY;
+	pthread_cond_signal(&st->cond);
+	pthread_mutex_unlock(&st->lock);
+	return 0;
+}
+
+void ssdtier_remove(struct ssdtier *st, uint64_t id)
+{
+	struct ssdtier_write *w;
+	uint64_t i;
+
+	pthread_mutex_lock(&st->lock);
+	i = idtable_find(&st->table, id);
+	if (st->table.buckets[i] != IDTABLE_EMPTY)
+		ssdtier_unindex(st, i);
+	w = ssdtier_queued(st, id);
+	if (w)
+		w->cancelled = 1;
+	pthread_mutex_unlock(&st->lock);
+}
+
+void ssdtier_get_stats(struct ssdtier *st, struct ssdtier_stats *stats,
+		int reset)
+{
+	pthread_mutex_lock(&st->lock);
+	*stats = st->stats;
+	if (reset)
+		memset(&st->stats, 0, sizeof(st->stats));
+	pthread_mutex_unlock(&st->lock);
+}
+
+long long ssdtier_capacity_blocks(const struct ssdtier *st)
+{
+	return st->num_slots;
+}
+
+long long ssdtier_used_blocks(struct ssdtier *st)
+{
+	long long used;
+
+	pthread_mutex_lock(&st->lock);
+	used = st->used;
+	pthread_mutex_unlock(&st->lock);
+	return used;
+}
@@ -0,0 +1,94 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#ifndef VECSUM_SSDTIER_H
+#define VECSUM_SSDTIER_H
+
+/*
+ * A file-backed cache tier, for a local SSD under the block cache.
+ *
+ * The tier is one file of fixed-size slots, opened with O_DIRECT so that
+ * reads come from the device and not from the page cache, and unlinked as
+ * soon as it is created.  Slots are written in a ring, like a log-structured
+ * flash cache: each write takes the next slot and evicts whatever was in it,
+ * so the device only ever sees large sequential-per-slot writes.
+ *
+ * Writes are asynchronous.  ssdtier_write copies the block into one of a
+ * few queue buffers and returns; a writer thread writes it out and only then
+ * makes it visible to ssdtier_read.  If every queue buffer is busy, the
+ * write is dropped rather than holding up the read path.
+ *
+ * The tier stores whatever bytes it is given, along with the length of the
+ * data they hold, so a compressed block cache can store its frames as they
+ * are.
+ */
+
+#include <stdint.h>
+
+struct ssdtier;
+
+struct ssdtier_stats {
+	// Blocks written, and the bytes in them
+	long long writes;
+	long long bytes_written;
+
+	// Writes dropped because the queue was full or the file system had
+	// no room
+	long long dropped;
+
+	// Writes that failed
+	long long errors;
+};
+
+/*
+ * Create a tier of capacity bytes in a file under dir, in slots that can
+ * hold up to slot_size bytes.  If dir's file system doesn't support
+ * O_DIRECT, the tier is created without it, with a warning.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int ssdtier_create(const char *dir, long long capacity, int slot_size,
+		struct ssdtier **out);
+
+/*
+ * Wait for the queued writes, and free the tier.
+ */
+void ssdtier_free(struct ssdtier *st);
+
+/*
+ * Read a block into buf, which must be aligned to 4096 bytes and have room
+ * for slot_size bytes rounded up to a multiple of 4096.  On a hit, sets
+ * *len to the length of the data the bytes hold.
+ *
+ * Returns the number of bytes stored, 0 on a miss, or a negative errno
+ * value on failure.
+ */
+int ssdtier_read(struct ssdtier *st, uint64_t id, void *buf, int *len);
+
+/*
+ * Queue stored_len bytes holding a block of len bytes to be written.
+ *
+ * Returns 0 on success, EEXIST if the block is already in the tier or
+ * queued, or EAGAIN if the write was dropped.
+ */
+int ssdtier_write(struct ssdtier *st, uint64_t id, const void *buf,
+		int stored_len, int len);
+
+/*
+ * Drop a block from the tier, if it is there.
+ */
+void ssdtier_remove(struct ssdtier *st, uint64_t id);
+
+/*
+ * Get the stats, and reset them if reset is nonzero.
+ */
+void ssdtier_get_stats(struct ssdtier *st, struct ssdtier_stats *stats,
+		int reset);
+
+/*
+ * Number of blocks the tier can hold, and number it holds now.
+ */
+long long ssdtier_capacity_blocks(const struct ssdtier *st);
+long long ssdtier_used_blocks(struct ssdtier *st);
+
+#endif
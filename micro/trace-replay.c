@@ -0,0 +1,724 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <hdfs.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blocktrace.h"
+#include "bufpool.h"
+
+// Smallest buffer the zcr fallback's pool hands out, as in vecsum2.
+#define POOL_MIN_BUFFER_SIZE (1024 * 1024)
+
+#define USAGE \
+"usage: trace-replay [options] <trace>\n" \
+"\n" \
+"Reissues the reads in a block trace written by vecsum2 (VECSUM_TRACE)\n" \
+"against one of vecsum2's read paths, and reports throughput and latency.\n" \
+"Workers take the reads in timestamp order from a shared queue, so with\n" \
+"original timing, reads that find every worker busy are issued late; the\n" \
+"report says by how much.\n" \
+"\n" \
+"options:\n" \
+"  -t <type>     libhdfs, zcr, local, or pread (the default)\n" \
+"  -a <address>  namenode RPC address for libhdfs and zcr (default\n" \
+"                \"default\")\n" \
+"  -s <speed>    replay speed: 1 keeps the original timing (the\n" \
+"                default), 10 replays ten times faster, and 0 issues\n" \
+"                every read as fast as possible\n" \
+"  -w <workers>  number of replay threads (default 1)\n" \
+"  -m            replay only the reads that missed the block cache\n" \
+"  -f <path>     read this file in place of every file in the trace\n"
+
+enum replay_type {
+	REPLAY_LIBHDFS = 0,
+	REPLAY_ZCR,
+	REPLAY_LOCAL,
+	REPLAY_PREAD,
+	REPLAY_MAX,
+};
+
+static const char * const REPLAY_TYPE_NAMES[] = {
+	[REPLAY_LIBHDFS] = "libhdfs",
+	[REPLAY_ZCR] = "zcr",
+	[REPLAY_LOCAL] = "local",
+	[REPLAY_PREAD] = "pread",
+};
+
+struct replay {
+	enum replay_type ty;
+	const char *rpc_address;
+	double speed;
+	int num_workers;
+	int misses_only;
+	const char *path_override;
+
+	struct blocktrace_log *log;
+
+	// Indexes into log->recs of the reads to replay, in order
+	long long *order;
+	long long num_reads;
+
+	// Taken by the workers one at a time
+	long long next;
+
+	// Size of the largest read
+	uint32_t max_len;
+
+	// Per file: the descriptor for pread, or the mapping for local
+	int *fds;
+	const char **maps;
+	long long *map_lens;
+
+	// The connection for libhdfs and zcr
+	hdfsFS fs;
+
+	// Where zcr reads that libhdfs can't hand us in place are copied to
+	struct bufpool *pool;
+
+	// CLOCK_MONOTONIC when the replay started, and the timestamp of the
+	// first read in the trace
+	uint64_t start;
+	uint64_t first_ts;
+
+	// Per read: nanoseconds from issue to completion, and from the
+	// scheduled issue time to the actual one
+	uint64_t *latency;
+	uint64_t *lateness;
+
+	// The first error any worker hit
+	int err;
+};
+
+struct worker {
+	struct replay *rp;
+	pthread_t thread;
+	char *buf;
+
+	// libhdfs and zcr: this worker's handles, and where each stream is
+	hdfsFile *files;
+	long long *stream_pos;
+	struct hadoopRzOptions *zopts;
+
+	// CLOCK_MONOTONIC when the worker finished its last read
+	uint64_t end;
+	long long bytes;
+	long long short_reads;
+
+	// zcr reads that fell back to copying into the pool
+	long long zcr_fallbacks;
+
+	// Keeps the compiler from dropping mmap page touches.
+	unsigned long sink;
+};
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const char *replay_path(const struct replay *rp, uint32_t file)
+{
+	return rp->path_override ? rp->path_override : rp->log->files[file];
+}
+
+/*
+ * Set the replay's error, unless a worker already did.
+ */
+static void replay_fail(struct replay *rp, int err)
+{
+	int zero = 0;
+
+	__atomic_compare_exchange_n(&rp->err, &zero, err, 0,
+		__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static int read_pread(struct replay *rp, struct worker *w,
+		const struct blocktrace_record *rec, long long *got)
+{
+	ssize_t res;
+
+	*got = 0;
+	while (*got < rec->length) {
+		res = pread(rp->fds[rec->file], w->buf + *got,
+			rec->length - *got, rec->offset + *got);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (res == 0)
+			break;
+		*got += res;
+	}
+	return 0;
+}
+
+static int read_local(struct replay *rp, struct worker *w,
+		const struct blocktrace_record *rec, long long *got)
+{
+	const volatile char *map = rp->maps[rec->file];
+	long long off, end = rec->offset + rec->length;
+
+	// Touch every page, which is what faults it in.
+	if (end > rp->map_lens[rec->file])
+		end = rp->map_lens[rec->file];
+	for (off = rec->offset; off < end; off += 4096)
+		w->sink += map[off];
+	*got = (end > (long long)rec->offset) ? end - rec->offset : 0;
+	return 0;
+}
+
+/*
+ * Open this worker's libhdfs handle for a file, if it hasn't yet.
+ */
+static int worker_open_hdfs(struct replay *rp, struct worker *w,
+		uint32_t file)
+{
+	int ret;
+
+	if (w->files[file])
+		return 0;
+	w->files[file] = hdfsOpenFile(rp->fs, replay_path(rp, file),
+		O_RDONLY, 0, 0, 0);
+	if (!w->files[file]) {
+		ret = errno;
+		fprintf(stderr, "hdfsOpenFile(%s) failed: error %d (%s)\n",
+			replay_path(rp, file), ret, strerror(ret));
+		return ret;
+	}
+	return 0;
+}
+
+static int read_libhdfs(struct replay *rp, struct worker *w,
+		const struct blocktrace_record *rec, long long *got)
+{
+	tSize res;
+	int ret;
+
+	*got = 0;
+	ret = worker_open_hdfs(rp, w, rec->file);
+	if (ret)
+		return ret;
+	while (*got < rec->length) {
+		res = hdfsPread(rp->fs, w->files[rec->file],
+			rec->offset + *got, w->buf + *got,
+			rec->length - *got);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (res == 0)
+			break;
+		*got += res;
+	}
+	return 0;
+}
+
+/*
+ * Copy the rest of a zcr read into a pool buffer, for a block that can't be
+ * mapped.  This is vecsum2's fallback, so that replays of reads that missed
+ * the HDFS cache work too.
+ */
+static int read_zcr_fallback(struct replay *rp, struct worker *w,
+		hdfsFile file, const struct blocktrace_record *rec,
+		long long *got)
+{
+	int32_t want = rec->length - *got, off = 0;
+	tSize res;
+	char *buf;
+	int ret = 0;
+
+	buf = bufpool_get(rp->pool, want);
+	if (!buf)
+		return ENOMEM;
+	w->zcr_fallbacks++;
+	while (off < want) {
+		res = hdfsRead(rp->fs, file, buf + off, want - off);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = errno;
+			break;
+		}
+		if (res == 0)
+			break;
+		off += res;
+	}
+	*got += off;
+	w->stream_pos[rec->file] += off;
+	bufpool_put(rp->pool, buf);
+	return ret;
+}
+
+static int read_zcr(struct replay *rp, struct worker *w,
+		const struct blocktrace_record *rec, long long *got)
+{
+	struct hadoopRzBuffer *rzbuf;
+	const volatile char *data;
+	hdfsFile file;
+	int32_t len, off;
+	int ret;
+
+	*got = 0;
+	ret = worker_open_hdfs(rp, w, rec->file);
+	if (ret)
+		return ret;
+	file = w->files[rec->file];
+	if (w->stream_pos[rec->file] != (long long)rec->offset) {
+		if (hdfsSeek(rp->fs, file, rec->offset))
+			return errno;
+		w->stream_pos[rec->file] = rec->offset;
+	}
+	while (*got < rec->length) {
+		rzbuf = hadoopReadZero(file, w->zopts, rec->length - *got);
+		if (!rzbuf) {
+			if (errno != EPROTONOSUPPORT)
+				return errno;
+			return read_zcr_fallback(rp, w, file, rec, got);
+		}
+		data = hadoopRzBufferGet(rzbuf);
+		len = data ? hadoopRzBufferLength(rzbuf) : 0;
+		// The buffer is a mapping, so touch it as read_local does.
+		for (off = 0; off < len; off += 4096)
+			w->sink += data[off];
+		hadoopRzBufferFree(file, rzbuf);
+		if (len <= 0)
+			break;
+		*got += len;
+		w->stream_pos[rec->file] += len;
+	}
+	return 0;
+}
+
+static int (*const REPLAY_READS[])(struct replay *, struct worker *,
+		const struct blocktrace_record *, long long *) = {
+	[REPLAY_LIBHDFS] = read_libhdfs,
+	[REPLAY_ZCR] = read_zcr,
+	[REPLAY_LOCAL] = read_local,
+	[REPLAY_PREAD] = read_pread,
+};
+
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	struct replay *rp = w->rp;
+	const struct blocktrace_record *rec;
+	struct timespec ts;
+	uint64_t target, issue;
+	long long i, got;
+	int ret;
+
+	while (!__atomic_load_n(&rp->err, __ATOMIC_RELAXED)) {
+		i = __atomic_fetch_add(&rp->next, 1, __ATOMIC_RELAXED);
+		if (i >= rp->num_reads)
+			break;
+		rec = &rp->log->recs[rp->order[i]];
+		target = rp->start;
+		if (rp->speed > 0) {
+			target += (rec->ts - rp->first_ts) / rp->speed;
+			ts.tv_sec = target / 1000000000ULL;
+			ts.tv_nsec = target % 1000000000ULL;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					&ts, NULL) == EINTR)
+				;
+		}
+		issue = monotonic_ns();
+		ret = REPLAY_READS[rp->ty](rp, w, rec, &got);
+		w->end = monotonic_ns();
+		if (ret) {
+			fprintf(stderr, "%s read of %u bytes at %llu in %s "
+				"failed: error %d (%s)\n",
+				REPLAY_TYPE_NAMES[rp->ty], rec->length,
+				(unsigned long long)rec->offset,
+				replay_path(rp, rec->file), ret,
+				strerror(ret));
+			replay_fail(rp, ret);
+			break;
+		}
+		rp->latency[i] = w->end - issue;
+		rp->lateness[i] = (issue > target) ? issue - target : 0;
+		w->bytes += got;
+		if (got < rec->length)
+			w->short_reads++;
+	}
+	return NULL;
+}
+
+static int worker_init(struct replay *rp, struct worker *w)
+{
+	w->rp = rp;
+	if (posix_memalign((void **)&w->buf, sysconf(_SC_PAGESIZE),
+			rp->max_len)) {
+		w->buf = NULL;
+		return ENOMEM;
+	}
+	if ((rp->ty != REPLAY_LIBHDFS) && (rp->ty != REPLAY_ZCR))
+		return 0;
+	w->files = calloc(rp->log->num_files, sizeof(hdfsFile));
+	w->stream_pos = calloc(rp->log->num_files, sizeof(long long));
+	if (!w->files || !w->stream_pos)
+		return ENOMEM;
+	if (rp->ty != REPLAY_ZCR)
+		return 0;
+	w->zopts = hadoopRzOptionsAlloc();
+	if (!w->zopts) {
+		fprintf(stderr, "hadoopRzOptionsAlloc failed.\n");
+		return ENOMEM;
+	}
+	if (hadoopRzOptionsSetSkipChecksum(w->zopts, 1) ||
+			hadoopRzOptionsSetByteBufferPool(w->zopts, NULL)) {
+		fprintf(stderr, "failed to set the zero-copy read options: "
+			"error %d\n", errno);
+		return EINVAL;
+	}
+	return 0;
+}
+
+static void worker_free(struct replay *rp, struct worker *w)
+{
+	uint32_t f;
+
+	free(w->buf);
+	if (w->files) {
+		for (f = 0; f < rp->log->num_files; f++) {
+			if (w->files[f])
+				hdfsCloseFile(rp->fs, w->files[f]);
+		}
+		free(w->files);
+	}
+	free(w->stream_pos);
+	if (w->zopts)
+		hadoopRzOptionsFree(w->zopts);
+}
+
+/*
+ * Open or map every file in the trace, for pread and local.
+ */
+static int replay_open_local(struct replay *rp)
+{
+	struct stat st;
+	uint32_t f;
+	void *addr;
+	int ret;
+
+	rp->fds = malloc(rp->log->num_files * sizeof(int));
+	rp->maps = calloc(rp->log->num_files, sizeof(char *));
+	rp->map_lens = calloc(rp->log->num_files, sizeof(long long));
+	if (!rp->fds || !rp->maps || !rp->map_lens)
+		return ENOMEM;
+	for (f = 0; f < rp->log->num_files; f++)
+		rp->fds[f] = -1;
+	for (f = 0; f < rp->log->num_files; f++) {
+		rp->fds[f] = open(replay_path(rp, f), O_RDONLY);
+		if (rp->fds[f] < 0) {
+			ret = errno;
+			fprintf(stderr, "failed to open %s: error %d (%s)\n",
+				replay_path(rp, f), ret, strerror(ret));
+			return ret;
+		}
+		if (rp->ty != REPLAY_LOCAL)
+			continue;
+		if (fstat(rp->fds[f], &st)) {
+			ret = errno;
+			fprintf(stderr, "failed to stat %s: error %d (%s)\n",
+				replay_path(rp, f), ret, strerror(ret));
+			return ret;
+		}
+		if (st.st_size == 0)
+			continue;
+		addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+			rp->fds[f], 0);
+		if (addr == MAP_FAILED) {
+			ret = errno;
+			fprintf(stderr, "mmap(%s) failed: error %d (%s)\n",
+				replay_path(rp, f), ret, strerror(ret));
+			return ret;
+		}
+		rp->maps[f] = addr;
+		rp->map_lens[f] = st.st_size;
+	}
+	return 0;
+}
+
+static int replay_connect(struct replay *rp)
+{
+	struct hdfsBuilder *builder;
+
+	builder = hdfsNewBuilder();
+	if (!builder) {
+		fprintf(stderr, "Failed to create builder.\n");
+		return ENOMEM;
+	}
+	hdfsBuilderSetNameNode(builder, rp->rpc_address);
+	hdfsBuilderConfSetStr(builder,
+		"dfs.client.read.shortcircuit.skip.checksum", "true");
+	rp->fs = hdfsBuilderConnect(builder);
+	if (!rp->fs) {
+		fprintf(stderr, "Could not connect to namenode %s!\n",
+			rp->rpc_address);
+		return EIO;
+	}
+	return 0;
+}
+
+static void replay_close(struct replay *rp)
+{
+	uint32_t f;
+
+	for (f = 0; rp->fds && rp->maps && (f < rp->log->num_files);
+			f++) {
+		if (rp->maps[f])
+			munmap((void *)rp->maps[f], rp->map_lens[f]);
+		if (rp->fds[f] >= 0)
+			close(rp->fds[f]);
+	}
+	free(rp->fds);
+	free(rp->maps);
+	free(rp->map_lens);
+	bufpool_free(rp->pool);
+	if (rp->fs)
+		hdfsDisconnect(rp->fs);
+}
+
+/*
+ * Create the pool that zcr reads fall back to, with a buffer per worker in
+ * every class up to the largest read.
+ */
+static int replay_create_pool(struct replay *rp)
+{
+	size_t min_size = POOL_MIN_BUFFER_SIZE, max_size = min_size;
+	int ret;
+
+	while (max_size < rp->max_len)
+		max_size <<= 1;
+	ret = bufpool_create(min_size, max_size, rp->num_workers, 0,
+		&rp->pool);
+	if (ret) {
+		fprintf(stderr, "failed to create the buffer pool: error %d "
+			"(%s)\n", ret, strerror(ret));
+	}
+	return ret;
+}
+
+/*
+ * Pick out the reads to replay.
+ */
+static int replay_plan(struct replay *rp)
+{
+	const struct blocktrace_log *log = rp->log;
+	long long i;
+
+	rp->order = malloc(log->num_recs * sizeof(long long));
+	rp->latency = calloc(log->num_recs, sizeof(uint64_t));
+	rp->lateness = calloc(log->num_recs, sizeof(uint64_t));
+	if (!rp->order || !rp->latency || !rp->lateness)
+		return ENOMEM;
+	for (i = 0; i < log->num_recs; i++) {
+		if (rp->misses_only &&
+				(log->recs[i].flags & BLOCKTRACE_FLAG_HIT))
+			continue;
+		if (log->recs[i].length > rp->max_len)
+			rp->max_len = log->recs[i].length;
+		rp->order[rp->num_reads++] = i;
+	}
+	if (rp->num_reads == 0) {
+		fprintf(stderr, "there are no reads to replay.\n");
+		return EINVAL;
+	}
+	rp->first_ts = log->recs[rp->order[0]].ts;
+	return 0;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x < y) ? -1 : (x > y);
+}
+
+/*
+ * Print the mean, percentiles and maximum of n samples in microseconds.
+ * Sorts them.
+ */
+static void print_distribution(const char *name, uint64_t *samples,
+		long long n)
+{
+	static const double PERCENTILES[] = { 50, 90, 99, 99.9 };
+	double total = 0;
+	long long i;
+	unsigned int p;
+
+	qsort(samples, n, sizeof(uint64_t), compare_u64);
+	for (i = 0; i < n; i++)
+		total += samples[i];
+	printf("%s (us): mean %.1f", name, total / n / 1e3);
+	for (p = 0; p < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); p++) {
+		i = (long long)(PERCENTILES[p] / 100 * (n - 1) + 0.5);
+		printf(", p%g %.1f", PERCENTILES[p], samples[i] / 1e3);
+	}
+	printf(", max %.1f\n", samples[n - 1] / 1e3);
+}
+
+static void replay_report(struct replay *rp, const struct worker *workers)
+{
+	long long bytes = 0, short_reads = 0, zcr_fallbacks = 0;
+	uint64_t end = rp->start, span;
+	double secs;
+	int i;
+
+	for (i = 0; i < rp->num_workers; i++) {
+		bytes += workers[i].bytes;
+		short_reads += workers[i].short_reads;
+		zcr_fallbacks += workers[i].zcr_fallbacks;
+		if (workers[i].end > end)
+			end = workers[i].end;
+	}
+	secs = (end - rp->start) / 1e9;
+	span = rp->log->recs[rp->order[rp->num_reads - 1]].ts - rp->first_ts;
+	printf("replayed %lld reads (%lld bytes) through %s with %d "
+		"workers in %.4g seconds; the trace spans %.4g seconds\n",
+		rp->num_reads, bytes, REPLAY_TYPE_NAMES[rp->ty],
+		rp->num_workers, secs, span / 1e9);
+	printf("throughput: %.4g GB/s, %.4g reads/s\n", bytes / secs / 1e9,
+		rp->num_reads / secs);
+	if (short_reads) {
+		printf("%lld reads came back short; the files may not match "
+			"the trace\n", short_reads);
+	}
+	if (zcr_fallbacks) {
+		printf("%lld zcr reads fell back to copying into the buffer "
+			"pool\n", zcr_fallbacks);
+	}
+	print_distribution("latency", rp->latency, rp->num_reads);
+	if (rp->speed > 0)
+		print_distribution("issue delay", rp->lateness, rp->num_reads);
+}
+
+int main(int argc, char **argv)
+{
+	struct replay rp;
+	struct worker *workers = NULL;
+	int c, i, started = 0, ret = 1;
+	unsigned int t;
+
+	memset(&rp, 0, sizeof(rp));
+	rp.ty = REPLAY_PREAD;
+	rp.rpc_address = "default";
+	rp.speed = 1;
+	rp.num_workers = 1;
+	while ((c = getopt(argc, argv, "t:a:s:w:mf:")) != -1) {
+		switch (c) {
+		case 't':
+			for (t = 0; t < REPLAY_MAX; t++) {
+				if (!strcmp(optarg, REPLAY_TYPE_NAMES[t]))
+					break;
+			}
+			if (t == REPLAY_MAX) {
+				fprintf(stderr, "unknown type %s\n" USAGE,
+					optarg);
+				return 1;
+			}
+			rp.ty = t;
+			break;
+		case 'a':
+			rp.rpc_address = optarg;
+			break;
+		case 's':
+			rp.speed = atof(optarg);
+			if (rp.speed < 0) {
+				fprintf(stderr, "the speed can't be "
+					"negative.\n" USAGE);
+				return 1;
+			}
+			break;
+		case 'w':
+			rp.num_workers = atoi(optarg);
+			if (rp.num_workers < 1) {
+				fprintf(stderr, "there must be at least one "
+					"worker.\n" USAGE);
+				return 1;
+			}
+			break;
+		case 'm':
+			rp.misses_only = 1;
+			break;
+		case 'f':
+			rp.path_override = optarg;
+			break;
+		default:
+			fprintf(stderr, USAGE);
+			return 1;
+		}
+	}
+	if (argc - optind != 1) {
+		fprintf(stderr, USAGE);
+		return 1;
+	}
+	if (blocktrace_load(argv[optind], NULL, NULL, &rp.log))
+		return 1;
+	if (replay_plan(&rp))
+		goto done;
+	if ((rp.ty == REPLAY_LIBHDFS) || (rp.ty == REPLAY_ZCR)) {
+		if (replay_connect(&rp))
+			goto done;
+		if ((rp.ty == REPLAY_ZCR) && replay_create_pool(&rp))
+			goto done;
+	} else if (replay_open_local(&rp)) {
+		goto done;
+	}
+	workers = calloc(rp.num_workers, sizeof(*workers));
+	if (!workers)
+		goto done;
+	for (i = 0; i < rp.num_workers; i++) {
+		if (worker_init(&rp, &workers[i])) {
+			fprintf(stderr, "failed to set up replay worker %d\n",
+				i);
+			goto done;
+		}
+	}
+	rp.start = monotonic_ns();
+	for (started = 0; started < rp.num_workers; started++) {
+		ret = pthread_create(&workers[started].thread, NULL,
+			worker_run, &workers[started]);
+		if (ret) {
+			fprintf(stderr, "pthread_create failed: error %d\n",
+				ret);
+			replay_fail(&rp, ret);
+			break;
+		}
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(workers[i].thread, NULL);
+	ret = 1;
+	if (rp.err)
+		goto done;
+	replay_report(&rp, workers);
+	ret = 0;
+done:
+	for (i = 0; workers && (i < rp.num_workers); i++)
+		worker_free(&rp, &workers[i]);
+	free(workers);
+	replay_close(&rp);
+	free(rp.order);
+	free(rp.latency);
+	free(rp.lateness);
+	blocktrace_log_free(rp.log);
+	return ret;
+}
@@ -0,0 +1,115 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include "util.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+uint64_t mix64(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+uint64_t splitmix64_next(uint64_t *state)
+{
+	return mix64(*state += 0x9e3779b97f4a7c15ULL);
+}
+
+double monotonic_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double resident_fraction(const void *map, size_t len)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	size_t i, pages = (len + page - 1) / page, resident = 0;
+	unsigned char *vec;
+
+	if (pages == 0)
+		return 1;
+	vec = malloc(pages);
+	if (!vec)
+		return -1;
+	if (mincore((void *)map, len, vec)) {
+		free(vec);
+		return -1;
+	}
+	for (i = 0; i < pages; i++)
+		resident += vec[i] & 1;
+	free(vec);
+	return (double)resident / pages;
+}
+
+int idtable_init(struct idtable *t, long long num_slots, const uint64_t *ids,
+		size_t stride)
+{
+	uint64_t size;
+
+	for (size = 1; size < 2 * (uint64_t)num_slots; )
+		size <<= 1;
+	t->buckets = malloc(size * sizeof(int64_t));
+	if (!t->buckets)
+		return ENOMEM;
+	memset(t->buckets, 0xff, size * sizeof(int64_t));
+	t->mask = size - 1;
+	t->ids = (const char *)ids;
+	t->stride = stride;
+	return 0;
+}
+
+void idtable_free(struct idtable *t)
+{
+	free(t->buckets);
+	t->buckets = NULL;
+}
+
+static uint64_t idtable_id(const struct idtable *t, int64_t slot)
+{
+	return __atomic_load_n((const uint64_t *)(t->ids + slot * t->stride),
+		__ATOMIC_RELAXED);
+}
+
+uint64_t idtable_find(const struct idtable *t, uint64_t id)
+{
+	uint64_t i = mix64(id) & t->mask, n;
+	int64_t slot;
+
+	for (n = 0; n <= t->mask; n++) {
+		slot = __atomic_load_n(&t->buckets[i], __ATOMIC_RELAXED);
+		if ((slot == IDTABLE_EMPTY) || (idtable_id(t, slot) == id))
+			break;
+		i = (i + 1) & t->mask;
+	}
+	return i;
+}
+
+void idtable_remove(struct idtable *t, uint64_t i)
+{
+	uint64_t j, home;
+
+	// Move a later entry into the hole unless that would put it before
+	// its home bucket.
+	for (j = (i + 1) & t->mask; t->buckets[j] != IDTABLE_EMPTY;
+			j = (j + 1) & t->mask) {
+		home = mix64(idtable_id(t, t->buckets[j])) & t->mask;
+		if (((j - home) & t->mask) >= ((j - i) & t->mask)) {
+			__atomic_store_n(&t->buckets[i], t->buckets[j],
+				__ATOMIC_RELAXED);
+			i = j;
+		}
+	}
+	__atomic_store_n(&t->buckets[i], IDTABLE_EMPTY, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,81 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#ifndef VECSUM_UTIL_H
+#define VECSUM_UTIL_H
+
+/*
+ * Small helpers that the tools and the caches share.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The splitmix64 finalizer.  Block ids are mostly small consecutive
+ * integers, which need mixing before they are masked.
+ */
+uint64_t mix64(uint64_t x);
+
+/*
+ * The splitmix64 generator: advance *state and return the next value.
+ * Fast, seedable, and good enough for benchmark data.
+ */
+uint64_t splitmix64_next(uint64_t *state);
+
+/*
+ * Seconds on the monotonic clock.
+ */
+double monotonic_seconds(void);
+
+/*
+ * Fraction of the pages of a mapping of len bytes that are resident, or -1
+ * if mincore fails.
+ */
+double resident_fraction(const void *map, size_t len);
+
+// Marks an empty idtable bucket.
+#define IDTABLE_EMPTY (-1)
+
+/*
+ * An open-addressed hash table from ids to slot numbers, with linear probing
+ * and backward-shift deletion.
+ *
+ * The table only holds slot numbers; the id of each slot lives with its
+ * owner, at ids + slot * stride bytes, and is read from there.  Buckets and
+ * ids are read and written with relaxed atomics, so lookups can run without
+ * a lock while one writer changes the table, as the shard cache's do.  Such
+ * a lookup can land on the wrong bucket, and the caller has to notice that
+ * the table changed under it.
+ */
+struct idtable {
+	int64_t *buckets;
+	uint64_t mask;
+	const char *ids;
+	size_t stride;
+};
+
+/*
+ * Set up a table that can hold num_slots entries while staying at most half
+ * full.  ids points at the id of slot 0.
+ *
+ * Returns 0 on success, or ENOMEM.
+ */
+int idtable_init(struct idtable *t, long long num_slots, const uint64_t *ids,
+		size_t stride);
+
+void idtable_free(struct idtable *t);
+
+/*
+ * Find the bucket that holds id, or the empty bucket where it would go.
+ * Gives up after one trip around the table, which can only happen to a
+ * lookup racing a writer.
+ */
+uint64_t idtable_find(const struct idtable *t, uint64_t id);
+
+/*
+ * Empty bucket i, moving later entries of its probe run back to fill it.
+ */
+void idtable_remove(struct idtable *t, uint64_t i);
+
+#endif
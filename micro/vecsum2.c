@@ -7,6 +7,8 @@
 #include <fcntl.h>
 #include <hdfs.h>
 #include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,11 +21,40 @@
 #include <unistd.h>
 
 #include "immintrin.h"
+#include "x86intrin.h"
+
+#include "blockcache.h"
+#include "blockcodec.h"
+#include "blocksched.h"
+#include "blocktrace.h"
+#include "bufpool.h"
+#include "expected.h"
+#include "floatfile.h"
+#include "prefetch.h"
+#include "profiler.h"
+#include "results.h"
+#include "roofline.h"
+#include "shardcache.h"
+#include "util.h"
 
 #define VECSUM_CHUNK_SIZE (8 * 1024 * 1024)
 #define ZCR_READ_CHUNK_SIZE (1024 * 1024 * 8) // 8
 #define NORMAL_READ_CHUNK_SIZE (8 * 1024 * 1024)
 #define DOUBLES_PER_LOOP_ITER 16
+// Doubles decoded at a time from a compressed cache block; 8 KiB stays in L1.
+#define DOUBLES_PER_TILE 1024
+#define DEFAULT_PROFILE_HZ 997
+#define DEFAULT_REGRESSION_TOLERANCE 0.05
+#define DEFAULT_REGRESSION_ALPHA 0.05
+// Smallest buffer the pool hands out; chunks are at most VECSUM_CHUNK_SIZE.
+#define POOL_MIN_BUFFER_SIZE (1024 * 1024)
+#define DEFAULT_POOL_BUFFERS 2
+#define SHARD_MIN_BLOCKS 4
+
+#if VECSUM_CHUNK_SIZE != EXPECTED_BLOCK_SIZE
+#error "VECSUM_CHUNK_SIZE must match the block size of the canonical \
+reduction order in expected.h"
+#endif
 
 #ifdef __GNUC__
 #define restrict __restrict__
@@ -36,10 +67,131 @@ static double timespec_to_double(const struct timespec *restrict ts)
 	return sec + (nsec / 1000000000L);
 }
 
+/*
+ * Phase accounting.  The backend loops bracket each call into the read path
+ * with rdtsc, so that we can split a run into time spent opening the file,
+ * reading it, summing it, releasing buffers and seeking back to the start
+ * without having to reach for perf.  rdtsc costs a few dozen cycles, which
+ * is noise next to an 8 MB chunk.
+ */
+enum vecsum_phase {
+	PHASE_OPEN = 0,
+	PHASE_READ,
+	PHASE_KERNEL,
+	PHASE_RELEASE,
+	PHASE_SEEK,
+	PHASE_MAX,
+};
+
+static const char * const PHASE_NAMES[PHASE_MAX] = {
+	"open",
+	"read",
+	"kernel",
+	"release",
+	"seek",
+};
+
+struct phase_stats {
+	// TSC value when the run started.
+	uint64_t start;
+
+	// Cycles charged to each phase.
+	uint64_t cycles[PHASE_MAX];
+
+	// Number of spans charged to each phase.
+	uint64_t calls[PHASE_MAX];
+
+	// Threads whose spans were merged in, if more than one ran at once.
+	int threads;
+};
+
+static struct phase_stats g_phases;
+
+static inline uint64_t phase_now(void)
+{
+	return __rdtsc();
+}
+
+/*
+ * Charge the cycles since *span to the given phase, and start the next span
+ * at the current time.  This lets a loop chain spans back to back with one
+ * rdtsc per phase boundary.
+ */
+static inline void phase_charge(struct phase_stats *restrict stats,
+		enum vecsum_phase phase, uint64_t *restrict span)
+{
+	uint64_t now = __rdtsc();
+
+	stats->cycles[phase] += now - *span;
+	stats->calls[phase]++;
+	*span = now;
+}
+
+static inline void phase_end(enum vecsum_phase phase, uint64_t *restrict span)
+{
+	phase_charge(&g_phases, phase, span);
+}
+
+/*
+ * Add a thread's phases into the run's.
+ */
+static void phase_merge(const struct phase_stats *restrict stats,
+		int threads)
+{
+	int i;
+
+	for (i = 0; i < PHASE_MAX; i++) {
+		g_phases.cycles[i] += stats->cycles[i];
+		g_phases.calls[i] += stats->calls[i];
+	}
+	if (threads > g_phases.threads)
+		g_phases.threads = threads;
+}
+
+static void phase_print(double tsc_hz)
+{
+	uint64_t total, accounted = 0;
+	int i;
+
+	total = phase_now() - g_phases.start;
+	if (total == 0)
+		total = 1;
+	printf("phases: %-8s %10s %14s %12s %8s %14s\n", "phase", "calls",
+		"cycles", "seconds", "% run", "cycles/call");
+	for (i = 0; i < PHASE_MAX; i++) {
+		accounted += g_phases.cycles[i];
+		printf("phases: %-8s %10llu %14llu %12.5g %7.2f%% %14.5g\n",
+			PHASE_NAMES[i], (unsigned long long)g_phases.calls[i],
+			(unsigned long long)g_phases.cycles[i],
+			g_phases.cycles[i] / tsc_hz,
+			100.0 * g_phases.cycles[i] / total,
+			g_phases.calls[i] ? (double)g_phases.cycles[i] /
+				g_phases.calls[i] : 0.0);
+	}
+	if (accounted > total)
+		accounted = total;
+	printf("phases: %-8s %10s %14llu %12.5g %7.2f%%\n", "other", "-",
+		(unsigned long long)(total - accounted),
+		(total - accounted) / tsc_hz,
+		100.0 * (total - accounted) / total);
+	if (g_phases.threads > 1) {
+		printf("phases: (read and kernel add up %d threads, so they "
+			"can pass 100%%)\n", g_phases.threads);
+	}
+	printf("phases: (TSC calibrated at %.4g GHz)\n", tsc_hz / 1e9);
+}
+
+/*
+ * Wall-clock seconds taken by each pass, filled in by the backends.  These
+ * are the samples that go into the results file.
+ */
+static double *g_pass_seconds;
+
 struct stopwatch {
 	struct timespec start;
 	struct timespec stop;
 	struct rusage rusage;
+	uint64_t start_tsc;
 };
 
 static struct stopwatch *stopwatch_create(void)
@@ -63,6 +215,7 @@ static struct stopwatch *stopwatch_create(void)
 			err, strerror(err));
 		goto error;
 	}
+	watch->start_tsc = phase_now();
 	return watch;
 
 error:
@@ -70,10 +223,15 @@ error:
 	return NULL;
 }
 
-static void stopwatch_stop(struct stopwatch *restrict watch,
+/*
+ * Stop the stopwatch and print the throughput.  Returns the TSC frequency
+ * measured over the life of the stopwatch, or 0 on error.
+ */
+static double stopwatch_stop(struct stopwatch *restrict watch,
 		long long bytes_read)
 {
-	double elapsed, rate;
+	double elapsed, rate, tsc_hz = 0;
+	uint64_t stop_tsc = phase_now();
 
 	if (clock_gettime(CLOCK_MONOTONIC, &watch->stop)) {
 		int err = errno;
@@ -83,21 +241,57 @@ static void stopwatch_stop(struct stopwatch *restrict watch,
 	}
 	elapsed = timespec_to_double(&watch->stop) -
 		timespec_to_double(&watch->start);
-	rate = (bytes_read / elapsed) / (1024 * 1024 * 1024);
+	rate = bytes_read / elapsed / 1e9;
 	printf("stopwatch: took %.5g seconds to read %lld bytes, "
 		"for %.5g GB/s\n", elapsed, bytes_read, rate);
 	printf("stopwatch:  %.5g seconds\n", elapsed);
+	if (elapsed > 0)
+		tsc_hz = (stop_tsc - watch->start_tsc) / elapsed;
 done:
 	free(watch);
+	return tsc_hz;
 }
 
 enum vecsum_type {
 	VECSUM_LIBHDFS = 0,
 	VECSUM_ZCR,
 	VECSUM_LOCAL,
+	VECSUM_PREAD,
+};
+
+#define VECSUM_TYPE_VALID_VALUES "libhdfs, zcr, local, or pread"
+
+/*
+ * What the pread and local paths do with the pages of a chunk once they have
+ * added it up.  A scan of a file bigger than memory otherwise pushes
+ * everything else out of the page cache, including the hot data that other
+ * readers depend on, to make room for pages it will never read again.
+ */
+enum drop_behind {
+	// Leave the pages to the kernel's LRU.
+	DROP_BEHIND_OFF = 0,
+
+	// Drop them from the page cache with POSIX_FADV_DONTNEED, after
+	// unmapping them from the local path's mapping.
+	DROP_BEHIND_DONTNEED,
+
+	// Mark them for reclaim before anything else with MADV_COLD.
+	DROP_BEHIND_COLD,
+
+	// Reclaim them right away with MADV_PAGEOUT.
+	DROP_BEHIND_PAGEOUT,
+
+	DROP_BEHIND_MAX,
 };
 
-#define VECSUM_TYPE_VALID_VALUES "libhdfs, zcr, or local"
+static const char * const DROP_BEHIND_NAMES[DROP_BEHIND_MAX] = {
+	[DROP_BEHIND_OFF] = "off",
+	[DROP_BEHIND_DONTNEED] = "dontneed",
+	[DROP_BEHIND_COLD] = "cold",
+	[DROP_BEHIND_PAGEOUT] = "pageout",
+};
+
+#define DROP_BEHIND_VALID_VALUES "off, dontneed, cold, or pageout"
 
 int parse_vecsum_type(const char *str)
 {
@@ -107,10 +301,28 @@ int parse_vecsum_type(const char *str)
 		return VECSUM_ZCR;
 	else if (strcasecmp(str, "local") == 0)
 		return VECSUM_LOCAL;
+	else if (strcasecmp(str, "pread") == 0)
+		return VECSUM_PREAD;
 	else
 		return -1;
 }
 
+/*
+ * Where the values live in the file.  For a raw file of doubles, the payload
+ * is the whole file.  For a self-describing file (see floatfile.h), it sits
+ * between the header page and the footer.
+ */
+struct file_layout {
+	long long file_length;
+	long long payload_offset;
+	long long payload_length;
+
+	// The header and footer, or NULL for a raw file.  The footer is
+	// followed by the block table.
+	struct floatfile_header *hdr;
+	struct floatfile_footer *ftr;
+};
+
 struct options {
 	// The path to read.
 	const char *path;
@@ -123,13 +335,359 @@ struct options {
 
 	// RPC address to use for HDFS
 	const char *rpc_address;
+
+	// Where to write folded stacks from the sampling profiler, or NULL if
+	// profiling is off
+	const char *profile_path;
+
+	// Sampling frequency for the profiler, in samples per CPU-second
+	int profile_hz;
+
+	// If non-NULL, the results file to append this run to
+	const char *results_path;
+
+	// If non-NULL, a results file to compare this run against
+	const char *baseline_path;
+
+	// Largest throughput drop, as a fraction, that is not a regression
+	double tolerance;
+
+	// Significance level for the regression test
+	double alpha;
+
+	// Nonzero if we should measure memory bandwidth before the run
+	int calibrate;
+
+	// If non-NULL, a file of expected aggregates that overrides the ones
+	// in the file's footer
+	const char *expected_path;
+
+	// Nonzero if we have expected aggregates to check every pass against
+	int have_expected;
+	struct expected expected;
+
+	// Nonzero if we should check every block against the checksums in the
+	// file's footer
+	int verify_checksums;
+
+	// Nonzero if we should only add up the values in [filter_lo,
+	// filter_hi]
+	int filter;
+	double filter_lo;
+	double filter_hi;
+
+	// Nonzero if filtered scans should skip blocks whose zone maps show
+	// they can't match
+	int zone_maps;
+
+	// Capacity of the in-process block cache in front of the read path,
+	// or 0 for no cache
+	long long cache_bytes;
+
+	// Nonzero if the block cache should use huge pages
+	int cache_hugepages;
+
+	// Replacement policy of the block cache
+	enum cache_policy_type cache_policy;
+
+	// Nonzero if the block cache should hold blocks compressed
+	int cache_compress;
+
+	// Directory and capacity of the block cache's SSD tier, or NULL for
+	// no SSD tier, and BLOCKCACHE_SSD_* flags for it
+	const char *ssd_dir;
+	long long ssd_bytes;
+	int ssd_flags;
+
+	// Most chunks the pread path may read ahead of its misses, or 0 for
+	// no prefetching, and the number of threads to read them on
+	int prefetch_depth;
+	int prefetch_threads;
+
+	// Threads for a block-aware scan of the libhdfs path, or 0 to stream
+	// the file from one thread
+	int threads;
+
+	// Buffers in each size class of the read buffer pool that the libhdfs
+	// and zcr paths copy into, and nonzero if it should use huge pages
+	int pool_buffers;
+	int pool_hugepages;
+
+	// What the pread and local paths do with the pages they have read
+	enum drop_behind drop_behind;
+
+	// The block cache, if there is one
+	struct blockcache *cache;
+
+	// The sharded cache that the threads of a block-aware scan share
+	// instead, if there is one
+	struct shardcache *shared_cache;
+
+	// Where to write a block-level read trace, or NULL for none
+	const char *trace_path;
+
+	// The read trace, if there is one, and our file's id in it
+	struct blocktrace *trace;
+	uint32_t trace_file;
+
+	// Where the values live in the file, filled in by layout_probe
+	struct file_layout layout;
 };
 
+/*
+ * Parse a fraction in [0, 1) from the environment variable var.  Returns 0
+ * on success, or EINVAL if the value is invalid.
+ */
+static int parse_fraction_env(const char *var, double *out)
+{
+	const char *str = getenv(var);
+	char *end;
+	double val;
+
+	if (!str)
+		return 0;
+	val = strtod(str, &end);
+	if ((end == str) || *end || (val < 0) || (val >= 1)) {
+		fprintf(stderr, "Invalid value for the %s environment "
+			"variable.  You must set this to a number between "
+			"0 and 1.\n", var);
+		return EINVAL;
+	}
+	*out = val;
+	return 0;
+}
+
+/*
+ * Parse the settings of the block cache's SSD tier.  The tier needs a cache
+ * in front of it.  Returns 0 on success, or EINVAL if the settings are
+ * invalid.
+ */
+static int parse_ssd_env(struct options *opts)
+{
+	const char *str;
+
+	opts->ssd_dir = getenv("VECSUM_SSD_DIR");
+	if (!opts->ssd_dir)
+		return 0;
+	if (!opts->cache_bytes) {
+		fprintf(stderr, "VECSUM_SSD_DIR needs a block cache in front "
+			"of the SSD tier.  You must also set "
+			"VECSUM_CACHE_BYTES.\n");
+		return EINVAL;
+	}
+	str = getenv("VECSUM_SSD_BYTES");
+	if (str)
+		opts->ssd_bytes = atoll(str);
+	if (opts->ssd_bytes < VECSUM_CHUNK_SIZE) {
+		fprintf(stderr, "Invalid value for the VECSUM_SSD_BYTES "
+			"environment variable.  You must set this to at least "
+			"VECSUM_CHUNK_SIZE (%d bytes) when VECSUM_SSD_DIR is "
+			"set.\n", VECSUM_CHUNK_SIZE);
+		return EINVAL;
+	}
+	str = getenv("VECSUM_SSD_MODE");
+	if (str) {
+		if (!strcmp(str, "inclusive")) {
+			opts->ssd_flags |= BLOCKCACHE_SSD_INCLUSIVE;
+		} else if (strcmp(str, "exclusive")) {
+			fprintf(stderr, "Invalid value for the VECSUM_SSD_MODE "
+				"environment variable.  Valid values are "
+				"exclusive and inclusive.\n");
+			return EINVAL;
+		}
+	}
+	str = getenv("VECSUM_SSD_PROMOTE");
+	if (str && !atoi(str))
+		opts->ssd_flags |= BLOCKCACHE_SSD_NO_PROMOTE;
+	return 0;
+}
+
+/*
+ * Parse the prefetcher settings.  Only the pread path prefetches.  Returns 0
+ * on success, or EINVAL if the settings are invalid.
+ */
+static int parse_prefetch_env(struct options *opts)
+{
+	const char *str;
+
+	str = getenv("VECSUM_PREFETCH_DEPTH");
+	if (str)
+		opts->prefetch_depth = atoi(str);
+	if (opts->prefetch_depth < 0) {
+		fprintf(stderr, "Invalid value for the VECSUM_PREFETCH_DEPTH "
+			"environment variable.  You must set this to a "
+			"number of chunks, or 0 for no prefetching.\n");
+		return EINVAL;
+	}
+	if (opts->prefetch_depth && (opts->ty != VECSUM_PREAD)) {
+		fprintf(stderr, "VECSUM_PREFETCH_DEPTH only applies to "
+			"VECSUM_TYPE=pread.\n");
+		return EINVAL;
+	}
+	opts->prefetch_threads = 1;
+	str = getenv("VECSUM_PREFETCH_THREADS");
+	if (str)
+		opts->prefetch_threads = atoi(str);
+	if (opts->prefetch_threads < 1) {
+		fprintf(stderr, "Invalid value for the "
+			"VECSUM_PREFETCH_THREADS environment variable.  You "
+			"must set this to at least 1.\n");
+		return EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Parse the number of scan threads.  Only the libhdfs path has a
+ * multi-threaded scan.  Returns 0 on success, or EINVAL if the setting is
+ * invalid.
+ */
+static int parse_threads_env(struct options *opts)
+{
+	const char *str = getenv("VECSUM_THREADS");
+
+	if (!str)
+		return 0;
+	opts->threads = atoi(str);
+	if (opts->threads < 0) {
+		fprintf(stderr, "Invalid value for the VECSUM_THREADS "
+			"environment variable.  You must set this to a number "
+			"of threads, or 0 for a single-threaded stream.\n");
+		return EINVAL;
+	}
+	if (opts->threads && (opts->ty != VECSUM_LIBHDFS)) {
+		fprintf(stderr, "VECSUM_THREADS only applies to "
+			"VECSUM_TYPE=libhdfs.\n");
+		return EINVAL;
+	}
+	if ((opts->threads <= 1) || !opts->cache_bytes)
+		return 0;
+	// The threads share a sharded CLOCK cache, which holds blocks as they
+	// are and has no SSD tier.
+	str = getenv("VECSUM_CACHE_POLICY");
+	if ((str && (opts->cache_policy != CACHE_POLICY_CLOCK)) ||
+			opts->cache_compress || opts->cache_hugepages ||
+			opts->ssd_dir) {
+		fprintf(stderr, "When VECSUM_THREADS is more than 1, the "
+			"block cache is a sharded CLOCK cache, so "
+			"VECSUM_CACHE_POLICY can only be clock, and "
+			"VECSUM_CACHE_COMPRESS, VECSUM_CACHE_HUGEPAGES and "
+			"VECSUM_SSD_DIR don't apply.\n");
+		return EINVAL;
+	}
+	opts->cache_policy = CACHE_POLICY_CLOCK;
+	return 0;
+}
+
+/*
+ * Parse the read buffer pool settings.  Returns 0 on success, or EINVAL if
+ * the settings are invalid.
+ */
+static int parse_pool_env(struct options *opts)
+{
+	const char *str;
+
+	// Every scan thread holds a buffer.
+	opts->pool_buffers = (opts->threads > DEFAULT_POOL_BUFFERS) ?
+		opts->threads : DEFAULT_POOL_BUFFERS;
+	str = getenv("VECSUM_POOL_BUFFERS");
+	if (str)
+		opts->pool_buffers = atoi(str);
+	if (opts->pool_buffers < 1) {
+		fprintf(stderr, "Invalid value for the VECSUM_POOL_BUFFERS "
+			"environment variable.  You must set this to at least "
+			"1.\n");
+		return EINVAL;
+	}
+	str = getenv("VECSUM_POOL_HUGEPAGES");
+	if (str)
+		opts->pool_hugepages = atoi(str);
+	return 0;
+}
+
+/*
+ * Parse the drop-behind mode.  Only the pread and local paths read the file
+ * through the page cache themselves, and only the local path has a mapping
+ * to madvise.  Returns 0 on success, or EINVAL if the setting is invalid.
+ */
+static int parse_drop_behind_env(struct options *opts)
+{
+	const char *str = getenv("VECSUM_DROP_BEHIND");
+	int mode;
+
+	if (!str)
+		return 0;
+	for (mode = 0; mode < DROP_BEHIND_MAX; mode++) {
+		if (!strcasecmp(str, DROP_BEHIND_NAMES[mode]))
+			break;
+	}
+	if (mode == DROP_BEHIND_MAX) {
+		fprintf(stderr, "Invalid value for the VECSUM_DROP_BEHIND "
+			"environment variable.  Valid values are "
+			DROP_BEHIND_VALID_VALUES ".\n");
+		return EINVAL;
+	}
+	opts->drop_behind = mode;
+	if (mode == DROP_BEHIND_OFF)
+		return 0;
+	if ((opts->ty != VECSUM_PREAD) && (opts->ty != VECSUM_LOCAL)) {
+		fprintf(stderr, "VECSUM_DROP_BEHIND only applies to "
+			"VECSUM_TYPE=pread or local.\n");
+		return EINVAL;
+	}
+	if ((mode >= DROP_BEHIND_COLD) && (opts->ty != VECSUM_LOCAL)) {
+		fprintf(stderr, "VECSUM_DROP_BEHIND=%s only applies to "
+			"VECSUM_TYPE=local.\n", DROP_BEHIND_NAMES[mode]);
+		return EINVAL;
+	}
+#if !defined(MADV_COLD) || !defined(MADV_PAGEOUT)
+	if (mode >= DROP_BEHIND_COLD) {
+		fprintf(stderr, "VECSUM_DROP_BEHIND=%s needs MADV_COLD and "
+			"MADV_PAGEOUT, from Linux 5.4, which this build "
+			"doesn't have.\n", DROP_BEHIND_NAMES[mode]);
+		return EINVAL;
+	}
+#endif
+	return 0;
+}
+
+/*
+ * Parse a filter range of the form lo:hi from VECSUM_FILTER.  Returns 0 on
+ * success, or EINVAL if the range is invalid.
+ */
+static int parse_filter_env(struct options *opts)
+{
+	const char *str = getenv("VECSUM_FILTER");
+	char *end;
+
+	if (!str)
+		return 0;
+	opts->filter_lo = strtod(str, &end);
+	if ((end == str) || (*end != ':'))
+		goto error;
+	str = end + 1;
+	opts->filter_hi = strtod(str, &end);
+	if ((end == str) || *end || !(opts->filter_lo <= opts->filter_hi))
+		goto error;
+	opts->filter = 1;
+	return 0;
+error:
+	fprintf(stderr, "Invalid value for the VECSUM_FILTER environment "
+		"variable.  You must set this to a range of the form lo:hi, "
+		"with lo <= hi.\n");
+	return EINVAL;
+}
+
 static struct options *options_create(void)
 {
 	struct options *opts = NULL;
 	const char *pass_str;
 	const char *ty_str;
+	const char *hz_str;
+	const char *calibrate_str;
+	const char *verify_str;
+	const char *zone_maps_str;
+	const char *cache_str;
 	int ty;
 
 	opts = calloc(1, sizeof(struct options));
@@ -173,6 +731,90 @@ static struct options *options_create(void)
 	if (!opts->rpc_address) {
 		opts->rpc_address = "default";
 	}
+	// The profiler's signals cost every benchmark some time, so it only
+	// runs when VECSUM_PROFILE names a file.
+	opts->profile_path = getenv("VECSUM_PROFILE");
+	if (opts->profile_path && (!*opts->profile_path ||
+			!strcasecmp(opts->profile_path, "off")))
+		opts->profile_path = NULL;
+	opts->profile_hz = DEFAULT_PROFILE_HZ;
+	hz_str = getenv("VECSUM_PROFILE_HZ");
+	if (hz_str) {
+		opts->profile_hz = atoi(hz_str);
+		if (opts->profile_hz <= 0) {
+			fprintf(stderr, "Invalid value for the "
+				"VECSUM_PROFILE_HZ environment variable.  You "
+				"must set this to a number greater than 0.\n");
+			goto error;
+		}
+	}
+	opts->results_path = getenv("VECSUM_RESULTS");
+	opts->baseline_path = getenv("VECSUM_BASELINE");
+	opts->tolerance = DEFAULT_REGRESSION_TOLERANCE;
+	if (parse_fraction_env("VECSUM_TOLERANCE", &opts->tolerance))
+		goto error;
+	opts->alpha = DEFAULT_REGRESSION_ALPHA;
+	if (parse_fraction_env("VECSUM_ALPHA", &opts->alpha))
+		goto error;
+	calibrate_str = getenv("VECSUM_CALIBRATE");
+	if (calibrate_str)
+		opts->calibrate = atoi(calibrate_str);
+	opts->expected_path = getenv("VECSUM_EXPECTED");
+	if (opts->expected_path) {
+		if (expected_read(opts->expected_path, &opts->expected))
+			goto error;
+		opts->have_expected = 1;
+	}
+	verify_str = getenv("VECSUM_VERIFY_CHECKSUMS");
+	if (verify_str)
+		opts->verify_checksums = atoi(verify_str);
+	if (parse_filter_env(opts))
+		goto error;
+	opts->zone_maps = 1;
+	zone_maps_str = getenv("VECSUM_ZONE_MAPS");
+	if (zone_maps_str)
+		opts->zone_maps = atoi(zone_maps_str);
+	cache_str = getenv("VECSUM_CACHE_BYTES");
+	if (cache_str) {
+		opts->cache_bytes = atoll(cache_str);
+		if (opts->cache_bytes < VECSUM_CHUNK_SIZE) {
+			fprintf(stderr, "Invalid value for the "
+				"VECSUM_CACHE_BYTES environment variable.  You "
+				"must set this to at least VECSUM_CHUNK_SIZE "
+				"(%d bytes).\n", VECSUM_CHUNK_SIZE);
+			goto error;
+		}
+	}
+	cache_str = getenv("VECSUM_CACHE_HUGEPAGES");
+	if (cache_str)
+		opts->cache_hugepages = atoi(cache_str);
+	cache_str = getenv("VECSUM_CACHE_POLICY");
+	if (cache_str) {
+		int policy = cache_policy_parse(cache_str);
+
+		if (policy < 0) {
+			fprintf(stderr, "Invalid value for the "
+				"VECSUM_CACHE_POLICY environment variable.  "
+				"Valid values are " CACHE_POLICY_VALID_VALUES
+				".\n");
+			goto error;
+		}
+		opts->cache_policy = policy;
+	}
+	cache_str = getenv("VECSUM_CACHE_COMPRESS");
+	if (cache_str)
+		opts->cache_compress = atoi(cache_str);
+	if (parse_ssd_env(opts))
+		goto error;
+	if (parse_prefetch_env(opts))
+		goto error;
+	if (parse_threads_env(opts))
+		goto error;
+	if (parse_pool_env(opts))
+		goto error;
+	if (parse_drop_behind_env(opts))
+		goto error;
+	opts->trace_path = getenv("VECSUM_TRACE");
 	return opts;
 error:
 	free(opts);
@@ -181,20 +823,85 @@ error:
 
 static void options_free(struct options *opts)
 {
+	blockcache_free(opts->cache);
+	shardcache_free(opts->shared_cache);
+	free(opts->layout.hdr);
+	free(opts->layout.ftr);
 	free(opts);
 }
 
+/*
+ * Describe the benchmark configuration.  Runs with the same description
+ * are compared against each other by the regression check.
+ */
+static void options_describe(const struct options *restrict opts,
+		char *buf, size_t buf_len)
+{
+	static const char * const type_names[] = {
+		[VECSUM_LIBHDFS] = "libhdfs",
+		[VECSUM_ZCR] = "zcr",
+		[VECSUM_LOCAL] = "local",
+		[VECSUM_PREAD] = "pread",
+	};
+	int len;
+
+	len = snprintf(buf, buf_len, "type=%s,path=%s,chunk=%d",
+		type_names[opts->ty], opts->path, VECSUM_CHUNK_SIZE);
+	if (opts->filter && (len >= 0) && ((size_t)len < buf_len)) {
+		len += snprintf(buf + len, buf_len - len,
+			",filter=%g:%g,zonemaps=%d", opts->filter_lo,
+			opts->filter_hi, opts->zone_maps);
+	}
+	if (opts->cache_bytes && (len >= 0) && ((size_t)len < buf_len)) {
+		len += snprintf(buf + len, buf_len - len,
+			",cache=%lld,policy=%s%s", opts->cache_bytes,
+			cache_policy_name(opts->cache_policy),
+			opts->cache_compress ? ",compress" : "");
+	}
+	if (opts->prefetch_depth && (len >= 0) && ((size_t)len < buf_len)) {
+		len += snprintf(buf + len, buf_len - len, ",prefetch=%d",
+			opts->prefetch_depth);
+	}
+	if (opts->threads && (len >= 0) && ((size_t)len < buf_len)) {
+		len += snprintf(buf + len, buf_len - len, ",threads=%d",
+			opts->threads);
+	}
+	if (opts->drop_behind && (len >= 0) && ((size_t)len < buf_len)) {
+		len += snprintf(buf + len, buf_len - len, ",dropbehind=%s",
+			DROP_BEHIND_NAMES[opts->drop_behind]);
+	}
+	if (opts->ssd_dir && (len >= 0) && ((size_t)len < buf_len)) {
+		snprintf(buf + len, buf_len - len, ",ssd=%lld,%s%s",
+			opts->ssd_bytes,
+			(opts->ssd_flags & BLOCKCACHE_SSD_INCLUSIVE) ?
+			"inclusive" : "exclusive",
+			(opts->ssd_flags & BLOCKCACHE_SSD_NO_PROMOTE) ?
+			",nopromote" : "");
+	}
+}
+
 struct test_data {
 	hdfsFS fs;
 	hdfsFile file;
 	long long length;
-	double *buf;
+
+	// HDFS block size of the file
+	long long block_size;
+
+	// Where reads that libhdfs can't hand us in place are copied to
+	struct bufpool *pool;
+
+	// zcr reads this pass that fell back to copying into the pool, that
+	// came back short, and blocks that took more than one read
+	long long zcr_fallbacks;
+	long long zcr_short_reads;
+	long long zcr_stitched;
 };
 
 static void test_data_free(struct test_data *restrict tdata)
 {
+	bufpool_free(tdata->pool);
 	if (tdata->fs) {
-		free(tdata->buf);
 		if (tdata->file) {
 			hdfsCloseFile(tdata->fs, tdata->file);
 		}
@@ -208,6 +915,7 @@ static struct test_data *test_data_create(const struct options *restrict opts)
 	struct test_data *tdata = NULL;
 	struct hdfsBuilder *builder = NULL;
 	hdfsFileInfo *pinfo = NULL;
+	int ret;
 	
 	tdata = calloc(1, sizeof(struct test_data));
 	if (!tdata) {
@@ -236,16 +944,7 @@ static struct test_data *test_data_create(const struct options *restrict opts)
 		goto error;
 	}
 	tdata->length = pinfo->mSize;
-	if (tdata->length == 0) {
-		fprintf(stderr, "file %s has size 0.\n", opts->path);
-		goto error;
-	}
-	if (tdata->length % VECSUM_CHUNK_SIZE) {
-		fprintf(stderr, "file %s has size %lld, which is not aligned with "
-			"our VECSUM_CHUNK_SIZE of %d\n",
-			opts->path, tdata->length, VECSUM_CHUNK_SIZE);
-		goto error;
-	}
+	tdata->block_size = pinfo->mBlockSize;
 	tdata->file = hdfsOpenFile(tdata->fs, opts->path, O_RDONLY, 0, 0, 0);
 	if (!tdata->file) {
 		int err = errno;
@@ -253,6 +952,16 @@ static struct test_data *test_data_create(const struct options *restrict opts)
 			opts->path, err, strerror(err));
 		goto error;
 	}
+	hdfsFreeFileInfo(pinfo, 1);
+	pinfo = NULL;
+	ret = bufpool_create(POOL_MIN_BUFFER_SIZE, VECSUM_CHUNK_SIZE,
+		opts->pool_buffers,
+		opts->pool_hugepages ? BUFPOOL_HUGEPAGES : 0, &tdata->pool);
+	if (ret) {
+		fprintf(stderr, "Failed to create the buffer pool: error %d "
+			"(%s)\n", ret, strerror(ret));
+		goto error;
+	}
 	return tdata;
 
 error:
@@ -265,41 +974,240 @@ error:
 	return NULL;
 }
 
-static int check_byte_size(int byte_size, const char *const str)
+/*
+ * Read exactly len bytes at offset off, through libhdfs if tdata is
+ * non-NULL, and from the local file fd otherwise.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+static int read_fully_at(const struct test_data *restrict tdata, int fd,
+		long long off, void *buf, long long len)
 {
-	if (byte_size % sizeof(double)) {
-		fprintf(stderr, "%s is not a multiple "
-			"of sizeof(double)\n", str);
-		return EINVAL;
-	}
-	if ((byte_size / sizeof(double)) % DOUBLES_PER_LOOP_ITER) {
-		fprintf(stderr, "The number of doubles contained in "
-			"%s is not a multiple of DOUBLES_PER_LOOP_ITER\n",
-			str);
-		return EINVAL;
+	char *cbuf = buf;
+	long long res;
+
+	while (len > 0) {
+		if (tdata) {
+			res = hdfsPread(tdata->fs, tdata->file, off, cbuf,
+				(len > INT32_MAX) ? INT32_MAX : len);
+		} else {
+			res = pread(fd, cbuf, len, off);
+		}
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (res == 0)
+			return EIO;
+		cbuf += res;
+		off += res;
+		len -= res;
 	}
 	return 0;
 }
 
-#ifdef SIMPLE_VECSUM
-
-static double vecsum(const double *buf, int num_doubles)
+/*
+ * Check the header in page, and load the footer it points to.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+static int layout_load_footer(struct options *restrict opts,
+		const struct test_data *restrict tdata, int fd,
+		const char *page)
 {
-	int i;
-	double sum = 0.0;
-	for (i = 0; i < num_doubles; i++) {
-		sum += buf[i];
+	struct file_layout *layout = &opts->layout;
+	struct floatfile_header *hdr;
+	struct floatfile_footer *ftr;
+	int ret;
+
+	hdr = malloc(sizeof(*hdr));
+	if (!hdr)
+		return ENOMEM;
+	memcpy(hdr, page, sizeof(*hdr));
+	layout->hdr = hdr;
+	ret = floatfile_header_check(hdr, layout->file_length);
+	if (ret)
+		return ret;
+	if (hdr->footer_length < sizeof(*ftr)) {
+		fprintf(stderr, "layout_load_footer: %s has a footer of only "
+			"%llu bytes.\n", opts->path,
+			(unsigned long long)hdr->footer_length);
+		return EINVAL;
 	}
-	return sum;
+	ftr = malloc(hdr->footer_length);
+	if (!ftr)
+		return ENOMEM;
+	layout->ftr = ftr;
+	ret = read_fully_at(tdata, fd, hdr->footer_offset, ftr,
+			hdr->footer_length);
+	if (ret) {
+		fprintf(stderr, "layout_load_footer: failed to read the "
+			"footer of %s: error %d (%s)\n", opts->path, ret,
+			strerror(ret));
+		return ret;
+	}
+	ret = floatfile_footer_check(hdr, ftr);
+	if (ret)
+		return ret;
+	if ((opts->verify_checksums || (opts->filter && opts->zone_maps)) &&
+			(hdr->block_size != VECSUM_CHUNK_SIZE)) {
+		fprintf(stderr, "layout_load_footer: %s has %u-byte blocks, "
+			"but we can only use the checksums and zone maps of "
+			"blocks of VECSUM_CHUNK_SIZE (%d bytes).\n",
+			opts->path, hdr->block_size, VECSUM_CHUNK_SIZE);
+		return EINVAL;
+	}
+	layout->payload_offset = hdr->payload_offset;
+	layout->payload_length = hdr->payload_length;
+	if (!opts->have_expected) {
+		opts->expected.count = ftr->count;
+		opts->expected.sum = ftr->sum;
+		opts->expected.min = ftr->min;
+		opts->expected.max = ftr->max;
+		opts->have_expected = 1;
+	}
+	printf("%s: float file v%u, %llu doubles at offset %llu, "
+		"%llu blocks\n", opts->path, hdr->version,
+		(unsigned long long)hdr->count,
+		(unsigned long long)hdr->payload_offset,
+		(unsigned long long)ftr->num_blocks);
+	return 0;
 }
 
-#else
-
+/*
+ * Work out where the payload is.  If the file starts with a float file
+ * header, we check it, load the footer, and take the expected aggregates
+ * from it unless VECSUM_EXPECTED was given.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+static int layout_probe(struct options *restrict opts,
+		const struct test_data *restrict tdata)
+{
+	struct file_layout *layout = &opts->layout;
+	char page[FLOATFILE_HEADER_SIZE];
+	struct stat st_buf;
+	int fd = -1, ret;
+
+	if (tdata) {
+		layout->file_length = tdata->length;
+	} else {
+		fd = open(opts->path, O_RDONLY);
+		if (fd < 0) {
+			ret = errno;
+			fprintf(stderr, "layout_probe: failed to open %s: "
+				"error %d (%s)\n", opts->path, ret,
+				strerror(ret));
+			return ret;
+		}
+		if (fstat(fd, &st_buf)) {
+			ret = errno;
+			fprintf(stderr, "layout_probe: fstat(%s) failed: "
+				"error %d (%s)\n", opts->path, ret,
+				strerror(ret));
+			goto done;
+		}
+		layout->file_length = st_buf.st_size;
+	}
+	if (layout->file_length == 0) {
+		fprintf(stderr, "file %s has size 0.\n", opts->path);
+		ret = EINVAL;
+		goto done;
+	}
+	layout->payload_offset = 0;
+	layout->payload_length = layout->file_length;
+	if (layout->file_length >= FLOATFILE_HEADER_SIZE) {
+		ret = read_fully_at(tdata, fd, 0, page, sizeof(page));
+		if (ret) {
+			fprintf(stderr, "layout_probe: failed to read the "
+				"first page of %s: error %d (%s)\n",
+				opts->path, ret, strerror(ret));
+			goto done;
+		}
+		if (floatfile_has_header(page, sizeof(page))) {
+			ret = layout_load_footer(opts, tdata, fd, page);
+			if (ret)
+				goto done;
+		}
+	}
+	if (layout->payload_length % sizeof(double)) {
+		fprintf(stderr, "file %s has a payload of %lld bytes, which "
+			"is not a whole number of doubles.\n", opts->path,
+			layout->payload_length);
+		ret = EINVAL;
+		goto done;
+	}
+	if (opts->verify_checksums && !layout->ftr) {
+		fprintf(stderr, "VECSUM_VERIFY_CHECKSUMS was set, but %s has "
+			"no block checksums.\n", opts->path);
+		ret = EINVAL;
+		goto done;
+	}
+	if (opts->filter && opts->zone_maps && !layout->ftr) {
+		printf("%s has no zone maps, so the filtered scan will read "
+			"every block.\n", opts->path);
+	}
+	ret = 0;
+done:
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
+
+/*
+ * Length of the chunk starting pos bytes into the payload.  Chunks end at
+ * multiples of VECSUM_CHUNK_SIZE in the file, or at the end of the payload,
+ * so that every chunk is exactly one block of the canonical reduction.
+ */
+static long long layout_chunk_len(const struct file_layout *restrict layout,
+		long long pos)
+{
+	long long len;
+
+	len = floatfile_block_left(VECSUM_CHUNK_SIZE,
+			layout->payload_offset + pos);
+	if (len > layout->payload_length - pos)
+		len = layout->payload_length - pos;
+	return len;
+}
+
+static int check_byte_size(int byte_size, const char *const str)
+{
+	if (byte_size % sizeof(double)) {
+		fprintf(stderr, "%s is not a multiple "
+			"of sizeof(double)\n", str);
+		return EINVAL;
+	}
+	if ((byte_size / sizeof(double)) % DOUBLES_PER_LOOP_ITER) {
+		fprintf(stderr, "The number of doubles contained in "
+			"%s is not a multiple of DOUBLES_PER_LOOP_ITER\n",
+			str);
+		return EINVAL;
+	}
+	return 0;
+}
+
+#ifdef SIMPLE_VECSUM
+
+static double vecsum(const double *buf, int num_doubles)
+{
+	int i;
+	double sum = 0.0;
+	for (i = 0; i < num_doubles; i++) {
+		sum += buf[i];
+	}
+	return sum;
+}
+
+#else
+
 static double vecsum(const struct options *restrict opts,
 		const double *restrict buf, int num_doubles)
 {
-	int i;
+	int i, tail;
 	double hi, lo;
+	double lanes[DOUBLES_PER_LOOP_ITER] __attribute__((aligned(16)));
 	__m128d x0, x1, x2, x3, x4, x5, x6, x7;
 	__m128d sum0 = _mm_set_pd(0.0,0.0);
 	__m128d sum1 = _mm_set_pd(0.0,0.0);
@@ -309,7 +1217,8 @@ static double vecsum(const struct options *restrict opts,
 	__m128d sum5 = _mm_set_pd(0.0,0.0);
 	__m128d sum6 = _mm_set_pd(0.0,0.0);
 	__m128d sum7 = _mm_set_pd(0.0,0.0);
-	for (i = 0; i < num_doubles; i+=DOUBLES_PER_LOOP_ITER) {
+	tail = num_doubles % DOUBLES_PER_LOOP_ITER;
+	for (i = 0; i < num_doubles - tail; i+=DOUBLES_PER_LOOP_ITER) {
 		x0 = _mm_load_pd(buf + i + 0);
 		x1 = _mm_load_pd(buf + i + 2);
 		x2 = _mm_load_pd(buf + i + 4);
@@ -327,6 +1236,28 @@ static double vecsum(const struct options *restrict opts,
 		sum6 = _mm_add_pd(sum6, x6);
 		sum7 = _mm_add_pd(sum7, x7);
 	}
+	if (tail) {
+		// Add the leftovers into the lanes they would have gone to if
+		// there had been a whole iteration's worth.
+		_mm_store_pd(lanes + 0, sum0);
+		_mm_store_pd(lanes + 2, sum1);
+		_mm_store_pd(lanes + 4, sum2);
+		_mm_store_pd(lanes + 6, sum3);
+		_mm_store_pd(lanes + 8, sum4);
+		_mm_store_pd(lanes + 10, sum5);
+		_mm_store_pd(lanes + 12, sum6);
+		_mm_store_pd(lanes + 14, sum7);
+		for (; i < num_doubles; i++)
+			lanes[i % DOUBLES_PER_LOOP_ITER] += buf[i];
+		sum0 = _mm_load_pd(lanes + 0);
+		sum1 = _mm_load_pd(lanes + 2);
+		sum2 = _mm_load_pd(lanes + 4);
+		sum3 = _mm_load_pd(lanes + 6);
+		sum4 = _mm_load_pd(lanes + 8);
+		sum5 = _mm_load_pd(lanes + 10);
+		sum6 = _mm_load_pd(lanes + 12);
+		sum7 = _mm_load_pd(lanes + 14);
+	}
 	x0 = _mm_add_pd(sum0, sum1);
 	x1 = _mm_add_pd(sum2, sum3);
 	x2 = _mm_add_pd(sum4, sum5);
@@ -339,46 +1270,711 @@ static double vecsum(const struct options *restrict opts,
 	return hi + lo;
 }
 
+/*
+ * Add up the values in [opts->filter_lo, opts->filter_hi], in the same
+ * lanes and fold order as vecsum().  Values outside the range, and NaNs,
+ * are masked to zero.  The number of values that matched is added to
+ * *matched.
+ */
+static double vecsum_filtered(const struct options *restrict opts,
+		const double *restrict buf, int num_doubles,
+		long long *matched)
+{
+	int i, j, tail;
+	double hi, lo;
+	double lanes[DOUBLES_PER_LOOP_ITER] __attribute__((aligned(16)));
+	long long counts[2] __attribute__((aligned(16)));
+	const __m128d flo = _mm_set1_pd(opts->filter_lo);
+	const __m128d fhi = _mm_set1_pd(opts->filter_hi);
+	__m128d x, mask, sum[DOUBLES_PER_LOOP_ITER / 2];
+	__m128i count = _mm_setzero_si128();
+
+	for (j = 0; j < DOUBLES_PER_LOOP_ITER / 2; j++)
+		sum[j] = _mm_setzero_pd();
+	tail = num_doubles % DOUBLES_PER_LOOP_ITER;
+	for (i = 0; i < num_doubles - tail; i+=DOUBLES_PER_LOOP_ITER) {
+		for (j = 0; j < DOUBLES_PER_LOOP_ITER / 2; j++) {
+			x = _mm_load_pd(buf + i + (2 * j));
+			mask = _mm_and_pd(_mm_cmpge_pd(x, flo),
+					_mm_cmple_pd(x, fhi));
+			sum[j] = _mm_add_pd(sum[j], _mm_and_pd(mask, x));
+			// A true mask is all ones, which is -1 as an integer.
+			count = _mm_sub_epi64(count, _mm_castpd_si128(mask));
+		}
+	}
+	for (j = 0; j < DOUBLES_PER_LOOP_ITER / 2; j++)
+		_mm_store_pd(lanes + (2 * j), sum[j]);
+	_mm_store_si128((__m128i *)counts, count);
+	*matched += counts[0] + counts[1];
+	for (; i < num_doubles; i++) {
+		if ((buf[i] >= opts->filter_lo) && (buf[i] <= opts->filter_hi)) {
+			lanes[i % DOUBLES_PER_LOOP_ITER] += buf[i];
+			(*matched)++;
+		} else {
+			lanes[i % DOUBLES_PER_LOOP_ITER] += 0.0;
+		}
+	}
+	for (j = 0; j < DOUBLES_PER_LOOP_ITER / 2; j++)
+		sum[j] = _mm_load_pd(lanes + (2 * j));
+	x = _mm_add_pd(_mm_add_pd(_mm_add_pd(sum[0], sum[1]),
+				_mm_add_pd(sum[2], sum[3])),
+			_mm_add_pd(_mm_add_pd(sum[4], sum[5]),
+				_mm_add_pd(sum[6], sum[7])));
+	_mm_storeh_pd(&hi, x);
+	_mm_storel_pd(&lo, x);
+	return hi + lo;
+}
+
+/*
+ * Add n values into running per-lane sums, in the lanes of vecsum(), or
+ * vecsum_filtered() for a filtered scan.  A block can be added a piece at a
+ * time, as long as every piece but the last is a whole number of loop
+ * iterations, so that value i of a piece goes in the lane it would have in
+ * the block.  The pieces needn't be aligned.
+ */
+static void vecsum_lanes_add(const struct options *restrict opts,
+		double *restrict lanes, const double *restrict vals, int n,
+		long long *matched)
+{
+	__m128d sum[DOUBLES_PER_LOOP_ITER / 2];
+	int i, j;
+
+	if (opts->filter) {
+		for (i = 0; i < n; i++) {
+			if ((vals[i] >= opts->filter_lo) &&
+					(vals[i] <= opts->filter_hi)) {
+				lanes[i % DOUBLES_PER_LOOP_ITER] += vals[i];
+				(*matched)++;
+			} else {
+				lanes[i % DOUBLES_PER_LOOP_ITER] += 0.0;
+			}
+		}
+		return;
+	}
+	for (j = 0; j < DOUBLES_PER_LOOP_ITER / 2; j++)
+		sum[j] = _mm_load_pd(lanes + (2 * j));
+	for (i = 0; i + DOUBLES_PER_LOOP_ITER <= n;
+			i += DOUBLES_PER_LOOP_ITER) {
+		for (j = 0; j < DOUBLES_PER_LOOP_ITER / 2; j++) {
+			sum[j] = _mm_add_pd(sum[j],
+				_mm_loadu_pd(vals + i + (2 * j)));
+		}
+	}
+	for (j = 0; j < DOUBLES_PER_LOOP_ITER / 2; j++)
+		_mm_store_pd(lanes + (2 * j), sum[j]);
+	for (; i < n; i++)
+		lanes[i % DOUBLES_PER_LOOP_ITER] += vals[i];
+}
+
+/*
+ * Fold per-lane sums in the order vecsum() does.
+ */
+static double vecsum_lanes_fold(const double *restrict lanes)
+{
+	__m128d x0, x1, x2, x3, x4, x5, x6;
+	double hi, lo;
+
+	x0 = _mm_add_pd(_mm_load_pd(lanes + 0), _mm_load_pd(lanes + 2));
+	x1 = _mm_add_pd(_mm_load_pd(lanes + 4), _mm_load_pd(lanes + 6));
+	x2 = _mm_add_pd(_mm_load_pd(lanes + 8), _mm_load_pd(lanes + 10));
+	x3 = _mm_add_pd(_mm_load_pd(lanes + 12), _mm_load_pd(lanes + 14));
+	x4 = _mm_add_pd(x0, x1);
+	x5 = _mm_add_pd(x2, x3);
+	x6 = _mm_add_pd(x4, x5);
+	_mm_storeh_pd(&hi, x6);
+	_mm_storel_pd(&lo, x6);
+	return hi + lo;
+}
+
+/*
+ * Add up a frame from a compressed block cache, in the same lanes and fold
+ * order as vecsum(), or vecsum_filtered() for a filtered scan, so that the
+ * sum matches the uncompressed block's bit for bit.  Each tile is added up
+ * while it is still in L1, right after it is decoded, so the block is never
+ * written out whole.  If crc is non-NULL, the values are checksummed into
+ * it on the way.
+ */
+static double vecsum_frame(const struct options *restrict opts,
+		const void *frame, long long *matched, uint32_t *crc)
+{
+	double tile[DOUBLES_PER_TILE] __attribute__((aligned(16)));
+	double lanes[DOUBLES_PER_LOOP_ITER] __attribute__((aligned(16)));
+	struct blockcodec_reader rd;
+	const double *vals;
+	int n;
+
+	memset(lanes, 0, sizeof(lanes));
+	blockcodec_reader_init(&rd, frame);
+	// Every tile but the last is a whole number of loop iterations.
+	while ((n = blockcodec_next(&rd, tile, DOUBLES_PER_TILE,
+			&vals)) > 0) {
+		if (crc)
+			*crc = floatfile_crc32c(*crc, vals, n * sizeof(double));
+		vecsum_lanes_add(opts, lanes, vals, n, matched);
+	}
+	return vecsum_lanes_fold(lanes);
+}
+
+/*
+ * A block that arrives in pieces of any length, as zero-copy reads do where
+ * it crosses an HDFS block boundary.  Each piece is added up in place, a
+ * whole number of loop iterations at a time; the bytes left over at the
+ * end of a piece, which may end in the middle of a value, wait in the carry
+ * buffer until the next piece completes an iteration.
+ */
+struct vecsum_stitch {
+	double lanes[DOUBLES_PER_LOOP_ITER] __attribute__((aligned(16)));
+	double carry[DOUBLES_PER_LOOP_ITER] __attribute__((aligned(16)));
+	int carry_len;
+	uint32_t crc;
+	long long matched;
+	long long len;
+};
+
+static void vecsum_stitch_init(struct vecsum_stitch *restrict st)
+{
+	memset(st, 0, sizeof(*st));
+}
+
+static void vecsum_stitch_add(const struct options *restrict opts,
+		struct vecsum_stitch *restrict st, const void *buf,
+		long long len)
+{
+	const char *cbuf = buf;
+	long long n;
+
+	if (opts->verify_checksums)
+		st->crc = floatfile_crc32c(st->crc, buf, len);
+	st->len += len;
+	if (st->carry_len) {
+		n = sizeof(st->carry) - st->carry_len;
+		if (n > len)
+			n = len;
+		memcpy((char *)st->carry + st->carry_len, cbuf, n);
+		st->carry_len += n;
+		cbuf += n;
+		len -= n;
+		if (st->carry_len < (int)sizeof(st->carry))
+			return;
+		vecsum_lanes_add(opts, st->lanes, st->carry,
+			DOUBLES_PER_LOOP_ITER, &st->matched);
+		st->carry_len = 0;
+	}
+	n = len - (len % sizeof(st->carry));
+	if (n) {
+		vecsum_lanes_add(opts, st->lanes, (const double *)cbuf,
+			n / sizeof(double), &st->matched);
+	}
+	memcpy(st->carry, cbuf + n, len - n);
+	st->carry_len = len - n;
+}
+
 #endif
 
-static int vecsum_zcr_loop(int pass, struct test_data *restrict tdata,
-		struct hadoopRzOptions *restrict zopts,
-		const struct options *restrict opts)
+/*
+ * What one pass saw.
+ */
+struct pass_stats {
+	// The sum, or for a filtered scan, the sum of the matching values
+	double sum;
+
+	// Number of values that matched the filter
+	long long matched;
+
+	long long bytes_read;
+	long long bytes_skipped;
+	long long blocks;
+	long long blocks_skipped;
+
+	// Time spent adding up blocks that hit the block cache
+	double hit_seconds;
+
+	// Bytes whose pages were dropped behind the scan, and the time spent
+	// dropping them
+	long long bytes_dropped;
+	double drop_seconds;
+};
+
+/*
+ * Check the result of a pass against the expected aggregates, if we have
+ * them.  Returns 0 if the pass is correct, or EBADMSG if not.
+ *
+ * A filtered scan can't be checked against the file's sum, but it still has
+ * to account for every byte of the payload, whether it read it or skipped
+ * it.
+ */
+static int vecsum_check_pass(const struct options *restrict opts, int pass,
+		const struct pass_stats *restrict ps)
+{
+	const struct expected *exp = &opts->expected;
+	long long bytes = ps->bytes_read + ps->bytes_skipped;
+	struct blockcache_stats cs;
+
+	if (opts->cache) {
+		blockcache_get_stats(opts->cache, &cs, 1);
+		printf("cache pass %d: %lld hits, %lld misses (hit ratio "
+			"%.4g), %lld bytes from cache, %lld bytes read "
+			"through, %lld evictions, %lld of %lld blocks cached\n",
+			pass, cs.hits, cs.misses, (cs.hits + cs.misses) ?
+			(double)cs.hits / (cs.hits + cs.misses) : 0.0,
+			cs.bytes_hit, cs.bytes_missed, cs.evictions,
+			blockcache_used_blocks(opts->cache),
+			blockcache_capacity_blocks(opts->cache));
+		// The hit path is what compression slows down, and the
+		// effective capacity is what it buys.
+		printf("cache pass %d: %lld bytes cached in %lld bytes "
+			"(%.3gx), hit path %.5g GB/s (%.4g ns per byte)\n",
+			pass, blockcache_cached_bytes(opts->cache),
+			blockcache_stored_bytes(opts->cache),
+			blockcache_stored_bytes(opts->cache) ?
+			(double)blockcache_cached_bytes(opts->cache) /
+			blockcache_stored_bytes(opts->cache) : 0.0,
+			ps->hit_seconds > 0 ? (cs.bytes_hit + cs.bytes_ssd) /
+			ps->hit_seconds / 1e9 : 0.0,
+			(cs.bytes_hit + cs.bytes_ssd) ? ps->hit_seconds * 1e9 /
+			(cs.bytes_hit + cs.bytes_ssd) : 0.0);
+	}
+	if (opts->cache && opts->ssd_dir) {
+		// Overall, a block is a hit if either tier had it.
+		printf("ssd pass %d: %lld hits, %lld misses (hit ratio %.4g), "
+			"%lld bytes from ssd, %lld promotions, %lld "
+			"demotions, %lld writes dropped, %lld of %lld blocks "
+			"on ssd, overall hit ratio %.4g\n", pass, cs.ssd_hits,
+			cs.ssd_misses, (cs.ssd_hits + cs.ssd_misses) ?
+			(double)cs.ssd_hits / (cs.ssd_hits + cs.ssd_misses) :
+			0.0, cs.bytes_ssd, cs.promotions, cs.demotions,
+			cs.ssd_dropped, blockcache_ssd_used_blocks(opts->cache),
+			blockcache_ssd_capacity_blocks(opts->cache),
+			(cs.hits + cs.misses) ? (double)(cs.hits +
+			cs.ssd_hits) / (cs.hits + cs.misses) : 0.0);
+	}
+	if (opts->filter) {
+		printf("filter pass %d: matched %lld values (%.4g%% of the "
+			"file), skipped %lld of %lld blocks and %lld of %lld "
+			"bytes (%.1f%%)\n", pass, ps->matched,
+			100.0 * ps->matched / (bytes / sizeof(double)),
+			ps->blocks_skipped, ps->blocks, ps->bytes_skipped,
+			bytes, 100.0 * ps->bytes_skipped / bytes);
+	}
+	if (!opts->have_expected)
+		return 0;
+	if (bytes != exp->count * (long long)sizeof(double)) {
+		fprintf(stderr, "pass %d read %lld bytes, but the file holds "
+			"%lld doubles (%lld bytes)\n", pass, bytes,
+			exp->count, exp->count * (long long)sizeof(double));
+		return EBADMSG;
+	}
+	if (opts->filter)
+		return 0;
+	if (!expected_sum_matches(ps->sum, exp->sum)) {
+		fprintf(stderr, "pass %d got sum %a (%.17g), but expected "
+			"%a (%.17g)\n", pass, ps->sum, ps->sum, exp->sum,
+			exp->sum);
+		return EBADMSG;
+	}
+	return 0;
+}
+
+/*
+ * Check a block's checksum against the footer.  Returns 0 if they match,
+ * or EBADMSG if not.
+ */
+static int vecsum_check_crc(const struct options *restrict opts,
+		long long block, uint32_t crc)
+{
+	const struct floatfile_block *entry;
+
+	entry = floatfile_block_get(opts->layout.ftr, block);
+	if (crc != entry->crc) {
+		fprintf(stderr, "block %lld has checksum 0x%08x, but the "
+			"footer says 0x%08x\n", block, crc, entry->crc);
+		return EBADMSG;
+	}
+	return 0;
+}
+
+/*
+ * Check a block against its checksum in the footer, if we were asked to.
+ * Returns 0 if the block is intact, or EBADMSG if not.
+ */
+static int vecsum_check_block(const struct options *restrict opts,
+		long long block, const void *buf, long long len)
+{
+	if (!opts->verify_checksums)
+		return 0;
+	return vecsum_check_crc(opts, block, floatfile_crc32c(0, buf, len));
+}
+
+/*
+ * Returns nonzero if a filtered scan can skip the block of len bytes,
+ * because its zone map shows that nothing in it can match.  Skipped blocks
+ * are counted in ps.
+ */
+static int vecsum_skip_block(const struct options *restrict opts,
+		struct pass_stats *restrict ps, long long block, long long len)
+{
+	const struct floatfile_block *entry;
+
+	if (!opts->filter || !opts->zone_maps || !opts->layout.ftr)
+		return 0;
+	entry = floatfile_block_get(opts->layout.ftr, block);
+	if (floatfile_block_may_match(entry, opts->filter_lo,
+			opts->filter_hi))
+		return 0;
+	ps->blocks++;
+	ps->blocks_skipped++;
+	ps->bytes_skipped += len;
+	return 1;
+}
+
+/*
+ * Look a block up in the block cache, if there is one.  Returns the cached
+ * bytes, or NULL on a miss.
+ */
+static const void *vecsum_cache_lookup(const struct options *restrict opts,
+		long long block)
+{
+	int len;
+
+	if (!opts->cache)
+		return NULL;
+	return blockcache_lookup(opts->cache, block, &len);
+}
+
+/*
+ * Offer a block that missed to the block cache, if there is one.
+ */
+static void vecsum_cache_insert(const struct options *restrict opts,
+		long long block, const void *buf, long long len)
+{
+	if (opts->cache)
+		blockcache_insert(opts->cache, block, buf, len);
+}
+
+/*
+ * Record a chunk access in the read trace, if there is one.  offset is in
+ * the payload.
+ */
+static void vecsum_trace(const struct options *restrict opts, int op,
+		long long offset, long long len, int hit)
+{
+	if (opts->trace) {
+		blocktrace_record(opts->trace, opts->trace_file,
+			opts->layout.payload_offset + offset, len, op,
+			hit ? BLOCKTRACE_FLAG_HIT : 0);
+	}
+}
+
+/*
+ * Check and add up one block of len bytes that a read path has brought in.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+static int vecsum_block(const struct options *restrict opts,
+		struct pass_stats *restrict ps, long long block,
+		const void *buf, long long len)
+{
+	int ret;
+
+	ret = vecsum_check_block(opts, block, buf, len);
+	if (ret)
+		return ret;
+	if (opts->filter) {
+		ps->sum += vecsum_filtered(opts, buf, len / sizeof(double),
+				&ps->matched);
+	} else {
+		ps->sum += vecsum(opts, buf, len / sizeof(double));
+	}
+	ps->blocks++;
+	ps->bytes_read += len;
+	return 0;
+}
+
+/*
+ * Check and add up one block of len bytes that hit the block cache,
+ * decoding it on the way if the cache is compressed.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+static int vecsum_cached_block(const struct options *restrict opts,
+		struct pass_stats *restrict ps, long long block,
+		const void *cached, long long len)
+{
+	double start = monotonic_seconds(), sum;
+	uint32_t crc = 0;
+	int ret;
+
+	if (!opts->cache || !blockcache_compressed(opts->cache)) {
+		ret = vecsum_block(opts, ps, block, cached, len);
+		goto done;
+	}
+	sum = vecsum_frame(opts, cached, &ps->matched,
+		opts->verify_checksums ? &crc : NULL);
+	if (opts->verify_checksums) {
+		ret = vecsum_check_crc(opts, block, crc);
+		if (ret)
+			goto done;
+	}
+	ps->sum += sum;
+	ps->blocks++;
+	ps->bytes_read += len;
+	ret = 0;
+done:
+	ps->hit_seconds += monotonic_seconds() - start;
+	return ret;
+}
+
+/*
+ * Check and add up a block that was stitched together from pieces.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+static int vecsum_stitch_finish(const struct options *restrict opts,
+		struct pass_stats *restrict ps, long long block,
+		struct vecsum_stitch *restrict st)
+{
+	int ret;
+
+	vecsum_lanes_add(opts, st->lanes, st->carry,
+		st->carry_len / sizeof(double), &st->matched);
+	if (opts->verify_checksums) {
+		ret = vecsum_check_crc(opts, block, st->crc);
+		if (ret)
+			return ret;
+	}
+	ps->sum += vecsum_lanes_fold(st->lanes);
+	ps->matched += st->matched;
+	ps->blocks++;
+	ps->bytes_read += st->len;
+	return 0;
+}
+
+tSize hdfsReadFully(hdfsFS fs, hdfsFile f, void* buffer, tSize length)
+{
+    uint8_t *buf = buffer;
+    tSize ret, nread = 0;
+
+    while (length > 0) {
+        ret = hdfsRead(fs, f, buf, length);
+        if (ret < 0) {
+            if (errno != EINTR) {
+                return -1;
+            }
+        }
+        if (ret == 0) {
+            break;
+        }
+        nread += ret;
+        length -= ret;
+        buf += ret;
+    }
+    return nread;
+}
+
+/*
+ * Print how the read buffer pool did over a pass: the share of buffers it
+ * handed out from its pre-faulted slots, and roughly how long allocating
+ * and faulting in those buffers would have taken instead.
+ */
+static void vecsum_pool_report(int pass, struct test_data *restrict tdata)
+{
+	struct bufpool_stats st;
+
+	bufpool_get_stats(tdata->pool, &st, 1);
+	printf("pool pass %d: %lld gets, hit rate %.4g (%lld from the thread "
+		"cache), %.4g seconds of allocation avoided\n", pass,
+		st.gets, st.gets ? (double)st.hits / st.gets : 0.0,
+		st.thread_hits, st.seconds_saved);
+}
+
+/*
+ * Print how the zero-copy reads went over a pass.
+ */
+static void vecsum_zcr_report(int pass, struct test_data *restrict tdata)
+{
+	printf("zcr pass %d: %lld short reads, %lld blocks stitched across "
+		"reads, %lld fallback reads\n", pass, tdata->zcr_short_reads,
+		tdata->zcr_stitched, tdata->zcr_fallbacks);
+	tdata->zcr_short_reads = 0;
+	tdata->zcr_stitched = 0;
+	tdata->zcr_fallbacks = 0;
+}
+
+/*
+ * Read up to want bytes with one zero-copy read, and point *buf at them.
+ * If libhdfs can't read them in place, they are copied into *copy, a
+ * buffer from the pool, instead.  The caller frees *rzbuf and puts back
+ * *copy.
+ *
+ * Returns the number of bytes read, which is short where the read reaches
+ * an HDFS block boundary and 0 at the end of the file, or -1 with errno set
+ * on failure.
+ */
+static int32_t vecsum_zcr_read(struct test_data *restrict tdata,
+		struct hadoopRzOptions *restrict zopts, int32_t want,
+		struct hadoopRzBuffer **rzbuf, void **copy, const void **buf)
 {
 	int32_t len;
-	double sum = 0.0;
-	const double *buf;
+
+	*rzbuf = hadoopReadZero(tdata->file, zopts, want);
+	if (*rzbuf) {
+		*buf = hadoopRzBufferGet(*rzbuf);
+		return *buf ? hadoopRzBufferLength(*rzbuf) : 0;
+	}
+	if (errno != EPROTONOSUPPORT) {
+		fprintf(stderr, "hadoopReadZero failed with error code %d "
+			"(%s)\n", errno, strerror(errno));
+		return -1;
+	}
+	// The block can't be mmapped, and libhdfs has no pool to copy it
+	// into, so copy it into ours.
+	*copy = bufpool_get(tdata->pool, want);
+	if (!*copy) {
+		errno = ENOMEM;
+		return -1;
+	}
+	len = hdfsReadFully(tdata->fs, tdata->file, *copy, want);
+	if (len < 0) {
+		fprintf(stderr, "hdfsRead failed with error %d (%s)\n",
+			errno, strerror(errno));
+		return -1;
+	}
+	*buf = *copy;
+	tdata->zcr_fallbacks++;
+	return len;
+}
+
+/*
+ * Read and add up one block of want bytes with zero-copy reads.  A read
+ * comes back short where the block crosses an HDFS block boundary; then
+ * the rest of the block is read in more pieces, which are added up where
+ * they lie and stitched together, and only gathered into one buffer if the
+ * block cache needs it whole.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+static int vecsum_zcr_block(struct test_data *restrict tdata,
+		struct hadoopRzOptions *restrict zopts,
+		const struct options *restrict opts,
+		struct pass_stats *restrict ps, long long block, int32_t want,
+		uint64_t *restrict span)
+{
 	struct hadoopRzBuffer *rzbuf = NULL;
-	int ret;
+	struct vecsum_stitch st;
+	void *copy = NULL;
+	char *whole = NULL;
+	const void *buf;
+	int32_t len, got = 0;
+	int ret = 0, stitched = 0;
 
-	while (1) {
-		rzbuf = hadoopReadZero(tdata->file, zopts, ZCR_READ_CHUNK_SIZE);
-		if (!rzbuf) {
+	while (got < want) {
+		len = vecsum_zcr_read(tdata, zopts, want - got, &rzbuf,
+			&copy, &buf);
+		phase_end(PHASE_READ, span);
+		if (len < 0) {
 			ret = errno;
-			fprintf(stderr, "hadoopReadZero failed with error "
-				"code %d (%s)\n", ret, strerror(ret));
 			goto done;
 		}
-		buf = hadoopRzBufferGet(rzbuf);
-		if (!buf) break;
-		len = hadoopRzBufferLength(rzbuf);
-		if (len < ZCR_READ_CHUNK_SIZE) {
-			fprintf(stderr, "hadoopReadZero got a partial read "
-				"of length %d\n", len);
-			ret = EINVAL;
-			goto done;
+		if (len == 0) {
+			fprintf(stderr, "hadoopReadZero reached the end of the "
+				"file %d bytes into a block of %d\n", got,
+				want);
+			ret = EINVAL;
+			goto done;
+		}
+		if (len < want - got)
+			tdata->zcr_short_reads++;
+		if (!got && (len == want)) {
+			vecsum_cache_insert(opts, block, buf, len);
+			ret = vecsum_block(opts, ps, block, buf, len);
+			if (ret)
+				goto done;
+		} else {
+			if (!stitched) {
+				stitched = 1;
+				tdata->zcr_stitched++;
+				vecsum_stitch_init(&st);
+				if (opts->cache) {
+					whole = bufpool_get(tdata->pool, want);
+					if (!whole) {
+						ret = ENOMEM;
+						goto done;
+					}
+				}
+			}
+			vecsum_stitch_add(opts, &st, buf, len);
+			if (whole)
+				memcpy(whole + got, buf, len);
+		}
+		got += len;
+		phase_end(PHASE_KERNEL, span);
+		if (rzbuf)
+			hadoopRzBufferFree(tdata->file, rzbuf);
+		rzbuf = NULL;
+		bufpool_put(tdata->pool, copy);
+		copy = NULL;
+		phase_end(PHASE_RELEASE, span);
+	}
+	if (stitched) {
+		if (whole)
+			vecsum_cache_insert(opts, block, whole, want);
+		ret = vecsum_stitch_finish(opts, ps, block, &st);
+		phase_end(PHASE_KERNEL, span);
+	}
+
+done:
+	if (rzbuf)
+		hadoopRzBufferFree(tdata->file, rzbuf);
+	bufpool_put(tdata->pool, copy);
+	bufpool_put(tdata->pool, whole);
+	return ret;
+}
+
+static int vecsum_zcr_loop(int pass, struct test_data *restrict tdata,
+		struct hadoopRzOptions *restrict zopts,
+		const struct options *restrict opts)
+{
+	const struct file_layout *layout = &opts->layout;
+	int32_t want;
+	struct pass_stats ps = { 0 };
+	long long pos = 0, block = 0, stream_pos = 0;
+	const void *cached;
+	int ret;
+	uint64_t span = phase_now();
+
+	for (; pos < layout->payload_length; pos += want, block++) {
+		want = layout_chunk_len(layout, pos);
+		if (vecsum_skip_block(opts, &ps, block, want))
+			continue;
+		cached = vecsum_cache_lookup(opts, block);
+		vecsum_trace(opts, BLOCKTRACE_OP_READ_ZERO, pos, want,
+			!!cached);
+		if (cached) {
+			ret = vecsum_cached_block(opts, &ps, block, cached,
+				want);
+			if (ret)
+				return ret;
+			phase_end(PHASE_KERNEL, &span);
+			continue;
+		}
+		// Blocks that were skipped or found in the cache leave the
+		// stream behind, so catch it up before reading.
+		if (stream_pos != pos) {
+			hdfsSeek(tdata->fs, tdata->file,
+				layout->payload_offset + pos);
+			stream_pos = pos;
+			phase_end(PHASE_SEEK, &span);
 		}
-		sum += vecsum(opts, buf,
-			ZCR_READ_CHUNK_SIZE / sizeof(double));
-		hadoopRzBufferFree(tdata->file, rzbuf);
+		ret = vecsum_zcr_block(tdata, zopts, opts, &ps, block, want,
+			&span);
+		if (ret)
+			return ret;
+		stream_pos += want;
 	}
-	printf("finished zcr pass %d.  sum = %g\n", pass, sum);
-	ret = 0;
-
-done:
-	if (rzbuf)
-		hadoopRzBufferFree(tdata->file, rzbuf);
-	return ret;
+	printf("finished zcr pass %d.  sum = %g\n", pass, ps.sum);
+	vecsum_zcr_report(pass, tdata);
+	vecsum_pool_report(pass, tdata);
+	return vecsum_check_pass(opts, pass, &ps);
 }
 
 static int vecsum_zcr(struct test_data *restrict tdata,
@@ -403,14 +1999,21 @@ static int vecsum_zcr(struct test_data *restrict tdata,
 		perror("hadoopRzOptionsSetByteBufferPool failed: ");
 		goto done;
 	}
+	hdfsSeek(tdata->fs, tdata->file, opts->layout.payload_offset);
 	for (pass = 0; pass < opts->passes; ++pass) {
+		uint64_t span;
+		double start = monotonic_seconds();
+
 		ret = vecsum_zcr_loop(pass, tdata, zopts, opts);
 		if (ret) {
 			fprintf(stderr, "vecsum_zcr_loop pass %d failed "
 				"with error %d\n", pass, ret);
 			goto done;
 		}
-		hdfsSeek(tdata->fs, tdata->file, 0);
+		span = phase_now();
+		hdfsSeek(tdata->fs, tdata->file, opts->layout.payload_offset);
+		phase_end(PHASE_SEEK, &span);
+		g_pass_seconds[pass] = monotonic_seconds() - start;
 	}
 	ret = 0;
 done:
@@ -419,86 +2022,498 @@ done:
 	return ret;
 }
 
-tSize hdfsReadFully(hdfsFS fs, hdfsFile f, void* buffer, tSize length)
-{
-    uint8_t *buf = buffer;
-    tSize ret, nread = 0;
-
-    while (length > 0) {
-        ret = hdfsRead(fs, f, buf, length);
-        if (ret < 0) {
-            if (errno != EINTR) {
-                return -1;
-            }
-        }
-        if (ret == 0) {
-            break;
-        }
-        nread += ret;
-        length -= ret;
-        buf += ret;
-    }
-    return nread;
-}
-
-static int vecsum_normal_loop(int pass, const struct test_data *restrict tdata,
+static int vecsum_normal_loop(int pass, struct test_data *restrict tdata,
 			const struct options *restrict opts)
 {
-	double sum = 0.0;
+	const struct file_layout *layout = &opts->layout;
+	struct pass_stats ps = { 0 };
+	long long pos = 0, block = 0, stream_pos = 0;
+	const void *cached;
+	void *buf;
+	int ret, want, res;
+	uint64_t span = phase_now();
 
-	while (1) {
-		int res = hdfsReadFully(tdata->fs, tdata->file, tdata->buf,
-				NORMAL_READ_CHUNK_SIZE);
-		if (res == 0) // EOF
-			break;
+	for (; pos < layout->payload_length; pos += want, block++) {
+		want = layout_chunk_len(layout, pos);
+		if (vecsum_skip_block(opts, &ps, block, want))
+			continue;
+		cached = vecsum_cache_lookup(opts, block);
+		vecsum_trace(opts, BLOCKTRACE_OP_HDFS_READ, pos, want,
+			!!cached);
+		if (cached) {
+			ret = vecsum_cached_block(opts, &ps, block, cached,
+				want);
+			if (ret)
+				return ret;
+			phase_end(PHASE_KERNEL, &span);
+			continue;
+		}
+		if (stream_pos != pos) {
+			hdfsSeek(tdata->fs, tdata->file,
+				layout->payload_offset + pos);
+			stream_pos = pos;
+			phase_end(PHASE_SEEK, &span);
+		}
+		buf = bufpool_get(tdata->pool, want);
+		if (!buf)
+			return ENOMEM;
+		res = hdfsReadFully(tdata->fs, tdata->file, buf, want);
+		phase_end(PHASE_READ, &span);
 		if (res < 0) {
 			int err = errno;
 			fprintf(stderr, "hdfsRead failed with error %d (%s)\n",
 				err, strerror(err));
+			bufpool_put(tdata->pool, buf);
 			return err;
 		}
-		if (res < NORMAL_READ_CHUNK_SIZE) {
+		if (res < want) {
 			fprintf(stderr, "hdfsRead got a partial read of "
 				"length %d\n", res);
+			bufpool_put(tdata->pool, buf);
 			return EINVAL;
 		}
-		sum += vecsum(opts, tdata->buf,
-			      NORMAL_READ_CHUNK_SIZE / sizeof(double));
+		stream_pos += res;
+		vecsum_cache_insert(opts, block, buf, res);
+		ret = vecsum_block(opts, &ps, block, buf, res);
+		bufpool_put(tdata->pool, buf);
+		if (ret)
+			return ret;
+		phase_end(PHASE_KERNEL, &span);
+	}
+	printf("finished normal pass %d.  sum = %g\n", pass, ps.sum);
+	vecsum_pool_report(pass, tdata);
+	return vecsum_check_pass(opts, pass, &ps);
+}
+
+/*
+ * A pass of the block-aware scan, shared by its threads.
+ *
+ * One thread uses the block cache, which isn't thread-safe.  More threads
+ * share the sharded cache instead: a hit pins the chunk while the thread
+ * adds it up, and a miss is read without any lock and then inserted, so
+ * neither hits nor misses wait for each other.
+ */
+struct vecsum_sched {
+	struct test_data *tdata;
+	const struct options *opts;
+	struct blocksched *bs;
+
+	// Each chunk's sum, and nonzero if it was read rather than skipped, so
+	// that the sums can be added up in file order once the threads are
+	// done
+	double *chunk_sums;
+	char *chunk_read;
+
+	// The sharded cache's stats at the end of the last pass
+	struct shardcache_stats last_shared;
+
+	// The error that the first thread to fail failed with
+	int err;
+};
+
+struct vecsum_sched_worker {
+	struct vecsum_sched *sc;
+	pthread_t thread;
+	struct pass_stats ps;
+
+	// The thread's phases, merged into the run's once it is done
+	struct phase_stats phases;
+
+	// Chunks that hit and missed the cache
+	long long hits;
+	long long misses;
+};
+
+/*
+ * Read and add up one chunk for the block-aware scan, with one read per
+ * HDFS block that it touches.  Sets *hit if it came out of the block cache.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+static int vecsum_sched_chunk(struct vecsum_sched *restrict sc,
+		struct vecsum_sched_worker *restrict w, long long chunk,
+		char *buf, int *hit)
+{
+	const struct options *opts = sc->opts;
+	long long block_size = sc->tdata->block_size, off, pos, piece;
+	struct pass_stats *ps = &w->ps, cs = { 0 };
+	const void *cached;
+	double start;
+	int len, cached_len, ret = 0;
+	uint64_t span;
+
+	blocksched_chunk(sc->bs, chunk, &off, &len);
+	*hit = 0;
+	if (vecsum_skip_block(opts, ps, chunk, len))
+		return 0;
+	start = monotonic_seconds();
+	span = phase_now();
+	if (opts->shared_cache)
+		cached = shardcache_pin(opts->shared_cache, chunk, &cached_len);
+	else
+		cached = vecsum_cache_lookup(opts, chunk);
+	vecsum_trace(opts, BLOCKTRACE_OP_HDFS_READ,
+		off - opts->layout.payload_offset, len, !!cached);
+	if (cached) {
+		*hit = 1;
+		ret = vecsum_cached_block(opts, &cs, chunk, cached, len);
+		if (opts->shared_cache)
+			shardcache_unpin(opts->shared_cache, cached);
+		phase_charge(&w->phases, PHASE_KERNEL, &span);
+		goto done;
+	}
+	for (pos = 0; pos < len; pos += piece) {
+		piece = block_size - ((off + pos) % block_size);
+		if (piece > len - pos)
+			piece = len - pos;
+		ret = read_fully_at(sc->tdata, -1, off + pos, buf + pos, piece);
+		if (ret) {
+			fprintf(stderr, "hdfsPread failed with error %d (%s)\n",
+				ret, strerror(ret));
+			goto done;
+		}
 	}
-	printf("finished normal pass %d.  sum = %g\n", pass, sum);
+	phase_charge(&w->phases, PHASE_READ, &span);
+	// Another thread may have inserted the chunk meanwhile, or pinned
+	// every block of its shard; either way, this copy isn't needed.
+	if (opts->shared_cache)
+		shardcache_insert(opts->shared_cache, chunk, buf, len);
+	else
+		vecsum_cache_insert(opts, chunk, buf, len);
+	ret = vecsum_block(opts, &cs, chunk, buf, len);
+	phase_charge(&w->phases, PHASE_KERNEL, &span);
+done:
+	if (ret)
+		return ret;
+	blocksched_account(sc->bs, chunk, *hit, len,
+		monotonic_seconds() - start);
+	sc->chunk_sums[chunk] = cs.sum;
+	sc->chunk_read[chunk] = 1;
+	ps->matched += cs.matched;
+	ps->bytes_read += cs.bytes_read;
+	ps->blocks += cs.blocks;
+	ps->hit_seconds += cs.hit_seconds;
 	return 0;
 }
 
+static void *vecsum_sched_run(void *arg)
+{
+	struct vecsum_sched_worker *w = arg;
+	struct vecsum_sched *sc = w->sc;
+	struct blocksched_block *blk;
+	long long chunk, read, hits;
+	char *buf;
+	int hit, ret = 0, none = 0;
+
+	buf = bufpool_get(sc->tdata->pool, VECSUM_CHUNK_SIZE);
+	if (!buf)
+		ret = ENOMEM;
+	while (!ret && !__atomic_load_n(&sc->err, __ATOMIC_RELAXED)) {
+		blk = blocksched_next(sc->bs);
+		if (!blk)
+			break;
+		read = hits = 0;
+		for (chunk = blk->first_chunk;
+				chunk < blk->first_chunk + blk->num_chunks;
+				chunk++) {
+			ret = vecsum_sched_chunk(sc, w, chunk, buf, &hit);
+			if (ret)
+				break;
+			read += sc->chunk_read[chunk];
+			hits += hit;
+		}
+		if (!ret)
+			blocksched_block_done(sc->bs, blk, read, hits);
+		w->hits += hits;
+		w->misses += read - hits;
+	}
+	if (ret) {
+		__atomic_compare_exchange_n(&sc->err, &none, ret, 0,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	}
+	bufpool_put(sc->tdata->pool, buf);
+	return NULL;
+}
+
+/*
+ * Print how each class of chunk group did over a pass.  Throughput is per
+ * thread: the bytes of a class over the time the threads spent on them.
+ */
+static void vecsum_sched_report(int pass, struct vecsum_sched *restrict sc)
+{
+	struct blocksched_stats st;
+	int cls;
+
+	blocksched_get_stats(sc->bs, &st);
+	printf("blocks pass %d: %lld-byte HDFS blocks", pass,
+		sc->tdata->block_size);
+	for (cls = 0; cls < BLOCKSCHED_CLASSES; cls++) {
+		printf("; %s: %lld chunk groups, %lld chunks, %.5g GB/s per "
+			"thread", blocksched_class_name(cls), st.groups[cls],
+			st.chunks[cls], st.seconds[cls] > 0 ?
+			st.bytes[cls] / st.seconds[cls] / 1e9 : 0.0);
+	}
+	printf("\n");
+}
+
+/*
+ * Print how the sharded cache did over a pass.
+ */
+static void vecsum_sched_report_cache(int pass,
+		struct vecsum_sched *restrict sc, long long hits,
+		long long misses)
+{
+	struct shardcache_stats ss;
+
+	shardcache_get_stats(sc->opts->shared_cache, &ss);
+	printf("cache pass %d: %lld hits, %lld misses (hit ratio %.4g), "
+		"%lld inserts, %lld evictions, %lld inserts turned away "
+		"busy, %lld lookup retries, room for %lld blocks in the "
+		"sharded cache\n", pass, hits, misses, (hits + misses) ?
+		(double)hits / (hits + misses) : 0.0,
+		ss.inserts - sc->last_shared.inserts,
+		ss.evictions - sc->last_shared.evictions,
+		ss.busy - sc->last_shared.busy,
+		ss.retries - sc->last_shared.retries,
+		shardcache_capacity_blocks(sc->opts->shared_cache));
+	sc->last_shared = ss;
+}
+
+static int vecsum_sched_pass(int pass, struct vecsum_sched *restrict sc)
+{
+	const struct options *opts = sc->opts;
+	struct vecsum_sched_worker *workers;
+	struct pass_stats ps = { 0 };
+	long long chunk, num_chunks = blocksched_num_chunks(sc->bs);
+	long long hits = 0, misses = 0;
+	int i, started, ret;
+
+	workers = calloc(opts->threads, sizeof(*workers));
+	if (!workers)
+		return ENOMEM;
+	blocksched_start_pass(sc->bs);
+	memset(sc->chunk_read, 0, num_chunks);
+	sc->err = 0;
+	for (started = 0; started < opts->threads; started++) {
+		workers[started].sc = sc;
+		ret = pthread_create(&workers[started].thread, NULL,
+			vecsum_sched_run, &workers[started]);
+		if (ret) {
+			fprintf(stderr, "vecsum_sched_pass: failed to create "
+				"a thread: error %d (%s)\n", ret,
+				strerror(ret));
+			sc->err = ret;
+			break;
+		}
+	}
+	for (i = 0; i < started; i++) {
+		pthread_join(workers[i].thread, NULL);
+		ps.matched += workers[i].ps.matched;
+		ps.bytes_read += workers[i].ps.bytes_read;
+		ps.bytes_skipped += workers[i].ps.bytes_skipped;
+		ps.blocks += workers[i].ps.blocks;
+		ps.blocks_skipped += workers[i].ps.blocks_skipped;
+		ps.hit_seconds += workers[i].ps.hit_seconds;
+		hits += workers[i].hits;
+		misses += workers[i].misses;
+		phase_merge(&workers[i].phases, started);
+	}
+	free(workers);
+	if (sc->err)
+		return sc->err;
+	for (chunk = 0; chunk < num_chunks; chunk++) {
+		if (sc->chunk_read[chunk])
+			ps.sum += sc->chunk_sums[chunk];
+	}
+	printf("finished normal pass %d.  sum = %g\n", pass, ps.sum);
+	vecsum_sched_report(pass, sc);
+	if (opts->shared_cache)
+		vecsum_sched_report_cache(pass, sc, hits, misses);
+	vecsum_pool_report(pass, sc->tdata);
+	return vecsum_check_pass(opts, pass, &ps);
+}
+
+/*
+ * The number of shards for the threads' cache: as many as there are
+ * threads, rounded down to a power of two, but few enough that each shard
+ * holds at least SHARD_MIN_BLOCKS blocks.  Only inserts lock a shard, and
+ * CLOCK does poorly with a handful of blocks per hand.
+ */
+static int vecsum_num_shards(const struct options *opts)
+{
+	long long blocks = opts->cache_bytes / VECSUM_CHUNK_SIZE;
+	int shards = 1;
+
+	while ((shards * 2 <= opts->threads) &&
+			(shards * 2 * SHARD_MIN_BLOCKS <= blocks))
+		shards *= 2;
+	return shards;
+}
+
+/*
+ * Scan the file with opts->threads threads, which take the chunks of whole
+ * HDFS blocks in an order planned from where their replicas are (see
+ * blocksched.h), and read them with hdfsPread.
+ */
+static int vecsum_sched(struct test_data *restrict tdata,
+			const struct options *restrict opts)
+{
+	const struct file_layout *layout = &opts->layout;
+	struct vecsum_sched sc = { 0 };
+	char hostname[256] = { 0 }, ***hosts;
+	int pass, ret;
+	uint64_t span = phase_now();
+
+	sc.tdata = tdata;
+	sc.opts = opts;
+	if (tdata->block_size <= 0)
+		tdata->block_size = tdata->length ? tdata->length : 1;
+	if (gethostname(hostname, sizeof(hostname) - 1)) {
+		ret = errno;
+		fprintf(stderr, "vecsum_sched: gethostname failed: error %d "
+			"(%s)\n", ret, strerror(ret));
+		goto done;
+	}
+	hosts = hdfsGetHosts(tdata->fs, opts->path, 0, tdata->length);
+	if (!hosts) {
+		ret = errno ? errno : EIO;
+		fprintf(stderr, "hdfsGetHosts(%s) failed: error %d (%s)\n",
+			opts->path, ret, strerror(ret));
+		goto done;
+	}
+	ret = blocksched_create(layout->payload_offset,
+		layout->payload_offset + layout->payload_length,
+		VECSUM_CHUNK_SIZE, tdata->block_size, hosts, hostname,
+		&sc.bs);
+	hdfsFreeHosts(hosts);
+	if (ret) {
+		fprintf(stderr, "vecsum_sched: failed to create the "
+			"scheduler: error %d (%s)\n", ret, strerror(ret));
+		goto done;
+	}
+	sc.chunk_sums = calloc(blocksched_num_chunks(sc.bs), sizeof(double));
+	sc.chunk_read = calloc(blocksched_num_chunks(sc.bs), sizeof(char));
+	if (!sc.chunk_sums || !sc.chunk_read) {
+		ret = ENOMEM;
+		goto done;
+	}
+	phase_end(PHASE_OPEN, &span);
+	for (pass = 0; pass < opts->passes; pass++) {
+		double start = monotonic_seconds();
+
+		ret = vecsum_sched_pass(pass, &sc);
+		if (ret) {
+			fprintf(stderr, "vecsum_sched_pass pass %d failed "
+				"with error %d\n", pass, ret);
+			goto done;
+		}
+		g_pass_seconds[pass] = monotonic_seconds() - start;
+	}
+	ret = 0;
+done:
+	blocksched_free(sc.bs);
+	free(sc.chunk_sums);
+	free(sc.chunk_read);
+	return ret;
+}
+
 static int vecsum_libhdfs(struct test_data *restrict tdata,
 			const struct options *restrict opts)
 {
 	int pass;
+	uint64_t span = phase_now();
 
-	tdata->buf = malloc(NORMAL_READ_CHUNK_SIZE);
-	if (!tdata->buf) {
-		fprintf(stderr, "failed to malloc buffer of size %d\n",
-			NORMAL_READ_CHUNK_SIZE);
-		return ENOMEM;
-	}
+	if (opts->threads)
+		return vecsum_sched(tdata, opts);
+	hdfsSeek(tdata->fs, tdata->file, opts->layout.payload_offset);
+	phase_end(PHASE_OPEN, &span);
 	for (pass = 0; pass < opts->passes; ++pass) {
+		double start = monotonic_seconds();
 		int ret = vecsum_normal_loop(pass, tdata, opts);
 		if (ret) {
 			fprintf(stderr, "vecsum_normal_loop pass %d failed "
 				"with error %d\n", pass, ret);
 			return ret;
 		}
-		hdfsSeek(tdata->fs, tdata->file, 0);
+		span = phase_now();
+		hdfsSeek(tdata->fs, tdata->file, opts->layout.payload_offset);
+		phase_end(PHASE_SEEK, &span);
+		g_pass_seconds[pass] = monotonic_seconds() - start;
+	}
+	return 0;
+}
+
+/*
+ * Drop the pages of a chunk that we have added up, so that the scan doesn't
+ * push other data out of the page cache.  off and len are where the chunk
+ * lies in the payload, and payload is the local path's mapping of it, or
+ * NULL for the pread path.  Returns 0 on success, or an errno value on
+ * failure.
+ */
+static int vecsum_drop_behind(const struct options *restrict opts,
+		struct pass_stats *restrict ps, int fd, const char *payload,
+		long long off, long long len)
+{
+	long long file_off = opts->layout.payload_offset + off;
+	// The advice works on whole pages.  The part of the first page before
+	// the chunk belongs to the chunk before, which is done with too.
+	long long skew = file_off & (sysconf(_SC_PAGESIZE) - 1);
+	double start = monotonic_seconds();
+	int advice = MADV_DONTNEED, ret = 0;
+
+	if (payload) {
+#if defined(MADV_COLD) && defined(MADV_PAGEOUT)
+		if (opts->drop_behind == DROP_BEHIND_COLD)
+			advice = MADV_COLD;
+		else if (opts->drop_behind == DROP_BEHIND_PAGEOUT)
+			advice = MADV_PAGEOUT;
+#endif
+		// Pages that are still mapped stay in the page cache, so
+		// dontneed unmaps them before dropping them.
+		if (madvise((char *)payload + off - skew, len + skew, advice))
+			ret = errno;
+	}
+	if (!ret && (opts->drop_behind == DROP_BEHIND_DONTNEED)) {
+		ret = posix_fadvise(fd, file_off - skew, len + skew,
+			POSIX_FADV_DONTNEED);
+	}
+	if (ret) {
+		fprintf(stderr, "vecsum_drop_behind: failed to drop %lld "
+			"bytes at %lld with %s: error %d (%s)\n", len,
+			file_off, DROP_BEHIND_NAMES[opts->drop_behind], ret,
+			strerror(ret));
+		return ret;
 	}
+	ps->bytes_dropped += len;
+	ps->drop_seconds += monotonic_seconds() - start;
 	return 0;
 }
 
+/*
+ * Print how much of a pass was dropped behind the scan, if any was.
+ */
+static void vecsum_drop_behind_report(const struct options *restrict opts,
+		int pass, const struct pass_stats *restrict ps)
+{
+	if (opts->drop_behind == DROP_BEHIND_OFF)
+		return;
+	printf("dropbehind pass %d: %s dropped %lld of %lld bytes scanned, "
+		"%.4g seconds advising\n", pass,
+		DROP_BEHIND_NAMES[opts->drop_behind], ps->bytes_dropped,
+		ps->bytes_read, ps->drop_seconds);
+}
+
 static int vecsum_local(const struct options *opts)
 {
+	const struct file_layout *layout = &opts->layout;
 	void *addr = MAP_FAILED;
-	struct stat st_buf;
+	const char *payload;
+	const void *buf;
 	int pass, err, fd = -1, ret;
-	size_t length;
-	double sum;
+	size_t length, off, len;
+	long long block;
+	struct pass_stats ps;
+	uint64_t span = phase_now();
 
 	fd = open(opts->path, O_RDONLY);
 	if (fd < 0) {
@@ -508,22 +2523,7 @@ static int vecsum_local(const struct options *opts)
 		ret = EIO;
 		goto done;
 	}
-	if (fstat(fd, &st_buf)) {
-		err = errno;
-		fprintf(stderr, "vecsum_local: fstat(%s) failed: "
-			"error %d (%s)\n", opts->path, err, strerror(err));
-		ret = EIO;
-		goto done;
-	}
-	length = st_buf.st_size;
-	if (length % VECSUM_CHUNK_SIZE) {
-		fprintf(stderr, "vecsum_local: file %s has size "
-			"%lld, but we need a size aligned with %lld\n",
-			opts->path, (long long)length,
-			(long long)VECSUM_CHUNK_SIZE);
-		ret = EINVAL;
-		goto done;
-	}
+	length = layout->file_length;
 	addr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
 	if (addr == MAP_FAILED) {
 		err = errno;
@@ -532,34 +2532,286 @@ static int vecsum_local(const struct options *opts)
 		ret = EIO;
 		goto done;
 	}
+	payload = (const char *)addr + layout->payload_offset;
+	phase_end(PHASE_OPEN, &span);
 	for (pass = 0; pass < opts->passes; pass++) {
-		sum = vecsum(opts, addr, length / sizeof(double));
-		printf("finished vecsum_local pass %d.  sum = %g\n", pass, sum);
+		double start = monotonic_seconds();
+
+		// Page faults are taken inside the kernel here, so the mmap
+		// read and the sum show up together as kernel time.  We sum
+		// one chunk at a time to get the same reduction order as the
+		// other read paths.  Skipped blocks are never touched, so
+		// they are never faulted in.
+		memset(&ps, 0, sizeof(ps));
+		block = 0;
+		for (off = 0; off < layout->payload_length; off += len) {
+			len = layout_chunk_len(layout, off);
+			if (vecsum_skip_block(opts, &ps, block, len)) {
+				block++;
+				continue;
+			}
+			buf = vecsum_cache_lookup(opts, block);
+			vecsum_trace(opts, BLOCKTRACE_OP_MMAP, off, len, !!buf);
+			if (buf) {
+				ret = vecsum_cached_block(opts, &ps, block++,
+					buf, len);
+			} else {
+				buf = payload + off;
+				vecsum_cache_insert(opts, block, buf, len);
+				ret = vecsum_block(opts, &ps, block++, buf,
+					len);
+				if (!ret && opts->drop_behind) {
+					ret = vecsum_drop_behind(opts, &ps, fd,
+						payload, off, len);
+				}
+			}
+			if (ret)
+				goto done;
+		}
+		phase_end(PHASE_KERNEL, &span);
+		g_pass_seconds[pass] = monotonic_seconds() - start;
+		printf("finished vecsum_local pass %d.  sum = %g\n", pass,
+			ps.sum);
+		vecsum_drop_behind_report(opts, pass, &ps);
+		ret = vecsum_check_pass(opts, pass, &ps);
+		if (ret)
+			goto done;
+		span = phase_now();
 	}
 	ret = 0;
 done:
+	span = phase_now();
 	if (addr != MAP_FAILED)
 		munmap(addr, length);
 	if (fd >= 0)
 		close(fd);
+	phase_end(PHASE_RELEASE, &span);
 	return ret;
 }
 
-static long long vecsum_length(const struct options *restrict opts,
-				const struct test_data *restrict tdata)
+/*
+ * Print what the prefetcher did over a pass.  Accuracy is the share of the
+ * chunks read ahead that were used, coverage the share of the misses that
+ * were read ahead, and timeliness the share of those that arrived before
+ * they were needed.
+ */
+static void vecsum_prefetch_report(int pass, struct prefetcher *pf)
+{
+	struct prefetch_stats st;
+	long long used;
+
+	prefetch_get_stats(pf, &st, 1);
+	used = st.timely + st.late;
+	printf("prefetch pass %d: %lld issued, %lld timely, %lld late, "
+		"%lld wasted, %lld demand reads; accuracy %.4g, coverage "
+		"%.4g, timeliness %.4g, %.4g seconds waiting, depth %d (max "
+		"%d)\n", pass, st.issued, st.timely, st.late, st.wasted,
+		st.demand, (used + st.wasted) ?
+		(double)used / (used + st.wasted) : 0.0, (used + st.demand) ?
+		(double)used / (used + st.demand) : 0.0, used ?
+		(double)st.timely / used : 0.0, st.wait_seconds, st.depth,
+		st.max_depth);
+}
+
+static int vecsum_pread_loop(int pass, int fd, void *buf,
+		struct prefetcher *pf, const struct options *restrict opts)
 {
-	if (opts->ty == VECSUM_LOCAL) {
-		struct stat st_buf = { 0 };
-		if (stat(opts->path, &st_buf)) {
-			int err = errno;
-			fprintf(stderr, "vecsum_length: stat(%s) failed: "
-				"error %d (%s)\n", opts->path, err, strerror(err));
-			return -EIO;
+	const struct file_layout *layout = &opts->layout;
+	struct pass_stats ps = { 0 };
+	long long pos = 0, block = 0;
+	const void *cached, *data;
+	ssize_t res;
+	int ret, want;
+	uint64_t span = phase_now();
+
+	for (; pos < layout->payload_length; pos += want, block++) {
+		want = layout_chunk_len(layout, pos);
+		if (vecsum_skip_block(opts, &ps, block, want))
+			continue;
+		cached = vecsum_cache_lookup(opts, block);
+		vecsum_trace(opts, BLOCKTRACE_OP_PREAD, pos, want,
+			!!cached);
+		if (cached) {
+			ret = vecsum_cached_block(opts, &ps, block, cached,
+				want);
+			if (ret)
+				return ret;
+			phase_end(PHASE_KERNEL, &span);
+			continue;
 		}
-		return st_buf.st_size;
-	} else {
-		return tdata->length;
+		if (pf) {
+			res = prefetch_read(pf, layout->payload_offset + pos,
+				want, &data);
+			if (res < 0) {
+				errno = -res;
+				res = -1;
+			}
+		} else {
+			data = buf;
+			do {
+				res = pread(fd, buf, want,
+					layout->payload_offset + pos);
+			} while ((res < 0) && (errno == EINTR));
+		}
+		phase_end(PHASE_READ, &span);
+		if (res < 0) {
+			ret = errno;
+			fprintf(stderr, "pread failed with error %d (%s)\n",
+				ret, strerror(ret));
+			return ret;
+		}
+		if (res < want) {
+			fprintf(stderr, "pread got a partial read of length "
+				"%zd\n", res);
+			return EINVAL;
+		}
+		vecsum_cache_insert(opts, block, data, res);
+		ret = vecsum_block(opts, &ps, block, data, res);
+		if (ret)
+			return ret;
+		phase_end(PHASE_KERNEL, &span);
+		if (opts->drop_behind) {
+			ret = vecsum_drop_behind(opts, &ps, fd, NULL, pos,
+				res);
+			if (ret)
+				return ret;
+			phase_end(PHASE_RELEASE, &span);
+		}
+	}
+	printf("finished pread pass %d.  sum = %g\n", pass, ps.sum);
+	if (pf)
+		vecsum_prefetch_report(pass, pf);
+	vecsum_drop_behind_report(opts, pass, &ps);
+	return vecsum_check_pass(opts, pass, &ps);
+}
+
+/*
+ * Read the local file with pread into a buffer, one chunk at a time.  This
+ * is the copying counterpart of vecsum_local, and, unlike libhdfs, it skips
+ * blocks without a seek.
+ */
+static int vecsum_pread(const struct options *opts)
+{
+	struct prefetcher *pf = NULL;
+	void *buf = NULL;
+	int pass, fd = -1, ret;
+	uint64_t span = phase_now();
+
+	fd = open(opts->path, O_RDONLY);
+	if (fd < 0) {
+		ret = errno;
+		fprintf(stderr, "vecsum_pread: failed to open %s: "
+			"error %d (%s)\n", opts->path, ret, strerror(ret));
+		goto done;
+	}
+	ret = posix_memalign(&buf, sysconf(_SC_PAGESIZE), VECSUM_CHUNK_SIZE);
+	if (ret) {
+		fprintf(stderr, "vecsum_pread: failed to allocate a buffer "
+			"of size %d\n", VECSUM_CHUNK_SIZE);
+		buf = NULL;
+		goto done;
+	}
+	if (opts->prefetch_depth) {
+		ret = prefetch_create(fd, opts->layout.payload_offset,
+			opts->layout.payload_offset +
+			opts->layout.payload_length, VECSUM_CHUNK_SIZE,
+			opts->prefetch_depth, opts->prefetch_threads, &pf);
+		if (ret) {
+			fprintf(stderr, "vecsum_pread: failed to create the "
+				"prefetcher: error %d (%s)\n", ret,
+				strerror(ret));
+			goto done;
+		}
+	}
+	phase_end(PHASE_OPEN, &span);
+	for (pass = 0; pass < opts->passes; pass++) {
+		double start = monotonic_seconds();
+
+		ret = vecsum_pread_loop(pass, fd, buf, pf, opts);
+		if (ret) {
+			fprintf(stderr, "vecsum_pread_loop pass %d failed "
+				"with error %d\n", pass, ret);
+			goto done;
+		}
+		g_pass_seconds[pass] = monotonic_seconds() - start;
+	}
+	ret = 0;
+done:
+	span = phase_now();
+	prefetch_free(pf);
+	free(buf);
+	if (fd >= 0)
+		close(fd);
+	phase_end(PHASE_RELEASE, &span);
+	return ret;
+}
+
+/*
+ * Record the per-pass throughput in the results file and check it against
+ * the baseline, if either was requested.
+ *
+ * Returns 0 on success, RESULTS_EXIT_REGRESSION on a regression, or an
+ * errno value on failure.
+ */
+static int vecsum_report(const struct options *restrict opts,
+		long long length)
+{
+	char config[1024];
+	double *gbps;
+	int pass, ret = 0;
+
+	if (!opts->results_path && !opts->baseline_path)
+		return 0;
+	gbps = calloc(opts->passes, sizeof(double));
+	if (!gbps) {
+		fprintf(stderr, "failed to allocate throughput samples\n");
+		return ENOMEM;
+	}
+	for (pass = 0; pass < opts->passes; pass++) {
+		if (g_pass_seconds[pass] > 0) {
+			gbps[pass] = length / g_pass_seconds[pass] / 1e9;
+		}
+	}
+	options_describe(opts, config, sizeof(config));
+	if (opts->results_path) {
+		ret = results_append(opts->results_path, config, length,
+				gbps, opts->passes);
+		if (ret)
+			goto done;
 	}
+	if (opts->baseline_path) {
+		ret = results_compare(opts->baseline_path, config, gbps,
+				opts->passes, opts->tolerance, opts->alpha);
+	}
+done:
+	free(gbps);
+	return ret;
+}
+
+/*
+ * Print the run's throughput as a fraction of the memory bandwidth ceiling
+ * that applies to its read path.
+ */
+static void vecsum_roofline_report(const struct options *restrict opts,
+		const struct roofline *restrict rl, long long length)
+{
+	enum roofline_level level;
+	double seconds = 0, gbps;
+	int pass;
+
+	for (pass = 0; pass < opts->passes; pass++)
+		seconds += g_pass_seconds[pass];
+	if (seconds <= 0)
+		return;
+	gbps = (double)length * opts->passes / seconds / 1e9;
+	// libhdfs and pread copy each chunk out of the page cache before we
+	// sum it; zcr and local sum the page cache in place.
+	level = roofline_applicable(rl, length,
+			opts->threads ? opts->threads : 1,
+			(opts->ty == VECSUM_LIBHDFS) || (opts->ty == VECSUM_PREAD));
+	printf("roofline: %.5g GB/s is %.1f%% of %s (%.5g GB/s)\n", gbps,
+		100 * gbps / rl->gbps[level], roofline_level_name(level),
+		rl->gbps[level]);
 }
 
 int main(void)
@@ -568,7 +2820,11 @@ int main(void)
 	struct options *opts = NULL;
 	struct test_data *tdata = NULL;
 	struct stopwatch *watch = NULL;
+	struct roofline rl;
+	double tsc_hz = 0;
+	uint64_t span;
 
+	g_phases.start = phase_now();
 	if (check_byte_size(VECSUM_CHUNK_SIZE, "VECSUM_CHUNK_SIZE") ||
 		check_byte_size(ZCR_READ_CHUNK_SIZE,
 				"ZCR_READ_CHUNK_SIZE") ||
@@ -579,10 +2835,48 @@ int main(void)
 	opts = options_create();
 	if (!opts)
 		goto done;
-	if (opts->ty != VECSUM_LOCAL) {
+	g_pass_seconds = calloc(opts->passes, sizeof(double));
+	if (!g_pass_seconds) {
+		fprintf(stderr, "failed to allocate pass timings\n");
+		goto done;
+	}
+	if (opts->calibrate) {
+		if (roofline_calibrate(&rl))
+			goto done;
+		roofline_print(&rl);
+	}
+	if (opts->profile_path) {
+		if (profiler_start(opts->profile_path, opts->profile_hz))
+			goto done;
+	}
+	if (opts->trace_path) {
+		if (blocktrace_open(opts->trace_path, &opts->trace))
+			goto done;
+		opts->trace_file = blocktrace_file(opts->trace, opts->path);
+	}
+	if ((opts->ty == VECSUM_LIBHDFS) || (opts->ty == VECSUM_ZCR)) {
+		span = phase_now();
 		tdata = test_data_create(opts);
 		if (!tdata)
 			goto done;
+		phase_end(PHASE_OPEN, &span);
+	}
+	if (layout_probe(opts, tdata))
+		goto done;
+	if (opts->cache_bytes && (opts->threads > 1)) {
+		if (shardcache_create(opts->cache_bytes, VECSUM_CHUNK_SIZE,
+				vecsum_num_shards(opts), &opts->shared_cache))
+			goto done;
+	} else if (opts->cache_bytes) {
+		if (blockcache_create(opts->cache_bytes, VECSUM_CHUNK_SIZE,
+				(opts->cache_hugepages ? BLOCKCACHE_HUGEPAGES :
+				 0) | (opts->cache_compress ?
+				 BLOCKCACHE_COMPRESS : 0), opts->cache_policy,
+				&opts->cache))
+			goto done;
+		if (opts->ssd_dir && blockcache_add_ssd_tier(opts->cache,
+				opts->ssd_dir, opts->ssd_bytes, opts->ssd_flags))
+			goto done;
 	}
 	watch = stopwatch_create();
 	if (!watch)
@@ -597,6 +2891,9 @@ int main(void)
 	case VECSUM_LOCAL:
 		ret = vecsum_local(opts);
 		break;
+	case VECSUM_PREAD:
+		ret = vecsum_pread(opts);
+		break;
 	}
 	if (ret) {
 		fprintf(stderr, "vecsum failed with error %d\n", ret);
@@ -605,14 +2902,26 @@ int main(void)
 	ret = 0;
 done:
 	if (watch && (ret == 0)) {
-		long long length = vecsum_length(opts, tdata);
-		if (length >= 0) {
-			stopwatch_stop(watch, length * opts->passes);
-		}
+		long long length = opts->layout.payload_length;
+
+		tsc_hz = stopwatch_stop(watch, length * opts->passes);
+		if (opts->calibrate)
+			vecsum_roofline_report(opts, &rl, length);
+		ret = vecsum_report(opts, length);
 	}
-	if (tdata)
+	if (tdata) {
+		span = phase_now();
 		test_data_free(tdata);
+		phase_end(PHASE_RELEASE, &span);
+	}
+	if (tsc_hz > 0)
+		phase_print(tsc_hz);
+	if (profiler_stop() && (ret == 0))
+		ret = 1;
+	if (opts && blocktrace_close(opts->trace) && (ret == 0))
+		ret = 1;
 	if (opts)
 		options_free(opts);
+	free(g_pass_seconds);
 	return ret;
 }
@@ -0,0 +1,562 @@
+/*
+ * vim: ts=8:sw=8:tw=79:noet
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+
+// Each worker warms this much of a file at a time, so that large files are
+// warmed in parallel too.
+#define WARMUP_CHUNK_SIZE (64LL * 1024 * 1024)
+
+// readahead only queues reads, so a file warmed with it is polled with
+// mincore this often, and taken as done once it stops growing for this
+// long.
+#define WARMUP_SETTLE_POLL 0.01
+#define WARMUP_SETTLE_IDLE 0.1
+
+// The kernel queues at most one readahead window per readahead call, so a
+// chunk is asked for in steps no bigger than the smallest common window.
+#define WARMUP_READAHEAD_STEP (128LL * 1024)
+
+#define USAGE \
+"usage: warmup [options] [file...]\n" \
+"\n" \
+"Loads files into the page cache in parallel, optionally pinning them\n" \
+"with mlock the way the HDFS cache does, and reports how fast they\n" \
+"warmed.  While it runs it prints a progress line for every file in\n" \
+"flight each interval, a cached line as each file finishes, and a warm\n" \
+"line at the end, with the fraction of each file that mincore finds\n" \
+"resident.  With -l, it then holds the pins until it is interrupted.\n" \
+"\n" \
+"options:\n" \
+"  -m <manifest>  also warm the paths in a partitions.txt from\n" \
+"                 create-partitions.sh, as seen from this host\n" \
+"  -M <method>    mmap (touch every page of a mapping, the default),\n" \
+"                 readahead (queue the reads, then wait for mincore to\n" \
+"                 stop finding more pages), or read (pread into a\n" \
+"                 scratch buffer)\n" \
+"  -j <threads>   number of worker threads (default: one per CPU)\n" \
+"  -l             pin the files in memory with mlock\n" \
+"  -i <seconds>   progress interval (default 1; 0 for none)\n" \
+"  -d <path>      create path once everything is warm, for scripts to\n" \
+"                 wait on\n"
+
+enum warmup_method {
+	WARMUP_MMAP = 0,
+	WARMUP_READAHEAD,
+	WARMUP_READ,
+	WARMUP_MAX,
+};
+
+static const char * const WARMUP_METHOD_NAMES[] = {
+	[WARMUP_MMAP] = "mmap",
+	[WARMUP_READAHEAD] = "readahead",
+	[WARMUP_READ] = "read",
+};
+
+struct warm_file {
+	char *path;
+	int fd;
+	char *map;
+	long long size;
+	long long num_chunks;
+
+	// Bytes and chunks warmed so far
+	long long done;
+	long long chunks_done;
+
+	// CLOCK_MONOTONIC seconds when the first chunk started, and when the
+	// file was warm
+	double start;
+	double end;
+};
+
+struct warmup {
+	struct warm_file *files;
+	int num_files;
+	enum warmup_method method;
+	int pin;
+	int num_threads;
+	double interval;
+	const char *done_path;
+
+	// Work is handed out chunk by chunk, file by file.
+	long long next_chunk;
+	long long num_chunks;
+
+	// Serializes output.
+	pthread_mutex_t lock;
+
+	// When the last file was warm
+	double end;
+
+	// Set when the workers are done, to stop the progress thread.
+	int finished;
+	pthread_cond_t cond;
+
+	// The first error any worker hit
+	int err;
+};
+
+static int warmup_add(struct warmup *wu, const char *path)
+{
+	struct warm_file *files;
+
+	files = realloc(wu->files, (wu->num_files + 1) * sizeof(*files));
+	if (!files)
+		return ENOMEM;
+	wu->files = files;
+	memset(&files[wu->num_files], 0, sizeof(files[0]));
+	files[wu->num_files].fd = -1;
+	files[wu->num_files].path = strdup(path);
+	if (!files[wu->num_files].path)
+		return ENOMEM;
+	wu->num_files++;
+	return 0;
+}
+
+static int load_manifest(struct warmup *wu, const char *manifest)
+{
+	char line[4096], path[2048];
+	long long bytes;
+	int ret = 0;
+	FILE *fp;
+
+	fp = fopen(manifest, "r");
+	if (!fp) {
+		ret = errno;
+		fprintf(stderr, "failed to open %s: error %d (%s)\n",
+			manifest, ret, strerror(ret));
+		return ret;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%*s %lld %2047s", &bytes, path) != 2)
+			continue;
+		ret = warmup_add(wu, path);
+		if (ret)
+			break;
+	}
+	fclose(fp);
+	return ret;
+}
+
+/*
+ * Open and map every file.  Mapping is cheap, and even the methods that
+ * don't read through the mapping use it for mlock and mincore.
+ */
+static int warmup_open(struct warmup *wu)
+{
+	struct warm_file *wf;
+	struct stat st;
+	int i, ret;
+
+	for (i = 0; i < wu->num_files; i++) {
+		wf = &wu->files[i];
+		wf->fd = open(wf->path, O_RDONLY);
+		if (wf->fd < 0) {
+			ret = errno;
+			fprintf(stderr, "failed to open %s: error %d (%s)\n",
+				wf->path, ret, strerror(ret));
+			return ret;
+		}
+		if (fstat(wf->fd, &st)) {
+			ret = errno;
+			fprintf(stderr, "failed to stat %s: error %d (%s)\n",
+				wf->path, ret, strerror(ret));
+			return ret;
+		}
+		wf->size = st.st_size;
+		wf->num_chunks = (wf->size + WARMUP_CHUNK_SIZE - 1) /
+			WARMUP_CHUNK_SIZE;
+		wu->num_chunks += wf->num_chunks;
+		if (wf->size == 0)
+			continue;
+		wf->map = mmap(NULL, wf->size, PROT_READ, MAP_SHARED, wf->fd,
+			0);
+		if (wf->map == MAP_FAILED) {
+			ret = errno;
+			wf->map = NULL;
+			fprintf(stderr, "mmap(%s) failed: error %d (%s)\n",
+				wf->path, ret, strerror(ret));
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Warm len bytes of a file at off.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+static int warm_chunk(struct warmup *wu, struct warm_file *wf, long long off,
+		long long len, char *buf)
+{
+	volatile unsigned long sink = 0;
+	long page = sysconf(_SC_PAGESIZE);
+	long long i;
+	ssize_t res;
+
+	switch (wu->method) {
+	case WARMUP_MMAP:
+		// Ask for the chunk up front, so that the touches below
+		// mostly find it already read.
+		madvise(wf->map + off, len, MADV_WILLNEED);
+		if (wu->pin)
+			break;
+		for (i = 0; i < len; i += page)
+			sink += wf->map[off + i];
+		break;
+	case WARMUP_READAHEAD:
+		for (i = 0; i < len; i += WARMUP_READAHEAD_STEP) {
+			if (readahead(wf->fd, off + i,
+					(len - i < WARMUP_READAHEAD_STEP) ?
+					len - i : WARMUP_READAHEAD_STEP))
+				return errno;
+		}
+		break;
+	case WARMUP_READ:
+		for (i = 0; i < len; i += res) {
+			res = pread(wf->fd, buf, len - i, off + i);
+			if (res < 0) {
+				if (errno == EINTR) {
+					res = 0;
+					continue;
+				}
+				return errno;
+			}
+			if (res == 0)
+				break;
+		}
+		break;
+	default:
+		break;
+	}
+	// mlock faults in whatever isn't resident yet, and pins it.
+	if (wu->pin && mlock(wf->map + off, len))
+		return errno;
+	(void)sink;
+	return 0;
+}
+
+/*
+ * Wait for the reads readahead queued for a file to land, and return when
+ * its resident fraction last grew.
+ */
+static double settle_file(const struct warm_file *wf)
+{
+	struct timespec ts = { 0, WARMUP_SETTLE_POLL * 1e9 };
+	double frac, last = -1, grew = monotonic_seconds();
+
+	while (1) {
+		frac = resident_fraction(wf->map, wf->size);
+		if (frac < 0)
+			return grew;
+		if (frac > last) {
+			last = frac;
+			grew = monotonic_seconds();
+		}
+		if ((frac >= 1) ||
+				(monotonic_seconds() - grew >= WARMUP_SETTLE_IDLE))
+			return grew;
+		nanosleep(&ts, NULL);
+	}
+}
+
+/*
+ * Report a finished file.  Called with the lock held.
+ */
+static void report_file(const struct warm_file *wf)
+{
+	double secs = wf->end - wf->start;
+
+	printf("cached %s %lld bytes in %.3f seconds, %.3f GB/s, %.1f%% "
+		"resident\n", wf->path, wf->size, secs,
+		secs > 0 ? wf->size / secs / 1e9 : 0.0,
+		100 * resident_fraction(wf->map, wf->size));
+	fflush(stdout);
+}
+
+/*
+ * Note that the last chunk of a file is done, and report the file once it
+ * is warm.
+ */
+static void finish_file(struct warmup *wu, struct warm_file *wf)
+{
+	double end;
+
+	// With -l, mlock has already faulted in everything readahead queued.
+	if ((wu->method == WARMUP_READAHEAD) && !wu->pin)
+		end = settle_file(wf);
+	else
+		end = monotonic_seconds();
+	pthread_mutex_lock(&wu->lock);
+	wf->end = end;
+	if (end > wu->end)
+		wu->end = end;
+	report_file(wf);
+	pthread_mutex_unlock(&wu->lock);
+}
+
+static void *worker_run(void *arg)
+{
+	struct warmup *wu = arg;
+	struct warm_file *wf;
+	long long chunk, base = 0, off, len;
+	char *buf = NULL;
+	int f = 0, ret, finished;
+
+	if ((wu->method == WARMUP_READ) &&
+			posix_memalign((void **)&buf, 4096, WARMUP_CHUNK_SIZE)) {
+		pthread_mutex_lock(&wu->lock);
+		wu->err = ENOMEM;
+		pthread_mutex_unlock(&wu->lock);
+		return NULL;
+	}
+	while (!__atomic_load_n(&wu->err, __ATOMIC_RELAXED)) {
+		chunk = __atomic_fetch_add(&wu->next_chunk, 1,
+			__ATOMIC_RELAXED);
+		if (chunk >= wu->num_chunks)
+			break;
+		// Chunks are handed out in order, so each worker's file only
+		// ever moves forward.
+		for (; chunk >= base + wu->files[f].num_chunks; f++)
+			base += wu->files[f].num_chunks;
+		wf = &wu->files[f];
+		off = (chunk - base) * WARMUP_CHUNK_SIZE;
+		len = wf->size - off;
+		if (len > WARMUP_CHUNK_SIZE)
+			len = WARMUP_CHUNK_SIZE;
+		pthread_mutex_lock(&wu->lock);
+		if (wf->start == 0)
+			wf->start = monotonic_seconds();
+		pthread_mutex_unlock(&wu->lock);
+		ret = warm_chunk(wu, wf, off, len, buf);
+		finished = 0;
+		pthread_mutex_lock(&wu->lock);
+		if (ret) {
+			if (!wu->err) {
+				wu->err = ret;
+				fprintf(stderr, "failed to %s %lld bytes of %s "
+					"at %lld: error %d (%s)%s\n",
+					wu->pin ? "pin" : "warm", len,
+					wf->path, off, ret, strerror(ret),
+					((ret == ENOMEM) || (ret == EPERM)) &&
+					wu->pin ? "; check ulimit -l" : "");
+			}
+		} else {
+			wf->done += len;
+			finished = (++wf->chunks_done == wf->num_chunks);
+		}
+		pthread_mutex_unlock(&wu->lock);
+		if (finished)
+			finish_file(wu, wf);
+	}
+	free(buf);
+	return NULL;
+}
+
+static void *progress_run(void *arg)
+{
+	struct warmup *wu = arg;
+	struct warm_file *wf;
+	struct timespec ts;
+	double start = monotonic_seconds(), secs;
+	long long total;
+	int i;
+
+	pthread_mutex_lock(&wu->lock);
+	while (!wu->finished) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += (time_t)wu->interval;
+		ts.tv_nsec += (wu->interval - (time_t)wu->interval) * 1e9;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		if (pthread_cond_timedwait(&wu->cond, &wu->lock, &ts) !=
+				ETIMEDOUT)
+			continue;
+		total = 0;
+		for (i = 0; i < wu->num_files; i++) {
+			wf = &wu->files[i];
+			total += wf->done;
+			if ((wf->start == 0) ||
+					(wf->chunks_done == wf->num_chunks))
+				continue;
+			printf("progress %s %lld of %lld bytes (%.1f%%)\n",
+				wf->path, wf->done, wf->size,
+				100.0 * wf->done / wf->size);
+		}
+		secs = monotonic_seconds() - start;
+		printf("progress total %lld bytes in %.1f seconds, %.3f "
+			"GB/s\n", total, secs, total / secs / 1e9);
+		fflush(stdout);
+	}
+	pthread_mutex_unlock(&wu->lock);
+	return NULL;
+}
+
+/*
+ * Hold the pins until SIGINT or SIGTERM.
+ */
+static void hold_pins(void)
+{
+	sigset_t set;
+	int sig;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	printf("holding pins until interrupted\n");
+	fflush(stdout);
+	sigwait(&set, &sig);
+}
+
+int main(int argc, char **argv)
+{
+	struct warmup wu;
+	pthread_t *threads = NULL, progress;
+	long long total = 0;
+	double start, secs;
+	sigset_t set;
+	int c, i, m, started = 0, have_progress = 0, ret = 1;
+	FILE *fp;
+
+	memset(&wu, 0, sizeof(wu));
+	wu.method = WARMUP_MMAP;
+	wu.num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	wu.interval = 1;
+	pthread_mutex_init(&wu.lock, NULL);
+	pthread_cond_init(&wu.cond, NULL);
+	while ((c = getopt(argc, argv, "m:M:j:li:d:")) != -1) {
+		switch (c) {
+		case 'm':
+			if (load_manifest(&wu, optarg))
+				goto done;
+			break;
+		case 'M':
+			for (m = 0; m < WARMUP_MAX; m++) {
+				if (!strcmp(optarg, WARMUP_METHOD_NAMES[m]))
+					break;
+			}
+			if (m == WARMUP_MAX) {
+				fprintf(stderr, "unknown method %s\n" USAGE,
+					optarg);
+				goto done;
+			}
+			wu.method = m;
+			break;
+		case 'j':
+			wu.num_threads = atoi(optarg);
+			break;
+		case 'l':
+			wu.pin = 1;
+			break;
+		case 'i':
+			wu.interval = atof(optarg);
+			break;
+		case 'd':
+			wu.done_path = optarg;
+			break;
+		default:
+			fprintf(stderr, USAGE);
+			goto done;
+		}
+	}
+	for (i = optind; i < argc; i++) {
+		if (warmup_add(&wu, argv[i]))
+			goto done;
+	}
+	if ((wu.num_files == 0) || (wu.num_threads < 1)) {
+		fprintf(stderr, USAGE);
+		goto done;
+	}
+	// Block the signals that end a pinned hold in every thread, so that
+	// sigwait gets them.
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	if (wu.pin)
+		pthread_sigmask(SIG_BLOCK, &set, NULL);
+	if (warmup_open(&wu))
+		goto done;
+	threads = calloc(wu.num_threads, sizeof(pthread_t));
+	if (!threads)
+		goto done;
+	start = monotonic_seconds();
+	if (wu.interval > 0) {
+		if (pthread_create(&progress, NULL, progress_run, &wu) == 0)
+			have_progress = 1;
+	}
+	for (; started < wu.num_threads; started++) {
+		if (pthread_create(&threads[started], NULL, worker_run, &wu)) {
+			fprintf(stderr, "pthread_create failed\n");
+			wu.err = EAGAIN;
+			break;
+		}
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	secs = ((wu.end > 0) ? wu.end : monotonic_seconds()) - start;
+	pthread_mutex_lock(&wu.lock);
+	wu.finished = 1;
+	pthread_cond_signal(&wu.cond);
+	pthread_mutex_unlock(&wu.lock);
+	if (have_progress)
+		pthread_join(progress, NULL);
+	if (wu.err)
+		goto done;
+	// Empty files have no chunks, so nobody reported them.
+	for (i = 0; i < wu.num_files; i++) {
+		if (wu.files[i].size == 0) {
+			wu.files[i].start = monotonic_seconds();
+			wu.files[i].end = wu.files[i].start;
+			report_file(&wu.files[i]);
+		}
+		total += wu.files[i].size;
+	}
+	printf("warm %d files, %lld bytes, in %.3f seconds with %d %s "
+		"threads%s: %.3f GB/s\n", wu.num_files, total, secs,
+		wu.num_threads, WARMUP_METHOD_NAMES[wu.method],
+		wu.pin ? ", pinned" : "", total / secs / 1e9);
+	fflush(stdout);
+	if (wu.done_path) {
+		fp = fopen(wu.done_path, "w");
+		if (!fp) {
+			fprintf(stderr, "failed to create %s: error %d\n",
+				wu.done_path, errno);
+			goto done;
+		}
+		fprintf(fp, "%lld %.6f\n", total, secs);
+		fclose(fp);
+	}
+	if (wu.pin)
+		hold_pins();
+	ret = 0;
+done:
+	for (i = 0; i < wu.num_files; i++) {
+		if (wu.files[i].map)
+			munmap(wu.files[i].map, wu.files[i].size);
+		if (wu.files[i].fd >= 0)
+			close(wu.files[i].fd);
+		free(wu.files[i].path);
+	}
+	free(wu.files);
+	free(threads);
+	return ret;
+}